@@ -0,0 +1,53 @@
+/**
+ * DIY Smart Home - light switch
+ * Boot profiler
+ * 2022 Łukasz Łasek
+ */
+#include "BootProf.h"
+
+static_assert((uint8_t)EBootPhase::eCnt <= 16, "Review the boot profiler markers" );
+
+uint32_t CBootProf::Sm_arrCycles[ (uint8_t)EBootPhase::eCnt ] = {};
+uint32_t CBootProf::Sm_arrUs[ (uint8_t)EBootPhase::eCnt ] = {};
+uint16_t CBootProf::Sm_nMarked = 0;
+bool CBootProf::Sm_bReported = false;
+
+/// Phase names by EBootPhase
+static const char* const Sg_arrPhaseNames[] =
+{
+    "rom", "fs", "cfgch", "cfgwifi", "cfgmqtt", "en", "assoc", "ip", "tcp", "conn", "sub", "rdy"
+};
+
+static_assert( sizeof( Sg_arrPhaseNames ) / sizeof( Sg_arrPhaseNames[ 0 ]) == (uint8_t)EBootPhase::eCnt, "Review the boot phase names" );
+
+uint CBootProf::Format( char* a_pszBuf, uint a_nLen )
+{
+    int nLen = snprintf( a_pszBuf, a_nLen, "%u", GetReadyMs());
+    uint8_t nPrev = (uint8_t)EBootPhase::eCnt;
+    for( uint8_t nPhase = 0; ( nPhase < (uint8_t)EBootPhase::eCnt ) && ( nLen < (int)a_nLen ); nPhase++ )
+    {
+        if( Sm_nMarked & ( 1u << nPhase ))
+        {
+            // A phase done within the previous one, e.g. a synchronous WIFI association, lasts 0:
+            bool bLater = ( nPrev == (uint8_t)EBootPhase::eCnt ) || ((int32_t)( Sm_arrUs[ nPhase ] - Sm_arrUs[ nPrev ]) >= 0 );
+            nLen += snprintf( a_pszBuf + nLen, a_nLen - nLen, " %s:%u", Sg_arrPhaseNames[ nPhase ], ( bLater ) ? GetUs( nPhase, nPrev ) : 0 );
+            if( bLater )
+                nPrev = nPhase;
+        }
+        else
+        {
+            nLen += snprintf( a_pszBuf + nLen, a_nLen - nLen, " %s:-", Sg_arrPhaseNames[ nPhase ]);
+        }
+    }
+    return min((uint)nLen, a_nLen - 1 );
+}
+
+uint32_t CBootProf::GetUs( uint8_t a_nPhase, uint8_t a_nPrev )
+{
+    if( a_nPrev == (uint8_t)EBootPhase::eCnt )
+        return Sm_arrUs[ a_nPhase ];
+    uint32_t nUs = Sm_arrUs[ a_nPhase ] - Sm_arrUs[ a_nPrev ];
+    if( nUs >= BOOT_PROF_CYCLES_US )
+        return nUs;
+    return ( Sm_arrCycles[ a_nPhase ] - Sm_arrCycles[ a_nPrev ]) / ESP.getCpuFreqMHz();
+}
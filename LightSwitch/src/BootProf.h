@@ -0,0 +1,119 @@
+/**
+ * DIY Smart Home - light switch
+ * Boot profiler
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+
+
+
+/// Boot report - payload
+#define BOOT_PROF_REPORT        "boot"  // <hostname> boot <ready ms> <phase>:<us>|- ...
+
+/// Phase durations up to this long are taken from the CPU cycle counter, the longer ones from micros() -
+/// the cycle counter wraps in 26 s at 160 MHz
+#define BOOT_PROF_CYCLES_US     20000000
+
+
+
+/**
+ * Boot phase - each one ends with its marker.
+ */
+enum class EBootPhase : uint8_t
+{
+    eRom,       ///< Power on to setup(): the ROM and the SDK init
+    eFs,        ///< LittleFS mount
+    eCfgCh,     ///< Channel config parse
+    eCfgWiFi,   ///< WIFI config parse
+    eCfgMqtt,   ///< MQTT config and scenes parse
+    eEnable,    ///< WIFI, MQTT and buttons enabled - setup() done
+    eWiFiAssoc, ///< WIFI associated
+    eWiFiIp,    ///< DHCP done - got IP
+    eMqttTcp,   ///< MQTT server connected, CONNECT sent
+    eMqttConn,  ///< CONNACK received
+    eMqttSub,   ///< Subscriptions sent
+    eReady,     ///< Initial state published - the init stat delay included
+    eCnt
+};
+
+
+
+/**
+ * Boot profiler class.
+ * 
+ * Records a timestamp at the end of each boot phase: the CPU cycle counter and micros(). Only the first
+ * marker of a phase after boot counts, so the WIFI and MQTT phases keep their boot timestamps over
+ * the reconnections. A phase lasts from the previous marker set to its own marker, a phase not reached
+ * (e.g. no WIFI association event) is reported as "-" and is part of the next one. A phase done before
+ * the previous one ended, e.g. a synchronous WIFI association within setup(), lasts 0.
+ * The report is formatted once all the phases are done, see IsReady().
+ * 
+ * Mark() is a few stores - it is called from the boot path and the connection callbacks only.
+ */
+class CBootProf
+{
+public:
+    /**
+     * Mark the end of a boot phase - only the first mark after boot counts.
+     * 
+     * @param[in]   a_phase     Phase
+     */
+    static void Mark( EBootPhase a_phase )
+    {
+        uint8_t nPhase = (uint8_t)a_phase;
+        if( Sm_nMarked & ( 1u << nPhase ))
+            return;
+        Sm_arrCycles[ nPhase ] = ESP.getCycleCount();
+        Sm_arrUs[ nPhase ] = micros();
+        Sm_nMarked |= 1u << nPhase;
+    }
+
+    /**
+     * Check if the boot is done and the report is not sent yet.
+     */
+    static bool IsReady()
+    {
+        return ( Sm_nMarked & ( 1u << (uint8_t)EBootPhase::eReady )) && ( !Sm_bReported );
+    }
+
+    /**
+     * Record the report is sent.
+     */
+    static void SetReported()
+    {
+        Sm_bReported = true;
+    }
+
+    /**
+     * Get the boot time: power on to ready (ms).
+     */
+    static uint32_t GetReadyMs()
+    {
+        return Sm_arrUs[ (uint8_t)EBootPhase::eReady ] / 1000;
+    }
+
+    /**
+     * Format the report: the boot time and the phase durations.
+     * 
+     * @param[out]  a_pszBuf    Output buffer
+     * @param[in]   a_nLen      Output buffer length
+     * 
+     * @return  Length of the text.
+     */
+    static uint Format( char* a_pszBuf, uint a_nLen );
+
+private:
+    /**
+     * Get a phase duration (us).
+     * 
+     * @param[in]   a_nPhase    Phase - its marker must be set
+     * @param[in]   a_nPrev     Previous phase marked, eCnt: none - the phase starts at power on
+     */
+    static uint32_t GetUs( uint8_t a_nPhase, uint8_t a_nPrev );
+
+    static uint32_t Sm_arrCycles[ (uint8_t)EBootPhase::eCnt ];  ///< Markers: cycle counter
+    static uint32_t Sm_arrUs[ (uint8_t)EBootPhase::eCnt ];      ///< Markers: micros()
+    static uint16_t Sm_nMarked;     ///< Markers set: a bit per phase
+    static bool Sm_bReported;       ///< True if the report is sent
+};
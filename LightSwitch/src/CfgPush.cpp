@@ -0,0 +1,135 @@
+/**
+ * DIY Smart Home - light switch
+ * Config push
+ * 2022 Łukasz Łasek
+ */
+#include "CfgPush.h"
+#include "ManualSwitch.h"
+#include "WiFiHelper.h"
+#include "Mqtt.h"
+#include "Scenes.h"
+#include "CfgUtils.h"
+#include "Crc32.h"
+#include "Log.h"
+#include "StringUtils.h"
+#include "dbg.h"
+
+static_assert(( (uint8_t)ECfgFile::eCh0 == 0 ) && ( (uint8_t)ECfgFile::eCh2 == SW_CHANNELS - 1 ), "Review the channel cfg files" );
+
+// Config file -> name mapping:
+static const char* Sg_arrCfgFiles[ (uint8_t)ECfgFile::eCnt ] PROGMEM = { FS_CH0_CFG, FS_CH1_CFG, FS_CH2_CFG, FS_WIFI_CFG, FS_MQTT_CFG, FS_SCN_CFG };
+
+// Result -> reply mapping:
+static const char* Sg_arrCfgResults[] PROGMEM = { "ok", "err file", "err arg", "err seq", "err len", "err crc", "err invalid", "err fs" };
+static_assert( sizeof( Sg_arrCfgResults ) / sizeof( Sg_arrCfgResults[ 0 ]) == (uint8_t)ECfgResult::eFs + 1, "Review the cfg results" );
+
+ECfgFile CCfgPush::Find( const byte* a_pName, uint a_nLen )
+{
+    uint8_t nFile = 0;
+    while(( nFile < (uint8_t)ECfgFile::eCnt )
+        && ( !CStringUtils::IsEqual( Sg_arrCfgFiles[ nFile ], strlen( Sg_arrCfgFiles[ nFile ]), (byte*)a_pName, a_nLen )))
+    {
+        nFile++;
+    }
+    return (ECfgFile)nFile;
+}
+
+const char* CCfgPush::GetName( ECfgFile a_file )
+{
+    return ( a_file < ECfgFile::eCnt ) ? Sg_arrCfgFiles[ (uint8_t)a_file ] : "-";
+}
+
+const char* CCfgPush::GetResultName( ECfgResult a_result )
+{
+    return Sg_arrCfgResults[ (uint8_t)a_result ];
+}
+
+ECfgResult CCfgPush::Set( ECfgFile a_file, const char* a_pszName, const char* a_pszValue )
+{
+    if( a_file >= ECfgFile::eCnt )
+        return ECfgResult::eFile;
+    if(( !*a_pszName ) || ( strpbrk( a_pszName, "\r\n" )) || ( strpbrk( a_pszValue, "\r\n" )))
+        return ECfgResult::eArg;
+
+    m_file = ECfgFile::eCnt;    // an upload in progress is abandoned - the file is reused
+    {
+        // A missing file gets the value only:
+        File fileSrc = LittleFS.open( GetName( a_file ), "r" );
+        File fileDst = LittleFS.open( FS_CFG_PUSH_TMP, "w" );
+        if(( !fileDst ) || ( !CConfigUtils::WriteValue( fileSrc, fileDst, a_pszName, a_pszValue )))
+            return ECfgResult::eFs;
+        if( fileDst.position() > CFG_PUSH_MAX_LEN )
+            return ECfgResult::eLen;
+    }
+    return Commit( a_file );
+}
+
+ECfgResult CCfgPush::Put( ECfgFile a_file, uint32_t a_nOffs, const byte* a_pData, uint a_nLen )
+{
+    if( a_file >= ECfgFile::eCnt )
+        return ECfgResult::eFile;
+    if( !a_nOffs )
+    {
+        m_file = a_file;
+        m_nLen = 0;
+        m_nCrc = 0;
+    }
+    else if(( a_file != m_file ) || ( a_nOffs != m_nLen ))
+    {
+        return ECfgResult::eSeq;
+    }
+
+    ECfgResult result = ECfgResult::eOk;
+    if( m_nLen + a_nLen > CFG_PUSH_MAX_LEN )
+    {
+        result = ECfgResult::eLen;
+    }
+    else if( memchr( a_pData, 0, a_nLen ))
+    {
+        result = ECfgResult::eArg;  // not a text file
+    }
+    else
+    {
+        File file = LittleFS.open( FS_CFG_PUSH_TMP, ( a_nOffs ) ? "a" : "w" );
+        if(( !file ) || ( file.write( a_pData, a_nLen ) != a_nLen ))
+            result = ECfgResult::eFs;
+    }
+    if( result != ECfgResult::eOk )
+    {
+        m_file = ECfgFile::eCnt;
+        return result;
+    }
+    m_nLen += a_nLen;
+    m_nCrc = CCrc32::Calc( a_pData, a_nLen, m_nCrc );
+    return ECfgResult::eOk;
+}
+
+ECfgResult CCfgPush::End( ECfgFile a_file, uint32_t a_nLen, uint32_t a_nCrc )
+{
+    if( a_file >= ECfgFile::eCnt )
+        return ECfgResult::eFile;
+    if( a_file != m_file )
+        return ECfgResult::eSeq;
+    m_file = ECfgFile::eCnt;
+    if( a_nLen != m_nLen )
+        return ECfgResult::eLen;
+    if( a_nCrc != m_nCrc )
+        return ECfgResult::eCrc;
+    return Commit( a_file );
+}
+
+ECfgResult CCfgPush::Commit( ECfgFile a_file )
+{
+    if(( m_fnCheck ) && ( !m_fnCheck( a_file, FS_CFG_PUSH_TMP )))
+    {
+        LittleFS.remove( FS_CFG_PUSH_TMP );
+        DBGLOG1( "cfg %s invalid\n", GetName( a_file ));
+        LOGW( "cfg %s invalid", GetName( a_file ));
+        return ECfgResult::eInvalid;
+    }
+    // LittleFS replaces the file atomically:
+    if( !LittleFS.rename( FS_CFG_PUSH_TMP, GetName( a_file )))
+        return ECfgResult::eFs;
+    DBGLOG1( "cfg %s stored\n", GetName( a_file ));
+    return ECfgResult::eOk;
+}
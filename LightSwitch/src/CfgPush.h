@@ -0,0 +1,150 @@
+/**
+ * DIY Smart Home - light switch
+ * Config push
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+#include <LittleFS.h>
+
+
+
+/// Config file upload path - renamed to the config file once verified
+#define FS_CFG_PUSH_TMP     "cfg_tmp"
+
+/// Max config file length
+#define CFG_PUSH_MAX_LEN    4096
+
+/// Max data length of a config file chunk sent by the tools - fits MQTT_CLIENT_RX_BUF_LEN with the topic and the cmd
+#define CFG_PUSH_CHUNK_LEN  256
+
+
+
+/**
+ * Config file pushed.
+ */
+enum class ECfgFile : uint8_t
+{
+    eCh0,       ///< FS_CH0_CFG - channel 0
+    eCh1,       ///< FS_CH1_CFG - channel 1
+    eCh2,       ///< FS_CH2_CFG - channel 2
+    eWiFi,      ///< FS_WIFI_CFG
+    eMqtt,      ///< FS_MQTT_CFG
+    eScn,       ///< FS_SCN_CFG
+    eCnt        ///< Number of the config files, also: unknown file
+};
+
+/**
+ * Config push result.
+ */
+enum class ECfgResult : uint8_t
+{
+    eOk,        ///< Stored
+    eFile,      ///< Unknown config file
+    eArg,       ///< Malformed cmd argument: key, value, offset, size or CRC
+    eSeq,       ///< Chunk offset out of sequence, or no upload in progress
+    eLen,       ///< File too long or length mismatch
+    eCrc,       ///< CRC mismatch
+    eInvalid,   ///< Config rejected by the module
+    eFs         ///< FS error
+};
+
+
+
+/**
+ * Config push class.
+ * 
+ * Stores the config files pushed over the device management channel, so a config change needs neither
+ * an FS image upload nor a reset:
+ * 1. MQTT_CMD_MGT_CFG_SET - a single value: the current file is copied with the value replaced (added if missing).
+ * 2. MQTT_CMD_MGT_CFG_PUT - a whole file in chunks, MQTT_CMD_MGT_CFG_END - the size and the CRC32 of the file.
+ * The new file is written to FS_CFG_PUSH_TMP first, validated by the module owning it (a dry-run read of the file)
+ * and renamed over the config file - a power loss leaves either the old or the new file.
+ * The caller then applies the stored file live: re-initializes the affected channel or the MQTT/WIFI section only.
+ */
+class CCfgPush
+{
+public:
+    /**
+     * Config validation callback: dry-run read of the file.
+     * 
+     * @param[in]   a_file      Config file validated
+     * @param[in]   a_pszPath   Path of the file to read
+     * 
+     * @return  false if the config is invalid.
+     */
+    typedef std::function< bool( ECfgFile a_file, const char* a_pszPath )> CheckCb;
+
+    CCfgPush() : m_file( ECfgFile::eCnt ), m_nLen( 0 ), m_nCrc( 0 ) {}
+
+    /**
+     * Set the config validation callback.
+     */
+    void SetCheck( CheckCb a_fnCheck ) { m_fnCheck = a_fnCheck; }
+
+    /**
+     * Find the config file by its name.
+     * 
+     * @return  Config file, ECfgFile::eCnt if unknown.
+     */
+    static ECfgFile Find( const byte* a_pName, uint a_nLen );
+
+    /**
+     * Get the config file name.
+     */
+    static const char* GetName( ECfgFile a_file );
+
+    /**
+     * Get the result name - the reply of the cmd.
+     */
+    static const char* GetResultName( ECfgResult a_result );
+
+    /**
+     * Set a single value: MQTT_CMD_MGT_CFG_SET.
+     * 
+     * @param[in]   a_file      Config file
+     * @param[in]   a_pszName   The beginning of a value name/description entry, see CConfigUtils::ReadValue()
+     * @param[in]   a_pszValue  Value - a single line
+     */
+    ECfgResult Set( ECfgFile a_file, const char* a_pszName, const char* a_pszValue );
+
+    /**
+     * Store a chunk of a file: MQTT_CMD_MGT_CFG_PUT.
+     * 
+     * The chunk at offset 0 starts a new upload, the following chunks must be sent in order.
+     * 
+     * @param[in]   a_file      Config file
+     * @param[in]   a_nOffs     Chunk offset in the file
+     * @param[in]   a_pData     Chunk data
+     * @param[in]   a_nLen      Chunk length
+     */
+    ECfgResult Put( ECfgFile a_file, uint32_t a_nOffs, const byte* a_pData, uint a_nLen );
+
+    /**
+     * Finish the file upload: MQTT_CMD_MGT_CFG_END.
+     * 
+     * @param[in]   a_file      Config file
+     * @param[in]   a_nLen      File length
+     * @param[in]   a_nCrc      File CRC32
+     */
+    ECfgResult End( ECfgFile a_file, uint32_t a_nLen, uint32_t a_nCrc );
+
+    /**
+     * Get the number of the bytes of the file uploaded - the offset of the next chunk.
+     */
+    uint32_t GetLen()
+    {
+        return m_nLen;
+    }
+
+private:
+    /**
+     * Validate FS_CFG_PUSH_TMP and rename it over the config file.
+     */
+    ECfgResult Commit( ECfgFile a_file );
+
+    CheckCb m_fnCheck;  ///< Config validation callback
+    ECfgFile m_file;    ///< Config file being uploaded, ECfgFile::eCnt: none
+    uint32_t m_nLen;    ///< Bytes of the file uploaded
+    uint32_t m_nCrc;    ///< CRC32 of the bytes uploaded
+};
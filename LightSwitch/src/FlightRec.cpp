@@ -0,0 +1,63 @@
+/**
+ * DIY Smart Home - light switch
+ * Flight recorder
+ * 2022 Łukasz Łasek
+ */
+#include "FlightRec.h"
+#include "Log.h"
+#include "Metrics.h"
+#include "dbg.h"
+
+volatile uint32_t* CFlightRec::Sm_pRtc = nullptr;
+uint32_t CFlightRec::Sm_nSeq = 0;
+uint16_t CFlightRec::Sm_nTime = 0;
+uint32_t CFlightRec::Sm_nLoopMs = 0;
+uint32_t CFlightRec::Sm_nLoopCnt = 0;
+uint32_t CFlightRec::Sm_nHeapLow = UINT32_MAX;
+
+void CFlightRec::Begin( uint32_t a_nRtcOffs )
+{
+    Sm_pRtc = RTC_USER_MEM + a_nRtcOffs;
+    rst_info* pInfo = ESP.getResetInfoPtr();
+    uint16_t nBoots = 0;
+    if( Sm_pRtc[ 0 ] == FLIGHT_REC_MAGIC )
+    {
+        Sm_nSeq = Sm_pRtc[ 1 ];
+        nBoots = ( Sm_pRtc[ 2 ] >> 16 ) + 1;
+    }
+    else
+    {
+        Sm_pRtc[ 0 ] = FLIGHT_REC_MAGIC;
+        Sm_nSeq = 0;
+    }
+    Sm_pRtc[ 1 ] = Sm_nSeq;
+    Sm_pRtc[ 2 ] = ((uint32_t)nBoots << 16 ) | (( pInfo->reason & 0xff ) << 8 ) | ( pInfo->exccause & 0xff );
+    Sm_pRtc[ 3 ] = ( pInfo->reason == REASON_EXCEPTION_RST ) ? pInfo->epc1 : 0;
+    Sm_nLoopMs = millis();
+    Sm_nTime = Sm_nLoopMs >> FLIGHT_REC_TIME_SHIFT;
+    Add( EFrEvent::eBoot, pInfo->reason );
+    DBGLOG3( "flight rec: boot %u reason %u seq %u\n", nBoots, pInfo->reason, Sm_nSeq );
+    LOGI( "boot %u reason %u exc %u", nBoots, pInfo->reason, pInfo->exccause );
+}
+
+void CFlightRec::loop()
+{
+    uint32_t nMs = millis();
+    uint32_t nGapMs = nMs - Sm_nLoopMs;
+    Sm_nLoopMs = nMs;
+    Sm_nTime = nMs >> FLIGHT_REC_TIME_SHIFT;
+    CMetrics::Max( EMetric::eLoopGapMax, nGapMs );
+    if( nGapMs >= FLIGHT_REC_GAP_MS )
+        Add( EFrEvent::eLoopGap, min( nGapMs, (uint32_t)FLIGHT_REC_ARG_MAX ));
+
+    if( !( ++Sm_nLoopCnt & (( 1u << FLIGHT_REC_HEAP_SHIFT ) - 1 )))
+    {
+        uint32_t nHeap = ESP.getFreeHeap();
+        CMetrics::Min( EMetric::eHeapFreeMin, nHeap );
+        if( nHeap + FLIGHT_REC_HEAP_STEP <= Sm_nHeapLow )
+        {
+            Sm_nHeapLow = nHeap;
+            Add( EFrEvent::eHeapLow, min( nHeap / FLIGHT_REC_HEAP_UNIT, (uint32_t)FLIGHT_REC_ARG_MAX ));
+        }
+    }
+}
@@ -0,0 +1,185 @@
+/**
+ * DIY Smart Home - light switch
+ * Flight recorder
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+
+
+
+/// Number of the events kept (4 bytes each) - must be a power of 2
+#define FLIGHT_REC_LEN          64
+
+/// Number of the header blocks
+#define FLIGHT_REC_HDR_BLOCKS   4
+
+/// RTC user memory used in 4-byte blocks
+#define FLIGHT_REC_BLOCKS       ( FLIGHT_REC_HDR_BLOCKS + FLIGHT_REC_LEN )
+
+/// Header magic - a power loss clears the RTC user memory to garbage
+#define FLIGHT_REC_MAGIC        0x46524331  // "FRC1"
+
+/// Number of the event type bits
+#define FLIGHT_REC_TYPE_BITS    6
+
+/// Number of the event argument bits
+#define FLIGHT_REC_ARG_BITS     10
+
+/// Number of the event time bits
+#define FLIGHT_REC_TIME_BITS    16
+
+/// Max event argument
+#define FLIGHT_REC_ARG_MAX      (( 1u << FLIGHT_REC_ARG_BITS ) - 1 )
+
+/// Event time unit: 1024 ms, a shift of millis()
+#define FLIGHT_REC_TIME_SHIFT   10
+
+/// Loop iteration time recorded as a loop gap (ms)
+#define FLIGHT_REC_GAP_MS       100
+
+/// Free heap checked every 2^n loop iterations
+#define FLIGHT_REC_HEAP_SHIFT   8
+
+/// Free heap recorded as a new low-water mark when below the previous one by more (bytes)
+#define FLIGHT_REC_HEAP_STEP    1024
+
+/// Free heap argument unit (bytes)
+#define FLIGHT_REC_HEAP_UNIT    64
+
+static_assert(( FLIGHT_REC_LEN & ( FLIGHT_REC_LEN - 1 )) == 0, "FLIGHT_REC_LEN must be a power of 2" );
+static_assert( FLIGHT_REC_TYPE_BITS + FLIGHT_REC_ARG_BITS + FLIGHT_REC_TIME_BITS == 32, "Review the flight recorder event layout" );
+
+
+
+/**
+ * Flight recorder event type.
+ */
+enum class EFrEvent : uint8_t
+{
+    eBoot,      ///< Boot: argument - reset reason (REASON_...)
+    eReset,     ///< Reset issued by the FW: argument - EFrReset
+    eWiFiUp,    ///< WIFI connected - got IP
+    eWiFiDown,  ///< WIFI disconnected
+    eMqttUp,    ///< MQTT connected
+    eMqttDown,  ///< MQTT connection lost
+    eTap,       ///< Tap: argument - channel:2, tap event:4, tap cnt:4 (saturated)
+    eRelay,     ///< Relay switched: argument - channel:2, 0:off, 1:on
+    eHeapLow,   ///< Free heap low-water mark: argument - free heap / FLIGHT_REC_HEAP_UNIT (saturated)
+    eLoopGap,   ///< Loop iteration longer than FLIGHT_REC_GAP_MS: argument - ms (saturated)
+    eCfg,       ///< Config pushed and applied: argument - ECfgFile
+    eOta,       ///< OTA FWU: argument - 0:started, else aborted: the error
+    eCnt
+};
+
+/**
+ * Reset issued by the FW - the eReset event argument.
+ */
+enum class EFrReset : uint8_t
+{
+    eWiFi,      ///< WIFI connection timeout
+    eMgt,       ///< MQTT_CMD_MGT_RESET
+    eOta        ///< OTA FWU done
+};
+
+
+
+/**
+ * Flight recorder class.
+ * 
+ * Records the device events in a ring of compact 32-bit events kept in the RTC user memory, so the events
+ * before a reset - a WIFI timeout reset, a watchdog, an exception - survive it and can be read over
+ * the device management channel after the reboot (MQTT_CMD_MGT_FLIGHT_REC). A power loss clears the events.
+ * 
+ * Event layout (MSB to LSB): type:6, argument:10, time:16 - FLIGHT_REC_TIME_SHIFT ms units since boot, wrapping.
+ * The events are numbered with a sequence number growing since the last power on, the last FLIGHT_REC_LEN events
+ * are kept. Header: magic, sequence number of the next event, boot cnt:16 | reset reason:8 | exception cause:8,
+ * exception PC of the last reset.
+ * 
+ * Add() is a two word store to the RTC user memory - cheap enough to stay on in the production build.
+ * It must be called from the loop context only.
+ */
+class CFlightRec
+{
+public:
+    /**
+     * Open the recorder at boot: keep the events if the header survived the reset, clear them otherwise.
+     * Record the reset reason.
+     * 
+     * @param[in]   a_nRtcOffs  Offset in the RTC user memory (4-byte blocks), FLIGHT_REC_BLOCKS are used.
+     */
+    static void Begin( uint32_t a_nRtcOffs );
+
+    /**
+     * Main loop function: update the event time, record the loop gaps and the free heap low-water marks.
+     */
+    static void loop();
+
+    /**
+     * Record an event.
+     * 
+     * @param[in]   a_event     Event type
+     * @param[in]   a_nArg      Argument - saturated to FLIGHT_REC_ARG_MAX
+     */
+    static void Add( EFrEvent a_event, uint16_t a_nArg = 0 )
+    {
+        if( !Sm_pRtc )
+            return;
+        Sm_pRtc[ FLIGHT_REC_HDR_BLOCKS + ( Sm_nSeq & ( FLIGHT_REC_LEN - 1 ))] =
+            ((uint32_t)a_event << ( FLIGHT_REC_ARG_BITS + FLIGHT_REC_TIME_BITS )) |
+            ((uint32_t)min( a_nArg, (uint16_t)FLIGHT_REC_ARG_MAX ) << FLIGHT_REC_TIME_BITS ) | Sm_nTime;
+        Sm_pRtc[ 1 ] = ++Sm_nSeq;
+    }
+
+    /**
+     * Get the sequence number of the oldest event kept.
+     */
+    static uint32_t GetFirst()
+    {
+        return ( Sm_nSeq > FLIGHT_REC_LEN ) ? Sm_nSeq - FLIGHT_REC_LEN : 0;
+    }
+
+    /**
+     * Get the sequence number of the next event to be recorded.
+     */
+    static uint32_t GetEnd()
+    {
+        return Sm_nSeq;
+    }
+
+    /**
+     * Get an event.
+     * 
+     * @param[in]   a_nSeq  Sequence number - must be within [GetFirst(), GetEnd())
+     * 
+     * @return  Packed event.
+     */
+    static uint32_t Get( uint32_t a_nSeq )
+    {
+        return Sm_pRtc[ FLIGHT_REC_HDR_BLOCKS + ( a_nSeq & ( FLIGHT_REC_LEN - 1 ))];
+    }
+
+    /**
+     * Get the reset info: boot cnt:16 | reset reason:8 | exception cause:8.
+     */
+    static uint32_t GetResetInfo()
+    {
+        return ( Sm_pRtc ) ? Sm_pRtc[ 2 ] : 0;
+    }
+
+    /**
+     * Get the exception PC of the last reset.
+     */
+    static uint32_t GetResetPc()
+    {
+        return ( Sm_pRtc ) ? Sm_pRtc[ 3 ] : 0;
+    }
+
+private:
+    static volatile uint32_t* Sm_pRtc;  ///< Recorder in the RTC user memory, nullptr: not open
+    static uint32_t Sm_nSeq;            ///< Sequence number of the next event
+    static uint16_t Sm_nTime;           ///< Current event time
+    static uint32_t Sm_nLoopMs;         ///< Start of the current loop iteration (ms)
+    static uint32_t Sm_nLoopCnt;        ///< Loop iterations
+    static uint32_t Sm_nHeapLow;        ///< Free heap low-water mark recorded
+};
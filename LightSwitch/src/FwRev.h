@@ -10,3 +10,9 @@
 
 /// Current FW revision
 #define FW_REV_CURRENT      FW_REV_0
+
+/// FW revision prefix - begins the discovery reply
+#define FW_REV_PREFIX       "SWV"
+
+/// FW revision prefix length
+#define FW_REV_PREFIX_LEN   3
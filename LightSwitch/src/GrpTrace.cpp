@@ -0,0 +1,194 @@
+/**
+ * DIY Smart Home - light switch
+ * Group cmd latency tracing
+ * 2022 Łukasz Łasek
+ */
+#include "GrpTrace.h"
+#include "StringUtils.h"
+
+void CClockSync::Setup( ulong a_nPeriodMs )
+{
+    m_nPeriodMs = a_nPeriodMs;
+    ResetRetry();
+    m_bSynced = false;
+    m_bPending = false;
+    m_nRejects = 0;
+}
+
+bool CClockSync::IsDue()
+{
+    if( !m_nPeriodMs )
+        return false;
+    if( m_bKick )
+        return true;
+    m_tm.UpdateCur();
+    return m_tm.Delta() >= ((( m_bPending ) || ( !m_bSynced )) ? m_nRetryMs : m_nPeriodMs );
+}
+
+uint32_t CClockSync::Request()
+{
+    m_tm.UpdateAll();
+    // The previous request is not replied - back off:
+    if( m_bPending )
+        m_nRetryMs = min( m_nRetryMs * 2, m_nPeriodMs );
+    m_bKick = false;
+    m_bPending = true;
+    m_nReqMs = millis();
+    return m_nReqMs;
+}
+
+void CClockSync::OnReply( uint32_t a_nT0, uint32_t a_nRefMs )
+{
+    if(( !m_bPending ) || ( a_nT0 != m_nReqMs ))
+        return;
+    m_bPending = false;
+    ResetRetry();
+    uint32_t nT2 = millis();
+    uint32_t nRtt = nT2 - a_nT0;
+    if(( m_bSynced ) && ( nRtt > m_nRtt + CLOCK_SYNC_RTT_SLACK_MS ) && ( ++m_nRejects < CLOCK_SYNC_REJECTS ))
+        return;
+    m_nRejects = 0;
+    m_nRtt = nRtt;
+    m_nOffset = (int32_t)( a_nRefMs + nRtt / 2 - nT2 );
+    m_bSynced = true;
+}
+
+
+
+const char* CGrpTrace::Tag( const char* a_pszMsg, const char* a_pszHostName )
+{
+    if( !m_clk.IsSynced())
+        return a_pszMsg;
+    int nLen = snprintf( m_szMsg, sizeof( m_szMsg ), "%s" GRP_TRACE_TAG "%.*s:%u:%u", a_pszMsg, GRP_TRACE_HOST_LEN, a_pszHostName,
+        m_nTraceId, m_clk.Now());
+    if(( nLen < 0 ) || ( nLen >= (int)sizeof( m_szMsg )))
+        return a_pszMsg;
+    m_nTraceId++;
+    return m_szMsg;
+}
+
+void CGrpTrace::OnReceive( byte* payload, uint& len )
+{
+    // Armed during the dispatch - a relay may flip at once, restored by OnDispatch() if not accepted:
+    m_prev = m_pending;
+
+    // <group cmd>/t:<origin hostname>:<trace id>:<origin ms> - the hostname does not contain the separators:
+    uint nTag = len;
+    while(( nTag > 0 ) && ( payload[ nTag - 1 ] != GRP_TRACE_TAG[ 0 ]))
+        nTag--;
+    if(( !nTag ) || ( !CStringUtils::BeginsWith( GRP_TRACE_TAG, GRP_TRACE_TAG_LEN, payload + nTag - 1, len - nTag + 1 )))
+        return;
+    byte* pHost = payload + nTag - 1 + GRP_TRACE_TAG_LEN;
+    uint nLen = len - nTag + 1 - GRP_TRACE_TAG_LEN;
+    len = nTag - 1;
+
+    byte* arrFields[ 3 ] = { pHost, nullptr, nullptr };
+    uint arrFieldLens[ 3 ] = { 0, 0, 0 };
+    uint8_t nField = 0;
+    for( uint nIdx = 0; nIdx < nLen; nIdx++ )
+    {
+        if( pHost[ nIdx ] != ':' )
+        {
+            arrFieldLens[ nField ]++;
+        }
+        else if( ++nField < 3 )
+        {
+            arrFields[ nField ] = pHost + nIdx + 1;
+        }
+        else
+        {
+            return;
+        }
+    }
+    if(( nField != 2 ) || ( !arrFieldLens[ 0 ]) || ( !CStringUtils::IsU32_10( arrFields[ 1 ], arrFieldLens[ 1 ], 5 ))
+        || ( !CStringUtils::IsU32_10( arrFields[ 2 ], arrFieldLens[ 2 ], 10 )))
+        return;
+
+    SOrigin& rOrigin = m_arrOrigins[ FindOrigin( arrFields[ 0 ], arrFieldLens[ 0 ])];
+    uint16_t nId = CStringUtils::AtoU32_10( arrFields[ 1 ], arrFieldLens[ 1 ]);
+    uint16_t nGap = nId - rOrigin.nLastId - 1;
+    if(( rOrigin.nRx++ ) && ( nGap ) && ( nGap <= GRP_TRACE_LOST_MAX ))
+        rOrigin.nLost += nGap;
+    rOrigin.nLastId = nId;
+
+    m_pending.nOrigin = GRP_TRACE_ORIGINS;
+    if( !m_clk.IsSynced())
+        return;
+    m_pending.nOriginMs = CStringUtils::AtoU32_10( arrFields[ 2 ], arrFieldLens[ 2 ]);
+    m_pending.nRxMs = m_clk.Now();
+    m_pending.nOrigin = &rOrigin - m_arrOrigins;
+    rOrigin.net.Add((int32_t)( m_pending.nRxMs - m_pending.nOriginMs ), ++rOrigin.nTimed );
+}
+
+void CGrpTrace::OnDispatch( bool a_bMatched )
+{
+    if( !a_bMatched )
+        m_pending = m_prev;
+    m_prev.nOrigin = GRP_TRACE_ORIGINS;
+}
+
+void CGrpTrace::OnApply()
+{
+    if( m_pending.nOrigin >= m_nCnt )
+        return;
+    SOrigin& rOrigin = m_arrOrigins[ m_pending.nOrigin ];
+    m_pending.nOrigin = GRP_TRACE_ORIGINS;
+    uint32_t nApplyMs = m_clk.Now();
+    if( nApplyMs - m_pending.nRxMs > GRP_TRACE_APPLY_MS )
+        return;
+    rOrigin.nApplied++;
+    rOrigin.app.Add((int32_t)( nApplyMs - m_pending.nRxMs ), rOrigin.nApplied );
+    rOrigin.e2e.Add((int32_t)( nApplyMs - m_pending.nOriginMs ), rOrigin.nApplied );
+}
+
+void CGrpTrace::Format( uint8_t a_nIdx, char* a_pszBuf, uint a_nLen )
+{
+    const SOrigin& rOrigin = m_arrOrigins[ a_nIdx ];
+    int32_t arrAvg[ 3 ] =
+    {
+        ( rOrigin.nTimed ) ? (int32_t)( rOrigin.net.nSum / rOrigin.nTimed ) : 0,
+        ( rOrigin.nApplied ) ? (int32_t)( rOrigin.app.nSum / rOrigin.nApplied ) : 0,
+        ( rOrigin.nApplied ) ? (int32_t)( rOrigin.e2e.nSum / rOrigin.nApplied ) : 0
+    };
+    snprintf( a_pszBuf, a_nLen, "%s %u %u %u %u net:%d/%d/%d app:%d/%d/%d e2e:%d/%d/%d", rOrigin.szHostName, rOrigin.nRx, rOrigin.nTimed,
+        rOrigin.nApplied, rOrigin.nLost, ( rOrigin.nTimed ) ? rOrigin.net.nMin : 0, arrAvg[ 0 ], ( rOrigin.nTimed ) ? rOrigin.net.nMax : 0,
+        ( rOrigin.nApplied ) ? rOrigin.app.nMin : 0, arrAvg[ 1 ], ( rOrigin.nApplied ) ? rOrigin.app.nMax : 0,
+        ( rOrigin.nApplied ) ? rOrigin.e2e.nMin : 0, arrAvg[ 2 ], ( rOrigin.nApplied ) ? rOrigin.e2e.nMax : 0 );
+}
+
+uint8_t CGrpTrace::FindOrigin( const byte* a_pHostName, uint a_nLen )
+{
+    a_nLen = min( a_nLen, (uint)GRP_TRACE_HOST_LEN );
+    uint8_t nIdx = 0;
+    for( ; nIdx < m_nCnt; nIdx++ )
+    {
+        if(( !strncmp( m_arrOrigins[ nIdx ].szHostName, (const char*)a_pHostName, a_nLen )) && ( !m_arrOrigins[ nIdx ].szHostName[ a_nLen ]))
+        {
+            m_arrOrigins[ nIdx ].nSeenMs = millis();
+            return nIdx;
+        }
+    }
+    if( m_nCnt < GRP_TRACE_ORIGINS )
+    {
+        m_nCnt++;
+    }
+    else
+    {
+        // Replace the least recently seen one - the one added last keeps its slot until it goes quiet:
+        nIdx = 0;
+        for( uint8_t nCand = 1; nCand < m_nCnt; nCand++ )
+        {
+            if( m_arrOrigins[ nCand ].nSeenMs - m_arrOrigins[ nIdx ].nSeenMs > LONG_MAX )  // older, wrap-safe
+                nIdx = nCand;
+        }
+        if( m_pending.nOrigin == nIdx )
+            m_pending.nOrigin = GRP_TRACE_ORIGINS;
+        if( m_prev.nOrigin == nIdx )
+            m_prev.nOrigin = GRP_TRACE_ORIGINS;
+    }
+    SOrigin& rOrigin = m_arrOrigins[ nIdx ];
+    memset( &rOrigin, 0, sizeof( rOrigin ));
+    memcpy( rOrigin.szHostName, a_pHostName, a_nLen );
+    rOrigin.nSeenMs = millis();
+    return nIdx;
+}
@@ -0,0 +1,307 @@
+/**
+ * DIY Smart Home - light switch
+ * Group cmd latency tracing
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+#include "Timer.h"
+
+
+
+/// Group cmd trace tag - appended to a traced group cmd
+#define GRP_TRACE_TAG           "/t:"   // + <origin hostname> + ':' + <trace id> + ':' + <origin ms>
+
+/// Group cmd trace tag length
+#define GRP_TRACE_TAG_LEN       3
+
+/// Max length of the origin hostname kept
+#define GRP_TRACE_HOST_LEN      32
+
+/// Max length of a traced group cmd: the group cmd, the tag, the origin hostname, the trace id and the time
+#define GRP_TRACE_MSG_LEN       ( 48 + GRP_TRACE_TAG_LEN + GRP_TRACE_HOST_LEN + 20 )
+
+/// Number of the origins with the latency stats kept - the least recently seen one is replaced when full
+#define GRP_TRACE_ORIGINS       8
+
+/// A relay transition later than this after the traced group cmd is not attributed to it (ms)
+#define GRP_TRACE_APPLY_MS      2000
+
+/// Trace id gaps up to this long are counted as lost group cmds, the longer ones as the origin reboots
+#define GRP_TRACE_LOST_MAX      100
+
+
+
+/// Clock sync first retry period while not synced, or the reply is lost (ms) - doubled per request not replied, up to the sync period
+#define CLOCK_SYNC_RETRY_MS     2000
+
+/// A sample with the RTT longer than the last one accepted by more is rejected (ms) - it carries more asymmetry
+#define CLOCK_SYNC_RTT_SLACK_MS 20
+
+/// Consecutive samples rejected before one is accepted anyway - the path got slower
+#define CLOCK_SYNC_REJECTS      3
+
+
+
+/**
+ * Clock sync class.
+ * 
+ * Estimates the offset of the reference clock - a time source answering the clock requests over
+ * the device management channel - from the local millis(), NTP style: the request carries the local time t0,
+ * the reply the reference time tr, received at the local time t2. Assuming a symmetric path,
+ * offset = tr + ( t2 - t0 ) / 2 - t2. The samples with the RTT much longer than the last one accepted are rejected.
+ * The error is up to half of the RTT asymmetry, a few ms over a LAN broker.
+ */
+class CClockSync
+{
+public:
+    CClockSync() : m_nPeriodMs( 0 ), m_nRetryMs( CLOCK_SYNC_RETRY_MS ), m_bSynced( false ), m_bPending( false ), m_bKick( false ),
+        m_nReqMs( 0 ), m_nOffset( 0 ), m_nRtt( 0 ), m_nRejects( 0 ) {}
+
+    /**
+     * Configure the sync period.
+     * 
+     * @param[in]   a_nPeriodMs     Sync period (ms), 0: disabled
+     */
+    void Setup( ulong a_nPeriodMs );
+
+    /**
+     * Request a sync as soon as possible, e.g. on connect.
+     */
+    void Kick()
+    {
+        m_bKick = true;
+        ResetRetry();
+    }
+
+    /**
+     * Check if a clock request is due: kicked, the period expired, or a retry while not synced - backed off
+     * exponentially while no reference clock replies.
+     */
+    bool IsDue();
+
+    /**
+     * Start a clock request.
+     * 
+     * @return  Local time of the request t0 (ms) - sent with the request, returned by the reply.
+     */
+    uint32_t Request();
+
+    /**
+     * Handle a clock reply.
+     * 
+     * @param[in]   a_nT0       Local time of the request t0 (ms) - a reply to an older request is ignored
+     * @param[in]   a_nRefMs    Reference time (ms)
+     */
+    void OnReply( uint32_t a_nT0, uint32_t a_nRefMs );
+
+    /**
+     * Get the reference time (ms) - valid if synced.
+     */
+    uint32_t Now()
+    {
+        return millis() + m_nOffset;
+    }
+
+    /**
+     * Check if synced.
+     */
+    bool IsSynced()
+    {
+        return m_bSynced;
+    }
+
+    /**
+     * Get the offset of the reference clock (ms).
+     */
+    int32_t GetOffset()
+    {
+        return m_nOffset;
+    }
+
+    /**
+     * Get the RTT of the sample accepted (ms).
+     */
+    uint32_t GetRtt()
+    {
+        return m_nRtt;
+    }
+
+protected:
+    /**
+     * Reset the retry period to the first one.
+     */
+    void ResetRetry()
+    {
+        m_nRetryMs = min((ulong)CLOCK_SYNC_RETRY_MS, m_nPeriodMs );
+    }
+
+    ulong m_nPeriodMs;      ///< Sync period (ms), 0: disabled
+    ulong m_nRetryMs;       ///< Retry period (ms)
+    bool m_bSynced;         ///< True if synced
+    bool m_bPending;        ///< True if a request is sent, not replied
+    bool m_bKick;           ///< True if a request is due now
+    uint32_t m_nReqMs;      ///< Local time of the pending request t0 (ms)
+    int32_t m_nOffset;      ///< Reference clock - local clock (ms)
+    uint32_t m_nRtt;        ///< RTT of the sample accepted (ms)
+    uint8_t m_nRejects;     ///< Consecutive samples rejected
+    CTimer m_tm;            ///< Request timer
+};
+
+
+
+/**
+ * Latency stats: min, max and the sum of the samples (ms).
+ */
+struct SLatStat
+{
+    int32_t nMin;   ///< Min
+    int32_t nMax;   ///< Max
+    int64_t nSum;   ///< Sum
+
+    /**
+     * Add a sample.
+     * 
+     * @param[in]   a_nMs   Sample (ms) - negative if the clocks are off by more than the latency
+     * @param[in]   a_nCnt  Number of the samples, including this one
+     */
+    void Add( int32_t a_nMs, uint32_t a_nCnt )
+    {
+        nMin = ( a_nCnt == 1 ) ? a_nMs : min( nMin, a_nMs );
+        nMax = ( a_nCnt == 1 ) ? a_nMs : max( nMax, a_nMs );
+        nSum += a_nMs;
+    }
+};
+
+
+
+/**
+ * Group cmd latency tracing class.
+ * 
+ * The origin device tags its group cmds with its hostname, a trace id and the origin time taken from
+ * the reference clock (CClockSync). A receiver strips the tag before the group cmd is dispatched, records
+ * the receive time and, if a channel accepts it and a relay flips within GRP_TRACE_APPLY_MS, the apply time. Per origin it keeps:
+ * - the group cmds received, received with the clock synced (timed), applied and lost (trace id gaps),
+ * - net: origin to receive - the MQTT path through the broker,
+ * - app: receive to relay flip - the dispatch, the dwell and the coalescing of the channel,
+ * - e2e: origin to relay flip.
+ * The group cmds received while not synced are counted, their latency is not.
+ */
+class CGrpTrace
+{
+public:
+    CGrpTrace() : m_nTraceId( 0 ), m_nCnt( 0 )
+    {
+        m_pending.nOrigin = m_prev.nOrigin = GRP_TRACE_ORIGINS;
+    }
+
+    /**
+     * Get the clock sync.
+     */
+    CClockSync& GetClock()
+    {
+        return m_clk;
+    }
+
+    /**
+     * Tag a group cmd - only if the clock is synced.
+     * 
+     * @param[in]   a_pszMsg        Group cmd
+     * @param[in]   a_pszHostName   Origin hostname
+     * 
+     * @return  Group cmd tagged, valid until the next call - the group cmd if not synced.
+     */
+    const char* Tag( const char* a_pszMsg, const char* a_pszHostName );
+
+    /**
+     * Strip the tag of a group cmd, record the receive time. The group cmd waits for a relay flip
+     * until OnDispatch() reports no channel accepted it.
+     * 
+     * @param[in]       payload     Group cmd
+     * @param[in,out]   len         Group cmd length - the tag is excluded
+     */
+    void OnReceive( byte* payload, uint& len );
+
+    /**
+     * Group cmd dispatched to the channels - a group cmd not accepted by any channel does not wait for a relay flip,
+     * the one accepted before waits again.
+     * 
+     * @param[in]   a_bMatched  True if a channel accepted or queued the group cmd
+     */
+    void OnDispatch( bool a_bMatched );
+
+    /**
+     * Relay flipped - record the apply time of the group cmd accepted last.
+     */
+    void OnApply();
+
+    /**
+     * Get the number of the origins.
+     */
+    uint8_t GetCnt()
+    {
+        return m_nCnt;
+    }
+
+    /**
+     * Format the stats of an origin:
+     *   <origin> <rx> <timed> <applied> <lost> net:<min>/<avg>/<max> app:<min>/<avg>/<max> e2e:<min>/<avg>/<max>
+     * 
+     * @param[in]   a_nIdx      Origin index
+     * @param[out]  a_pszBuf    Output buffer
+     * @param[in]   a_nLen      Output buffer length
+     */
+    void Format( uint8_t a_nIdx, char* a_pszBuf, uint a_nLen );
+
+    /**
+     * Remove all the stats.
+     */
+    void Clear()
+    {
+        m_nCnt = 0;
+        m_pending.nOrigin = m_prev.nOrigin = GRP_TRACE_ORIGINS;
+    }
+
+protected:
+    /**
+     * Origin stats.
+     */
+    struct SOrigin
+    {
+        char szHostName[ GRP_TRACE_HOST_LEN + 1 ];  ///< Origin hostname
+        uint16_t nLastId;   ///< Last trace id received
+        ulong nSeenMs;      ///< Last group cmd received (ms)
+        uint32_t nRx;       ///< Group cmds received
+        uint32_t nTimed;    ///< Group cmds received with the clock synced
+        uint32_t nApplied;  ///< Group cmds applied: a relay flipped
+        uint32_t nLost;     ///< Group cmds lost: trace id gaps
+        SLatStat net;       ///< Origin to receive (ms)
+        SLatStat app;       ///< Receive to relay flip (ms)
+        SLatStat e2e;       ///< Origin to relay flip (ms)
+    };
+
+    /**
+     * Group cmd waiting for a relay flip.
+     */
+    struct SPending
+    {
+        uint8_t nOrigin;    ///< Origin, GRP_TRACE_ORIGINS: none
+        uint32_t nOriginMs; ///< Origin time (ms)
+        uint32_t nRxMs;     ///< Receive time (ms)
+    };
+
+    /**
+     * Find an origin, add it if new.
+     * 
+     * @return  Origin index.
+     */
+    uint8_t FindOrigin( const byte* a_pHostName, uint a_nLen );
+
+    CClockSync m_clk;       ///< Reference clock
+    uint16_t m_nTraceId;    ///< Trace id of the next group cmd sent
+    char m_szMsg[ GRP_TRACE_MSG_LEN ];  ///< Group cmd tagged
+    SOrigin m_arrOrigins[ GRP_TRACE_ORIGINS ];  ///< Origin stats
+    uint8_t m_nCnt;         ///< Number of the origins
+    SPending m_pending;     ///< Group cmd waiting for a relay flip
+    SPending m_prev;        ///< Group cmd accepted before the one being dispatched
+};
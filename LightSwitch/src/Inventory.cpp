@@ -0,0 +1,79 @@
+/**
+ * DIY Smart Home - light switch
+ * Device inventory
+ * 2022 Łukasz Łasek
+ */
+#include "Inventory.h"
+#include "FwRev.h"
+#include "StringUtils.h"
+#include "dbg.h"
+
+bool CInventory::Add( const byte* a_pReply, uint a_nLen )
+{
+    if( !CStringUtils::BeginsWith( FW_REV_PREFIX, FW_REV_PREFIX_LEN, (byte*)a_pReply, a_nLen ))
+        return false;
+    bool bCandidate = ( a_nLen > INV_CANDIDATE_LEN )
+        && ( !memcmp( a_pReply + a_nLen - INV_CANDIDATE_LEN, INV_CANDIDATE, INV_CANDIDATE_LEN ));
+    if( bCandidate )
+        a_nLen -= INV_CANDIDATE_LEN;
+
+    // <fw rev> <hostname> <ip> <mac> - the rev may contain spaces, the hostname is the 3rd token from the end:
+    uint nEnd = a_nLen;
+    uint nPos = a_nLen;
+    for( uint8_t nToken = 0; nToken < 3; nToken++ )
+    {
+        nEnd = nPos;
+        while(( nPos > 0 ) && ( a_pReply[ nPos - 1 ] != ' ' ))
+            nPos--;
+        if(( nPos <= FW_REV_PREFIX_LEN ) || ( nPos == nEnd ))
+            return false;
+        nPos--;     // skip the space
+    }
+    if( a_nLen >= INV_REPLY_LEN )
+        return false;
+    const char* pHostName = (const char*)a_pReply + nPos + 1;
+    uint nHostLen = nEnd - nPos - 1;
+
+    // Refresh the device, or replace the least recently seen one if full - the hostname is compared in place:
+    uint8_t nIdx = 0;
+    while(( nIdx < m_nCnt ) && ( CmpHostName( m_arrDevs[ nIdx ], pHostName, nHostLen )))
+        nIdx++;
+    if( nIdx == INV_MAX_DEVICES )
+    {
+        nIdx = 0;
+        for( uint8_t nDev = 1; nDev < m_nCnt; nDev++ )
+        {
+            if( m_arrDevs[ nDev ].nSeenMs - m_arrDevs[ nIdx ].nSeenMs > LONG_MAX )  // older, wrap-safe
+                nIdx = nDev;
+        }
+        DBGLOG2( "inv full - replace %.*s\n", m_arrDevs[ nIdx ].nHostLen, m_arrDevs[ nIdx ].szReply + m_arrDevs[ nIdx ].nHostPos );
+    }
+    else if( nIdx == m_nCnt )
+    {
+        m_nCnt++;
+    }
+    SDev& rDev = m_arrDevs[ nIdx ];
+    memcpy( rDev.szReply, a_pReply, a_nLen );
+    rDev.szReply[ a_nLen ] = 0;
+    rDev.nHostPos = nPos + 1;
+    rDev.nHostLen = nHostLen;
+    rDev.nSeenMs = millis();
+    rDev.bCandidate = bCandidate;
+    return true;
+}
+
+bool CInventory::IsElected( const char* a_pszHostName )
+{
+    for( uint8_t nIdx = 0; nIdx < m_nCnt; nIdx++ )
+    {
+        if(( m_arrDevs[ nIdx ].bCandidate ) && ( CmpHostName( m_arrDevs[ nIdx ], a_pszHostName, strlen( a_pszHostName )) < 0 ))
+            return false;
+    }
+    return true;
+}
+
+int CInventory::CmpHostName( const SDev& a_rDev, const char* a_pHostName, uint a_nLen )
+{
+    int nCmp = memcmp( a_rDev.szReply + a_rDev.nHostPos, a_pHostName, min((uint)a_rDev.nHostLen, a_nLen ));
+    return ( nCmp ) ? nCmp : (int)a_rDev.nHostLen - (int)a_nLen;
+}
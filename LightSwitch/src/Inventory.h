@@ -0,0 +1,99 @@
+/**
+ * DIY Smart Home - light switch
+ * Device inventory
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+
+
+
+/// Max number of the devices kept in the inventory - the least recently seen one is replaced
+#define INV_MAX_DEVICES     32
+
+/// Inventory candidate marker appended to the discovery reply
+#define INV_CANDIDATE       " inv"
+
+/// Inventory candidate marker length
+#define INV_CANDIDATE_LEN   4
+
+/// Max discovery reply length kept, including the terminator - fits MQTT_DIR_REPLY_LEN, a longer reply is rejected
+#define INV_REPLY_LEN       128
+
+
+
+/**
+ * Device inventory class.
+ * 
+ * Collects the discovery replies (MQTT_CMD_MGT_DISCOVERY) of the fleet seen on the device management topic:
+ *   <fw rev> <hostname> <ip> <mac>[ inv]
+ * The replies marked with INV_CANDIDATE come from the inventory candidates - the devices collecting the inventory.
+ * The candidate with the lowest hostname is the elected one: it replies the collected fleet list to MQTT_CMD_MGT_INVENTORY,
+ * so a single device answers instead of the whole fleet.
+ * The replies are kept in fixed slots - the discovery traffic of the fleet does not touch the heap.
+ */
+class CInventory
+{
+public:
+    CInventory() : m_nCnt( 0 ) {}
+
+    /**
+     * Add or refresh a device.
+     * 
+     * @param[in]   a_pReply    Discovery reply
+     * @param[in]   a_nLen      Length of the reply
+     * 
+     * @return  false if not a discovery reply.
+     */
+    bool Add( const byte* a_pReply, uint a_nLen );
+
+    /**
+     * Test if the device is the elected one: no candidate with a lower hostname seen.
+     * 
+     * @param[in]   a_pszHostName   Hostname of the device
+     */
+    bool IsElected( const char* a_pszHostName );
+
+    /**
+     * Get the number of the devices.
+     */
+    uint8_t GetCnt()
+    {
+        return m_nCnt;
+    }
+
+    /**
+     * Get the discovery reply of a device, without the candidate marker.
+     * 
+     * @param[in]   a_nIdx      Device index: 0..GetCnt()-1
+     */
+    const char* Get( uint8_t a_nIdx )
+    {
+        return m_arrDevs[ a_nIdx ].szReply;
+    }
+
+protected:
+    /**
+     * Inventory device.
+     */
+    struct SDev
+    {
+        char szReply[ INV_REPLY_LEN ];  ///< Discovery reply, without the candidate marker
+        uint8_t nHostPos;   ///< Hostname position in the reply
+        uint8_t nHostLen;   ///< Hostname length
+        ulong nSeenMs;      ///< Last reply time (ms)
+        bool bCandidate;    ///< True if an inventory candidate
+    };
+
+    /**
+     * Compare the hostname of a device with a hostname, strcmp() style.
+     * 
+     * @param[in]   a_rDev      Device
+     * @param[in]   a_pHostName Hostname - not terminated
+     * @param[in]   a_nLen      Hostname length
+     */
+    static int CmpHostName( const SDev& a_rDev, const char* a_pHostName, uint a_nLen );
+
+    SDev m_arrDevs[ INV_MAX_DEVICES ];  ///< Devices seen
+    uint8_t m_nCnt;                     ///< Number of the devices
+};
@@ -0,0 +1,45 @@
+/**
+ * DIY Smart Home - light switch
+ * Leveled log
+ * 2022 Łukasz Łasek
+ */
+#include "Log.h"
+
+SLogRec CLog::Sm_arrRec[ LOG_LEN ];
+std::atomic< uint32_t > CLog::Sm_nHead( 0 );
+std::atomic< uint32_t > CLog::Sm_nTail( 0 );
+std::atomic< uint32_t > CLog::Sm_nDropped( 0 );
+ELogLvl CLog::Sm_lvl = (ELogLvl)LOG_LEVEL;
+
+uint CLog::Format( const SLogRec& a_rRec, char* a_pszBuf, uint a_nLen )
+{
+    // The unused arguments are passed too - harmless for printf:
+    int nLen = snprintf( a_pszBuf, a_nLen, a_rRec.pszFmt,
+        a_rRec.arrArgs[ 0 ], a_rRec.arrArgs[ 1 ], a_rRec.arrArgs[ 2 ], a_rRec.arrArgs[ 3 ]);
+    static_assert( LOG_ARGS == 4, "Review the record format arguments" );
+    if( nLen < 0 )
+    {
+        a_pszBuf[ 0 ] = 0;
+        return 0;
+    }
+    return min((uint)nLen, a_nLen - 1 );
+}
+
+char CLog::GetLevelChar( ELogLvl a_lvl )
+{
+    switch( a_lvl )
+    {
+        case ELogLvl::eErr:
+            return 'E';
+        case ELogLvl::eWarn:
+            return 'W';
+        case ELogLvl::eInfo:
+            return 'I';
+        default:
+            return 'D';
+    }
+}
+
+void CLog::CheckFmt( const char* a_pszFmt, ... )
+{
+}
@@ -0,0 +1,228 @@
+/**
+ * DIY Smart Home - light switch
+ * Leveled log
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+#include <atomic>
+#include <type_traits>
+
+
+
+/// Log levels - the records above the compile-time LOG_LEVEL are compiled out
+#define LOG_LEVEL_NONE      0
+#define LOG_LEVEL_ERR       1
+#define LOG_LEVEL_WARN      2
+#define LOG_LEVEL_INFO      3
+#define LOG_LEVEL_DBG       4
+
+/// Compile-time log level
+#ifndef LOG_LEVEL
+#ifdef DBG
+#define LOG_LEVEL           LOG_LEVEL_DBG
+#else
+#define LOG_LEVEL           LOG_LEVEL_INFO
+#endif
+#endif
+
+/// Number of the records kept until drained by the sink - must be a power of 2
+#ifndef LOG_LEN
+#define LOG_LEN             32
+#endif
+
+/// Max number of the format arguments of a record
+#define LOG_ARGS            4
+
+static_assert(( LOG_LEN & ( LOG_LEN - 1 )) == 0, "LOG_LEN must be a power of 2" );
+
+
+
+/**
+ * Log level.
+ */
+enum class ELogLvl : uint8_t
+{
+    eNone = LOG_LEVEL_NONE, ///< Nothing logged
+    eErr = LOG_LEVEL_ERR,   ///< Error
+    eWarn = LOG_LEVEL_WARN, ///< Warning
+    eInfo = LOG_LEVEL_INFO, ///< Information
+    eDbg = LOG_LEVEL_DBG    ///< Debug
+};
+
+/**
+ * Log record - formatted by the sink.
+ */
+struct SLogRec
+{
+    const char* pszFmt;             ///< printf format
+    uintptr_t arrArgs[ LOG_ARGS ];  ///< Format arguments
+    uint32_t nMs;                   ///< Time (ms)
+    ELogLvl lvl;                    ///< Level
+};
+
+
+
+/**
+ * Leveled log class.
+ * 
+ * The log macros LOGE(), LOGW(), LOGI(), LOGD() store the format and the raw arguments in a ring of records,
+ * the formatting is deferred to the sink draining the ring from the main loop, see CLogSink.
+ * A record costs no formatting and no I/O when added. The records above the compile-time LOG_LEVEL are compiled out,
+ * the ones above the runtime level (SetLevel()) are dropped when added.
+ * 
+ * The arguments are kept by value: up to LOG_ARGS integers, chars, enums or pointers. The format and the %s
+ * arguments must outlive the record - string literals or the strings that are not freed or modified,
+ * never a String temporary or a receive buffer. The format is checked against the arguments at compile time.
+ * 
+ * The ring is lock-free single producer single consumer: the records are added from the loop context only
+ * and drained by the sink, a full ring drops the new records and counts them.
+ */
+class CLog
+{
+public:
+    /**
+     * Add a record.
+     * 
+     * @param[in]   a_lvl       Level
+     * @param[in]   a_pszFmt    printf format - must outlive the record
+     * @param[in]   a_args      Format arguments - up to LOG_ARGS
+     */
+    template< typename... TArgs >
+    static void Add( ELogLvl a_lvl, const char* a_pszFmt, TArgs... a_args )
+    {
+        static_assert( sizeof...( a_args ) <= LOG_ARGS, "Too many log arguments" );
+        if( a_lvl > Sm_lvl )
+            return;
+        uint32_t nHead = Sm_nHead.load( std::memory_order_relaxed );
+        if( nHead - Sm_nTail.load( std::memory_order_acquire ) >= LOG_LEN )
+        {
+            Sm_nDropped.store( Sm_nDropped.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+            return;
+        }
+        SLogRec& rRec = Sm_arrRec[ nHead & ( LOG_LEN - 1 )];
+        const uintptr_t arrArgs[ LOG_ARGS + 1 ] = { Arg( a_args )... };
+        memcpy( rRec.arrArgs, arrArgs, sizeof( rRec.arrArgs ));
+        rRec.pszFmt = a_pszFmt;
+        rRec.nMs = millis();
+        rRec.lvl = a_lvl;
+        Sm_nHead.store( nHead + 1, std::memory_order_release );
+    }
+
+    /**
+     * Get a record not drained yet - the sink only.
+     * 
+     * @param[in]   a_nIdx      Record index: 0 - the oldest one
+     * 
+     * @return  nullptr if none.
+     */
+    static const SLogRec* Peek( uint32_t a_nIdx = 0 )
+    {
+        uint32_t nTail = Sm_nTail.load( std::memory_order_relaxed );
+        if( a_nIdx >= Sm_nHead.load( std::memory_order_acquire ) - nTail )
+            return nullptr;
+        return &Sm_arrRec[( nTail + a_nIdx ) & ( LOG_LEN - 1 )];
+    }
+
+    /**
+     * Release the oldest records returned by Peek() - the sink only.
+     * 
+     * @param[in]   a_nCnt      Number of the records, up to GetCnt()
+     */
+    static void Pop( uint32_t a_nCnt = 1 )
+    {
+        Sm_nTail.store( Sm_nTail.load( std::memory_order_relaxed ) + a_nCnt, std::memory_order_release );
+    }
+
+    /**
+     * Get the number of the records not drained yet - the sink only.
+     */
+    static uint32_t GetCnt()
+    {
+        return Sm_nHead.load( std::memory_order_acquire ) - Sm_nTail.load( std::memory_order_relaxed );
+    }
+
+    /**
+     * Format a record.
+     * 
+     * @param[in]   a_rRec      Record
+     * @param[out]  a_pszBuf    Output buffer
+     * @param[in]   a_nLen      Output buffer length - the message is truncated
+     * 
+     * @return  Message length, up to a_nLen - 1.
+     */
+    static uint Format( const SLogRec& a_rRec, char* a_pszBuf, uint a_nLen );
+
+    /**
+     * Get the number of the records dropped since boot - the ring was full.
+     */
+    static uint32_t GetDropped()
+    {
+        return Sm_nDropped.load( std::memory_order_relaxed );
+    }
+
+    /**
+     * Set the runtime level - the records above it are dropped.
+     */
+    static void SetLevel( ELogLvl a_lvl )
+    {
+        Sm_lvl = a_lvl;
+    }
+
+    /**
+     * Get the level letter: E, W, I, D.
+     */
+    static char GetLevelChar( ELogLvl a_lvl );
+
+    /**
+     * Check the format against the arguments at compile time - never called.
+     */
+    static void CheckFmt( const char* a_pszFmt, ... ) __attribute__(( format( printf, 1, 2 )));
+
+private:
+    /**
+     * Convert a format argument to a record argument.
+     */
+    template< typename T >
+    static uintptr_t Arg( T a_arg )
+    {
+        static_assert(( std::is_integral< T >::value || std::is_enum< T >::value || std::is_pointer< T >::value )
+            && ( sizeof( T ) <= sizeof( uintptr_t )), "Log arguments: integers, chars, enums or persistent strings only" );
+        return (uintptr_t)a_arg;
+    }
+
+    static SLogRec Sm_arrRec[ LOG_LEN ];        ///< Ring of records
+    static std::atomic< uint32_t > Sm_nHead;    ///< Sequence number of the next record added - the producer
+    static std::atomic< uint32_t > Sm_nTail;    ///< Sequence number of the next record drained - the sink
+    static std::atomic< uint32_t > Sm_nDropped; ///< Records dropped - the ring was full
+    static ELogLvl Sm_lvl;                      ///< Runtime level
+};
+
+
+
+/// Add a record of a level - compile-time format check, deferred formatting
+#define LOG_ADD( lvl, fmt, ... )    do { if( false ) CLog::CheckFmt( fmt, ##__VA_ARGS__ ); CLog::Add( lvl, fmt, ##__VA_ARGS__ ); } while( false )
+
+#if LOG_LEVEL >= LOG_LEVEL_ERR
+    #define LOGE( fmt, ... )        LOG_ADD( ELogLvl::eErr, fmt, ##__VA_ARGS__ )
+#else
+    #define LOGE( fmt, ... )
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+    #define LOGW( fmt, ... )        LOG_ADD( ELogLvl::eWarn, fmt, ##__VA_ARGS__ )
+#else
+    #define LOGW( fmt, ... )
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+    #define LOGI( fmt, ... )        LOG_ADD( ELogLvl::eInfo, fmt, ##__VA_ARGS__ )
+#else
+    #define LOGI( fmt, ... )
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DBG
+    #define LOGD( fmt, ... )        LOG_ADD( ELogLvl::eDbg, fmt, ##__VA_ARGS__ )
+#else
+    #define LOGD( fmt, ... )
+#endif
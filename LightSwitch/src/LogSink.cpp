@@ -0,0 +1,116 @@
+/**
+ * DIY Smart Home - light switch
+ * Log sink
+ * 2022 Łukasz Łasek
+ */
+#include "LogSink.h"
+#include "dbg.h"
+
+void CLogSink::Setup( CMqttClient& a_rMqtt, const char* a_pszHostName, const char* a_pszTopic,
+    const String& a_rstrSyslog, uint16_t a_nSyslogPort, ELogLvl a_lvl )
+{
+    m_pMqtt = &a_rMqtt;
+    m_pszHostName = a_pszHostName;
+    m_pszTopic = a_pszTopic;
+    m_syslogIp = IPAddress();
+    if(( !a_rstrSyslog.isEmpty()) && ( !m_syslogIp.fromString( a_rstrSyslog )))
+    {
+        DBGLOG1( "log syslog server invalid: '%s'\n", a_rstrSyslog.c_str());
+        m_syslogIp = IPAddress();
+    }
+    m_nSyslogPort = ( a_nSyslogPort ) ? a_nSyslogPort : LOG_SYSLOG_PORT;
+    m_udp.stop();
+    if( m_syslogIp )
+        m_udp.begin( 0 );
+    CLog::SetLevel( a_lvl );
+    DBGLOG4( "log cfg: topic:'%s' syslog:'%s:%u' lvl:%u\n", m_pszTopic, a_rstrSyslog.c_str(), m_nSyslogPort, (uint8_t)a_lvl );
+}
+
+void CLogSink::loop()
+{
+    if( !m_pMqtt )
+        return;
+
+    for( uint8_t nSink = 0; nSink < eSinks; nSink++ )
+    {
+        if( IsOn((ESink)nSink ))
+            Drain((ESink)nSink );
+    }
+
+    // Release the records taken by all the sinks - all of them if none is configured. A full ring is released
+    // up to the fastest sink, the lagging ones skip the rest:
+    uint32_t nCnt = CLog::GetCnt();
+    uint32_t nMin = nCnt;
+    uint32_t nMax = 0;
+    for( uint8_t nSink = 0; nSink < eSinks; nSink++ )
+    {
+        if( IsOn((ESink)nSink ))
+        {
+            nMin = min( nMin, m_arrSinks[ nSink ].nTaken );
+            nMax = max( nMax, m_arrSinks[ nSink ].nTaken );
+        }
+    }
+    if(( nCnt >= LOG_LEN ) && ( nMax > nMin ))
+        nMin = nMax;
+    for( SSinkState& rSink : m_arrSinks )
+    {
+        if( rSink.nTaken < nMin )
+        {
+            rSink.nSkipped += nMin - rSink.nTaken;
+            rSink.nTaken = nMin;
+        }
+        rSink.nTaken -= nMin;
+    }
+    CLog::Pop( nMin );
+}
+
+void CLogSink::Drain( ESink a_sink )
+{
+    SSinkState& rSink = m_arrSinks[ a_sink ];
+    uint32_t nDropped = CLog::GetDropped() + rSink.nSkipped;
+    if( nDropped != rSink.nDroppedSent )
+    {
+        char szMsg[ 32 ];
+        snprintf( szMsg, sizeof( szMsg ), "log: %u dropped", nDropped - rSink.nDroppedSent );
+        if( !Send( a_sink, ELogLvl::eWarn, millis(), szMsg ))
+            return;
+        rSink.nDroppedSent = nDropped;
+    }
+
+    for( uint8_t nIdx = 0; nIdx < LOG_SINK_BATCH; nIdx++ )
+    {
+        const SLogRec* pRec = CLog::Peek( rSink.nTaken );
+        if( !pRec )
+            break;
+        char szMsg[ LOG_MSG_LEN ];
+        CLog::Format( *pRec, szMsg, sizeof( szMsg ));
+        if( !Send( a_sink, pRec->lvl, pRec->nMs, szMsg ))
+            break;
+        rSink.nTaken++;
+    }
+}
+
+bool CLogSink::Send( ESink a_sink, ELogLvl a_lvl, uint32_t a_nMs, const char* a_pszMsg )
+{
+    char szLine[ LOG_LINE_LEN ];
+    if( a_sink == eMqtt )
+    {
+        snprintf( szLine, sizeof( szLine ), "%u %c %s", a_nMs, CLog::GetLevelChar( a_lvl ), a_pszMsg );
+        if( !m_pMqtt->Publish( m_pszTopic, szLine ))
+            return false;
+        DBGLOG3( "log %u %c %s\n", a_nMs, CLog::GetLevelChar( a_lvl ), a_pszMsg );
+        return true;
+    }
+
+    // RFC 5424 severity by ELogLvl:
+    static const uint8_t Sl_arrSeverity[] = { 7, 3, 4, 6, 7 };
+    int nLen = snprintf( szLine, sizeof( szLine ), "<%u>1 - %s sw - - - %u %s",
+        LOG_SYSLOG_FACILITY * 8 + Sl_arrSeverity[ (uint8_t)a_lvl ], m_pszHostName, a_nMs, a_pszMsg );
+    if( !m_udp.beginPacket( m_syslogIp, m_nSyslogPort ))
+        return false;
+    m_udp.write((const uint8_t*)szLine, min( nLen, (int)sizeof( szLine ) - 1 ));
+    m_udp.endPacket();
+    if( !*m_pszTopic )
+        DBGLOG3( "log %u %c %s\n", a_nMs, CLog::GetLevelChar( a_lvl ), a_pszMsg );
+    return true;
+}
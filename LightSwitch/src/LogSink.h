@@ -0,0 +1,120 @@
+/**
+ * DIY Smart Home - light switch
+ * Log sink
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+#include <WiFiUdp.h>
+
+#include "MqttClient.h"
+#include "Log.h"
+
+
+
+/// Default runtime log level: info
+#define LOG_LEVEL_DEFAULT   "3"
+
+/// Default syslog server port
+#define LOG_SYSLOG_PORT     514
+
+/// Syslog facility: local0
+#define LOG_SYSLOG_FACILITY 16
+
+/// Max number of the records drained per loop iteration
+#define LOG_SINK_BATCH      4
+
+/// Max formatted message length
+#define LOG_MSG_LEN         128
+
+/// Max sent line length: syslog header or time and level + message
+#define LOG_LINE_LEN        ( LOG_MSG_LEN + 64 )
+
+
+
+/**
+ * Log sink class.
+ * 
+ * Drains the log records from the main loop, see CLog: formats them and sends them to the configured
+ * UDP syslog server (RFC 5424, facility local0) and/or the MQTT log topic (QoS 0):
+ *   syslog: <pri>1 - <hostname> sw - - - <ms> <msg>
+ *   MQTT: <ms> <level: E|W|I|D> <msg>
+ * Up to LOG_SINK_BATCH records are sent per sink and loop iteration and only if the MQTT client has room for them,
+ * so the sink never blocks the switches. Each sink drains the ring at its own pace: a record stays in the ring
+ * until every sink configured has taken it, so syslog keeps receiving the records while MQTT is disconnected.
+ * The records wait in the ring for a stalled sink until it is full, then the stalled sink skips the oldest ones
+ * instead of stalling the others. The records dropped on a full ring or skipped are reported with a warning per sink.
+ * The DBG build echoes the records on the serial port.
+ */
+class CLogSink
+{
+public:
+    CLogSink() : m_pMqtt( nullptr ), m_pszHostName( "" ), m_pszTopic( "" ), m_nSyslogPort( 0 ), m_arrSinks() {}
+
+    /**
+     * Configure the sink - an empty config disables it, the records are drained and dropped then.
+     * 
+     * @param[in]   a_rMqtt         MQTT client
+     * @param[in]   a_pszHostName   Hostname sent to the syslog server - kept, not copied
+     * @param[in]   a_pszTopic      MQTT log topic, empty: disabled - kept, not copied
+     * @param[in]   a_rstrSyslog    Syslog server IP, empty: disabled
+     * @param[in]   a_nSyslogPort   Syslog server port, 0: LOG_SYSLOG_PORT
+     * @param[in]   a_lvl           Runtime log level
+     */
+    void Setup( CMqttClient& a_rMqtt, const char* a_pszHostName, const char* a_pszTopic,
+        const String& a_rstrSyslog, uint16_t a_nSyslogPort, ELogLvl a_lvl );
+
+    /**
+     * Main loop function: drain the log records.
+     */
+    void loop();
+
+protected:
+    /**
+     * Log sink kind.
+     */
+    enum ESink : uint8_t
+    {
+        eMqtt,      ///< MQTT log topic
+        eSyslog,    ///< UDP syslog server
+        eSinks
+    };
+
+    /**
+     * Drain state of a sink.
+     */
+    struct SSinkState
+    {
+        uint32_t nTaken;        ///< Records in the ring taken by the sink
+        uint32_t nSkipped;      ///< Records skipped by the sink on a full ring
+        uint32_t nDroppedSent;  ///< Records dropped or skipped reported
+    };
+
+    /**
+     * Check if a sink is configured.
+     */
+    bool IsOn( ESink a_sink )
+    {
+        return ( a_sink == eMqtt ) ? *m_pszTopic : (bool)m_syslogIp;
+    }
+
+    /**
+     * Send up to LOG_SINK_BATCH records the sink has not taken yet.
+     */
+    void Drain( ESink a_sink );
+
+    /**
+     * Send a record to a sink.
+     * 
+     * @return  false if the sink has no room for it - retry later.
+     */
+    bool Send( ESink a_sink, ELogLvl a_lvl, uint32_t a_nMs, const char* a_pszMsg );
+
+    CMqttClient* m_pMqtt;   ///< MQTT client
+    const char* m_pszHostName;  ///< Hostname sent to the syslog server
+    const char* m_pszTopic; ///< Configured MQTT log topic, empty: disabled
+    IPAddress m_syslogIp;   ///< Configured syslog server, 0: disabled
+    uint16_t m_nSyslogPort; ///< Configured syslog server port
+    WiFiUDP m_udp;          ///< Syslog socket
+    SSinkState m_arrSinks[ eSinks ];    ///< Drain state per sink
+};
@@ -5,133 +5,255 @@
  */
 #include "ManualSwitch.h"
 #include "Mqtt.h"
+#include "FlightRec.h"
+#include "Log.h"
+#include "Metrics.h"
 #include "CfgUtils.h"
 #include "StringUtils.h"
 
-#define PIN_IN0     D5  // GPIO 14
-#define PIN_IN1     D6  // GPIO 12
-#define PIN_IN2     D7  // GPIO 13
 uint8_t CManualSwitch::Sm_arrPinIn[ SW_CHANNELS ] = { PIN_IN0, PIN_IN1, PIN_IN2 };
 
-#define PIN_OUT0    D1  // GPIO 5
-#define PIN_OUT1    D2  // GPIO 4
-#define PIN_OUT2    D8  // GPIO 15
 uint8_t CManualSwitch::Sm_arrPinOut[ SW_CHANNELS ] = { PIN_OUT0, PIN_OUT1, PIN_OUT2 };
 
-extern CMqtt g_mqtt;
-
 // Tap operations:
 #define SW_TAP_OP_TOGGLE            0   // Toggle output on/off. Arg: none
 #define SW_TAP_OP_TOGGLE_MASK_OFF   1   // Toggle output on/off and send MQTT_CMD_GRP_TURN_OFF. Arg: mask
 #define SW_TAP_OP_AUTO_OFF          2   // Turn on the output, setup auto-off timer for (TapCnt * <arg>) secs. Arg: timer step duratin in seconds
 #define SW_TAP_OP_FORWARD           3   // Forward the tap event via MQTT_CMD_GRP_FWD_SHORT_TAP/MQTT_CMD_GRP_FWD_LONG_TAP. Arg: mask
-#define SW_TAP_OP_DISABLE           4   // Fake op, no-op. Arg: none
-#define SW_TAP_OPS                  4   // # of real ops, i.e. not including DISABLE
+#define SW_TAP_OP_PROGRAM           4   // Run the tap program. Arg: program source
+#define SW_TAP_OP_DISABLE           5   // Fake op, no-op. Arg: none
+#define SW_TAP_OPS                  5   // # of real ops, i.e. not including DISABLE
 static_assert( SW_TAP_OP_DISABLE == SW_TAP_OPS, "Review all SW tap modes" );
 
 // Cfg tap op name -> tap op (index) mapping:
-static const char* Sg_arrCfgTapOps[ SW_TAP_OPS ] PROGMEM = { "tgle", "tgof", "aoff", "fwte" };
+static const char* Sg_arrCfgTapOps[ SW_TAP_OPS ] PROGMEM = { "tgle", "tgof", "aoff", "fwte", "prog" };
 
 // Cfg tap event name -> tap event (index) mapping:
-static const char* Sg_arrCfgTapEvents[ SW_TAP_EVENTS ] PROGMEM = { "ev-ss", "ev-sm", "ev-ls" };
+static const char* Sg_arrCfgTapEvents[ SW_TAP_EVENTS ] PROGMEM = { "ev-ss", "ev-sm", "ev-ls", "ev-g0", "ev-g1", "ev-g2", "ev-g3" };
 
 // Cft tap event arg name -> tap event (index) mapping:
-static const char* Sg_arrCfgTapEventArgs[ SW_TAP_EVENTS ] PROGMEM = { "arg-ss", "arg-sm", "arg-ls" };
+static const char* Sg_arrCfgTapEventArgs[ SW_TAP_EVENTS ] PROGMEM = { "arg-ss", "arg-sm", "arg-ls", "arg-g0", "arg-g1", "arg-g2", "arg-g3" };
+
+// Cfg custom gesture pattern name -> custom gesture (index) mapping:
+static const char* Sg_arrCfgGestures[ SW_GESTURES ] PROGMEM = { "gst0", "gst1", "gst2", "gst3" };
 
-void CManualSwitch::ReadCfg( uint8_t a_nChanNo )
+bool CManualSwitch::ReadCfg( uint8_t a_nChanNo, const char* a_pszPath )
 {
-    m_pszClearMask = NULL;
+    m_nClearMask = 0;
     m_nLongTapMs = m_nNextTapMs = 0;
     m_nChanNo = a_nChanNo;
+    m_bStatDirty = true;
+    m_bPending = false;
+    m_nCfgErrors = 0;
 
     const char* arrCfgFile[ SW_CHANNELS ] = { FS_CH0_CFG, FS_CH1_CFG, FS_CH2_CFG };
-    File file = LittleFS.open( arrCfgFile[ a_nChanNo ], "r" );
+    File file = LittleFS.open(( a_pszPath ) ? a_pszPath : arrCfgFile[ a_nChanNo ], "r" );
     if( file )
     {
-        m_nId = CConfigUtils::ReadValue( file, "id" ).toInt();
-        if( m_nId > SW_MAX_ID )
-        {
-            m_nId = 0;
-        }
+        m_nId = ReadCfgId( file );
 
         m_nLongTapMs = CConfigUtils::ReadValue( file, "long" ).toInt();
         m_nNextTapMs = CConfigUtils::ReadValue( file, "next" ).toInt();
+        m_nCoalesceMs = CConfigUtils::ReadValue( file, "coalesce", SW_DEF_COALESCE_MS ).toInt();
+        m_nDwellMs = CConfigUtils::ReadValue( file, "dwell", SW_DEF_DWELL_MS ).toInt();
+
+        bool bTune = CConfigUtils::ReadValue( file, "tune", SW_DEF_TUNE ).toInt();
+        uint16_t nLongMinMs = CConfigUtils::ReadValue( file, "min long", String( m_nLongTapMs ).c_str()).toInt();
+        uint16_t nLongMaxMs = CConfigUtils::ReadValue( file, "max long", String( m_nLongTapMs ).c_str()).toInt();
+        uint16_t nNextMinMs = CConfigUtils::ReadValue( file, "min next", SW_DEF_MIN_NEXT_MS ).toInt();
+        uint16_t nNextMaxMs = CConfigUtils::ReadValue( file, "max next", String( m_nNextTapMs ).c_str()).toInt();
+        SetAutoTune( bTune, nLongMinMs, nLongMaxMs, nNextMinMs, nNextMaxMs );
 
-        bool bEnabled = ReadCfgTapEvent( file, SW_TAP_EVENT_SHORT_SINGLE );
-        bEnabled |= ReadCfgTapEvent( file, SW_TAP_EVENT_SHORT_MULTI );
-        bEnabled |= ReadCfgTapEvent( file, SW_TAP_EVENT_LONG_SINGLE );
+        SetHoldMs( CConfigUtils::ReadValue( file, "hold", SW_DEF_HOLD_MS ).toInt());
+        ResetGestures();
+        m_prog.Clear();
 
-        if( !bEnabled )
+        if( !ReadCfgTapEvents( file, m_nId, m_prog, GetGestures(), m_arrTapEntry, m_nCfgErrors ))
         {
             m_nChanNo += SW_CHANNELS;   // disable the channel
         }
 
-        DBGLOG4( "sw ch%d cfg: id:%d long-ms:%u next-ms:%u ",
-            m_nChanNo, m_nId, m_nLongTapMs, m_nNextTapMs );
-        DBGLOG6( "ev: ss-op:%u -arg:'%s' sm-op:%u -arg:'%s' ls-op:%u -arg:'%s'\n",
-            m_arrTapOps[ SW_TAP_EVENT_SHORT_SINGLE ], m_arrTapArgs[ SW_TAP_EVENT_SHORT_SINGLE ].c_str(),
-            m_arrTapOps[ SW_TAP_EVENT_SHORT_MULTI ], m_arrTapArgs[ SW_TAP_EVENT_SHORT_MULTI ].c_str(),
-            m_arrTapOps[ SW_TAP_EVENT_LONG_SINGLE ], m_arrTapArgs[ SW_TAP_EVENT_LONG_SINGLE ].c_str());
+        DBGLOG6( "sw ch%d cfg: id:%d long-ms:%u next-ms:%u coalesce-ms:%u dwell-ms:%u ",
+            m_nChanNo, m_nId, m_nLongTapMs, m_nNextTapMs, m_nCoalesceMs, m_nDwellMs );
+        DBGLOG5( "tune:%u long-ms:%u-%u next-ms:%u-%u ", bTune, nLongMinMs, nLongMaxMs, nNextMinMs, nNextMaxMs );
+        DBGLOG5( "ev: ss:%u sm:%u ls:%u prog-len:%u masks:%u\n",
+            m_arrTapEntry[ SW_TAP_EVENT_SHORT_SINGLE ], m_arrTapEntry[ SW_TAP_EVENT_SHORT_MULTI ],
+            m_arrTapEntry[ SW_TAP_EVENT_LONG_SINGLE ], m_prog.GetLen(), m_prog.GetMasks());
+        return !m_nCfgErrors;
     }
     else
     {
         m_nChanNo += SW_CHANNELS;   // disable the channel
         DBGLOG1( "sw ch%d cfg missing - disable\n", m_nChanNo );
+        return false;
     }
 }
 
-bool CManualSwitch::IsDisabled()
+bool CManualSwitch::CheckCfg( const char* a_pszPath )
 {
-    return m_nChanNo >= SW_CHANNELS;
+    // Parse only, into the scratch programs and gestures on the stack - no channel on the heap:
+    File file = LittleFS.open( a_pszPath, "r" );
+    if( !file )
+    {
+        return false;
+    }
+    CTapProg prog;
+    CGestures gestures;
+    CTouchBtn::InitGestures( gestures );
+    uint8_t arrTapEntry[ SW_TAP_EVENTS ];
+    uint8_t nErrors = 0;
+    ReadCfgTapEvents( file, ReadCfgId( file ), prog, gestures, arrTapEntry, nErrors );
+    return !nErrors;
 }
 
-bool CManualSwitch::ReadCfgTapEvent( File& a_rFile, uint8_t a_nTapEvent )
+void CManualSwitch::Reconfigure()
 {
-    m_arrTapArgs[ a_nTapEvent ] = CConfigUtils::ReadValue( a_rFile, Sg_arrCfgTapEvents[ a_nTapEvent ], Sg_arrCfgTapOps[ SW_TAP_OP_TOGGLE ]);
-    for( uint16_t nOp = 0; nOp < SW_TAP_OPS; nOp++ )
+    uint8_t nChanNo = m_nChanNo % SW_CHANNELS;
+    bool bWasEnabled = !IsDisabled();
+    bool bOn = ( bWasEnabled ) && ( GetSwitchState());
+    if( bWasEnabled )
     {
-        if( m_arrTapArgs[ a_nTapEvent ] == Sg_arrCfgTapOps[ nOp ])
+        CTouchBtn::Disable();
+    }
+
+    // ReadCfg() clears the pending state - a coalesced cmd is kept unless the channel gets disabled:
+    bool bPending = ( bWasEnabled ) && ( m_bPending );
+    bool bPendingOn = m_bPendingOn;
+    ulong nPendingAutoOff = m_nPendingAutoOff;
+    ReadCfg( nChanNo );
+    if( IsDisabled())
+    {
+        if( bOn )
         {
-            m_arrTapOps[ a_nTapEvent ] = nOp;
-            switch( nOp )
-            {
-                case SW_TAP_OP_TOGGLE_MASK_OFF:
-                case SW_TAP_OP_FORWARD:
-                    m_arrTapArgs[ a_nTapEvent ] = CConfigUtils::ReadValue( a_rFile, Sg_arrCfgTapEventArgs[ a_nTapEvent ]);
-                    if( m_arrTapArgs[ a_nTapEvent ].length() == MQTT_CMD_MASK_LEN )
-                    {
-                        // Unmask itself
-                        if( m_nId )
-                        {
-                            uint8_t nId = m_nId - 1;
-                            uint8_t nNibble = nId >> 2;         // same as: nId / 4
-                            uint8_t nMask = 1 << ( nId & 3 );   // same as: 1 << ( nId % 4 )
-                            byte nVal = CStringUtils::NibbleToU8_16( m_arrTapArgs[ a_nTapEvent ][ 2 + ( 15 - nNibble )]);
-                            nVal &= ~nMask;
-                            m_arrTapArgs[ a_nTapEvent ][ 2 + ( 15 - nNibble )] = CStringUtils::U8ToNibble_16( nVal );
-                        }
-                    }
-                    else
-                    {
-                        continue;   // will set DISABLE
-                    }
-                    break;
-
-                case SW_TAP_OP_AUTO_OFF:
-                    m_arrTapArgs[ a_nTapEvent ] = CConfigUtils::ReadValue( a_rFile, Sg_arrCfgTapEventArgs[ a_nTapEvent ], "60" );
-                    break;
-
-                default:
-                    m_arrTapArgs[ a_nTapEvent ].clear();
-                    break;
-            }
-            return true;
+            digitalWrite( Sm_arrPinOut[ nChanNo ], LOW );
         }
+        m_nPinSwitchVal = LOW;
+        m_nAutoOff = 0;
     }
+    else if( !bWasEnabled )
+    {
+        Enable();
+        MqttPubStat();
+    }
+    else
+    {
+        // Keep the output, the auto-off timer and the pending state - applied with the new coalescing window and dwell time:
+        m_bPending = bPending;
+        m_bPendingOn = bPendingOn;
+        m_nPendingAutoOff = nPendingAutoOff;
+        if( m_nPendingDelay )
+        {
+            m_nPendingDelay = m_nCoalesceMs;
+        }
+        CTouchBtn::Enable( Sm_arrPinIn[ m_nChanNo ], m_nLongTapMs, m_nNextTapMs );
+        MqttPubStat();
+    }
+    DBGLOG2( "sw ch%d reconfigured, enabled:%u\n", nChanNo, !IsDisabled());
+}
 
-    m_arrTapOps[ a_nTapEvent ] = SW_TAP_OP_DISABLE;
-    m_arrTapArgs[ a_nTapEvent ].clear();
-    return false;
+bool CManualSwitch::IsDisabled()
+{
+    return m_nChanNo >= SW_CHANNELS;
+}
+
+uint8_t CManualSwitch::ReadCfgId( File& a_rFile )
+{
+    uint8_t nId = CConfigUtils::ReadValue( a_rFile, "id" ).toInt();
+    return ( nId > SW_MAX_ID ) ? 0 : nId;
+}
+
+bool CManualSwitch::ReadCfgTapEvents( File& a_rFile, uint8_t a_nId, CTapProg& a_rProg, CGestures& a_rGestures, uint8_t* a_arrTapEntry, uint8_t& a_rnErrors )
+{
+    bool bEnabled = ReadCfgTapEvent( a_rFile, SW_TAP_EVENT_SHORT_SINGLE, false, a_nId, a_rProg, a_arrTapEntry, a_rnErrors );
+    bEnabled |= ReadCfgTapEvent( a_rFile, SW_TAP_EVENT_SHORT_MULTI, false, a_nId, a_rProg, a_arrTapEntry, a_rnErrors );
+    bEnabled |= ReadCfgTapEvent( a_rFile, SW_TAP_EVENT_LONG_SINGLE, true, a_nId, a_rProg, a_arrTapEntry, a_rnErrors );
+    for( uint8_t nGesture = 0; nGesture < SW_GESTURES; nGesture++ )
+    {
+        bEnabled |= ReadCfgGesture( a_rFile, nGesture, a_nId, a_rProg, a_rGestures, a_arrTapEntry, a_rnErrors );
+    }
+    return bEnabled;
+}
+
+bool CManualSwitch::ReadCfgGesture( File& a_rFile, uint8_t a_nGesture, uint8_t a_nId, CTapProg& a_rProg, CGestures& a_rGestures,
+    uint8_t* a_arrTapEntry, uint8_t& a_rnErrors )
+{
+    uint8_t nTapEvent = SW_TAP_EVENT_GESTURE0 + a_nGesture;
+    String strPattern = CConfigUtils::ReadValue( a_rFile, Sg_arrCfgGestures[ a_nGesture ]);
+    strPattern.trim();
+    a_arrTapEntry[ nTapEvent ] = TAP_PROG_NONE;
+    if(( !strPattern.length()) || ( strPattern == "-" ))
+    {
+        return false;
+    }
+
+    char cLast = strPattern[ strPattern.length() - 1 ];
+    if( !ReadCfgTapEvent( a_rFile, nTapEvent, ( cLast == GESTURE_LONG ) || ( cLast == GESTURE_HOLD ), a_nId, a_rProg, a_arrTapEntry, a_rnErrors ))
+    {
+        return false;
+    }
+    if( !a_rGestures.Add( strPattern.c_str(), TOUCH_GESTURE_CUSTOM + a_nGesture ))
+    {
+        DBGLOG1( "gst '%s' invalid - disable\n", strPattern.c_str());
+        a_rnErrors++;
+        a_arrTapEntry[ nTapEvent ] = TAP_PROG_NONE;
+        return false;
+    }
+    return true;
+}
+
+bool CManualSwitch::ReadCfgTapEvent( File& a_rFile, uint8_t a_nTapEvent, bool a_bFwdLong, uint8_t a_nId, CTapProg& a_rProg,
+    uint8_t* a_arrTapEntry, uint8_t& a_rnErrors )
+{
+    a_arrTapEntry[ a_nTapEvent ] = TAP_PROG_NONE;
+    String strOp = CConfigUtils::ReadValue( a_rFile, Sg_arrCfgTapEvents[ a_nTapEvent ], Sg_arrCfgTapOps[ SW_TAP_OP_TOGGLE ]);
+    uint16_t nOp = 0;
+    while(( nOp < SW_TAP_OPS ) && ( strOp != Sg_arrCfgTapOps[ nOp ]))
+    {
+        nOp++;
+    }
+
+    // Translate the tap operation into the tap program source:
+    String strSrc;
+    switch( nOp )
+    {
+        case SW_TAP_OP_TOGGLE:
+            strSrc = "tgl";
+            break;
+
+        case SW_TAP_OP_TOGGLE_MASK_OFF:
+            strSrc = "tgl " MQTT_CMD_GRP_TURN_OFF " ";
+            strSrc += CConfigUtils::ReadValue( a_rFile, Sg_arrCfgTapEventArgs[ a_nTapEvent ]);
+            break;
+
+        case SW_TAP_OP_AUTO_OFF:
+            strSrc = "arm ";
+            strSrc += CConfigUtils::ReadValue( a_rFile, Sg_arrCfgTapEventArgs[ a_nTapEvent ], "60" );
+            strSrc += " on";
+            break;
+
+        case SW_TAP_OP_FORWARD:
+            strSrc = ( a_bFwdLong ) ? MQTT_CMD_GRP_FWD_LONG_TAP " " : MQTT_CMD_GRP_FWD_SHORT_TAP " ";
+            strSrc += CConfigUtils::ReadValue( a_rFile, Sg_arrCfgTapEventArgs[ a_nTapEvent ]);
+            break;
+
+        case SW_TAP_OP_PROGRAM:
+            strSrc = CConfigUtils::ReadValue( a_rFile, Sg_arrCfgTapEventArgs[ a_nTapEvent ]);
+            break;
+
+        default:
+            return false;
+    }
+
+    // Unmask itself:
+    uint64_t nSelfMask = ( a_nId ) ? 1ull << ( a_nId - 1 ) : 0;
+    a_arrTapEntry[ a_nTapEvent ] = a_rProg.Compile( strSrc.c_str(), nSelfMask );
+    if( a_arrTapEntry[ a_nTapEvent ] == TAP_PROG_NONE )
+    {
+        DBGLOG2( "%s '%s' invalid - disable\n", Sg_arrCfgTapEvents[ a_nTapEvent ], strSrc.c_str());
+        a_rnErrors++;
+        return false;
+    }
+    return true;
 }
 
 void CManualSwitch::Enable()
@@ -142,6 +264,7 @@ void CManualSwitch::Enable()
     }
 
     m_tmAutoOff.UpdateAll();
+    m_tmDrive.UpdateAll();
     pinMode( Sm_arrPinOut[ m_nChanNo ], OUTPUT );
     DriveSwitch( false );
     CTouchBtn::Enable( Sm_arrPinIn[ m_nChanNo ], m_nLongTapMs, m_nNextTapMs );
@@ -155,7 +278,17 @@ void CManualSwitch::Disable()
 
 void CManualSwitch::DriveSwitch( bool a_bStateOn )
 {
-    m_nPinSwitchVal = ( a_bStateOn ) ? HIGH : LOW;
+    uint8_t nPinSwitchVal = ( a_bStateOn ) ? HIGH : LOW;
+    if( nPinSwitchVal != m_nPinSwitchVal )
+    {
+        if( m_pTrace )
+            m_pTrace->Add(( a_bStateOn ) ? CInputTrace::EType::eRelayOn : CInputTrace::EType::eRelayOff, m_nTraceChan );
+        CFlightRec::Add( EFrEvent::eRelay, (( m_nChanNo % SW_CHANNELS ) << 8 ) | a_bStateOn );
+        CMetrics::Inc( EMetric::eRelayToggles, m_nChanNo );
+        if( m_pMqtt )
+            m_pMqtt->OnRelay();
+    }
+    m_nPinSwitchVal = nPinSwitchVal;
     digitalWrite( Sm_arrPinOut[ m_nChanNo ], m_nPinSwitchVal );
 }
 
@@ -164,9 +297,24 @@ bool CManualSwitch::GetSwitchState()
     return ( m_nPinSwitchVal == LOW ) ? false : true;
 }
 
+bool CManualSwitch::GetTargetState()
+{
+    return ( m_bPending ) ? m_bPendingOn : GetSwitchState();
+}
+
 void CManualSwitch::loop()
 {
     CTouchBtn::loop();
+    if( m_bPending )
+    {
+        m_tmPending.UpdateCur();
+        if(( m_tmPending.Delta() >= m_nPendingDelay )
+            && (( m_bPendingOn == GetSwitchState()) || ( IsDwellExpired())))
+        {
+            m_bPending = false;
+            ApplyState( m_bPendingOn, m_nPendingAutoOff );
+        }
+    }
     if( m_nAutoOff )
     {
         m_tmAutoOff.UpdateCur();
@@ -179,27 +327,72 @@ void CManualSwitch::loop()
 
 void CManualSwitch::OnTap( uint8_t a_nTapEvent, uint16_t a_nTapCnt )
 {
-    switch( m_arrTapOps[ a_nTapEvent ])
+    LOGD( "ch%u tap %u x%u", m_nChanNo, a_nTapEvent, a_nTapCnt );
+    CMetrics::Inc( EMetric::eTaps, m_nChanNo );
+    CFlightRec::Add( EFrEvent::eTap, (( m_nChanNo % SW_CHANNELS ) << 8 ) | (( a_nTapEvent & 0xf ) << 4 ) | min( a_nTapCnt, (uint16_t)0xf ));
+    uint8_t nPc = m_arrTapEntry[ a_nTapEvent ];
+    if( nPc == TAP_PROG_NONE )
     {
-        case SW_TAP_OP_TOGGLE:
-            SetState( !GetSwitchState(), 0 );
-            break;
+        return;
+    }
 
-        case SW_TAP_OP_TOGGLE_MASK_OFF:
-            SetState( !GetSwitchState(), 0 );
-            MqttSendGroupCmd( MQTT_CMD_GRP_TURN_OFF, 1, m_arrTapArgs[ a_nTapEvent ].c_str());
-            break;
+    bool bWasOn = GetTargetState();
+    ulong nAutoOff = 0;
+    for( ; ; nPc++ )
+    {
+        const STapInsn& rInsn = m_prog.GetInsn( nPc );
+        switch( rInsn.op )
+        {
+            case ETapOp::eEnd:
+                return;
 
-        case SW_TAP_OP_AUTO_OFF:
-            SetState( true, ((ulong)max( 1, a_nTapCnt - 1 )) * m_arrTapArgs[ a_nTapEvent ].toInt() * 1000 );
-            break;
+            case ETapOp::eOn:
+                SetState( true, nAutoOff );
+                break;
 
-        case SW_TAP_OP_FORWARD:
-            MqttSendGroupCmd(( a_nTapEvent == SW_TAP_EVENT_LONG_SINGLE ) ?  MQTT_CMD_GRP_FWD_LONG_TAP : MQTT_CMD_GRP_FWD_SHORT_TAP, a_nTapCnt, m_arrTapArgs[ a_nTapEvent ].c_str());
-            break;
+            case ETapOp::eOff:
+                SetState( false, 0 );
+                break;
 
-        default:
-            break;
+            case ETapOp::eToggle:
+            {
+                bool bOn = !GetTargetState();
+                SetState( bOn, ( bOn ) ? nAutoOff : 0 );
+                break;
+            }
+
+            case ETapOp::eArm:
+                nAutoOff = ((ulong)max( 1, a_nTapCnt - 1 )) * rInsn.nArg * 1000;
+                break;
+
+            case ETapOp::eTurnOff:
+                MqttSendGroupCmd( MQTT_CMD_GRP_TURN_OFF, 1, m_prog.GetMask( rInsn ));
+                break;
+
+            case ETapOp::eFwdShort:
+                MqttSendGroupCmd( MQTT_CMD_GRP_FWD_SHORT_TAP, a_nTapCnt, m_prog.GetMask( rInsn ));
+                break;
+
+            case ETapOp::eFwdLong:
+                MqttSendGroupCmd( MQTT_CMD_GRP_FWD_LONG_TAP, a_nTapCnt, m_prog.GetMask( rInsn ));
+                break;
+
+            case ETapOp::eScene:
+            {
+                char szCmd[ MQTT_CMD_GRP_SCENE_RECALL_LEN + 8 ];
+                snprintf( szCmd, sizeof( szCmd ), MQTT_CMD_GRP_SCENE_RECALL MQTT_CMD_SEPARATOR "%u", rInsn.nArg );
+                m_pMqtt->PubGroup( szCmd );
+                break;
+            }
+
+            case ETapOp::eIfOn:
+            case ETapOp::eIfOff:
+                if( bWasOn != ( rInsn.op == ETapOp::eIfOn ))
+                {
+                    nPc++;  // skip the guarded instruction - never the end
+                }
+                break;
+        }
     }
 }
 
@@ -217,6 +410,12 @@ void CManualSwitch::OnLongTap()
     OnTap( SW_TAP_EVENT_LONG_SINGLE, 1 );
 }
 
+void CManualSwitch::OnGesture( uint8_t a_nEvent, uint16_t a_nCnt )
+{
+    DBGLOG3( "gesture %d x%d pin#%d\n", a_nEvent - TOUCH_GESTURE_CUSTOM, a_nCnt, m_nPin );
+    OnTap( SW_TAP_EVENT_GESTURE0 + a_nEvent - TOUCH_GESTURE_CUSTOM, a_nCnt );
+}
+
 void CManualSwitch::SetState( bool a_bStateOn, ulong a_nAutoOff )
 {
     if( IsDisabled())
@@ -224,23 +423,71 @@ void CManualSwitch::SetState( bool a_bStateOn, ulong a_nAutoOff )
         return;
     }
 
-    DriveSwitch( a_bStateOn );
+    if(( a_bStateOn != GetSwitchState()) && ( !IsDwellExpired()))
+    {
+        // Too early for the relay - defer the change:
+        m_bPending = true;
+        m_bPendingOn = a_bStateOn;
+        m_nPendingAutoOff = a_nAutoOff;
+        m_nPendingDelay = 0;
+        m_nAutoOff = 0;
+        return;
+    }
+
+    m_bPending = false;
+    ApplyState( a_bStateOn, a_nAutoOff );
+}
+
+void CManualSwitch::QueueState( bool a_bStateOn, ulong a_nAutoOff )
+{
+    if( IsDisabled())
+    {
+        return;
+    }
+
+    if( !m_bPending )
+    {
+        m_tmPending.UpdateAll();
+        m_nPendingDelay = m_nCoalesceMs;
+    }
+    m_bPending = true;
+    m_bPendingOn = a_bStateOn;
+    m_nPendingAutoOff = a_nAutoOff;
+}
+
+void CManualSwitch::ApplyState( bool a_bStateOn, ulong a_nAutoOff )
+{
+    bool bChanged = a_bStateOn != GetSwitchState();
+    if( bChanged )
+    {
+        DriveSwitch( a_bStateOn );
+        m_tmDrive.UpdateAll();
+    }
     m_nAutoOff = a_nAutoOff;
     if( a_nAutoOff )
     {
         m_tmAutoOff.UpdateAll();
     }
-    MqttPubStat();
+    if(( bChanged ) || ( m_bStatDirty ))
+    {
+        MqttPubStat();
+    }
+}
+
+bool CManualSwitch::IsDwellExpired()
+{
+    m_tmDrive.UpdateCur();
+    return m_tmDrive.Delta() >= m_nDwellMs;
 }
 
-void CManualSwitch::OnGroupCmd( byte* payload, uint len )
+bool CManualSwitch::OnGroupCmd( byte* payload, uint len )
 {
     if( CStringUtils::BeginsWith( MQTT_CMD_GRP_FWD_LONG_TAP, MQTT_CMD_GRP_FWD_LONG_TAP_LEN, payload, len ))
     {
         payload += MQTT_CMD_GRP_FWD_LONG_TAP_LEN + 1;    // skip the separator
         len -= MQTT_CMD_GRP_FWD_LONG_TAP_LEN + 1;
-        OnGroupMaskCmd( payload, len,
-            [ this ]( const char* a_pMask, uint16_t a_nCnt )
+        return OnGroupMaskCmd( payload, len,
+            [ this ]( uint64_t a_nMask, uint16_t a_nCnt )
             {
                 /**
                  * The arriving group cmd may target multiple switches, which may mask each other, e.g.
@@ -253,33 +500,47 @@ void CManualSwitch::OnGroupCmd( byte* payload, uint len )
                  * to the group cmd. This will exclude both SW1 and SW2 from their mask.
                  * All other masked switches will receive the group command from SW1 and SW2.
                  */
-                this->m_pszClearMask = a_pMask;
+                this->m_nClearMask = a_nMask;
                 this->OnLongTap();
-                this->m_pszClearMask = NULL;
+                this->m_nClearMask = 0;
             });
     }
     else if( CStringUtils::BeginsWith( MQTT_CMD_GRP_FWD_SHORT_TAP, MQTT_CMD_GRP_FWD_SHORT_TAP_LEN, payload, len ))
     {
         payload += MQTT_CMD_GRP_FWD_SHORT_TAP_LEN + 1;   // skip the separator
         len -= MQTT_CMD_GRP_FWD_SHORT_TAP_LEN + 1;
-        OnGroupMaskCmd( payload, len,
-            [ this ]( const char* a_pMask, uint16_t a_nCnt )
+        return OnGroupMaskCmd( payload, len,
+            [ this ]( uint64_t a_nMask, uint16_t a_nCnt )
             {
-                this->m_pszClearMask = a_pMask;
+                this->m_nClearMask = a_nMask;
                 this->OnShortTap( a_nCnt );
-                this->m_pszClearMask = NULL;
+                this->m_nClearMask = 0;
             });
     }
     else if( CStringUtils::BeginsWith( MQTT_CMD_GRP_TURN_OFF, MQTT_CMD_GRP_TURN_OFF_LEN, payload, len ))
     {
         payload += MQTT_CMD_GRP_TURN_OFF_LEN + 1;   // skip the separator
         len -= MQTT_CMD_GRP_TURN_OFF_LEN + 1;
-        OnGroupMaskCmd( payload, len,
-            [ this ]( const char* a_pMask, uint16_t a_nCnt )
+        return OnGroupMaskCmd( payload, len,
+            [ this ]( uint64_t a_nMask, uint16_t a_nCnt )
             {
-                this->SetState( false, 0 );
+                this->QueueState( false, 0 );
             });
     }
+    return false;
+}
+
+bool CManualSwitch::ApplyScene( const SScene& a_rScene )
+{
+    if( !GroupMaskMatch( a_rScene.nMask ))
+    {
+        return false;
+    }
+    CMetrics::Inc( EMetric::eGrpMatched, m_nChanNo );
+
+    bool bOn = GroupMaskMatch( a_rScene.nOnMask );
+    SetState( bOn, ( bOn ) ? a_rScene.nAutoOffSecs * 1000ul : 0 );
+    return true;
 }
 
 void CManualSwitch::MqttPubStat()
@@ -289,19 +550,26 @@ void CManualSwitch::MqttPubStat()
         return;
     }
 
-    g_mqtt.PubStat( GetChanNo(), GetSwitchState());
+    m_bStatDirty = !m_pMqtt->PubStat( GetChanNo(), GetSwitchState());
+}
+
+bool CManualSwitch::IsStatDirty()
+{
+    return m_bStatDirty;
 }
 
-void CManualSwitch::MqttSendGroupCmd( const char* a_pszMqttCmd, uint16_t a_nArg, const char* a_pszMask )
+void CManualSwitch::MqttSendGroupCmd( const char* a_pszMqttCmd, uint16_t a_nArg, uint64_t a_nMask )
 {
-    String strMask( a_pszMask );
-    String strCmd( a_pszMqttCmd );
-    strCmd += MQTT_CMD_SEPARATOR;
-    GroupMaskClearBits( strMask );
-    strCmd += strMask;
-    strCmd += MQTT_CMD_SEPARATOR;
-    strCmd += a_nArg;
-    g_mqtt.PubGroup( strCmd.c_str());
+    // <cmd>/<mask>/<arg>:
+    char szCmd[ MQTT_CMD_GRP_FWD_SHORT_TAP_LEN + MQTT_CMD_MASK_LEN + 8 ];
+    uint nLen = strlen( a_pszMqttCmd );
+    memcpy( szCmd, a_pszMqttCmd, nLen );
+    szCmd[ nLen++ ] = MQTT_CMD_SEPARATOR[ 0 ];
+    CStringUtils::U64ToMask_16( a_nMask & ~m_nClearMask, szCmd + nLen );
+    nLen += MQTT_CMD_MASK_LEN;
+    szCmd[ nLen++ ] = MQTT_CMD_SEPARATOR[ 0 ];
+    snprintf( szCmd + nLen, sizeof( szCmd ) - nLen, "%u", a_nArg );
+    m_pMqtt->PubGroup( szCmd );
 }
 
 char CManualSwitch::GetChanNo()
@@ -320,21 +588,6 @@ char CManualSwitch::GetChanNo()
     return SW_CHANNEL_NA;
 }
 
-void CManualSwitch::GroupMaskClearBits( String& a_rstrMask )
-{
-    if( !m_pszClearMask )
-    {
-        return;
-    }
-
-    for( int nIdx = 2; nIdx < MQTT_CMD_MASK_LEN; nIdx++ )
-    {
-        byte nVal = CStringUtils::NibbleToU8_16( a_rstrMask[ nIdx ]);
-        byte nMask = CStringUtils::NibbleToU8_16( m_pszClearMask[ nIdx ]);
-        a_rstrMask[ nIdx ] = CStringUtils::U8ToNibble_16( nVal & ( ~nMask ));
-    }
-}
-
 bool CManualSwitch::GroupMaskMatch( byte* payload )
 {
     if( !m_nId )
@@ -349,17 +602,25 @@ bool CManualSwitch::GroupMaskMatch( byte* payload )
     return ( nMask & nCmdMask ) == nMask;
 }
 
-void CManualSwitch::OnGroupMaskCmd( byte* payload, uint len, std::function< void( const char*, uint16_t )> a_fnAction )
+bool CManualSwitch::GroupMaskMatch( uint64_t a_nMask )
+{
+    return ( m_nId ) && (( a_nMask >> ( m_nId - 1 )) & 1 );
+}
+
+bool CManualSwitch::OnGroupMaskCmd( byte* payload, uint len, std::function< void( uint64_t, uint16_t )> a_fnAction )
 {
     if( len > MQTT_CMD_MASK_LEN + 1 )
     {
         if( GroupMaskMatch( payload ))
         {
-            const char* pMask = (const char*)payload;
+            CMetrics::Inc( EMetric::eGrpMatched, m_nChanNo );
+            uint64_t nMask = CStringUtils::MaskToU64_16( payload );
             payload += MQTT_CMD_MASK_LEN + 1;
             len -= MQTT_CMD_MASK_LEN + 1;
             uint16_t nCnt = CStringUtils::AtoU16_10( payload, len );
-            a_fnAction( pMask, nCnt );
+            a_fnAction( nMask, nCnt );
+            return true;
         }
     }
+    return false;
 }
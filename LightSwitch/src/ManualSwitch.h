@@ -9,6 +9,7 @@
 
 #include "TouchBtn.h"
 #include "Mqtt.h"
+#include "TapProg.h"
 #include "dbg.h"
 
 
@@ -20,11 +21,37 @@
 
 
 
+/// Input (touch btn) pins of the switch channels
+#define PIN_IN0     D5  // GPIO 14
+#define PIN_IN1     D6  // GPIO 12
+#define PIN_IN2     D7  // GPIO 13
+
+/// Output (AC switch driver) pins of the switch channels
+#define PIN_OUT0    D1  // GPIO 5
+#define PIN_OUT1    D2  // GPIO 4
+#define PIN_OUT2    D8  // GPIO 15
+
+
+
 /// Switch max id
 #define SW_MAX_ID       64
 
 
 
+/// Default inbound command coalescing window in ms
+#define SW_DEF_COALESCE_MS  "100"
+
+/// Default minimum relay dwell time in ms
+#define SW_DEF_DWELL_MS     "200"
+
+/// Default auto tuning of the tap thresholds: disabled
+#define SW_DEF_TUNE         "0"
+
+/// Default auto tuning min next tap delay in ms
+#define SW_DEF_MIN_NEXT_MS  "120"
+
+
+
 /// Switch channel 0 in the mqtt channel name
 #define SW_CHANNEL_0    '0'
 
@@ -51,8 +78,19 @@
 /// Long single tap event
 #define SW_TAP_EVENT_LONG_SINGLE    2
 
+/// First custom gesture event
+#define SW_TAP_EVENT_GESTURE0       3
+
+/// Number of custom gestures
+#define SW_GESTURES                 4
+
 /// Number of tap events
-#define SW_TAP_EVENTS               3
+#define SW_TAP_EVENTS               ( SW_TAP_EVENT_GESTURE0 + SW_GESTURES )
+
+
+
+/// Default hold gesture repeat period in ms
+#define SW_DEF_HOLD_MS      "500"
 
 
 
@@ -73,7 +111,10 @@
  * 2. ev-sm - short multi tap,
  * 3. ev-ls - long single tap.
  * 
- * Each tap event can be assigned an argument: arg-ss, arg-sm, arg-ls.
+ * 4. ev-g0..ev-g3 - custom gestures: gst0..gst3 tap patterns, see CGestures, e.g. sss - triple tap,
+ *    sl - short then long tap, h - hold, repeated every hold ms while held.
+ * 
+ * Each tap event can be assigned an argument: arg-ss, arg-sm, arg-ls, arg-g0..arg-g3.
  * 
  * The response to each of the tap event can be configured to one of the following tap operations:
  * 1. tgle - toggle the on/off state of the switch driver output. This is the default.
@@ -86,7 +127,14 @@
  * 4. fwte - don't drive the local output, only forward the tap event to configured remote switches
  *           via a corresponding MQTT group cmd: MQTT_CMD_GRP_FWD_SHORT_TAP, MQTT_CMD_GRP_FWD_LONG_TAP.
  *    arg: 64-bit hexadecimal group mask (0x0123456789abcdef).
- * 5. anything else - the tap event is disabled/ignored.
+ *    A custom gesture is forwarded as a long tap if its pattern ends with a long tap or hold, as short taps otherwise.
+ * 5. prog - run a tap program: a chain of on/off/tgl, auto-off timer, group cmd and state conditional
+ *           instructions, see CTapProg.
+ *    arg: program source, e.g.: ifof arm 600 tgl ifof tof 0x0000000000000006
+ * 6. anything else - the tap event is disabled/ignored.
+ * 
+ * All the tap operations are compiled into tap programs when the cfg is read, e.g. aoff 60 -> arm 60 on,
+ * so a tap event runs its program with all the operands parsed already.
  * 
  * Each channel can be assigned a unique id, corresponding to a bit# (LSB first) in the mask sent
  * in a group command. A valid id is in the range of 1-64, while 0 denotes no id being assigned to the channel.
@@ -96,29 +144,112 @@
  * all channel ids and only masked channels are responding to the command. This allows for one tap event
  * to control multiple remote switches.
  * The group command format is described in the Mqtt.h file.
+ * A scene group command sets the on/off state of all the addressed channels at once, see CScenes.
  * 
  * The switch publishes its state upon change via its MQTT pub topic.
  * The states serviced by MQTT pub/sub topics are: on/off.
+ * 
+ * The inbound MQTT commands (channel on/off, group turn off) are coalesced: the first command starts
+ * a window (coalesce), the last command received within the window wins and is executed once the window expires.
+ * The relay is protected by the minimum dwell time (dwell): a state change requested earlier than
+ * the dwell time after the previous change is deferred until the dwell time expires.
+ * The state is published only if it actually changed (or the last publication failed).
+ * 
+ * With tune enabled, the long/next tap thresholds are learned from the presses (see CTouchBtn)
+ * within the configured bounds: min/max long, min/max next. The bounds default to the configured long/next
+ * tap ms, except min next (SW_DEF_MIN_NEXT_MS). The learned values and histograms are reported via
+ * MQTT_CMD_MGT_TAP.
  */
 class CManualSwitch : public CTouchBtn
 {
 public:
+    CManualSwitch() : m_pMqtt( nullptr ) {}
+
+    /**
+     * Set the MQTT client the channel publishes its state and group commands with.
+     * 
+     * @param[in]   a_rMqtt     MQTT client of the device.
+     */
+    void SetMqtt( CMqtt& a_rMqtt ) { m_pMqtt = &a_rMqtt; }
+
     /**
      * Read the configuration file corresponding to given channel
      * 
      * @param[in]   a_nChanNo   channel number
+     * @param[in]   a_pszPath   configuration file to read instead of the channel's one, see CheckCfg()
+     * 
+     * @return  false if the file is missing or an entry is invalid (the tap event is disabled).
      */
-    void ReadCfg( uint8_t a_nChanNo );
+    bool ReadCfg( uint8_t a_nChanNo, const char* a_pszPath = nullptr );
 
     /**
-     * @brief Read the configured tap event
+     * Validate a channel configuration file: a parse-only read into the scratch tap programs and gestures.
+     * 
+     * @param[in]   a_pszPath   configuration file
+     * 
+     * @return  false if the file is missing or an entry is invalid.
+     */
+    static bool CheckCfg( const char* a_pszPath );
+
+    /**
+     * Re-read the configuration file and re-initialize the channel live.
+     * 
+     * The touch btn is re-enabled with the new tap timing and tap programs, the output keeps its state
+     * and the auto-off timer unless the channel gets disabled - the output is turned off then.
+     * A pending state is kept, applied with the new coalescing window and dwell time - dropped if the channel gets disabled.
+     * The other channels are not affected.
+     */
+    void Reconfigure();
+
+    /**
+     * @brief Read the configured channel id.
+     * 
+     * @param a_rFile       Opened cfg file.
+     * 
+     * @return  Channel id: 1..SW_MAX_ID, 0: disabled or invalid.
+     */
+    static uint8_t ReadCfgId( File& a_rFile );
+
+    /**
+     * @brief Read the configured tap events and custom gestures, compile their tap operations and patterns.
+     * 
+     * Stateless - CheckCfg() parses into the scratch targets with it.
+     * 
+     * @param a_rFile       Opened cfg file.
+     * @param a_nId         Channel id - unmasked in the tap operations.
+     * @param a_rProg       Tap programs to compile into - cleared.
+     * @param a_rGestures   Gesture automaton to add the custom gestures to - with the built-in ones.
+     * @param a_arrTapEntry Tap program entries for all tap events (SW_TAP_EVENTS), TAP_PROG_NONE:disabled.
+     * @param a_rnErrors    Incremented per invalid entry.
+     * 
+     * @return  true if any tap event is enabled.
+     */
+    static bool ReadCfgTapEvents( File& a_rFile, uint8_t a_nId, CTapProg& a_rProg, CGestures& a_rGestures, uint8_t* a_arrTapEntry, uint8_t& a_rnErrors );
+
+    /**
+     * @brief Read the configured tap event, compile its tap operation.
      * 
      * @param a_rFile       Opened cfg file.
      * @param a_nTapEvent   Tap event to configure: SW_TAP_EVENT_*
+     * @param a_bFwdLong    Forward the tap event as a long tap (fwte).
+     * @param a_nId         Channel id, see ReadCfgTapEvents() for the targets.
+     * 
+     * @return  true if a valid tap operation is configured for the tap event (i.e. not SW_TAP_OP_DISABLE).
+     */
+    static bool ReadCfgTapEvent( File& a_rFile, uint8_t a_nTapEvent, bool a_bFwdLong, uint8_t a_nId, CTapProg& a_rProg,
+        uint8_t* a_arrTapEntry, uint8_t& a_rnErrors );
+
+    /**
+     * @brief Read the configured custom gesture: the pattern and the tap event, compile the pattern.
+     * 
+     * @param a_rFile       Opened cfg file.
+     * @param a_nGesture    Custom gesture index: 0..SW_GESTURES-1
+     * @param a_nId         Channel id, see ReadCfgTapEvents() for the targets.
      * 
-     * @return  true if a tap operation is configured for the tap event (i.e. not SW_TAP_OP_DISABLE).
+     * @return  true if the pattern is valid and a tap operation is configured for the gesture.
      */
-    bool ReadCfgTapEvent( File& a_rFile, uint8_t a_nTapEvent );
+    static bool ReadCfgGesture( File& a_rFile, uint8_t a_nGesture, uint8_t a_nId, CTapProg& a_rProg, CGestures& a_rGestures,
+        uint8_t* a_arrTapEntry, uint8_t& a_rnErrors );
 
 
 
@@ -159,12 +290,20 @@ public:
      */
     bool GetSwitchState();
 
+    /**
+     * Return the switch state to be set, i.e. the pending state if any, the current state otherwise.
+     * 
+     * @return  true if on, false if off
+     */
+    bool GetTargetState();
+
 
 
     /**
      * Main loop function.
      * 
      * Execute the main loop of the base class.
+     * Apply the pending state once the coalescing window and the relay dwell time expire.
      * Handle the automatic switch turn off triggered by a long button tap.
      */
     void loop();
@@ -172,29 +311,15 @@ public:
 
 
     /**
-     * @brief Execute a tap operation corresponding to the tap event.
-     * 
-     * Map the tap event (i.e. physical single-/multi- short/long tap) to the configured tap operation.
-     * Execute the operation.
-     * 1. SW_TAP_OP_TOGGLE:
-     *  a. Cycle the output on/off.
-     *  b. Disable the auto-off timer.
-     *  c. Publish the switch on/off state via MQTT pub topic.
-     * 
-     * 2. SW_TAP_OP_TOGGLE_MASK_OFF:
-     *  a. Same as SW_TAP_OP_TOGGLE.
-     *  b. Send the MQTT_CMD_GRP_TURN_OFF group command to turn off all masked switches in the group.
-     * 
-     * 3. SW_TAP_OP_AUTO_OFF:
-     *  a. Turn the output on.
-     *  b. Configure the auto-off timer for max( 1 (single tap), TapCnt - 1 (multi tap) ) seconds.
-     *  c. Publish the switch on/off state via MQTT pub topic.
+     * @brief Execute the tap program corresponding to the tap event.
      * 
-     * 4. SW_TAP_OP_FORWARD:
-     *  a. Forward the tap event through the MQTT_CMD_GRP_FWD_SHORT_TAP/MQTT_CMD_GRP_FWD_LONG_TAP group command.
-     * 
-     * 5. SW_TAP_OP_DISABLE:
-     *  a. no-op.
+     * Map the tap event (i.e. physical single-/multi- short/long tap, custom gesture) to the compiled
+     * tap program and run it, see ETapOp:
+     * 1. on/off/tgl - set the output state (SetState): publish it via MQTT pub topic, on - with the armed auto-off timer.
+     * 2. arm - set the auto-off timer for the following on: max( 1 (single tap), TapCnt - 1 (multi tap) ) steps.
+     * 3. tof/fst/flt - send the group command to the masked switches in the group.
+     * 4. ifon/ifof - skip the next instruction unless the output was on/off before the program.
+     * A disabled tap event is a no-op.
      * 
      * @param a_nTapEvent   The tap event: SW_TAP_EVENT_*.
      * @param a_nTapCnt     Number of subsequent taps.
@@ -213,6 +338,14 @@ public:
      */
     virtual void OnLongTap();
 
+    /**
+     * Receive and execute the custom gesture event.
+     * 
+     * @param[in]   a_nEvent    Gesture event: TOUCH_GESTURE_CUSTOM + custom gesture index.
+     * @param[in]   a_nCnt      Number of the taps of the gesture, the repeat number of a hold gesture.
+     */
+    virtual void OnGesture( uint8_t a_nEvent, uint16_t a_nCnt );
+
 
 
     /**
@@ -220,13 +353,26 @@ public:
      * 
      * In the enabled mode:
      * 1. Set the output on/off state and configure the auto-off timer.
-     * 2. Publish the switch on/off state via MQTT pub topic.
+     *    The change is deferred if the relay dwell time has not expired yet.
+     * 2. Publish the switch on/off state via MQTT pub topic if changed.
+     * 
+     * A pending (coalesced or deferred) state is overridden.
      * 
      * @param[in]   a_bStateOn  The on/off state to set: true:on, false:off.
      * @param[in]   a_nAutoOff  The auto-off timer in msec (0:disable).
      */
     void SetState( bool a_bStateOn, ulong a_nAutoOff );
 
+    /**
+     * @brief Queue the switch state requested by an inbound MQTT command.
+     * 
+     * The state is set by loop() once the coalescing window expires - the last queued state wins.
+     * 
+     * @param[in]   a_bStateOn  The on/off state to set: true:on, false:off.
+     * @param[in]   a_nAutoOff  The auto-off timer in msec (0:disable).
+     */
+    void QueueState( bool a_bStateOn, ulong a_nAutoOff );
+
     /**
      * Handle the received MQTT group command.
      * 
@@ -237,22 +383,48 @@ public:
      * 
      * @param[in]   payload     MQTT message paylaod
      * @param[in]   len         Length of the payload
+     * 
+     * @return  true if the channel id is masked - the cmd is accepted.
+     */
+    bool OnGroupCmd( byte* payload, uint len );
+
+    /**
+     * Apply the scene if the channel id is addressed.
+     * 
+     * Set the state immediately - no coalescing, so all the addressed channels switch together.
+     * The channel turned on gets the auto-off timer of the scene.
+     * 
+     * @param[in]   a_rScene    Scene: MQTT_CMD_GRP_SCENE, MQTT_CMD_GRP_SCENE_RECALL
+     * 
+     * @return  true if the channel id is addressed - the scene is applied.
      */
-    void OnGroupCmd( byte* payload, uint len );
+    bool ApplyScene( const SScene& a_rScene );
 
     /**
      * Publish the switch on/off state via MQTT pub topic.
+     * 
+     * Mark the state dirty if the publication failed.
      */
     void MqttPubStat();
 
+    /**
+     * Check whether the retained on/off state on the broker may be stale,
+     * i.e. the state was not published since boot or the last publication failed.
+     * 
+     * @return  true if the state has to be republished.
+     */
+    bool IsStatDirty();
+
     /**
      * Send an MQTT group command with the current mask and arg (tap cnt).
      * 
+     * The bits of m_nClearMask are cleared in the mask.
+     * 
      * @param[in]   a_pszMqttCmd    Base command to be sent
      * @param[in]   a_nArg          Numeric argument to be added at the end of a command (tap cnt)
-     * @param[in]   a_pszMask       Configured tap event mask
+     * @param[in]   a_nMask         Configured tap event mask
      */
-    void MqttSendGroupCmd( const char* a_pszMqttCmd, uint16_t a_nArg, const char* a_pszMask );
+    void MqttSendGroupCmd( const char* a_pszMqttCmd, uint16_t a_nArg, uint64_t a_nMask );
 
 
 
@@ -267,45 +439,75 @@ public:
 
 protected:
     /**
-     * Clear bits in the group mask.
+     * Check the mask match against the channel id.
      * 
-     * Note the clearing mask is m_pszClearMask.
+     * @param[in]   payload     Group mask received in a group cmd.
      * 
-     * @param[in]   a_rstrMask  The mask to be cleared - in a mask format
+     * @return  true if the channel id is masked.
      */
-    void GroupMaskClearBits( String& a_rstrMask );
+    bool GroupMaskMatch( byte* payload );
 
     /**
      * Check the mask match against the channel id.
      * 
-     * @param[in]   payload     Group mask received in a group cmd.
+     * @param[in]   a_nMask     Group mask value.
      * 
      * @return  true if the channel id is masked.
      */
-    bool GroupMaskMatch( byte* payload );
+    bool GroupMaskMatch( uint64_t a_nMask );
 
     /**
      * Helper function to execute the group command.
      * 
      * 1. Test the group mask.
      * 2. Extract the command argument (tap cnt).
-     * 3. Execute the action callback if channel id was masked.
+     * 3. Execute the action callback with the group mask value if channel id was masked.
+     * 
+     * @return  true if the channel id was masked.
      */
-    void OnGroupMaskCmd( byte* payload, uint len, std::function< void( const char*, uint16_t )> a_fnAction );
+    bool OnGroupMaskCmd( byte* payload, uint len, std::function< void( uint64_t, uint16_t )> a_fnAction );
 
+    /**
+     * Set the output on/off state and the auto-off timer, publish the state if changed.
+     * 
+     * @param[in]   a_bStateOn  The on/off state to set: true:on, false:off.
+     * @param[in]   a_nAutoOff  The auto-off timer in msec (0:disable).
+     */
+    void ApplyState( bool a_bStateOn, ulong a_nAutoOff );
+
+    /**
+     * Check whether the relay dwell time since the last output change expired.
+     * 
+     * @return  true if the output may change.
+     */
+    bool IsDwellExpired();
 
 
+
+    CMqtt* m_pMqtt;             ///< MQTT client of the device
     uint8_t m_nChanNo;          ///< Configured channel number
     uint8_t m_nPinSwitchVal;    ///< Current state of the AC switch driver pin
+    bool m_bStatDirty;          ///< The published on/off state may be stale
     CTimer m_tmAutoOff;         ///< Auto-off timer
     ulong m_nAutoOff;           ///< Threshold value for auto-off timer, 0:disabled
+    CTimer m_tmDrive;           ///< Last output change timer - relay dwell time
+
+    bool m_bPending;            ///< A state change is pending
+    bool m_bPendingOn;          ///< Pending on/off state
+    ulong m_nPendingAutoOff;    ///< Pending auto-off timer
+    ulong m_nPendingDelay;      ///< Pending state delay: the coalescing window or 0 (deferred by the dwell time)
+    CTimer m_tmPending;         ///< Pending state timer
+
+    uint16_t m_nCoalesceMs;     ///< Configured inbound command coalescing window (ms), 0:disabled
+    uint16_t m_nDwellMs;        ///< Configured minimum relay dwell time (ms), 0:disabled
 
-    uint16_t m_arrTapOps[ SW_TAP_EVENTS ];  ///< Configured tap operations for all tap events
-    String m_arrTapArgs[ SW_TAP_EVENTS ];   ///< Configured tap op args for all tap events
+    CTapProg m_prog;                        ///< Compiled tap programs of all tap events
+    uint8_t m_arrTapEntry[ SW_TAP_EVENTS ]; ///< Tap program entries for all tap events, TAP_PROG_NONE:disabled
 
     uint8_t m_nId;              ///< Configured switch channel id (1-64:valid, 0:disabled)
+    uint8_t m_nCfgErrors;       ///< Number of the invalid entries of the configuration read
 
-    const char* m_pszClearMask; ///< Bit mask to be cleared in context of MqttSendGroupCmd()
+    uint64_t m_nClearMask;      ///< Bit mask to be cleared in context of MqttSendGroupCmd()
 
     static uint8_t Sm_arrPinIn[ SW_CHANNELS ];  ///< Input (touch btn) pin configuration for switch channels
     static uint8_t Sm_arrPinOut[ SW_CHANNELS ]; ///< Output (AC switch driver) pin configuration for switch channels
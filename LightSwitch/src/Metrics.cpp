@@ -0,0 +1,185 @@
+/**
+ * DIY Smart Home - light switch
+ * Metrics
+ * 2022 Łukasz Łasek
+ */
+#include "Metrics.h"
+#include "ManualSwitch.h"
+#include "dbg.h"
+
+static_assert( METRICS_CHANNELS == SW_CHANNELS, "Review the per channel metrics" );
+
+/**
+ * Metric definition.
+ */
+struct SMetricDef
+{
+    const char* pszName;    ///< Name
+    const char* pszHelp;    ///< Help
+    bool bCounter;          ///< True if a counter, false: a gauge
+    bool bPerChan;          ///< True if a per channel metric
+    bool bSigned;           ///< True if the value is signed
+};
+
+/// Metric definitions by EMetric
+static const SMetricDef Sg_arrMetrics[] =
+{
+    { "sw_taps_total", "Taps handled per channel, local and group forwarded.", true, true, false },
+    { "sw_relay_toggles_total", "Relay transitions per channel.", true, true, false },
+    { "sw_mqtt_pubs_total", "MQTT messages published.", true, false, false },
+    { "sw_mqtt_pub_fails_total", "MQTT publications failed.", true, false, false },
+    { "sw_mqtt_reconnects_total", "MQTT connection losses.", true, false, false },
+    { "sw_grp_cmds_total", "Group cmds received.", true, false, false },
+    { "sw_grp_matched_total", "Group cmds and scenes matched per channel.", true, true, false },
+    { "sw_loop_gap_max_ms", "Longest loop iteration since boot.", false, false, false },
+    { "sw_heap_free_bytes", "Free heap.", false, false, false },
+    { "sw_heap_max_block_bytes", "Largest free heap block.", false, false, false },
+    { "sw_heap_fragmentation_percent", "Heap fragmentation.", false, false, false },
+    { "sw_heap_free_min_bytes", "Lowest free heap since boot.", false, false, false },
+    { "sw_wifi_rssi_dbm", "WIFI RSSI.", false, false, true },
+    { "sw_boot_ready_ms", "Power on to ready: the initial state published.", false, false, false }
+};
+
+static_assert( sizeof( Sg_arrMetrics ) / sizeof( Sg_arrMetrics[ 0 ]) == (uint8_t)EMetric::eCnt, "Review the metric definitions" );
+
+uint32_t CMetrics::Sm_arrVals[ (uint8_t)EMetric::eCnt ][ METRICS_CHANNELS ] = {};
+
+void CMetrics::Sample()
+{
+    SampleHeap();
+    Set( EMetric::eWiFiRssi, WiFi.RSSI());
+}
+
+void CMetrics::SampleHeap()
+{
+    uint32_t nFree = ESP.getFreeHeap();
+    Set( EMetric::eHeapFree, nFree );
+    Set( EMetric::eHeapMaxBlock, ESP.getMaxFreeBlockSize());
+    Set( EMetric::eHeapFrag, ESP.getHeapFragmentation());
+    Min( EMetric::eHeapFreeMin, nFree );
+}
+
+uint CMetrics::Render( EMetric a_metric, char* a_pszBuf, uint a_nLen )
+{
+    const SMetricDef& rDef = Sg_arrMetrics[ (uint8_t)a_metric ];
+    int nLen = snprintf( a_pszBuf, a_nLen, "# HELP %s %s\n# TYPE %s %s\n",
+        rDef.pszName, rDef.pszHelp, rDef.pszName, ( rDef.bCounter ) ? "counter" : "gauge" );
+    for( uint8_t nChan = 0; ( nChan < (( rDef.bPerChan ) ? METRICS_CHANNELS : 1 )) && ( nLen < (int)a_nLen ); nChan++ )
+    {
+        uint32_t nVal = Get( a_metric, nChan );
+        if( rDef.bPerChan )
+            nLen += snprintf( a_pszBuf + nLen, a_nLen - nLen, "%s{ch=\"%u\"} %u\n", rDef.pszName, nChan, nVal );
+        else if( rDef.bSigned )
+            nLen += snprintf( a_pszBuf + nLen, a_nLen - nLen, "%s %d\n", rDef.pszName, (int32_t)nVal );
+        else
+            nLen += snprintf( a_pszBuf + nLen, a_nLen - nLen, "%s %u\n", rDef.pszName, nVal );
+    }
+    return min((uint)nLen, a_nLen - 1 );
+}
+
+
+
+void CMetricsHttp::Begin( uint16_t a_nPort )
+{
+    Close();
+    m_server.stop();
+    if( a_nPort )
+    {
+        m_server.begin( a_nPort );
+        DBGLOG1( "metrics http port %u\n", a_nPort );
+    }
+}
+
+void CMetricsHttp::loop()
+{
+    switch( m_state )
+    {
+        case EState::eIdle:
+            if( m_server.status())
+            {
+                m_client = m_server.accept();
+                if( m_client )
+                {
+                    m_state = EState::eRequest;
+                    m_nReqLen = 0;
+                    m_bReqLine = false;
+                    m_nHdrEnd = 0;
+                    m_nStartMs = millis();
+                }
+            }
+            return;
+
+        case EState::eRequest:
+            if( ReadRequest())
+            {
+                m_szReq[ m_nReqLen ] = 0;
+                const char* pszAfter = m_szReq + sizeof( "GET " METRICS_PATH ) - 1;
+                bool bMetrics = ( !strncmp( m_szReq, "GET " METRICS_PATH, sizeof( "GET " METRICS_PATH ) - 1 ))
+                    && (( *pszAfter == ' ' ) || ( *pszAfter == '?' ) || ( !*pszAfter ));
+                m_state = ( bMetrics ) ? EState::eMetrics : EState::eNotFound;
+                m_nPos = 0;
+                if( bMetrics )
+                    CMetrics::Sample();
+            }
+            break;
+
+        default:
+            if( WriteResponse())
+            {
+                Close();
+                return;
+            }
+            break;
+    }
+
+    if(( !m_client.connected()) || ( millis() - m_nStartMs > METRICS_TIMEOUT_MS ))
+        Close();
+}
+
+bool CMetricsHttp::ReadRequest()
+{
+    uint8_t arrBuf[ METRICS_READ_LEN ];
+    int nAvail = m_client.available();
+    if( nAvail <= 0 )
+        return false;
+    int nLen = m_client.read( arrBuf, min( nAvail, (int)sizeof( arrBuf )));
+    for( int nIdx = 0; nIdx < nLen; nIdx++ )
+    {
+        char c = arrBuf[ nIdx ];
+        if(( c == '\r' ) || ( c == '\n' ))
+            m_bReqLine = true;
+        else if(( !m_bReqLine ) && ( m_nReqLen < METRICS_REQ_LEN - 1 ))
+            m_szReq[ m_nReqLen++ ] = c;
+
+        // CR LF CR LF:
+        m_nHdrEnd = ( c == (( m_nHdrEnd & 1 ) ? '\n' : '\r' )) ? m_nHdrEnd + 1 : ( c == '\r' ) ? 1 : 0;
+        if( m_nHdrEnd == 4 )
+            return true;
+    }
+    return false;
+}
+
+bool CMetricsHttp::WriteResponse()
+{
+    char szChunk[ METRICS_CHUNK_LEN ];
+    uint nLen;
+    if( m_state == EState::eNotFound )
+        nLen = snprintf( szChunk, sizeof( szChunk ), "HTTP/1.0 404 Not Found\r\nContent-Type: text/plain\r\nConnection: close\r\n\r\nnot found\n" );
+    else if( !m_nPos )
+        nLen = snprintf( szChunk, sizeof( szChunk ), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n" );
+    else
+        nLen = CMetrics::Render((EMetric)( m_nPos - 1 ), szChunk, sizeof( szChunk ));
+
+    if( m_client.availableForWrite() < (int)nLen )
+        return false;
+    m_client.write((const uint8_t*)szChunk, nLen );
+    m_nPos++;
+    return ( m_state == EState::eNotFound ) || ( m_nPos > (uint8_t)EMetric::eCnt );
+}
+
+void CMetricsHttp::Close()
+{
+    if( m_state != EState::eIdle )
+        m_client.stop();
+    m_state = EState::eIdle;
+}
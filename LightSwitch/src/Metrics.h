@@ -0,0 +1,204 @@
+/**
+ * DIY Smart Home - light switch
+ * Metrics
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+
+
+/// Number of the channels of the per channel metrics
+#define METRICS_CHANNELS        3
+
+/// Metrics path, the other paths get 404
+#define METRICS_PATH            "/metrics"
+
+/// Request line kept to match the path
+#define METRICS_REQ_LEN         32
+
+/// Max request bytes read per loop iteration
+#define METRICS_READ_LEN        128
+
+/// Request or response timeout (ms) - the connection is closed
+#define METRICS_TIMEOUT_MS      2000
+
+/// Max length of a response chunk: the HELP, TYPE and value lines of a metric
+#define METRICS_CHUNK_LEN       256
+
+
+
+/**
+ * Metric.
+ */
+enum class EMetric : uint8_t
+{
+    eTaps,          ///< Taps handled, local and group forwarded, per channel
+    eRelayToggles,  ///< Relay transitions, per channel
+    eMqttPubs,      ///< MQTT messages published
+    eMqttPubFails,  ///< MQTT publications failed
+    eMqttReconnects,    ///< MQTT connection losses
+    eGrpCmds,       ///< Group cmds received
+    eGrpMatched,    ///< Group cmds and scenes matched, per channel
+    eLoopGapMax,    ///< Longest loop iteration (ms)
+    eHeapFree,      ///< Free heap - sampled on scrape
+    eHeapMaxBlock,  ///< Largest free heap block - sampled on scrape
+    eHeapFrag,      ///< Heap fragmentation (%) - sampled on scrape
+    eHeapFreeMin,   ///< Lowest free heap since boot - sampled by CFlightRec
+    eWiFiRssi,      ///< WIFI RSSI - sampled on scrape
+    eBootMs,        ///< Power on to ready (ms), see CBootProf
+    eCnt
+};
+
+
+
+/**
+ * Metrics registry class.
+ * 
+ * Static registry of the counters and gauges: a value per metric, or per channel for the per channel metrics.
+ * The updates are single stores, cheap enough for the tap path. The metric names, help and types are in
+ * a static table, see Render().
+ */
+class CMetrics
+{
+public:
+    /**
+     * Increment a counter.
+     * 
+     * @param[in]   a_metric    Metric
+     * @param[in]   a_nChan     Channel of the per channel metrics
+     */
+    static void Inc( EMetric a_metric, uint8_t a_nChan = 0 )
+    {
+        Sm_arrVals[ (uint8_t)a_metric ][ a_nChan % METRICS_CHANNELS ]++;
+    }
+
+    /**
+     * Set a gauge.
+     */
+    static void Set( EMetric a_metric, int32_t a_nVal )
+    {
+        Sm_arrVals[ (uint8_t)a_metric ][ 0 ] = a_nVal;
+    }
+
+    /**
+     * Raise a max gauge.
+     */
+    static void Max( EMetric a_metric, uint32_t a_nVal )
+    {
+        if( a_nVal > Sm_arrVals[ (uint8_t)a_metric ][ 0 ])
+            Sm_arrVals[ (uint8_t)a_metric ][ 0 ] = a_nVal;
+    }
+
+    /**
+     * Lower a min gauge - 0 is not set yet.
+     */
+    static void Min( EMetric a_metric, uint32_t a_nVal )
+    {
+        uint32_t& rnVal = Sm_arrVals[ (uint8_t)a_metric ][ 0 ];
+        if(( !rnVal ) || ( a_nVal < rnVal ))
+            rnVal = a_nVal;
+    }
+
+    /**
+     * Get a value.
+     */
+    static uint32_t Get( EMetric a_metric, uint8_t a_nChan = 0 )
+    {
+        return Sm_arrVals[ (uint8_t)a_metric ][ a_nChan % METRICS_CHANNELS ];
+    }
+
+    /**
+     * Sample the gauges read on scrape: the heap and the WIFI RSSI.
+     */
+    static void Sample();
+
+    /**
+     * Sample the heap gauges: the free heap, the largest free block and the fragmentation.
+     */
+    static void SampleHeap();
+
+    /**
+     * Render a metric in the Prometheus text format: the HELP and TYPE lines and the value line(s).
+     * 
+     * @param[in]   a_metric    Metric
+     * @param[out]  a_pszBuf    Output buffer
+     * @param[in]   a_nLen      Output buffer length
+     * 
+     * @return  Length of the text.
+     */
+    static uint Render( EMetric a_metric, char* a_pszBuf, uint a_nLen );
+
+private:
+    static uint32_t Sm_arrVals[ (uint8_t)EMetric::eCnt ][ METRICS_CHANNELS ];  ///< Values
+};
+
+
+
+/**
+ * Metrics HTTP server class.
+ * 
+ * Serves the CMetrics registry as GET METRICS_PATH in the Prometheus text format, one client at a time.
+ * Never blocks the loop: the request is read up to METRICS_READ_LEN bytes per loop iteration and the response
+ * is written one metric per iteration, only if the client has room for it. The response has no length,
+ * the connection is closed when done. A stalled client is dropped after METRICS_TIMEOUT_MS.
+ */
+class CMetricsHttp
+{
+public:
+    CMetricsHttp() : m_server( 0 ), m_state( EState::eIdle ), m_nReqLen( 0 ), m_bReqLine( false ), m_nHdrEnd( 0 ), m_nPos( 0 ), m_nStartMs( 0 ) {}
+
+    /**
+     * Start listening.
+     * 
+     * @param[in]   a_nPort     TCP port, 0: disabled
+     */
+    void Begin( uint16_t a_nPort );
+
+    /**
+     * Main loop function: accept a client, read the request, write a response chunk.
+     */
+    void loop();
+
+protected:
+    /**
+     * Connection state.
+     */
+    enum class EState : uint8_t
+    {
+        eIdle,      ///< Waiting for a client
+        eRequest,   ///< Reading the request
+        eMetrics,   ///< Writing the metrics
+        eNotFound   ///< Writing the 404 response
+    };
+
+    /**
+     * Read the request: keep the request line, find the end of the headers.
+     * 
+     * @return  true if the request is complete.
+     */
+    bool ReadRequest();
+
+    /**
+     * Write the next response chunk.
+     * 
+     * @return  true if the response is complete.
+     */
+    bool WriteResponse();
+
+    /**
+     * Close the connection.
+     */
+    void Close();
+
+    WiFiServer m_server;    ///< Listening server
+    WiFiClient m_client;    ///< Current client
+    EState m_state;         ///< Connection state
+    char m_szReq[ METRICS_REQ_LEN ];    ///< Request line, truncated
+    uint8_t m_nReqLen;      ///< Request line length
+    bool m_bReqLine;        ///< True if the request line is complete
+    uint8_t m_nHdrEnd;      ///< Matched chars of the headers end: CR LF CR LF
+    uint8_t m_nPos;         ///< Response chunk: 0: the status line, 1..: the metrics
+    ulong m_nStartMs;       ///< Connection accepted (ms)
+};
@@ -9,34 +9,89 @@
 #include "CfgUtils.h"
 #include "StringUtils.h"
 #include "FwRev.h"
+#include "RtcLayout.h"
+#include "InputTrace.h"
+#include "Crc32.h"
+#include "FlightRec.h"
+#include "Log.h"
+#include "Metrics.h"
+#include "BootProf.h"
 
-extern CWiFiHelper g_wifi;
+static_assert( MQTT_CHANNELS == SW_CHANNELS, "Review the channel topics" );
 
-extern CManualSwitch g_swChan0;
-extern CManualSwitch g_swChan1;
-extern CManualSwitch g_swChan2;
+void CMqtt::Attach( CWiFiHelper& a_rWiFi, CInputTrace& a_rTrace, CManualSwitch& a_rSwChan0, CManualSwitch& a_rSwChan1, CManualSwitch& a_rSwChan2 )
+{
+    m_pWiFi = &a_rWiFi;
+    m_pTrace = &a_rTrace;
+    m_arrSwChans[ 0 ] = &a_rSwChan0;
+    m_arrSwChans[ 1 ] = &a_rSwChan1;
+    m_arrSwChans[ 2 ] = &a_rSwChan2;
+    for( uint8_t nIdx = 0; nIdx < MQTT_CHANNELS; nIdx++ )
+    {
+        m_arrSwChans[ nIdx ]->SetMqtt( *this );
+        m_arrSwChans[ nIdx ]->SetTrace( m_pTrace, nIdx );
+    }
+    m_cfg.SetCheck(
+        [ this ]( ECfgFile a_file, const char* a_pszPath )
+        {
+            return this->CheckCfg( a_file, a_pszPath );
+        });
+}
 
 void CMqtt::ReadCfg()
 {
+    m_scenes.ReadCfg();
+
     File file = LittleFS.open( FS_MQTT_CFG, "r" );
     if( file )
     {
-        m_strServer = CConfigUtils::ReadValue( file, "srv" );
+        m_arena.Reset();
+        m_pszServer = m_arena.Add( CConfigUtils::ReadValue( file, "srv" ));
         m_nPort = CConfigUtils::ReadValue( file, "port" ).toInt();
         m_nConnTimeout = CConfigUtils::ReadValue( file, "conn" ).toInt();
         m_nInitStatDelayMs = CConfigUtils::ReadValue( file, "init" ).toInt();
-        m_strClientId = CConfigUtils::ReadValue( file, "cli" );
-        m_strSubTopicCmd = CConfigUtils::ReadValue( file, "sub" );
-        m_strPubTopicStat = CConfigUtils::ReadValue( file, "pub" );
-        m_strPubSubTopicGrp = CConfigUtils::ReadValue( file, "grp" );
-        m_strPubTopicMgt = m_strSubTopicMgt = CConfigUtils::ReadValue( file, "mgt" );
-        m_strPubTopicMgt += "/stat";
-        m_strSubTopicMgt += "/cmd";
-
-        DBGLOG4( "mqtt cfg: server:'%s' port:%u timeo:%u client-id:'%s' ",
-            m_strServer.c_str(), m_nPort, m_nConnTimeout, m_strClientId.c_str());
-        DBGLOG5( "init-delay:%lu cmd-sub:'%s' stat-pub:'%s' grp:'%s' mgt:'%s|stat'\n",
-            m_nInitStatDelayMs, m_strSubTopicCmd.c_str(), m_strPubTopicStat.c_str(), m_strPubSubTopicGrp.c_str(), m_strSubTopicMgt.c_str());
+        m_nPubQos = ( CConfigUtils::ReadValue( file, "qos", "1" ).toInt()) ? MQTT_QOS_AT_LEAST_ONCE : MQTT_QOS_AT_MOST_ONCE;
+        m_nProtoLevel = ( CConfigUtils::ReadValue( file, "ver", "4" ).toInt() == MQTT_CLIENT_V5 ) ? MQTT_CLIENT_V5 : MQTT_CLIENT_V311;
+        m_bBatchStat = CConfigUtils::ReadValue( file, "bat", "0" ).toInt();
+        m_nDirJitterMs = CConfigUtils::ReadValue( file, "dir", MQTT_DIR_JITTER_MS ).toInt();
+        m_bInv = CConfigUtils::ReadValue( file, "inv", "0" ).toInt();
+        m_bTls = CConfigUtils::ReadValue( file, "tls", "0" ).toInt();
+        m_nHeapPeriodMs = CConfigUtils::ReadValue( file, "hpp", MQTT_HEAP_PERIOD_S ).toInt() * 1000;
+        m_grpTrace.GetClock().Setup( CConfigUtils::ReadValue( file, "lat", MQTT_LAT_PERIOD_S ).toInt() * 1000 );
+        m_pszClientId = m_arena.Add( CConfigUtils::ReadValue( file, "cli" ));
+        m_pszSubTopicCmd = m_arena.Add( CConfigUtils::ReadValue( file, "sub" ));
+        m_pszPubTopicStat = m_arena.Add( CConfigUtils::ReadValue( file, "pub" ));
+        m_pszPubSubTopicGrp = m_arena.Add( CConfigUtils::ReadValue( file, "grp" ));
+        m_pszSubTopicMgt = m_arena.Add( CConfigUtils::ReadValue( file, "mgt" ));
+        m_pszPubTopicMgt = m_arena.Add( m_pszSubTopicMgt, "/stat" );
+        m_pszSubTopicMgt = m_arena.Add( m_pszSubTopicMgt, "/cmd" );
+        m_arrPubTopicChan[ 0 ] = AddChannelTopic( SW_CHANNEL_0, m_pszPubTopicStat );
+        m_arrPubTopicChan[ 1 ] = AddChannelTopic( SW_CHANNEL_1, m_pszPubTopicStat );
+        m_arrPubTopicChan[ 2 ] = AddChannelTopic( SW_CHANNEL_2, m_pszPubTopicStat );
+        m_arrSubTopicChan[ 0 ] = AddChannelTopic( SW_CHANNEL_0, m_pszSubTopicCmd );
+        m_arrSubTopicChan[ 1 ] = AddChannelTopic( SW_CHANNEL_1, m_pszSubTopicCmd );
+        m_arrSubTopicChan[ 2 ] = AddChannelTopic( SW_CHANNEL_2, m_pszSubTopicCmd );
+        m_pszPubTopicBatch = m_arena.Add( m_pszPubTopicStat, MQTT_TOPIC_BATCH );
+
+        DBGLOG6( "mqtt cfg: server:'%s' port:%u timeo:%u client-id:'%s' ver:%u batch:%u ",
+            m_pszServer, m_nPort, m_nConnTimeout, m_pszClientId, m_nProtoLevel, m_bBatchStat );
+        DBGLOG6( "init-delay:%lu qos:%u cmd-sub:'%s' stat-pub:'%s' grp:'%s' mgt:'%s|stat'\n",
+            m_nInitStatDelayMs, m_nPubQos, m_pszSubTopicCmd, m_pszPubTopicStat, m_pszPubSubTopicGrp, m_pszSubTopicMgt );
+        DBGLOG4( "mqtt dir jitter:%u inv:%u heap period:%lu arena:%u\n", m_nDirJitterMs, m_bInv, m_nHeapPeriodMs, m_arena.GetUsed());
+        m_log.Setup( m_mqtt, m_pWiFi->GetHostName(), m_arena.Add( CConfigUtils::ReadValue( file, "log" )), CConfigUtils::ReadValue( file, "slg" ),
+            CConfigUtils::ReadValue( file, "slp" ).toInt(), (ELogLvl)min( CConfigUtils::ReadValue( file, "lvl", LOG_LEVEL_DEFAULT ).toInt(), (long)LOG_LEVEL ));
+
+        if( m_arena.IsOverflow())
+        {
+            DBGLOG( "mqtt cfg too long - disable" );
+            LOGE( "mqtt cfg too long" );
+            m_pszServer = "";
+        }
+        if(( m_bTls ) && ( !ReadCfgTls( file )))
+        {
+            DBGLOG( "mqtt tls pinned key missing - disable" );
+            m_pszServer = "";
+        }
     }
     else
     {
@@ -44,43 +99,102 @@ void CMqtt::ReadCfg()
     }
 }
 
+bool CMqtt::ReadCfgTls( File& a_rFile )
+{
+    uint16_t nRxBufLen = CConfigUtils::ReadValue( a_rFile, "rxb" ).toInt();
+    uint16_t nTxBufLen = CConfigUtils::ReadValue( a_rFile, "txb" ).toInt();
+    m_wcs.setBufferSizes(( nRxBufLen ) ? nRxBufLen : TLS_CLIENT_RX_BUF_LEN, ( nTxBufLen ) ? nTxBufLen : TLS_CLIENT_TX_BUF_LEN );
+    DBGLOG2( "mqtt tls cfg: rx-buf:%u tx-buf:%u\n", nRxBufLen, nTxBufLen );
+
+    String strFp = CConfigUtils::ReadValue( a_rFile, "fp" );
+    if( !strFp.isEmpty())
+    {
+        return m_wcs.setFingerprint( strFp.c_str());
+    }
+
+    String strKeyPath = CConfigUtils::ReadValue( a_rFile, "key" );
+    if( strKeyPath.isEmpty())
+    {
+        return false;
+    }
+    File fileKey = LittleFS.open( strKeyPath, "r" );
+    if(( !fileKey ) || ( !m_tlsKey.parse( fileKey.readString().c_str())))
+    {
+        return false;
+    }
+    m_wcs.setKnownKey( &m_tlsKey );
+    return true;
+}
+
 void CMqtt::Enable()
 {
     if(( m_bEnabled )
-        || ( m_strServer.isEmpty())
-        || ( m_strClientId.isEmpty()))
+        || ( !*m_pszServer )
+        || ( !*m_pszClientId ))
         return;
 
     m_bEnabled = true;
     m_bInitStatSent = false;
+    m_bBatchDirty = false;
+    m_nBatchSent = 0;
     m_wc.setTimeout( m_nConnTimeout );
-    m_mqtt.setServer( m_strServer.c_str(), m_nPort );
-    m_mqtt.setCallback(
+    if( m_bTls )
+    {
+        m_wcs.setTimeout( m_nConnTimeout );
+        m_wcs.SetRtcCache( RTC_TLS_SESSION_OFFS );
+        m_mqtt.SetClient( m_wcs );
+    }
+    else
+    {
+        m_mqtt.SetClient( m_wc );
+    }
+    m_mqtt.SetServer( m_pszServer, m_nPort );
+    m_mqtt.SetProtocol( m_nProtoLevel );
+    m_mqtt.ClearTopicAliases();
+    m_mqtt.AddTopicAlias( m_pszPubTopicStat );
+    m_mqtt.AddTopicAlias( m_arrPubTopicChan[ 0 ]);
+    m_mqtt.AddTopicAlias( m_arrPubTopicChan[ 1 ]);
+    m_mqtt.AddTopicAlias( m_arrPubTopicChan[ 2 ]);
+    m_mqtt.AddTopicAlias( m_pszPubSubTopicGrp );
+    m_mqtt.AddTopicAlias( m_pszPubTopicMgt );
+    m_mqtt.AddTopicAlias( m_pszPubTopicBatch );
+    m_mqtt.SetCallback(
         [ this ]( char* topic, byte* payload, uint len )
         {
             this->MqttCb( topic, payload, len );
         });
+    m_mqtt.SetConnCallback(
+        [ this ]()
+        {
+            this->OnConnect();
+        });
 }
 
 void CMqtt::Disable()
 {
     m_bEnabled = false;
-    m_mqtt.disconnect();
+    m_mqtt.Disconnect();
 }
 
 bool CMqtt::PubStat( char a_nChannel, bool a_bStateOn )
 {
-    return PubStat( a_nChannel, ( a_bStateOn ) ? MQTT_CMD_CH_ON : MQTT_CMD_CH_OFF );
+    bool bRet = PubStat( a_nChannel, ( a_bStateOn ) ? MQTT_CMD_CH_ON : MQTT_CMD_CH_OFF );
+    // Keep the retained batch current once the initial state is sent - a failure is retried, see PubDirtyStat():
+    if(( bRet ) && ( m_bBatchStat ) && ( m_bInitStatSent ))
+        PubBatchStat( false );
+    return bRet;
 }
 
 bool CMqtt::PubMgt( const char* a_pszMsg )
 {
-    return m_mqtt.publish( m_strPubTopicMgt.c_str(), a_pszMsg );
+    bool bRet = m_mqtt.Publish( m_pszPubTopicMgt, a_pszMsg );
+    CMetrics::Inc(( bRet ) ? EMetric::eMqttPubs : EMetric::eMqttPubFails );
+    return bRet;
 }
 
 bool CMqtt::PubGroup( const char* a_pszMsg )
 {
-    return m_mqtt.publish( m_strPubSubTopicGrp.c_str(), a_pszMsg );
+    return Publish( m_pszPubSubTopicGrp, m_grpTrace.Tag( a_pszMsg, m_pWiFi->GetHostName()), false );
 }
 
 void CMqtt::PubInitState()
@@ -103,155 +217,739 @@ void CMqtt::PubInitState()
         return;
 
     PubStat( MQTT_STAT_ONLINE );
-    g_swChan0.MqttPubStat();
-    g_swChan1.MqttPubStat();
-    g_swChan2.MqttPubStat();
+    // The retained batch replaces the channel states - the channel state is republished without the batch only,
+    // or if its last publication failed, see PubDirtyStat():
+    if(( !m_bBatchStat ) || ( !PubBatchStat()))
+    {
+        for( CManualSwitch* pms : m_arrSwChans )
+        {
+            pms->MqttPubStat();
+        }
+    }
 
-    OnMgtCmd((byte*)MQTT_CMD_MGT_DISCOVERY, MQTT_CMD_MGT_DISCOVERY_LEN );
+    ScheduleDir();
     m_bInitStatSent = true;
+    CBootProf::Mark( EBootPhase::eReady );
+}
+
+void CMqtt::PubDirtyStat()
+{
+    if( !m_bInitStatSent )
+        return;
+    if( m_bBatchDirty )
+    {
+        if((( m_nPubQos == MQTT_QOS_AT_LEAST_ONCE ) && ( m_mqtt.GetOutboxCnt() >= MQTT_OUTBOX_SLOTS )) || ( !PubBatchStat()))
+            return;
+    }
+    for( CManualSwitch* pms : m_arrSwChans )
+    {
+        if(( pms->IsDisabled()) || ( !pms->IsStatDirty()))
+            continue;
+        // Retried once a QoS 1 slot frees, a failure waits for the next loop:
+        if(( m_nPubQos == MQTT_QOS_AT_LEAST_ONCE ) && ( m_mqtt.GetOutboxCnt() >= MQTT_OUTBOX_SLOTS ))
+            return;
+        pms->MqttPubStat();
+        if( pms->IsStatDirty())
+            return;
+    }
+}
+
+void CMqtt::ScheduleDir()
+{
+    if( m_bDirPending )
+        return;
+    m_bDirPending = true;
+    m_tmDir.UpdateAll();
+}
+
+void CMqtt::PubDeferred()
+{
+    if( CBootProf::IsReady())
+        PubBootReport();
+    if( m_bDirPending )
+    {
+        m_tmDir.UpdateCur();
+        if( m_tmDir.Delta() >= m_nDirDelayMs )
+        {
+            m_bDirPending = false;
+            PubMgt( m_szDirReply );
+            if( m_bInv )
+                m_inv.Add((const byte*)m_szDirReply, strlen( m_szDirReply ));
+        }
+    }
+    if( m_bInvPending )
+    {
+        m_tmInv.UpdateCur();
+        if( m_tmInv.Delta() >= m_nInvDelayMs )
+        {
+            m_bInvPending = false;
+            PubInventory();
+        }
+    }
+}
+
+void CMqtt::PubBootReport()
+{
+    uint nLen = AddReply( 0, "%s " BOOT_PROF_REPORT " ", m_pWiFi->GetHostName());
+    CBootProf::Format( m_szReply + nLen, sizeof( m_szReply ) - nLen );
+    if( PubMgt( m_szReply ))
+    {
+        CBootProf::SetReported();
+        CMetrics::Set( EMetric::eBootMs, CBootProf::GetReadyMs());
+        LOGI( "boot ready %u ms", CBootProf::GetReadyMs());
+    }
+}
+
+void CMqtt::PubInventory()
+{
+    uint8_t nCnt = m_inv.GetCnt();
+    uint8_t nIdx = 0;
+    do
+    {
+        uint nLen = AddReply( 0, "%s " MQTT_CMD_MGT_INVENTORY " %u" MQTT_CMD_SEPARATOR "%u", m_pWiFi->GetHostName(), nIdx, nCnt );
+        // At least one device per reply:
+        for( char cSep = ' '; ( nIdx < nCnt ) && (( cSep == ' ' ) || ( nLen + 1 + strlen( m_inv.Get( nIdx )) <= MQTT_INV_REPLY_LEN )); nIdx++ )
+        {
+            nLen = AddReply( nLen, "%c%s", cSep, m_inv.Get( nIdx ));
+            cSep = ';';
+        }
+        PubMgt( m_szReply );
+    } while( nIdx < nCnt );
+}
+
+void CMqtt::FormatDirReply()
+{
+    const char* pszHostName = m_pWiFi->GetHostName();
+    String strMac = m_pWiFi->GetMac();
+    snprintf( m_szDirReply, sizeof( m_szDirReply ), "%s %s %s %s%s", FW_REV_CURRENT, pszHostName, m_pWiFi->GetIp().c_str(),
+        strMac.c_str(), ( m_bInv ) ? INV_CANDIDATE : "" );
+
+    // The device's slot: the MAC alone may repeat (e.g. the host builds), the hostname is unique in the fleet:
+    uint32_t nHash = CCrc32::Calc( pszHostName, strlen( pszHostName ));
+    nHash = CCrc32::Calc( strMac.c_str(), strMac.length(), nHash );
+    m_nDirDelayMs = ( m_nDirJitterMs ) ? nHash % m_nDirJitterMs : 0;
+}
+
+bool CMqtt::PubBatchStat( bool a_bForce )
+{
+    // Channel state: 0: off, 1: on, 2: disabled - 2 bits per channel:
+    uint8_t nBatch = 0;
+    for( uint8_t nIdx = 0; nIdx < SW_CHANNELS; nIdx++ )
+    {
+        uint8_t nStat = ( m_arrSwChans[ nIdx ]->IsDisabled()) ? 2 : ( m_arrSwChans[ nIdx ]->GetSwitchState()) ? 1 : 0;
+        nBatch |= nStat << ( 2 * nIdx );
+    }
+    if(( !a_bForce ) && ( !m_bBatchDirty ) && ( nBatch == m_nBatchSent ))
+        return true;
+
+    uint nLen = 0;
+    for( uint8_t nIdx = 0; nIdx < SW_CHANNELS; nIdx++ )
+    {
+        static const char* Sl_arrStat[] = { MQTT_CMD_CH_OFF, MQTT_CMD_CH_ON, MQTT_STAT_CH_NA };
+        nLen = AddReply( nLen, "%s%s", ( nIdx ) ? MQTT_CMD_SEPARATOR : "", Sl_arrStat[( nBatch >> ( 2 * nIdx )) & 3 ]);
+    }
+    DBGLOG2( "mqtt pub t:'%s' p:'%s'\n", m_pszPubTopicBatch, m_szReply );
+    m_bBatchDirty = !Publish( m_pszPubTopicBatch, m_szReply, true );
+    if( !m_bBatchDirty )
+        m_nBatchSent = nBatch;
+    return !m_bBatchDirty;
 }
 
 void CMqtt::OnMgtCmd( byte* payload, uint len )
 {
-    String strHostName = g_wifi.GetHostName();
+    const char* pszHostName = m_pWiFi->GetHostName();
     if( CStringUtils::IsEqual( MQTT_CMD_MGT_DISCOVERY, MQTT_CMD_MGT_DISCOVERY_LEN, payload, len ))
     {
-        String strResp( FW_REV_CURRENT );
-        strResp += " ";
-        strResp += strHostName;
-        strResp += " ";
-        strResp += g_wifi.GetIp();
-        strResp += " ";
-        strResp += g_wifi.GetMac();
-        PubMgt( strResp.c_str());
+        ScheduleDir();
+    }
+    else if(( m_bInv ) && ( CStringUtils::IsEqual( MQTT_CMD_MGT_INVENTORY, MQTT_CMD_MGT_INVENTORY_LEN, payload, len )))
+    {
+        if( !m_bInvPending )
+        {
+            m_bInvPending = true;
+            m_nInvDelayMs = ( m_inv.IsElected( pszHostName )) ? 0 : m_nDirJitterMs + m_nDirDelayMs + MQTT_INV_FALLBACK_MS;
+            m_tmInv.UpdateAll();
+        }
     }
     else if( CStringUtils::BeginsWith( MQTT_CMD_MGT_RESET, MQTT_CMD_MGT_RESET_LEN, payload, len ))
     {
         payload += MQTT_CMD_MGT_RESET_LEN + 1;  // skip the separator
         len -= MQTT_CMD_MGT_RESET_LEN + 1;
-        if( CStringUtils::IsEqual( strHostName, payload, len ))
+        if( CStringUtils::IsEqual( pszHostName, strlen( pszHostName ), payload, len ))
         {
+            CFlightRec::Add( EFrEvent::eReset, (uint16_t)EFrReset::eMgt );
             ESP.reset();
         }
     }
+    else if(( m_bTls ) && ( CStringUtils::IsEqual( MQTT_CMD_MGT_TLS, MQTT_CMD_MGT_TLS_LEN, payload, len )))
+    {
+        AddReply( 0, "%s %s", pszHostName, m_wcs.GetStats().c_str());
+        PubMgt( m_szReply );
+    }
+    else if( MatchMgtCmd( MQTT_CMD_MGT_TRACE, MQTT_CMD_MGT_TRACE_LEN, payload, len ))
+    {
+        PubTrace( len, CStringUtils::AtoU32_10( payload, len ));
+    }
+    else if( MatchMgtCmd( MQTT_CMD_MGT_TAP, MQTT_CMD_MGT_TAP_LEN, payload, len ))
+    {
+        PubTapStats(( len ) ? min( CStringUtils::AtoU16_10( payload, len ), (uint16_t)MQTT_CHANNELS ) : MQTT_CHANNELS );
+    }
+    else if( MatchMgtCmd( MQTT_CMD_MGT_OTA, MQTT_CMD_MGT_OTA_LEN, payload, len ))
+    {
+        AddReply( 0, "%s " MQTT_CMD_MGT_OTA " %s", pszHostName, m_pWiFi->GetOta().GetStats().c_str());
+        PubMgt( m_szReply );
+    }
+    else if( MatchMgtCmd( MQTT_CMD_MGT_FLIGHT_REC, MQTT_CMD_MGT_FLIGHT_REC_LEN, payload, len ))
+    {
+        PubFlightRec( len, CStringUtils::AtoU32_10( payload, len ));
+    }
+    else if( MatchMgtCmd( MQTT_CMD_MGT_CLOCK, MQTT_CMD_MGT_CLOCK_LEN, payload, len ))
+    {
+        // <request local ms>/<reference ms>:
+        uint nT0Len = 0;
+        while(( nT0Len < len ) && ( payload[ nT0Len ] != MQTT_CMD_SEPARATOR[ 0 ]))
+            nT0Len++;
+        if(( nT0Len < len ) && ( CStringUtils::IsU32_10( payload, nT0Len, 10 ))
+            && ( CStringUtils::IsU32_10( payload + nT0Len + 1, len - nT0Len - 1, 10 )))
+        {
+            m_grpTrace.GetClock().OnReply( CStringUtils::AtoU32_10( payload, nT0Len ), CStringUtils::AtoU32_10( payload + nT0Len + 1, len - nT0Len - 1 ));
+        }
+    }
+    else if( MatchMgtCmd( MQTT_CMD_MGT_LATENCY, MQTT_CMD_MGT_LATENCY_LEN, payload, len ))
+    {
+        PubLatency( len );
+    }
+    else if( MatchMgtCmd( MQTT_CMD_MGT_CFG_SET, MQTT_CMD_MGT_CFG_SET_LEN, payload, len ))
+    {
+        OnCfgCmd( MQTT_CMD_MGT_CFG_SET, payload, len );
+    }
+    else if( MatchMgtCmd( MQTT_CMD_MGT_CFG_PUT, MQTT_CMD_MGT_CFG_PUT_LEN, payload, len ))
+    {
+        OnCfgCmd( MQTT_CMD_MGT_CFG_PUT, payload, len );
+    }
+    else if( MatchMgtCmd( MQTT_CMD_MGT_CFG_END, MQTT_CMD_MGT_CFG_END_LEN, payload, len ))
+    {
+        OnCfgCmd( MQTT_CMD_MGT_CFG_END, payload, len );
+    }
 }
 
-void CMqtt::loop()
+void CMqtt::OnCfgCmd( const char* a_pszCmd, byte* payload, uint len )
 {
-    if( !m_bEnabled )
-        return;
+    // <file>/<arg>/<arg> - the last arg may contain separators:
+    byte* arrArgs[ 3 ];
+    uint arrArgLens[ 3 ];
+    uint8_t nArgs = 0;
+    for( ; nArgs < 2; nArgs++ )
+    {
+        uint nArgLen = 0;
+        while(( nArgLen < len ) && ( payload[ nArgLen ] != MQTT_CMD_SEPARATOR[ 0 ]))
+            nArgLen++;
+        if( nArgLen == len )
+            break;
+        arrArgs[ nArgs ] = payload;
+        arrArgLens[ nArgs ] = nArgLen;
+        payload += nArgLen + 1;     // skip the separator
+        len -= nArgLen + 1;
+    }
+    arrArgs[ 2 ] = payload;
+    arrArgLens[ 2 ] = len;
 
-    if( m_mqtt.connected())
+    ECfgFile file = ( nArgs == 2 ) ? CCfgPush::Find( arrArgs[ 0 ], arrArgLens[ 0 ]) : ECfgFile::eCnt;
+    ECfgResult result = ECfgResult::eArg;
+    bool bPut = !strcmp( a_pszCmd, MQTT_CMD_MGT_CFG_PUT );
+    if( file == ECfgFile::eCnt )
     {
-        PubInitState();
-        m_mqtt.loop();
+        result = ECfgResult::eFile;
+    }
+    else if(( m_pWiFi->GetOta().IsActive()) || ( m_pWiFi->GetOta().IsFsCorrupt()))
+    {
+        result = ECfgResult::eFs;   // an FS image may be rewriting the partition or left it partially written
+    }
+    else if( !LittleFS.begin())
+    {
+        result = ECfgResult::eFs;
+    }
+    else
+    {
+        if( !strcmp( a_pszCmd, MQTT_CMD_MGT_CFG_SET ))
+        {
+            char szName[ MQTT_CFG_NAME_LEN + 1 ];
+            char szValue[ MQTT_CFG_VALUE_LEN + 1 ];
+            if(( arrArgLens[ 1 ] <= MQTT_CFG_NAME_LEN ) && ( arrArgLens[ 2 ] <= MQTT_CFG_VALUE_LEN ))
+            {
+                memcpy( szName, arrArgs[ 1 ], arrArgLens[ 1 ]);
+                szName[ arrArgLens[ 1 ]] = 0;
+                memcpy( szValue, arrArgs[ 2 ], arrArgLens[ 2 ]);
+                szValue[ arrArgLens[ 2 ]] = 0;
+                result = m_cfg.Set( file, szName, szValue );
+            }
+        }
+        else if( !CStringUtils::IsU32_10( arrArgs[ 1 ], arrArgLens[ 1 ], MQTT_CMD_CH_ARG_DIGITS ))
+        {
+            // malformed offset or length
+        }
+        else if( bPut )
+        {
+            result = m_cfg.Put( file, CStringUtils::AtoU32_10( arrArgs[ 1 ], arrArgLens[ 1 ]), arrArgs[ 2 ], arrArgLens[ 2 ]);
+        }
+        else if( arrArgLens[ 2 ] == 8 )
+        {
+            uint32_t nCrc = 0;
+            uint8_t nIdx = 0;
+            for( ; ( nIdx < 8 ) && ( isxdigit( arrArgs[ 2 ][ nIdx ])); nIdx++ )
+                nCrc = ( nCrc << 4 ) | CStringUtils::NibbleToU8_16( arrArgs[ 2 ][ nIdx ]);
+            if( nIdx == 8 )
+                result = m_cfg.End( file, CStringUtils::AtoU32_10( arrArgs[ 1 ], arrArgLens[ 1 ]), nCrc );
+        }
+
+        // Apply the stored file:
+        if(( result == ECfgResult::eOk ) && ( !bPut ))
+        {
+            CFlightRec::Add( EFrEvent::eCfg, (uint16_t)file );
+            LOGI( "cfg %s applied", CCfgPush::GetName( file ));
+            if( file <= ECfgFile::eCh2 )
+                m_arrSwChans[ (uint8_t)file ]->Reconfigure();
+            else if( file == ECfgFile::eScn )
+                m_scenes.ReadCfg();
+            else
+                m_cfgReload = file;     // reconnects - once the reply is sent
+        }
+        LittleFS.end();
     }
-    else if( m_mqtt.connect( m_strClientId.c_str(), m_strPubTopicStat.c_str(), MQTT_QOS_EXACTLY_ONCE, true, MQTT_STAT_OFFLINE ))
+
+    uint nLen = AddReply( 0, "%s " MQTT_CMD_MGT_CFG " %s ", m_pWiFi->GetHostName(), CCfgPush::GetName( file ));
+    if(( result == ECfgResult::eOk ) && ( bPut ))
+        AddReply( nLen, "%u", (uint)m_cfg.GetLen());
+    else
+        AddReply( nLen, "%s", CCfgPush::GetResultName( result ));
+    PubMgt( m_szReply );
+}
+
+bool CMqtt::CheckCfg( ECfgFile a_file, const char* a_pszPath )
+{
+    switch( a_file )
     {
-        m_mqtt.subscribe( m_strSubTopicCmd.c_str());
-        String strMqttSubTopicChan( m_strSubTopicCmd + MQTT_TOPIC_CHANNEL );
-        m_mqtt.subscribe(( strMqttSubTopicChan + SW_CHANNEL_0 ).c_str());
-        m_mqtt.subscribe(( strMqttSubTopicChan + SW_CHANNEL_1 ).c_str());
-        m_mqtt.subscribe(( strMqttSubTopicChan + SW_CHANNEL_2 ).c_str());
-        m_mqtt.subscribe( m_strPubSubTopicGrp.c_str());
-        m_mqtt.subscribe( m_strSubTopicMgt.c_str());
-        DBGLOG( "mqtt connected" );
-        m_tmInitStat.UpdateAll();
-        m_bInitStatSent = false;
+        case ECfgFile::eWiFi:
+            return CWiFiHelper::CheckCfg( a_pszPath );
+
+        case ECfgFile::eMqtt:
+            return CheckMqttCfg( a_pszPath );
+
+        case ECfgFile::eScn:
+            return CScenes().ReadCfg( a_pszPath );
+
+        default:
+            return CManualSwitch::CheckCfg( a_pszPath );
     }
 }
 
-void CMqtt::MqttCb( char* topic, byte* payload, uint len )
+bool CMqtt::CheckMqttCfg( const char* a_pszPath )
+{
+    File file = LittleFS.open( a_pszPath, "r" );
+    if( !file )
+        return false;
+    for( const char* pszName : { "srv", "cli", "sub", "pub", "grp", "mgt" })
+    {
+        if( CConfigUtils::ReadValue( file, pszName ).isEmpty())
+            return false;
+    }
+    if( !CConfigUtils::ReadValue( file, "port" ).toInt())
+        return false;
+    return ( !CConfigUtils::ReadValue( file, "tls", "0" ).toInt())
+        || ( !CConfigUtils::ReadValue( file, "fp" ).isEmpty())
+        || ( !CConfigUtils::ReadValue( file, "key" ).isEmpty());
+}
+
+bool CMqtt::MatchMgtCmd( const char* a_pszCmd, uint a_nCmdLen, byte*& payload, uint& len )
 {
-    // Copy the buf for processing in all channels.
-    // The PubSubClient implementation does use a single buffer for rx/tx.
-    // In case multiple channels are executing (i.e. on a device private topic),
-    // the mqtt status sent by one channel (tx) will overwrite the payload before the next channel executes (rx).
-    byte* pBuf = m_pPayloadBuf;
-    if( m_nPayloadBufLen < len )
+    if(( len <= a_nCmdLen ) || ( !CStringUtils::BeginsWith( a_pszCmd, a_nCmdLen, payload, len )))
+        return false;
+    byte* pHost = payload + a_nCmdLen + 1;  // skip the separator
+    uint nLen = len - a_nCmdLen - 1;
+    uint nHostLen = 0;
+    while(( nHostLen < nLen ) && ( pHost[ nHostLen ] != MQTT_CMD_SEPARATOR[ 0 ]))
+        nHostLen++;
+    const char* pszHostName = m_pWiFi->GetHostName();
+    if( !CStringUtils::IsEqual( pszHostName, strlen( pszHostName ), pHost, nHostLen ))
+        return false;
+    payload = pHost + nHostLen;
+    len = nLen - nHostLen;
+    if( len )
     {
-        byte* pNewBuf = (byte*)realloc( m_pPayloadBuf, len );
-        if( pNewBuf )
+        payload++;  // skip the separator
+        len--;
+    }
+    return true;
+}
+
+void CMqtt::PubTapStats( uint8_t a_nChan )
+{
+    const char* pszHostName = m_pWiFi->GetHostName();
+    for( uint8_t nIdx = 0; nIdx < MQTT_CHANNELS; nIdx++ )
+    {
+        CManualSwitch* pms = m_arrSwChans[ nIdx ];
+        if(( pms->IsDisabled()) || (( a_nChan != MQTT_CHANNELS ) && ( a_nChan != nIdx )))
+            continue;
+        CTapHist& rPress = pms->GetPressHist();
+        CTapHist& rGap = pms->GetGapHist();
+        uint16_t nGapMs = pms->GetNextMaxMs();
+        uint nLen = AddReply( 0, "%s " MQTT_CMD_MGT_TAP " %u", pszHostName, nIdx );
+        if( a_nChan == MQTT_CHANNELS )
         {
-            pBuf = m_pPayloadBuf = pNewBuf;
-            m_nPayloadBufLen = len;
+            AddReply( nLen, " tune:%u long:%u next:%u press:%u/%u/%u gap:%u/%u/%u",
+                pms->IsAutoTune(), pms->GetLongTapMs(), pms->GetNextTapMs(),
+                rPress.GetCnt(), rPress.Quantile( 50 ), rPress.Quantile( 95 ),
+                rGap.GetCnt( nGapMs ), rGap.Quantile( 50, nGapMs ), rGap.Quantile( 95, nGapMs ));
+            PubMgt( m_szReply );
+            continue;
         }
-        else
+        for( CTapHist* pHist : { &rPress, &rGap })
+        {
+            uint nHistLen = AddReply( nLen, "%s%u", ( pHist == &rPress ) ? " press " : " gap ", TAP_HIST_BUCKET_MS );
+            uint8_t nBuckets = TAP_HIST_BUCKETS;
+            while(( nBuckets > 1 ) && ( !pHist->GetBucket( nBuckets - 1 )))
+                nBuckets--;
+            for( uint8_t nBucket = 0; nBucket < nBuckets; nBucket++ )
+            {
+                nHistLen = AddReply( nHistLen, "%c%u", ( nBucket ) ? ',' : ' ', pHist->GetBucket( nBucket ));
+            }
+            PubMgt( m_szReply );
+        }
+    }
+}
+
+void CMqtt::PubTrace( bool a_bChunk, uint32_t a_nSeq )
+{
+    uint nLen = AddReply( 0, "%s " MQTT_CMD_MGT_TRACE " ", m_pWiFi->GetHostName());
+    if( !a_bChunk )
+    {
+        nLen = AddReply( nLen, "%u %u", m_pTrace->GetFirst(), m_pTrace->GetEnd());
+        for( CManualSwitch* pms : m_arrSwChans )
+        {
+            if( pms->IsDisabled())
+            {
+                nLen = AddReply( nLen, " " MQTT_STAT_CH_NA );
+            }
+            else
+            {
+                nLen = AddReply( nLen, " %u" MQTT_CMD_SEPARATOR "%u", pms->GetLongTapMs(), pms->GetNextTapMs());
+            }
+        }
+    }
+    else
+    {
+        uint32_t nSeq = max( a_nSeq, m_pTrace->GetFirst());
+        uint32_t nEnd = min( nSeq + MQTT_TRACE_CHUNK, m_pTrace->GetEnd());
+        nLen = AddReply( nLen, "%u ", nSeq );
+        for( ; nSeq < nEnd; nSeq++ )
         {
-            pBuf = payload;
+            nLen = AddReply( nLen, "%08x", m_pTrace->Get( nSeq ));
         }
     }
-    if( pBuf != payload )
+    PubMgt( m_szReply );
+}
+
+void CMqtt::PubFlightRec( bool a_bChunk, uint32_t a_nSeq )
+{
+    uint nLen = AddReply( 0, "%s " MQTT_CMD_MGT_FLIGHT_REC " ", m_pWiFi->GetHostName());
+    if( !a_bChunk )
+    {
+        uint32_t nInfo = CFlightRec::GetResetInfo();
+        AddReply( nLen, "%u %u %u %08x %u %u", nInfo >> 16, ( nInfo >> 8 ) & 0xff, nInfo & 0xff, CFlightRec::GetResetPc(),
+            CFlightRec::GetFirst(), CFlightRec::GetEnd());
+    }
+    else
+    {
+        uint32_t nSeq = max( a_nSeq, CFlightRec::GetFirst());
+        uint32_t nEnd = min( nSeq + MQTT_FLIGHT_REC_CHUNK, CFlightRec::GetEnd());
+        nLen = AddReply( nLen, "%u ", nSeq );
+        for( ; nSeq < nEnd; nSeq++ )
+        {
+            nLen = AddReply( nLen, "%08x", CFlightRec::Get( nSeq ));
+        }
+    }
+    PubMgt( m_szReply );
+}
+
+void CMqtt::PubHeap()
+{
+    if(( !m_nHeapPeriodMs ) || ( !m_bInitStatSent ))
+        return;
+    m_tmHeap.UpdateCur();
+    if( m_tmHeap.Delta() < m_nHeapPeriodMs )
+        return;
+    m_tmHeap.UpdateLast();
+
+    CMetrics::SampleHeap();
+    AddReply( 0, "%s " MQTT_MGT_HEAP " %u %u %u %u", m_pWiFi->GetHostName(), CMetrics::Get( EMetric::eHeapFree ),
+        CMetrics::Get( EMetric::eHeapMaxBlock ), CMetrics::Get( EMetric::eHeapFrag ), CMetrics::Get( EMetric::eHeapFreeMin ));
+    PubMgt( m_szReply );
+}
+
+void CMqtt::PubClockReq()
+{
+    CClockSync& rClock = m_grpTrace.GetClock();
+    if( !rClock.IsDue())
+        return;
+    AddReply( 0, "%s " MQTT_CMD_MGT_CLOCK " %u", m_pWiFi->GetHostName(), rClock.Request());
+    PubMgt( m_szReply );
+}
+
+void CMqtt::PubLatency( bool a_bClear )
+{
+    const char* pszHostName = m_pWiFi->GetHostName();
+    CClockSync& rClock = m_grpTrace.GetClock();
+    AddReply( 0, "%s " MQTT_CMD_MGT_LATENCY " clk %u %d %u %u", pszHostName, rClock.IsSynced(), rClock.GetOffset(), rClock.GetRtt(), m_grpTrace.GetCnt());
+    PubMgt( m_szReply );
+    for( uint8_t nIdx = 0; nIdx < m_grpTrace.GetCnt(); nIdx++ )
+    {
+        uint nLen = AddReply( 0, "%s " MQTT_CMD_MGT_LATENCY " %u ", pszHostName, nIdx );
+        m_grpTrace.Format( nIdx, m_szReply + nLen, sizeof( m_szReply ) - nLen );
+        PubMgt( m_szReply );
+    }
+    if( a_bClear )
+        m_grpTrace.Clear();
+}
+
+void CMqtt::loop()
+{
+    if( !m_bEnabled )
+        return;
+
+    // Deferred while an OTA update may be rewriting the FS partition:
+    if(( m_cfgReload != ECfgFile::eCnt ) && ( !m_pWiFi->GetOta().IsActive()))
     {
-        memcpy( pBuf, payload, len );
+        if( m_cfgReload == ECfgFile::eMqtt )
+            Disable();
+        if( LittleFS.begin())
+        {
+            if( m_cfgReload == ECfgFile::eMqtt )
+                ReadCfg();
+            else
+                m_pWiFi->Reload();
+            LittleFS.end();
+        }
+        m_cfgReload = ECfgFile::eCnt;
+        Enable();
+        return;
     }
 
-    DBGLOG1( "Rcvd topic %s: '", topic );
-    for( uint i = 0; i < len; i++ )
+    if( m_mqtt.Connected())
     {
-        DBGLOG1( "%c", (char)pBuf[ i ]);
+        PubInitState();
+        PubDirtyStat();
+        PubDeferred();
+        PubHeap();
+        PubClockReq();
     }
-    DBGLOG( '\'' );
+    else if( !m_mqtt.Connecting())
+    {
+        if( m_bConnected )
+        {
+            m_bConnected = false;
+            CFlightRec::Add( EFrEvent::eMqttDown );
+            LOGW( "mqtt down" );
+            CMetrics::Inc( EMetric::eMqttReconnects );
+        }
+        if( m_mqtt.Connect( m_pszClientId, m_pszPubTopicStat, MQTT_QOS_EXACTLY_ONCE, true, MQTT_STAT_OFFLINE ))
+            CBootProf::Mark( EBootPhase::eMqttTcp );
+    }
+    m_mqtt.loop();
+    m_log.loop();
+}
+
+void CMqtt::OnConnect()
+{
+    CBootProf::Mark( EBootPhase::eMqttConn );
+    m_mqtt.Subscribe( m_pszSubTopicCmd );
+    m_mqtt.Subscribe( m_arrSubTopicChan[ 0 ]);
+    m_mqtt.Subscribe( m_arrSubTopicChan[ 1 ]);
+    m_mqtt.Subscribe( m_arrSubTopicChan[ 2 ]);
+    m_mqtt.Subscribe( m_pszPubSubTopicGrp );
+    m_mqtt.Subscribe( m_pszSubTopicMgt );
+    if( m_bInv )
+        m_mqtt.Subscribe( m_pszPubTopicMgt );
+    CBootProf::Mark( EBootPhase::eMqttSub );
+    DBGLOG( "mqtt connected" );
+    m_bConnected = true;
+    CFlightRec::Add( EFrEvent::eMqttUp );
+    LOGI( "mqtt up" );
+    m_tmInitStat.UpdateAll();
+    m_tmHeap.UpdateAll();
+    m_grpTrace.GetClock().Kick();
+    m_bInitStatSent = false;
+    FormatDirReply();
+}
+
+void CMqtt::MqttCb( char* topic, byte* payload, uint len )
+{
+    // No need to copy the payload for processing in all channels - the MQTT client uses separate rx/tx buffers,
+    // so the mqtt status sent by one channel (tx) will not overwrite the payload before the next channel executes (rx).
+
+    DBGLOG3( "Rcvd topic %s: '%.*s'\n", topic, (int)len, payload );
 
-    if( m_strPubSubTopicGrp == topic )
+    if( !strcmp( m_pszPubSubTopicGrp, topic ))
     {
-        g_swChan0.OnGroupCmd( pBuf, len );
-        g_swChan1.OnGroupCmd( pBuf, len );
-        g_swChan2.OnGroupCmd( pBuf, len );
+        OnGroupCmd( payload, len );
         return;
     }
-    else if( m_strSubTopicMgt == topic )
+    else if( !strcmp( m_pszSubTopicMgt, topic ))
     {
-        OnMgtCmd( pBuf, len );
+        OnMgtCmd( payload, len );
+        return;
+    }
+    else if(( m_bInv ) && ( !strcmp( m_pszPubTopicMgt, topic )))
+    {
+        // A discovery reply, or an inventory reply: <hostname> inv ... - the one scheduled is not needed:
+        if( !m_inv.Add( payload, len ))
+        {
+            uint nHostLen = 0;
+            while(( nHostLen < len ) && ( payload[ nHostLen ] != ' ' ))
+                nHostLen++;
+            if( CStringUtils::BeginsWith( " " MQTT_CMD_MGT_INVENTORY " ", MQTT_CMD_MGT_INVENTORY_LEN + 2, payload + nHostLen, len - nHostLen ))
+                m_bInvPending = false;
+        }
         return;
     }
 
-    CManualSwitch* pms = nullptr;
-    if( GetChannelTopic( SW_CHANNEL_0, m_strSubTopicCmd ) == topic )
+    for( uint8_t nIdx = 0; nIdx < MQTT_CHANNELS; nIdx++ )
     {
-        pms = &g_swChan0;
+        if( !strcmp( m_arrSubTopicChan[ nIdx ], topic ))
+        {
+            OnChanCmd( m_arrSwChans[ nIdx ], payload, len );
+            return;
+        }
     }
-    else if( GetChannelTopic( SW_CHANNEL_1, m_strSubTopicCmd ) == topic )
+}
+
+void CMqtt::OnChanCmd( CManualSwitch* a_pms, byte* payload, uint len )
+{
+    // <verb>[/<arg>]:
+    uint nVerbLen = 0;
+    while(( nVerbLen < len ) && ( payload[ nVerbLen ] != MQTT_CMD_SEPARATOR[ 0 ]))
     {
-        pms = &g_swChan1;
+        nVerbLen++;
     }
-    else if( GetChannelTopic( SW_CHANNEL_2, m_strSubTopicCmd ) == topic )
+    bool bArg = nVerbLen < len;
+    byte* pArg = payload + nVerbLen + 1;
+    uint nArgLen = ( bArg ) ? len - nVerbLen - 1 : 0;
+    if(( bArg ) && ( !CStringUtils::IsU32_10( pArg, nArgLen, MQTT_CMD_CH_ARG_DIGITS )))
     {
-        pms = &g_swChan2;
+        return;
     }
+    ulong nArg = CStringUtils::AtoU32_10( pArg, nArgLen );
 
-    if( pms )
+    if( CStringUtils::IsEqual( MQTT_CMD_CH_ON, MQTT_CMD_CH_ON_LEN, payload, nVerbLen ))
+    {
+        a_pms->QueueState( true, min( nArg, ULONG_MAX / 1000 ) * 1000 );
+    }
+    else if( CStringUtils::IsEqual( MQTT_CMD_CH_OFF, MQTT_CMD_CH_OFF_LEN, payload, nVerbLen ))
     {
-        if( CStringUtils::IsEqual( MQTT_CMD_CH_ON, MQTT_CMD_CH_ON_LEN, pBuf, len ))
+        if(( nArg ) && ( a_pms->GetTargetState()))
         {
-            pms->SetState( true, 0 );
+            a_pms->QueueState( true, min( nArg, ULONG_MAX / 1000 ) * 1000 );
         }
-        else if( CStringUtils::IsEqual( MQTT_CMD_CH_OFF, MQTT_CMD_CH_OFF_LEN, pBuf, len ))
+        else
         {
-            pms->SetState( false, 0 );
+            a_pms->QueueState( false, 0 );
         }
     }
+    else if(( !bArg ) && ( CStringUtils::IsEqual( MQTT_CMD_CH_TOGGLE, MQTT_CMD_CH_TOGGLE_LEN, payload, nVerbLen )))
+    {
+        a_pms->QueueState( !a_pms->GetTargetState(), 0 );
+    }
+    else if(( nArg ) && ( CStringUtils::IsEqual( MQTT_CMD_CH_PULSE, MQTT_CMD_CH_PULSE_LEN, payload, nVerbLen )))
+    {
+        a_pms->QueueState( true, nArg );
+    }
 }
 
-String CMqtt::GetChannelTopic( char a_nChannel, String& a_rstrTopic )
+void CMqtt::OnGroupCmd( byte* payload, uint len )
 {
-    String strTopic( a_rstrTopic );
-    if( a_nChannel )
+    CMetrics::Inc( EMetric::eGrpCmds );
+    m_grpTrace.OnReceive( payload, len );
+    SScene scene;
+    const SScene* pScene = nullptr;
+    if(( len > MQTT_CMD_GRP_SCENE_LEN + 1 ) && ( CStringUtils::BeginsWith( MQTT_CMD_GRP_SCENE, MQTT_CMD_GRP_SCENE_LEN, payload, len ))
+        && ( payload[ MQTT_CMD_GRP_SCENE_LEN ] == MQTT_CMD_SEPARATOR[ 0 ]))
+    {
+        if( CScenes::Parse( payload + MQTT_CMD_GRP_SCENE_LEN + 1, len - MQTT_CMD_GRP_SCENE_LEN - 1, scene ))
+        {
+            pScene = &scene;
+        }
+    }
+    else if(( len > MQTT_CMD_GRP_SCENE_RECALL_LEN + 1 ) && ( CStringUtils::BeginsWith( MQTT_CMD_GRP_SCENE_RECALL, MQTT_CMD_GRP_SCENE_RECALL_LEN, payload, len ))
+        && ( payload[ MQTT_CMD_GRP_SCENE_RECALL_LEN ] == MQTT_CMD_SEPARATOR[ 0 ]))
+    {
+        // A malformed preset recalls nothing - never preset 0:
+        byte* pPreset = payload + MQTT_CMD_GRP_SCENE_RECALL_LEN + 1;
+        uint nPresetLen = len - MQTT_CMD_GRP_SCENE_RECALL_LEN - 1;
+        if( CStringUtils::IsU32_10( pPreset, nPresetLen, MQTT_SCENE_PRESET_DIGITS ))
+        {
+            pScene = m_scenes.Get( CStringUtils::AtoU16_10( pPreset, nPresetLen ));
+        }
+    }
+    else
+    {
+        bool bMatched = false;
+        for( CManualSwitch* pms : m_arrSwChans )
+        {
+            bMatched |= pms->OnGroupCmd( payload, len );
+        }
+        m_grpTrace.OnDispatch( bMatched );
+        return;
+    }
+
+    bool bMatched = false;
+    if( pScene )
     {
-        strTopic += MQTT_TOPIC_CHANNEL;
-        strTopic += a_nChannel;
+        for( CManualSwitch* pms : m_arrSwChans )
+        {
+            bMatched |= pms->ApplyScene( *pScene );
+        }
     }
-    return strTopic;
+    m_grpTrace.OnDispatch( bMatched );
+}
+
+const char* CMqtt::AddChannelTopic( char a_nChannel, const char* a_pszTopic )
+{
+    char szChannel[ sizeof( MQTT_TOPIC_CHANNEL ) + 1 ] = "";
+    if( a_nChannel )
+        snprintf( szChannel, sizeof( szChannel ), MQTT_TOPIC_CHANNEL "%c", a_nChannel );
+    return m_arena.Add( a_pszTopic, szChannel );
+}
+
+uint CMqtt::AddReply( uint a_nLen, const char* a_pszFmt, ... )
+{
+    if( a_nLen >= sizeof( m_szReply ) - 1 )
+        return a_nLen;
+    va_list args;
+    va_start( args, a_pszFmt );
+    int nLen = vsnprintf( m_szReply + a_nLen, sizeof( m_szReply ) - a_nLen, a_pszFmt, args );
+    va_end( args );
+    return ( nLen < 0 ) ? a_nLen : min( a_nLen + nLen, (uint)sizeof( m_szReply ) - 1 );
 }
 
 bool CMqtt::PubStat( char a_nChannel, const char* a_pszMsg )
 {
-    String strTopic = GetChannelTopic( a_nChannel, m_strPubTopicStat );
-    DBGLOG2( "mqtt pub t:'%s' p:'%s'\n", strTopic.c_str(), a_pszMsg );
-    return m_mqtt.publish( strTopic.c_str(), a_pszMsg, true );
+    const char* pszTopic = ( a_nChannel ) ? m_arrPubTopicChan[ a_nChannel - SW_CHANNEL_0 ] : m_pszPubTopicStat;
+    DBGLOG2( "mqtt pub t:'%s' p:'%s'\n", pszTopic, a_pszMsg );
+    return Publish( pszTopic, a_pszMsg, true );
 }
 
 bool CMqtt::PubStat( const char* a_pszMsg )
 {
     return PubStat( 0, a_pszMsg );
 }
+
+bool CMqtt::Publish( const char* a_pszTopic, const char* a_pszMsg, bool a_bRetained )
+{
+    bool bRet = m_mqtt.Publish( a_pszTopic, a_pszMsg, a_bRetained, m_nPubQos );
+    CMetrics::Inc(( bRet ) ? EMetric::eMqttPubs : EMetric::eMqttPubFails );
+    if( !bRet )
+    {
+        DBGLOG1( "mqtt pub failed t:'%s'\n", a_pszTopic );
+        LOGW( "mqtt pub failed" );
+    }
+    return bRet;
+}
@@ -6,12 +6,23 @@
 #pragma once
 #include <Arduino.h>
 #include <WiFiClient.h>
-#include <PubSubClient.h>
 #include <LittleFS.h>
 
+#include "MqttClient.h"
+#include "TlsClient.h"
 #include "Timer.h"
+#include "Scenes.h"
+#include "CfgPush.h"
+#include "Inventory.h"
+#include "LogSink.h"
+#include "StrArena.h"
+#include "GrpTrace.h"
 #include "dbg.h"
 
+class CWiFiHelper;
+class CManualSwitch;
+class CInputTrace;
+
 
 
 // MQTT QOS
@@ -24,6 +35,18 @@
 /// Config file path
 #define FS_MQTT_CFG     "mqtt_cfg"
 
+/// Config string arena length: the server, the client id and the topic names
+#define MQTT_CFG_ARENA_LEN  640
+
+/// Max management reply length - fits MQTT_CLIENT_TX_BUF_LEN with the topic
+#define MQTT_REPLY_LEN      224
+
+/// Default heap stats publication period (s), 0: disabled
+#define MQTT_HEAP_PERIOD_S  "600"
+
+/// Default clock sync period of the group cmd latency tracing (s), 0: tracing disabled
+#define MQTT_LAT_PERIOD_S   "0"
+
 
 
 /// Device online state - payload
@@ -35,7 +58,7 @@
 
 
 /// Channel on state - payload
-#define MQTT_CMD_CH_ON      "on"
+#define MQTT_CMD_CH_ON      "on"    // [ + '/' + <auto-off secs> ]
 
 /// Channel on state - payload len
 #define MQTT_CMD_CH_ON_LEN  2
@@ -43,13 +66,34 @@
 
 
 /// Channel off state - payload
-#define MQTT_CMD_CH_OFF     "off"
+#define MQTT_CMD_CH_OFF     "off"   // [ + '/' + <delay secs> ]
 
 /// Channel off state - payload len
 #define MQTT_CMD_CH_OFF_LEN 3
 
 
 
+/// Channel toggle cmd - payload
+#define MQTT_CMD_CH_TOGGLE      "tgl"
+
+/// Channel toggle cmd - payload len
+#define MQTT_CMD_CH_TOGGLE_LEN  3
+
+
+
+/// Channel pulse cmd - payload
+#define MQTT_CMD_CH_PULSE       "pulse" // + '/' + <ms>
+
+/// Channel pulse cmd - payload len
+#define MQTT_CMD_CH_PULSE_LEN   5
+
+
+
+/// Max number of digits of a channel cmd argument
+#define MQTT_CMD_CH_ARG_DIGITS  9
+
+
+
 /// Tap cmd separator character
 #define MQTT_CMD_SEPARATOR          "/"
 
@@ -84,12 +128,51 @@
 
 
 
+/// Scene cmd - payload
+#define MQTT_CMD_GRP_SCENE              "scn"   // + '/' + <mask> + '/' + <on mask> [ + '/' + <auto-off secs> ]
+
+/// Scene cmd - payload len
+#define MQTT_CMD_GRP_SCENE_LEN          3
+
+
+
+/// Scene preset recall cmd - payload
+#define MQTT_CMD_GRP_SCENE_RECALL       "scr"   // + '/' + <preset>
+
+/// Scene preset recall cmd - payload len
+#define MQTT_CMD_GRP_SCENE_RECALL_LEN   3
+
+/// Max digits of the scene preset recalled
+#define MQTT_SCENE_PRESET_DIGITS        2
+
+
+
 /// Device discovery cmd - payload
 #define MQTT_CMD_MGT_DISCOVERY          "dir"
 
 /// Device discovery cmd - payload len
 #define MQTT_CMD_MGT_DISCOVERY_LEN      3
 
+/// Max discovery reply length
+#define MQTT_DIR_REPLY_LEN              128
+
+/// Default discovery reply jitter window (ms)
+#define MQTT_DIR_JITTER_MS              "2000"
+
+
+
+/// Device inventory cmd - payload
+#define MQTT_CMD_MGT_INVENTORY          "inv"
+
+/// Device inventory cmd - payload len
+#define MQTT_CMD_MGT_INVENTORY_LEN      3
+
+/// Max inventory reply length - fits MQTT_REPLY_LEN
+#define MQTT_INV_REPLY_LEN              200
+
+/// Inventory reply delay of a candidate not elected, after the discovery jitter window (ms) - unless the inventory is replied
+#define MQTT_INV_FALLBACK_MS            500
+
 
 
 /// Device reset cmd - payload
@@ -100,9 +183,112 @@
 
 
 
+/// TLS handshake stats cmd - payload
+#define MQTT_CMD_MGT_TLS                "tls"
+
+/// TLS handshake stats cmd - payload len
+#define MQTT_CMD_MGT_TLS_LEN            3
+
+
+
+/// Input trace download cmd - payload
+#define MQTT_CMD_MGT_TRACE              "trc"   // + '/' + <hostname> [ + '/' + <seq> ]
+
+/// Input trace download cmd - payload len
+#define MQTT_CMD_MGT_TRACE_LEN          3
+
+/// Number of the input trace records per reply - fits MQTT_CLIENT_TX_BUF_LEN with a 32 char hostname
+#define MQTT_TRACE_CHUNK                20
+
+
+
+/// Tap timing stats cmd - payload
+#define MQTT_CMD_MGT_TAP                "tap"   // + '/' + <hostname> [ + '/' + <channel> ]
+
+/// Tap timing stats cmd - payload len
+#define MQTT_CMD_MGT_TAP_LEN            3
+
+
+
+/// OTA FWU stats cmd - payload
+#define MQTT_CMD_MGT_OTA                "ota"   // + '/' + <hostname>
+
+/// OTA FWU stats cmd - payload len
+#define MQTT_CMD_MGT_OTA_LEN            3
+
+
+
+/// Flight recorder download cmd - payload
+#define MQTT_CMD_MGT_FLIGHT_REC         "frc"   // + '/' + <hostname> [ + '/' + <seq> ]
+
+/// Flight recorder download cmd - payload len
+#define MQTT_CMD_MGT_FLIGHT_REC_LEN     3
+
+/// Number of the flight recorder events per reply - fits MQTT_CLIENT_TX_BUF_LEN with a 32 char hostname
+#define MQTT_FLIGHT_REC_CHUNK           20
+
+
+
+/// Config value set cmd - payload
+#define MQTT_CMD_MGT_CFG_SET            "cfs"   // + '/' + <hostname> + '/' + <file> + '/' + <name> + '/' + <value>
+
+/// Config value set cmd - payload len
+#define MQTT_CMD_MGT_CFG_SET_LEN        3
+
+/// Config file chunk cmd - payload
+#define MQTT_CMD_MGT_CFG_PUT            "cfp"   // + '/' + <hostname> + '/' + <file> + '/' + <offset> + '/' + <data>
+
+/// Config file chunk cmd - payload len
+#define MQTT_CMD_MGT_CFG_PUT_LEN        3
+
+/// Config file end cmd - payload
+#define MQTT_CMD_MGT_CFG_END            "cfe"   // + '/' + <hostname> + '/' + <file> + '/' + <length> + '/' + <crc32: 8 hex digits>
+
+/// Config file end cmd - payload len
+#define MQTT_CMD_MGT_CFG_END_LEN        3
+
+/// Config cmd reply
+#define MQTT_CMD_MGT_CFG                "cfg"
+
+
+
+/// Clock sync reply cmd - payload, see CClockSync
+#define MQTT_CMD_MGT_CLOCK              "clk"   // + '/' + <hostname> + '/' + <request local ms> + '/' + <reference ms>
+
+/// Clock sync reply cmd - payload len
+#define MQTT_CMD_MGT_CLOCK_LEN          3
+
+/// Group cmd latency stats cmd - payload, see CGrpTrace
+#define MQTT_CMD_MGT_LATENCY            "lat"   // + '/' + <hostname> [ + '/' + clr ]
+
+/// Group cmd latency stats cmd - payload len
+#define MQTT_CMD_MGT_LATENCY_LEN        3
+
+
+
+/// Heap stats - periodic payload
+#define MQTT_MGT_HEAP                   "heap"  // <hostname> heap <free> <max block> <fragmentation %> <min free>
+
+/// Max config value name length
+#define MQTT_CFG_NAME_LEN               32
+
+/// Max config value length
+#define MQTT_CFG_VALUE_LEN              200
+
+
+
 /// Channel topic name added to the device topic names
 #define MQTT_TOPIC_CHANNEL  "/ch"
 
+/// Batched channels state topic name added to the device status topic name
+#define MQTT_TOPIC_BATCH    "/all"
+
+/// Disabled channel state in the batched channels state - payload
+#define MQTT_STAT_CH_NA     "-"
+
+/// Number of channels - same as SW_CHANNELS
+#define MQTT_CHANNELS       3
+
 
 
 /**
@@ -113,7 +299,23 @@
 class CMqtt
 {
 public:
-    CMqtt() : m_mqtt( m_wc ), m_bEnabled( false ), m_pPayloadBuf( nullptr ), m_nPayloadBufLen( 0 ) {}
+    CMqtt() : m_mqtt( m_wc ), m_bEnabled( false ), m_bConnected( false ), m_pWiFi( nullptr ), m_arrSwChans(), m_pTrace( nullptr ), m_cfgReload( ECfgFile::eCnt ),
+        m_szDirReply(), m_nDirDelayMs( 0 ), m_bDirPending( false ), m_bInvPending( false ), m_nInvDelayMs( 0 ), m_szReply(),
+        m_pszServer( "" ), m_pszClientId( "" ), m_nHeapPeriodMs( 0 ), m_pszSubTopicCmd( "" ), m_pszPubTopicStat( "" ), m_pszPubSubTopicGrp( "" ),
+        m_pszSubTopicMgt( "" ), m_pszPubTopicMgt( "" ), m_arrPubTopicChan(), m_arrSubTopicChan(), m_pszPubTopicBatch( "" ) {}
+
+    /**
+     * Attach the device the MQTT client serves: the WIFI helper and the switch channels.
+     * 
+     * The channels publish their state and group commands via this MQTT client.
+     * 
+     * @param[in]   a_rWiFi     WIFI helper - hostname, IP and MAC of the device.
+     * @param[in]   a_rTrace    Input trace - recorded by the channels, downloaded via MQTT_CMD_MGT_TRACE.
+     * @param[in]   a_rSwChan0  Switch channel 0.
+     * @param[in]   a_rSwChan1  Switch channel 1.
+     * @param[in]   a_rSwChan2  Switch channel 2.
+     */
+    void Attach( CWiFiHelper& a_rWiFi, CInputTrace& a_rTrace, CManualSwitch& a_rSwChan0, CManualSwitch& a_rSwChan1, CManualSwitch& a_rSwChan2 );
 
     /**
      * Read a configuration file.
@@ -123,7 +325,9 @@ public:
     /**
      * Enable MQTT.
      * 
-     * Set WIFI client timeout, configure the MQTT server and msg recv callback.
+     * Set WIFI client timeout, select the TLS client if configured,
+     * configure the MQTT server, protocol, topic aliases (MQTT 5),
+     * msg recv and connection callbacks.
      */
     void Enable();
 
@@ -139,7 +343,7 @@ public:
     /**
      * Publish a on/off state of a channel over the channel state topic.
      * 
-     * The MQTT message is retained.
+     * The MQTT message is retained and sent with the configured QoS. The batched channels state follows if enabled.
      * 
      * @param[in]   a_nChannel  Channel: SW_CHANNEL_...
      * @param[in]   a_bStateOn  True if current state is on.
@@ -162,7 +366,8 @@ public:
     /**
      * Publish a message over the device group channel.
      * 
-     * The MQTT message is NOT retained.
+     * The MQTT message is NOT retained and is sent with the configured QoS.
+     * Once the clock is synced, the message is tagged for the latency tracing, see CGrpTrace::Tag().
      * 
      * @param[in]   a_pszMsg    Message to send.
      * 
@@ -170,52 +375,254 @@ public:
      */
     bool PubGroup( const char* a_pszMsg );
 
+    /**
+     * A relay flipped - the apply time of the traced group cmd received last, see CGrpTrace.
+     */
+    void OnRelay()
+    {
+        m_grpTrace.OnApply();
+    }
+
     /**
      * Publish (once) the initial device and channels state.
      * 
      * Send a device availability message (MQTT_STAT_ONLINE) over the device state topic.
-     * Send an on/off state for all channels over respective channel state topics.
+     * Send the retained batched channels state if enabled - a single message instead of one per channel.
+     * Otherwise, or if the batch fails, send the on/off state of all channels over respective channel state topics
+     * (aliased under MQTT 5) - the retained channel state is lost on a broker restart without persistence.
+     * Schedule the discovery reply, see ScheduleDir().
      */
     void PubInitState();
 
+    /**
+     * Republish the on/off state of the channels whose last state publication failed, see CManualSwitch::IsStatDirty(),
+     * and the batched channels state if its last publication failed.
+     * 
+     * Done once the initial state is sent, and a QoS 1 outbox slot is free - a full outbox fails the publication.
+     */
+    void PubDirtyStat();
+
+    /**
+     * Publish the batched state of all channels over the batched state topic: <device status topic> + "/all".
+     * 
+     * The payload is: <ch0>/<ch1>/<ch2>, where a channel state is on, off or - (disabled channel).
+     * The MQTT message is retained - sent upon (re)connect instead of the channel states, and along with
+     * a channel state change, so it stays current.
+     * 
+     * @param[in]   a_bForce    False: skip the batch unchanged since sent
+     * 
+     * @return  True if succesfully sent or skipped.
+     */
+    bool PubBatchStat( bool a_bForce = true );
+
+    /**
+     * Schedule the discovery reply: <fw rev> <hostname> <ip> <mac>[ inv], see CInventory.
+     * 
+     * The reply is delayed by the device's slot in the configured jitter window - a hash of the hostname and the MAC,
+     * so a fleet reconnecting after a broker restart, or answering a discovery, does not reply at once.
+     * A reply already scheduled is not rescheduled.
+     */
+    void ScheduleDir();
+
+    /**
+     * Publish the scheduled discovery and inventory replies once due, and the boot report once the boot is done.
+     */
+    void PubDeferred();
+
+    /**
+     * Publish the boot report, see CBootProf:
+     *   <hostname> boot <ready ms> <phase>:<us>|- ...
+     */
+    void PubBootReport();
+
+    /**
+     * Publish the inventory collected over the device management channel, in as many replies as needed:
+     *   <hostname> inv <first device idx>/<device cnt> <discovery reply>;<discovery reply>...
+     */
+    void PubInventory();
+
+    /**
+     * Format the cached discovery reply and the device's jitter slot - upon (re)connect, the IP may change.
+     */
+    void FormatDirReply();
+
 
 
+    /**
+     * Handle the received MQTT channel command.
+     * 
+     * Parse the command in place and queue the resulting state (see CManualSwitch::QueueState):
+     * 1. MQTT_CMD_CH_ON[/<secs>] - turn on, with the auto-off timer if secs given.
+     * 2. MQTT_CMD_CH_OFF[/<secs>] - turn off, after secs if given: an on channel is kept on with the auto-off timer.
+     * 3. MQTT_CMD_CH_TOGGLE - toggle the state to be set.
+     * 4. MQTT_CMD_CH_PULSE/<ms> - turn on for ms, the relay dwell time applies.
+     * Malformed commands are ignored.
+     * 
+     * @param[in]   a_pms       Channel the command is addressed to
+     * @param[in]   payload     MQTT message paylaod
+     * @param[in]   len         Length of the payload
+     */
+    void OnChanCmd( CManualSwitch* a_pms, byte* payload, uint len );
+
+    /**
+     * Handle the received MQTT group command.
+     * 
+     * Strip the latency trace tag, see CGrpTrace::OnReceive().
+     * Apply the scene of MQTT_CMD_GRP_SCENE or the preset of MQTT_CMD_GRP_SCENE_RECALL to all the channels,
+     * pass the other cmds to the channels.
+     * The latency trace waits for a relay flip only if a channel accepted the cmd, see CGrpTrace::OnDispatch().
+     * 
+     * @param[in]   payload     MQTT message paylaod
+     * @param[in]   len         Length of the payload
+     */
+    void OnGroupCmd( byte* payload, uint len );
+
     /**
      * Handle the received MQTT management command.
      * 
      * Decode and execute the management command. The following cmds are handled:
-     * 1. MQTT_CMD_MGT_DISCOVERY
+     * 1. MQTT_CMD_MGT_DISCOVERY - see ScheduleDir(), MQTT_CMD_MGT_INVENTORY - see PubInventory(), inventory candidates only:
+     *    the elected one replies at once, the others after the jitter window + MQTT_INV_FALLBACK_MS unless an inventory is seen.
      * 2. MQTT_CMD_MGT_RESET
+     * 3. MQTT_CMD_MGT_TLS - reply: <hostname> full:<cnt>/<ms> res:<cnt>/<ms> fail:<cnt> heap:<bytes>
+     * 4. MQTT_CMD_MGT_TRACE - see PubTrace()
+     * 5. MQTT_CMD_MGT_TAP - see PubTapStats()
+     * 6. MQTT_CMD_MGT_OTA - reply: <hostname> ota <stats>, see COta::GetStats()
+     * 7. MQTT_CMD_MGT_CFG_SET, MQTT_CMD_MGT_CFG_PUT, MQTT_CMD_MGT_CFG_END - see OnCfgCmd()
+     * 8. MQTT_CMD_MGT_FLIGHT_REC - see PubFlightRec()
+     * 9. MQTT_CMD_MGT_CLOCK - the clock sync reply to PubClockReq(), see CClockSync
+     * 10. MQTT_CMD_MGT_LATENCY - see PubLatency()
      * 
      * @param[in]   payload     MQTT message paylaod
      * @param[in]   len         Length of the payload
      */
     void OnMgtCmd( byte* payload, uint len );
 
+    /**
+     * Handle the received config push command, see CCfgPush: <file>/<arg>/<arg>
+     * 
+     * Store the config value or file chunk, apply the stored file live:
+     * 1. channel cfg - the channel is reconfigured, see CManualSwitch::Reconfigure(),
+     * 2. scene cfg - the presets are re-read,
+     * 3. MQTT, WIFI cfg - the section is re-initialized once the reply is sent: reconnects.
+     * Rejected with "err fs" while an OTA update is active, the pending re-initialization waits for its end,
+     * or while the FS is left corrupt by an FS update abandoned, see COta::IsFsCorrupt().
+     * Reply: <hostname> cfg <file> ok|<next chunk offset>|err <reason>, see CCfgPush::GetResultName().
+     * 
+     * @param[in]   a_pszCmd    Command: MQTT_CMD_MGT_CFG_SET, MQTT_CMD_MGT_CFG_PUT, MQTT_CMD_MGT_CFG_END
+     * @param[in]   payload     Command argument - after the hostname
+     * @param[in]   len         Length of the argument
+     */
+    void OnCfgCmd( const char* a_pszCmd, byte* payload, uint len );
+
+    /**
+     * Validate a config file pushed, see CCfgPush::CheckCb.
+     */
+    bool CheckCfg( ECfgFile a_file, const char* a_pszPath );
+
+    /**
+     * Validate an MQTT configuration file: the server, the client id and the topics are required,
+     * TLS requires a pinned key.
+     * 
+     * @param[in]   a_pszPath   Configuration file
+     * 
+     * @return  false if invalid.
+     */
+    static bool CheckMqttCfg( const char* a_pszPath );
+
+    /**
+     * Publish the input trace over the device management channel.
+     * 
+     * Without a sequence number reply the trace range and the tap timing of the channels:
+     *   <hostname> trc <first seq> <end seq> <long ms>/<next ms> x3 ('-' for a disabled channel)
+     * With a sequence number reply up to MQTT_TRACE_CHUNK records starting at the seq,
+     * or at the oldest record kept if the seq has been overwritten:
+     *   <hostname> trc <seq> <8 hex digit record>...
+     * No records are returned for the end seq.
+     * 
+     * @param[in]   a_bChunk    True to reply the records, false to reply the range.
+     * @param[in]   a_nSeq      First record sequence number.
+     */
+    void PubTrace( bool a_bChunk, uint32_t a_nSeq );
+
+    /**
+     * Publish the flight recorder over the device management channel, see CFlightRec.
+     * 
+     * Without a sequence number reply the reset record and the event range:
+     *   <hostname> frc <boot cnt> <reset reason> <exception cause> <exception PC: 8 hex digits> <first seq> <end seq>
+     * With a sequence number reply up to MQTT_FLIGHT_REC_CHUNK events starting at the seq,
+     * or at the oldest event kept if the seq has been overwritten:
+     *   <hostname> frc <seq> <8 hex digit event>...
+     * 
+     * @param[in]   a_bChunk    True to reply the events, false to reply the reset record and the range.
+     * @param[in]   a_nSeq      First event sequence number.
+     */
+    void PubFlightRec( bool a_bChunk, uint32_t a_nSeq );
+
+    /**
+     * Publish the tap timing stats over the device management channel.
+     * 
+     * Without a channel reply the current thresholds and the learned timings of every enabled channel:
+     *   <hostname> tap <ch> tune:<0|1> long:<ms> next:<ms> press:<cnt>/<p50 ms>/<p95 ms> gap:<cnt>/<p50 ms>/<p95 ms>
+     * The gaps are the ones shorter than the max next tap delay.
+     * With a channel reply the press duration and gap histograms of the channel, trailing empty buckets omitted:
+     *   <hostname> tap <ch> press|gap <bucket ms> <cnt>,<cnt>...
+     * 
+     * @param[in]   a_nChan     Channel, MQTT_CHANNELS: all the channels.
+     */
+    void PubTapStats( uint8_t a_nChan );
+
+    /**
+     * Match a device management command addressed to the device: <cmd>/<hostname>[/<arg>].
+     * 
+     * @param[in]       a_pszCmd    Command
+     * @param[in]       a_nCmdLen   Command length
+     * @param[in,out]   payload     MQTT message payload, set to the argument if matched
+     * @param[in,out]   len         Length of the payload, set to the argument length (0:no argument) if matched
+     * 
+     * @return  true if matched.
+     */
+    bool MatchMgtCmd( const char* a_pszCmd, uint a_nCmdLen, byte*& payload, uint& len );
+
 
 
     /**
      * MQTT main loop function.
      * 
      * Test if the MQTT is enabled.
-     * If connected to MQTT server, publish the initial state and run MQTT main loop.
-     * If disconnected try to connect to the configured MQTT server.
-     * Upon connect subscribe to:
-     * 1. Device command subscription topic,
-     * 2. All channels command subsctiption topics, i.e. <device cmd sub topic> + "/ch#"",
-     * 3. Device private pub/sub topic,
+     * Apply the MQTT or WIFI config pushed, see OnCfgCmd().
+     * If connected to MQTT server, publish the initial state.
+     * If disconnected start a connection to the configured MQTT server, see OnConnect().
+     * Run MQTT main loop.
      * 
      * Note the function will take the configured WIFI client connection timeout time to exit in case the MQTT server is unavailable.
      */
     void loop();
 
+    /**
+     * MQTT connection established callback.
+     * 
+     * Subscribe to:
+     * 1. Device command subscription topic,
+     * 2. All channels command subsctiption topics, i.e. <device cmd sub topic> + "/ch#"",
+     * 3. Device private pub/sub topic,
+     * 4. Device management pub topic if an inventory candidate.
+     * Schedule the initial state publication.
+     */
+    void OnConnect();
+
     /**
      * MQTT cmd dispatcher callback.
      * 
+     * The topic and payload point into the MQTT client receive buffer and remain valid
+     * for the whole dispatch, even if a channel publishes its state in response.
+     * 
      * Dispatch the command received:
      * 1. Device cmd sub topic: MQTT_CMD_RESET,
      * 2. Device group pub sub topic: group cmds: MQTT_CMD_GRP_FWD_SHORT_TAP, MQTT_CMD_GRP_FWD_LONG_TAP, MQTT_CMD_GRP_TURN_OFF
-     * 3. Channel cmd sub topic: MQTT_CMD_CH_ON, MQTT_CMD_CH_OFF.
+     * 3. Device management pub topic (inventory candidates only): the discovery replies are collected, see CInventory,
+     *    an inventory reply cancels the one scheduled.
+     * 4. Channel cmd sub topic: MQTT_CMD_CH_ON, MQTT_CMD_CH_OFF - queued, coalesced by the channel.
      * 
      * @param[in]   topic       MQTT topic of the incoming cmd.
      * @param[in]   payload     Cmd payload.
@@ -227,16 +634,75 @@ public:
 
 protected:
     /**
-     * Construct the channel pub/sub topic name from the corresponding device topic name.
+     * Read the TLS configuration: BearSSL buffer sizes and the pinned server key.
+     * 
+     * The server is authenticated either by the SHA1 fingerprint of its certificate ("fp"),
+     * or by its public key read from a PEM file ("key").
+     * 
+     * @param[in]   a_rFile     Opened configuration file
+     * 
+     * @return  false if no pinned key is configured.
+     */
+    bool ReadCfgTls( File& a_rFile );
+
+    /**
+     * Construct the channel pub/sub topic name from the corresponding device topic name, store it in the config arena.
      * 
      * The channel topic name is the <device topic name> + "/ch#"".
      * 
      * @param[in]   a_nChannel      Channel: SW_CHANNEL_...
-     * @param[in]   a_rstrTopic     Device topic name.
+     * @param[in]   a_pszTopic      Device topic name.
      * 
      * @return  Channel topic name.
      */
-    String GetChannelTopic( char a_nChannel, String& a_rstrTopic );
+    const char* AddChannelTopic( char a_nChannel, const char* a_pszTopic );
+
+    /**
+     * Append formatted text to the management reply buffer, truncated to MQTT_REPLY_LEN.
+     * 
+     * @param[in]   a_nLen      Length of the reply so far
+     * @param[in]   a_pszFmt    printf format
+     * 
+     * @return  Length of the reply.
+     */
+    uint AddReply( uint a_nLen, const char* a_pszFmt, ... ) __attribute__(( format( printf, 3, 4 )));
+
+    /**
+     * Publish the heap stats over the management pub topic every configured period.
+     */
+    void PubHeap();
+
+    /**
+     * Publish a clock sync request over the management pub topic once due, see CClockSync:
+     *   <hostname> clk <request local ms>
+     * The reference clock replies with MQTT_CMD_MGT_CLOCK.
+     */
+    void PubClockReq();
+
+    /**
+     * Publish the group cmd latency stats, see CGrpTrace, a reply per origin:
+     *   <hostname> lat clk <synced> <offset ms> <rtt ms> <origins>
+     *   <hostname> lat <idx> <origin> <rx> <timed> <applied> <lost> net:<min>/<avg>/<max> app:... e2e:...
+     * 
+     * @param[in]   a_bClear    True if the stats are removed once sent
+     */
+    void PubLatency( bool a_bClear );
+
+
+
+    /**
+     * Publish a message with the configured QoS.
+     * 
+     * QoS 0 messages are sent immediately.
+     * QoS 1 messages are queued in the outbox and sent without waiting for the previous PUBACKs.
+     * 
+     * @param[in]   a_pszTopic  Topic to publish to.
+     * @param[in]   a_pszMsg    Message to publish.
+     * @param[in]   a_bRetained True if the message is retained.
+     * 
+     * @return  True if succesfully sent or queued.
+     */
+    bool Publish( const char* a_pszTopic, const char* a_pszMsg, bool a_bRetained );
 
 
 
@@ -266,24 +732,56 @@ protected:
 
 
     WiFiClient m_wc;        ///< WIFI client - controls connection timeout in the main loop function
-    PubSubClient m_mqtt;    ///< The MQTT client    
+    CTlsClient m_wcs;       ///< WIFI TLS client - used instead of m_wc if TLS is configured
+    BearSSL::PublicKey m_tlsKey;    ///< Configured pinned server public key
+    CMqttClient m_mqtt;     ///< The MQTT client
     bool m_bEnabled;        ///< True if MQTT is enabled
     bool m_bInitStatSent;   ///< True if the initial state is sent
+    bool m_bBatchDirty;     ///< True if the last batched channels state publication failed
+    uint8_t m_nBatchSent;   ///< Batched channels state sent last: 2 bits per channel, see PubBatchStat()
+    bool m_bConnected;      ///< True if connected - the connection loss is recorded once, see CFlightRec
     CTimer m_tmInitStat;    ///< Initial state send timer
-    byte* m_pPayloadBuf;    ///< Private buf for the received message in MQTT callback - see implementation for details
-    uint m_nPayloadBufLen;  ///< Length of the private buf for the received message in MQTT callback
+    CWiFiHelper* m_pWiFi;   ///< Attached WIFI helper
+    CManualSwitch* m_arrSwChans[ MQTT_CHANNELS ];   ///< Attached switch channels
+    CInputTrace* m_pTrace;  ///< Attached input trace
+    CScenes m_scenes;       ///< Scene presets
+    CCfgPush m_cfg;         ///< Config push
+    ECfgFile m_cfgReload;   ///< Config applied once the reply is sent: ECfgFile::eMqtt, ECfgFile::eWiFi, ECfgFile::eCnt: none
+    char m_szDirReply[ MQTT_DIR_REPLY_LEN ];    ///< Cached discovery reply
+    uint16_t m_nDirDelayMs; ///< Discovery reply delay - the device's slot in the jitter window
+    bool m_bDirPending;     ///< True if the discovery reply is scheduled
+    CTimer m_tmDir;         ///< Discovery reply timer
+    CInventory m_inv;       ///< Device inventory - inventory candidates only
+    bool m_bInvPending;     ///< True if the inventory reply is scheduled
+    ulong m_nInvDelayMs;    ///< Inventory reply delay
+    CTimer m_tmInv;         ///< Inventory reply timer
+    CLogSink m_log;         ///< Log sink
+    char m_szReply[ MQTT_REPLY_LEN ];   ///< Management reply - formatted in place, not on the heap
+    CTimer m_tmHeap;        ///< Heap stats timer
+    CGrpTrace m_grpTrace;   ///< Group cmd latency tracing
 
 
 
     // cfg:
-    String m_strServer;             ///< Configured MQTT server IP or hostname
-    String m_strClientId;           ///< Configured MQTT client id
+    CStrArena< MQTT_CFG_ARENA_LEN > m_arena;    ///< Config strings - the ones below
+    const char* m_pszServer;        ///< Configured MQTT server IP or hostname
+    const char* m_pszClientId;      ///< Configured MQTT client id
     uint16_t m_nPort;               ///< Configured MQTT service port
     uint16_t m_nConnTimeout;        ///< Configured WIFI connection timeout
+    uint8_t m_nPubQos;              ///< Configured QoS of the state and group messages: MQTT_QOS_AT_MOST_ONCE, MQTT_QOS_AT_LEAST_ONCE
+    uint8_t m_nProtoLevel;          ///< Configured MQTT protocol level: MQTT_CLIENT_V311, MQTT_CLIENT_V5
+    bool m_bBatchStat;              ///< Configured batched initial state publication
+    bool m_bTls;                    ///< Configured TLS connection
     ulong m_nInitStatDelayMs;       ///< Configured initial state pub delay (ms)
-    String m_strSubTopicCmd;        ///< Configured device cmd subscription topic
-    String m_strPubTopicStat;       ///< Configured device status publish topic
-    String m_strPubSubTopicGrp;     ///< Configured device group pub/sub topic
-    String m_strSubTopicMgt;        ///< Configured device management sub topic
-    String m_strPubTopicMgt;        ///< Configured device management pub topic
+    uint16_t m_nDirJitterMs;        ///< Configured discovery reply jitter window (ms), 0:disabled, default: MQTT_DIR_JITTER_MS
+    bool m_bInv;                    ///< Configured inventory candidate
+    ulong m_nHeapPeriodMs;          ///< Configured heap stats publication period (ms), 0: disabled, default: MQTT_HEAP_PERIOD_S
+    const char* m_pszSubTopicCmd;   ///< Configured device cmd subscription topic
+    const char* m_pszPubTopicStat;  ///< Configured device status publish topic
+    const char* m_pszPubSubTopicGrp;    ///< Configured device group pub/sub topic
+    const char* m_pszSubTopicMgt;   ///< Configured device management sub topic
+    const char* m_pszPubTopicMgt;   ///< Configured device management pub topic
+    const char* m_arrPubTopicChan[ MQTT_CHANNELS ]; ///< Channel status publish topics
+    const char* m_arrSubTopicChan[ MQTT_CHANNELS ]; ///< Channel cmd subscription topics
+    const char* m_pszPubTopicBatch; ///< Batched channels status publish topic
 };
@@ -0,0 +1,383 @@
+/**
+ * DIY Smart Home - light switch
+ * OTA FWU
+ * 2022 Łukasz Łasek
+ */
+#include "Ota.h"
+#include "FlightRec.h"
+#include "Log.h"
+#include "dbg.h"
+
+void COta::Begin( const char* a_pszHostname )
+{
+    if( IsActive())
+        Abort( UPDATE_ERROR_STREAM );
+    m_udp.begin( OTA_PORT );
+    MDNS.begin( a_pszHostname );
+    MDNS.enableArduino( OTA_PORT );
+    DBGLOG1( "OTA begin: %s\n", a_pszHostname );
+}
+
+void COta::loop()
+{
+    MDNS.update();
+    ulong nStartUs = micros();
+    switch( m_state )
+    {
+        case EState::eIdle:
+            if(( !m_udp.parsePacket()) || ( !Invite()))
+                return;
+            m_nMaxStepUs = 0;
+            break;
+
+        case EState::eVerify:
+            VerifySource();
+            break;
+
+        case EState::ePatch:
+            if( m_nChunkLen )
+                ApplyPatch();   // the chunk is not fully consumed yet
+            else
+                Receive();
+            break;
+
+        default:
+            Receive();
+            break;
+    }
+    m_nMaxStepUs = max( m_nMaxStepUs, micros() - nStartUs );
+}
+
+String COta::GetStats()
+{
+    char szStats[ 112 ];
+    snprintf( szStats, sizeof( szStats ), "%s %u/%u out:%u step:%lu sec:%u/%u fail:%u/%u%s",
+        ( IsActive()) ? "recv" : "idle", m_nRecv, m_nSize, m_nOut, m_nMaxStepUs,
+        m_nSectorsWritten, m_nSectorsSkipped, m_nFails, m_nLastErr, ( m_bFsCorrupt ) ? " fs:corrupt" : "" );
+    return String( szStats );
+}
+
+bool COta::Invite()
+{
+    char szInvite[ OTA_INVITE_LEN + 1 ];
+    int nLen = m_udp.read( szInvite, OTA_INVITE_LEN );
+    szInvite[ max( nLen, 0 )] = 0;
+    int nCmd;
+    uint nPort;
+    uint nSize;
+    if(( sscanf( szInvite, "%d %u %u %32s", &nCmd, &nPort, &nSize, m_szMd5 ) != 4 ) || ( strlen( m_szMd5 ) != 2 * DELTA_MD5_LEN ) ||
+        (( nCmd != U_FLASH ) && ( nCmd != U_FS )) || ( !nSize ))
+    {
+        return false;   // includes U_AUTH - no password is configured
+    }
+
+    IPAddress ip = m_udp.remoteIP();
+    m_udp.beginPacket( ip, m_udp.remotePort());
+    m_udp.print( "OK" );
+    m_udp.endPacket();
+
+    m_client.setTimeout( OTA_CONN_TIMEOUT_MS );
+    if( !m_client.connect( ip, nPort ))
+    {
+        m_nFails++;
+        m_nLastErr = UPDATE_ERROR_STREAM;
+        return false;
+    }
+    m_client.setNoDelay( true );
+    m_nCmd = nCmd;
+    m_nSize = nSize;
+    m_nRecv = 0;
+    m_nOut = 0;
+    m_nChunkPos = m_nChunkLen = 0;
+    m_nSectorsWritten = m_nSectorsSkipped = 0;
+    m_state = EState::eStart;
+    m_nLastRxMs = millis();
+    CFlightRec::Add( EFrEvent::eOta );
+    DBGLOG2( "OTA %s %u\n", ( nCmd == U_FLASH ) ? "flash" : "fs", nSize );
+    LOGI( "ota %s %u", ( nCmd == U_FLASH ) ? "flash" : "fs", nSize );
+    return true;
+}
+
+void COta::Receive()
+{
+    int nAvail = m_client.available();
+    if(( nAvail <= 0 ) || (( m_state == EState::eStart ) && ( nAvail < DELTA_MAGIC_LEN ) && ( (uint)nAvail < m_nSize )))
+    {
+        if(( !m_client.connected()) || ( millis() - m_nLastRxMs > OTA_DATA_TIMEOUT_MS ))
+            Abort( UPDATE_ERROR_STREAM );
+        return;
+    }
+
+    int nLen = m_client.read( m_arrChunk, min( nAvail, OTA_CHUNK_LEN ));
+    if(( nLen <= 0 ) || ( m_nRecv + nLen > m_nSize ))
+    {
+        Abort( UPDATE_ERROR_STREAM );
+        return;
+    }
+    m_nRecv += nLen;
+    m_nLastRxMs = millis();
+
+    if( m_state == EState::eStart )
+    {
+        if( CDeltaPatch::IsPatch( m_arrChunk, nLen ))
+        {
+            m_patch.Begin(
+                [ this ]( uint32_t a_nOffs, uint8_t* a_pBuf, size_t a_nLen )
+                {
+                    // FS: a compressed image only, see ApplyPatch():
+                    return ( m_nCmd == U_FLASH ) && ( ESP.flashRead( a_nOffs, a_pBuf, a_nLen ));
+                },
+                [ this ]( const uint8_t* a_pBuf, size_t a_nLen )
+                {
+                    return WriteImage( a_pBuf, a_nLen );
+                });
+            m_state = EState::ePatch;
+        }
+        else if( StartImage( m_nSize ))
+        {
+            m_state = EState::eImage;
+        }
+        else
+        {
+            return;
+        }
+    }
+
+    if( m_state == EState::ePatch )
+    {
+        m_nChunkPos = 0;
+        m_nChunkLen = nLen;
+        ApplyPatch();
+        return;
+    }
+
+    if( !WriteImage( m_arrChunk, nLen ))
+        return;
+    m_client.print( nLen );
+    if( m_nRecv == m_nSize )
+        EndImage();
+}
+
+bool COta::StartImage( uint32_t a_nSize )
+{
+    if( m_nCmd == U_FLASH )
+    {
+        if( !Update.begin( a_nSize, U_FLASH ))
+        {
+            Abort( Update.getError());
+            return false;
+        }
+        Update.setMD5( m_szMd5 );
+        return true;
+    }
+
+    // FS: written in place, the MD5 is verified at the end:
+    if( a_nSize > FS_PHYS_SIZE )
+    {
+        Abort( UPDATE_ERROR_SPACE );
+        return false;
+    }
+    m_pSector = new uint32_t[ FLASH_SECTOR_SIZE / 4 ];
+    m_nFsAddr = FS_PHYS_ADDR;
+    m_nSectorLen = 0;
+    m_md5.begin();
+    return true;
+}
+
+bool COta::WriteImage( const uint8_t* a_pData, size_t a_nLen )
+{
+    m_nOut += a_nLen;
+    if( m_nCmd == U_FLASH )
+    {
+        if( Update.write((uint8_t*)a_pData, a_nLen ) == a_nLen )
+            return true;
+        Abort( Update.getError());
+        return false;
+    }
+
+    m_md5.add( a_pData, a_nLen );
+    while( a_nLen )
+    {
+        size_t nLen = min( a_nLen, (size_t)( FLASH_SECTOR_SIZE - m_nSectorLen ));
+        memcpy((uint8_t*)m_pSector + m_nSectorLen, a_pData, nLen );
+        m_nSectorLen += nLen;
+        a_pData += nLen;
+        a_nLen -= nLen;
+        if(( m_nSectorLen == FLASH_SECTOR_SIZE ) && ( !FlushSector()))
+            return false;
+    }
+    return true;
+}
+
+void COta::EndImage()
+{
+    if( m_nCmd == U_FLASH )
+    {
+        if( !Update.end())
+        {
+            Abort( Update.getError());
+            return;
+        }
+    }
+    else
+    {
+        if(( m_nSectorLen ) && ( !FlushSector()))
+            return;
+        m_md5.calculate();
+        if( strcasecmp( m_md5.toString().c_str(), m_szMd5 ))
+        {
+            Abort( OTA_ERROR_MD5 );
+            return;
+        }
+        delete[] m_pSector;
+        m_pSector = nullptr;
+        m_bFsCorrupt = false;
+    }
+
+    m_client.print( "OK" );
+    m_client.stop();
+    m_state = EState::eIdle;
+    DBGLOG3( "OTA end: max step %lu us, sectors %u/%u\n", m_nMaxStepUs, m_nSectorsWritten, m_nSectorsSkipped );   // will reboot
+    delay( 10 );
+    CFlightRec::Add( EFrEvent::eReset, (uint16_t)EFrReset::eOta );
+    ESP.restart();
+}
+
+bool COta::FlushSector()
+{
+    // The partial last sector is padded as erased:
+    memset((uint8_t*)m_pSector + m_nSectorLen, 0xff, FLASH_SECTOR_SIZE - m_nSectorLen );
+    uint32_t arrFlash[ DELTA_COPY_BUF_LEN / 4 ];
+    bool bSame = true;
+    for( uint16_t nOffs = 0; ( bSame ) && ( nOffs < FLASH_SECTOR_SIZE ); nOffs += DELTA_COPY_BUF_LEN )
+    {
+        bSame = ( ESP.flashRead( m_nFsAddr + nOffs, (uint8_t*)arrFlash, DELTA_COPY_BUF_LEN )) &&
+            ( !memcmp( arrFlash, (uint8_t*)m_pSector + nOffs, DELTA_COPY_BUF_LEN ));
+    }
+    if( bSame )
+    {
+        m_nSectorsSkipped++;
+    }
+    else
+    {
+        if(( !ESP.flashEraseSector( m_nFsAddr / FLASH_SECTOR_SIZE )) || ( !ESP.flashWrite( m_nFsAddr, m_pSector, FLASH_SECTOR_SIZE )))
+        {
+            Abort( OTA_ERROR_FLASH );
+            return false;
+        }
+        m_nSectorsWritten++;
+    }
+    m_nFsAddr += FLASH_SECTOR_SIZE;
+    m_nSectorLen = 0;
+    return true;
+}
+
+void COta::VerifySource()
+{
+    const SDeltaHeader& rHdr = m_patch.GetHeader();
+    uint32_t nBase = ( m_nCmd == U_FLASH ) ? 0 : FS_PHYS_ADDR;
+    uint32_t nEnd = min( m_nVerifyPos + FLASH_SECTOR_SIZE, rHdr.nSrcSize );
+    uint32_t arrBuf[ DELTA_COPY_BUF_LEN / 4 ];
+    while( m_nVerifyPos < nEnd )
+    {
+        uint16_t nLen = min( nEnd - m_nVerifyPos, (uint32_t)DELTA_COPY_BUF_LEN );
+        if( !ESP.flashRead( nBase + m_nVerifyPos, (uint8_t*)arrBuf, nLen ))
+        {
+            Abort( OTA_ERROR_SOURCE );
+            return;
+        }
+        m_md5.add((uint8_t*)arrBuf, nLen );
+        m_nVerifyPos += nLen;
+    }
+    if( m_nVerifyPos < rHdr.nSrcSize )
+        return;
+
+    uint8_t arrMd5[ DELTA_MD5_LEN ];
+    m_md5.calculate();
+    m_md5.getBytes( arrMd5 );
+    if( memcmp( arrMd5, rHdr.arrSrcMd5, DELTA_MD5_LEN ))
+    {
+        Abort( OTA_ERROR_SOURCE );
+        return;
+    }
+    for( uint8_t nIdx = 0; nIdx < DELTA_MD5_LEN; nIdx++ )
+        snprintf( m_szMd5 + 2 * nIdx, 3, "%02x", rHdr.arrDstMd5[ nIdx ]);
+    if( StartImage( rHdr.nDstSize ))
+        m_state = EState::ePatch;
+}
+
+void COta::ApplyPatch()
+{
+    bool bHeader = m_patch.HasHeader();
+    m_nChunkPos += m_patch.Apply( m_arrChunk + m_nChunkPos, m_nChunkLen - m_nChunkPos, OTA_CHUNK_LEN );
+    if( !IsActive())
+        return;     // aborted by the image write
+    if( m_patch.GetState() == CDeltaPatch::EState::eError )
+    {
+        Abort( OTA_ERROR_PATCH );
+        return;
+    }
+
+    if(( !bHeader ) && ( m_patch.HasHeader()))
+    {
+        // Check the header, verify the source before writing anything - FS: no source, it is overwritten in place:
+        const SDeltaHeader& rHdr = m_patch.GetHeader();
+        uint32_t nSrcMax = ( m_nCmd == U_FLASH ) ? ESP.getSketchSize() : 0;
+        if(( rHdr.nCmd != m_nCmd ) || ( rHdr.nSrcSize > nSrcMax ))
+        {
+            Abort( OTA_ERROR_SOURCE );
+            return;
+        }
+        m_nVerifyPos = 0;
+        m_md5.begin();
+        m_state = EState::eVerify;
+        return;
+    }
+
+    if( m_nChunkPos < m_nChunkLen )
+        return;
+    m_client.print( m_nChunkLen );
+    m_nChunkPos = m_nChunkLen = 0;
+    if( m_patch.GetState() == CDeltaPatch::EState::eDone )
+    {
+        if( m_nRecv != m_nSize )
+        {
+            Abort( OTA_ERROR_PATCH );   // trailing bytes
+            return;
+        }
+        EndImage();
+    }
+    else if( m_nRecv == m_nSize )
+    {
+        Abort( OTA_ERROR_PATCH );       // truncated
+    }
+}
+
+void COta::Abort( uint8_t a_nErr )
+{
+    m_nFails++;
+    m_nLastErr = a_nErr;
+    if( Update.isRunning())
+        Update.end();   // incomplete: the update is abandoned
+    delete[] m_pSector;
+    m_pSector = nullptr;
+    if( m_client.connected())
+    {
+        char szReply[ 8 ];
+        snprintf( szReply, sizeof( szReply ), "ERR %u", a_nErr );
+        m_client.print( szReply );
+    }
+    m_client.stop();
+    m_state = EState::eIdle;
+    CFlightRec::Add( EFrEvent::eOta, a_nErr );
+    DBGLOG1( "OTA err %u\n", a_nErr );
+    LOGE( "ota err %u", a_nErr );
+
+    // The MD5 failed or the sectors written so far mix the target and the previous FS:
+    if(( m_nCmd == U_FS ) && (( m_nSectorsWritten ) || ( a_nErr == OTA_ERROR_MD5 )))
+    {
+        m_bFsCorrupt = true;
+        CFlightRec::Add( EFrEvent::eOta, OTA_ERROR_FS_CORRUPT );
+        LOGE( "ota fs corrupt" );
+    }
+}
@@ -0,0 +1,214 @@
+/**
+ * DIY Smart Home - light switch
+ * OTA FWU
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <ESP8266mDNS.h>
+#include <WiFiUdp.h>
+#include <Updater.h>
+#include <MD5Builder.h>
+#include <flash_hal.h>
+
+#include "DeltaPatch.h"
+
+
+
+/// OTA invitation UDP port - same as ArduinoOTA
+#define OTA_PORT            8266
+
+/// Max image bytes written per loop iteration - one TCP segment, so an iteration flushes one flash sector at most
+#define OTA_CHUNK_LEN       1460
+
+/// Max invitation length: <cmd> <port> <size> <md5>
+#define OTA_INVITE_LEN      64
+
+/// Uploader connection timeout in ms - blocks the loop iteration accepting the invitation
+#define OTA_CONN_TIMEOUT_MS 1000
+
+/// Image data timeout in ms - a stalled update is abandoned
+#define OTA_DATA_TIMEOUT_MS 10000
+
+/// Error: the patch source differs from the running image, or an FS patch with a source - a full image is needed
+#define OTA_ERROR_SOURCE    0x80
+
+/// Error: malformed patch
+#define OTA_ERROR_PATCH     0x81
+
+/// Error: FS image MD5 mismatch
+#define OTA_ERROR_MD5       0x82
+
+/// Error: FS flash write failed
+#define OTA_ERROR_FLASH     0x83
+
+/// Error: the FS is left partially rewritten by the update abandoned - a full FS image is needed
+#define OTA_ERROR_FS_CORRUPT    0x84
+
+static_assert( OTA_CHUNK_LEN < FLASH_SECTOR_SIZE, "OTA_CHUNK_LEN too big" );
+
+
+
+/**
+ * Non-blocking OTA FWU class.
+ * 
+ * Receives a firmware or filesystem image pushed by espota (upload_protocol = espota), like ArduinoOTA,
+ * but from the main loop instead of blocking in it: each loop iteration writes one chunk of the image
+ * (OTA_CHUNK_LEN max) to the flash, so the switches keep handling the taps and the MQTT cmds between
+ * the flash sector writes. The worst case loop iteration is a single sector erase and write.
+ * 
+ * Protocol (espota, no password):
+ * 1. UDP invitation: <cmd: U_FLASH|U_FS> <uploader TCP port> <image size> <image MD5>, reply: OK or ERR.
+ * 2. TCP connection to the uploader, the image is received and every chunk consumed is acked with its length.
+ * 3. The image MD5 is verified: reply OK and reboot, otherwise ERR.
+ * A failed or stalled update is abandoned - the device carries on with the current FW.
+ * 
+ * Instead of an image the uploader may send a delta patch (see CDeltaPatch, tools/swota) against the running
+ * FW image, or a compressed image (a patch without a source) of either partition. The source MD5 of the patch
+ * is verified first, a sector per loop iteration, the mismatch is reported as OTA_ERROR_SOURCE before anything
+ * is written. The rebuilt FW image is verified by the Updater before switching to it.
+ * 
+ * The FS image is written in place - there is no room for a second copy: the sectors already holding the target
+ * data are not erased nor written, which saves the flash wear of the mostly unchanged FS images. Its MD5 is known
+ * only at the end, so an FS patch with a source (the live FS being overwritten) is refused with OTA_ERROR_SOURCE.
+ * An FS update abandoned after a sector was written, or failing the MD5, leaves the FS corrupt: reported by
+ * GetStats() and the flight recorder (OTA_ERROR_FS_CORRUPT) until a full FS image is received.
+ */
+class COta
+{
+public:
+    /**
+     * Update state.
+     */
+    enum class EState : uint8_t
+    {
+        eIdle,      ///< Waiting for an invitation
+        eStart,     ///< Connected, waiting for the first image bytes
+        eImage,     ///< Receiving the image
+        eVerify,    ///< Verifying the patch source
+        ePatch      ///< Receiving and applying the patch
+    };
+
+    COta() : m_state( EState::eIdle ), m_nChunkPos( 0 ), m_nChunkLen( 0 ), m_pSector( nullptr ), m_nLastRxMs( 0 ),
+        m_nMaxStepUs( 0 ), m_nSectorsWritten( 0 ), m_nSectorsSkipped( 0 ), m_nFails( 0 ), m_nLastErr( 0 ), m_bFsCorrupt( false ) {}
+
+    /**
+     * Start listening for the invitations, announce the OTA service over mDNS.
+     * 
+     * Called on every WIFI (re)connect, abandons an update in progress.
+     * 
+     * @param[in]   a_pszHostname   mDNS host name
+     */
+    void Begin( const char* a_pszHostname );
+
+    /**
+     * Main loop function.
+     * 
+     * Accept an invitation, verify the next source sector or write the next chunk of the image.
+     */
+    void loop();
+
+    /**
+     * Check if an update is in progress.
+     */
+    bool IsActive()
+    {
+        return m_state != EState::eIdle;
+    }
+
+    /**
+     * Check if the FS is left corrupt by an FS update abandoned - a full FS image is needed.
+     */
+    bool IsFsCorrupt()
+    {
+        return m_bFsCorrupt;
+    }
+
+    /**
+     * Get the update stats.
+     * 
+     * @return  <idle|recv> <bytes received>/<upload size> out:<image bytes written> step:<max loop iteration us>
+     *          sec:<FS sectors written>/<skipped> fail:<cnt>/<last UPDATE_ERROR_..., OTA_ERROR_...>[ fs:corrupt]
+     */
+    String GetStats();
+
+private:
+    /**
+     * Accept the received invitation and connect to the uploader.
+     * 
+     * @return  false if the invitation is malformed or the uploader is unreachable.
+     */
+    bool Invite();
+
+    /**
+     * Receive the next chunk, pick the image or the patch mode with the first one.
+     */
+    void Receive();
+
+    /**
+     * Start writing the target image, m_szMd5 is its MD5.
+     * 
+     * @param[in]   a_nSize     Image size
+     * 
+     * @return  false on an error.
+     */
+    bool StartImage( uint32_t a_nSize );
+
+    /**
+     * Write the target image bytes: FW - via the Updater, FS - in place, sector by sector.
+     */
+    bool WriteImage( const uint8_t* a_pData, size_t a_nLen );
+
+    /**
+     * Verify and finish the target image, reboot if successful.
+     */
+    void EndImage();
+
+    /**
+     * Write the buffered FS sector unless the flash already holds it.
+     */
+    bool FlushSector();
+
+    /**
+     * Verify the next sector of the patch source.
+     */
+    void VerifySource();
+
+    /**
+     * Apply the pending patch bytes, up to OTA_CHUNK_LEN image bytes.
+     */
+    void ApplyPatch();
+
+    /**
+     * Abandon the update in progress.
+     * 
+     * @param[in]   a_nErr  Error: UPDATE_ERROR_..., OTA_ERROR_...
+     */
+    void Abort( uint8_t a_nErr );
+
+    WiFiUDP m_udp;                          ///< Invitation socket
+    WiFiClient m_client;                    ///< Uploader connection
+    uint8_t m_arrChunk[ OTA_CHUNK_LEN ];    ///< Received chunk
+    EState m_state;                         ///< Update state
+    uint8_t m_nCmd;                         ///< Partition: U_FLASH, U_FS
+    uint32_t m_nSize;                       ///< Upload size
+    uint32_t m_nRecv;                       ///< Upload bytes received
+    char m_szMd5[ 2 * DELTA_MD5_LEN + 1 ];  ///< Upload MD5, then the target image MD5 - hex
+    uint16_t m_nChunkPos;                   ///< Patch bytes of the chunk consumed
+    uint16_t m_nChunkLen;                   ///< Chunk length
+    CDeltaPatch m_patch;                    ///< Patch decoder
+    MD5Builder m_md5;                       ///< Patch source or FS image MD5
+    uint32_t m_nVerifyPos;                  ///< Patch source bytes verified
+    uint32_t m_nOut;                        ///< Target image bytes written
+    uint32_t* m_pSector;                    ///< FS sector buffer - allocated for an FS update
+    uint32_t m_nFsAddr;                     ///< FS flash address of the buffered sector
+    uint16_t m_nSectorLen;                  ///< Bytes in the sector buffer
+    ulong m_nLastRxMs;                      ///< Timestamp of the last image chunk
+    ulong m_nMaxStepUs;                     ///< Longest loop iteration of the last update in us
+    uint16_t m_nSectorsWritten;             ///< FS sectors written by the last update
+    uint16_t m_nSectorsSkipped;             ///< FS sectors already holding the target data
+    uint16_t m_nFails;                      ///< Number of the updates abandoned
+    uint8_t m_nLastErr;                     ///< Error of the last update abandoned: UPDATE_ERROR_..., OTA_ERROR_...
+    bool m_bFsCorrupt;                      ///< FS partially rewritten by an FS update abandoned
+};
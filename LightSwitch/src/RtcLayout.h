@@ -0,0 +1,33 @@
+/**
+ * DIY Smart Home - light switch
+ * RTC user memory layout
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include "TlsClient.h"
+#include "FlightRec.h"
+
+
+
+// The RTC user memory survives a reset, but not a power loss.
+// It is addressed in 4-byte blocks: 128 blocks, the first 32 blocks are reserved for the OTA FWU.
+
+/// Number of the RTC user memory blocks
+#define RTC_USER_BLOCKS         128
+
+/// TLS session cache - offset
+#define RTC_TLS_SESSION_OFFS    32
+
+/// TLS session cache - size
+#define RTC_TLS_SESSION_BLOCKS  TLS_CLIENT_RTC_BLOCKS
+
+/// Flight recorder - offset
+#define RTC_FLIGHT_REC_OFFS     ( RTC_TLS_SESSION_OFFS + RTC_TLS_SESSION_BLOCKS )
+
+/// Flight recorder - size
+#define RTC_FLIGHT_REC_BLOCKS   FLIGHT_REC_BLOCKS
+
+/// First free block
+#define RTC_FREE_OFFS           ( RTC_FLIGHT_REC_OFFS + RTC_FLIGHT_REC_BLOCKS )
+
+static_assert( RTC_FREE_OFFS <= RTC_USER_BLOCKS, "Review the RTC user memory layout" );
@@ -0,0 +1,78 @@
+/**
+ * DIY Smart Home - light switch
+ * Scenes
+ * 2022 Łukasz Łasek
+ */
+#include <LittleFS.h>
+
+#include "Scenes.h"
+#include "Mqtt.h"
+#include "CfgUtils.h"
+#include "StringUtils.h"
+#include "dbg.h"
+
+bool CScenes::ReadCfg( const char* a_pszPath )
+{
+    memset( m_arrbValid, 0, sizeof( m_arrbValid ));
+    File file = LittleFS.open( a_pszPath, "r" );
+    if( !file )
+    {
+        DBGLOG( "scn cfg missing" );
+        return false;
+    }
+
+    bool bRet = true;
+    for( uint8_t nPreset = 0; nPreset < SCENE_PRESETS; nPreset++ )
+    {
+        String strName( "scn" );
+        strName += nPreset;
+        String strScene = CConfigUtils::ReadValue( file, strName.c_str());
+        m_arrbValid[ nPreset ] = Parse((const byte*)strScene.c_str(), strScene.length(), m_arrPresets[ nPreset ]);
+        bRet &= ( m_arrbValid[ nPreset ]) || ( strScene.isEmpty()) || ( strScene == "-" );
+        DBGLOG3( "scn%u:%u '%s'\n", nPreset, m_arrbValid[ nPreset ], strScene.c_str());
+    }
+    return bRet;
+}
+
+const SScene* CScenes::Get( uint16_t a_nPreset )
+{
+    return (( a_nPreset < SCENE_PRESETS ) && ( m_arrbValid[ a_nPreset ])) ? &m_arrPresets[ a_nPreset ] : nullptr;
+}
+
+bool CScenes::Parse( const byte* payload, uint len, SScene& a_rScene )
+{
+    // <mask>/<on mask>[/<auto-off secs>]:
+    if(( len < 2 * MQTT_CMD_MASK_LEN + 1 ) || ( payload[ MQTT_CMD_MASK_LEN ] != MQTT_CMD_SEPARATOR[ 0 ]))
+    {
+        return false;
+    }
+    for( uint nIdx = 0; nIdx < 2 * MQTT_CMD_MASK_LEN + 1; nIdx += MQTT_CMD_MASK_LEN + 1 )
+    {
+        if(( payload[ nIdx ] != '0' ) || ( payload[ nIdx + 1 ] != 'x' ))
+        {
+            return false;
+        }
+        for( uint nDigit = 2; nDigit < MQTT_CMD_MASK_LEN; nDigit++ )
+        {
+            if( !isxdigit( payload[ nIdx + nDigit ]))
+            {
+                return false;
+            }
+        }
+    }
+    a_rScene.nMask = CStringUtils::MaskToU64_16( payload );
+    a_rScene.nOnMask = CStringUtils::MaskToU64_16( payload + MQTT_CMD_MASK_LEN + 1 );
+    a_rScene.nAutoOffSecs = 0;
+    if( len > 2 * MQTT_CMD_MASK_LEN + 1 )
+    {
+        byte* pSecs = (byte*)payload + 2 * MQTT_CMD_MASK_LEN + 2;
+        uint nSecsLen = len - 2 * MQTT_CMD_MASK_LEN - 2;
+        if(( payload[ 2 * MQTT_CMD_MASK_LEN + 1 ] != MQTT_CMD_SEPARATOR[ 0 ]) || ( !CStringUtils::IsU32_10( pSecs, nSecsLen, 5 ))
+            || ( CStringUtils::AtoU32_10( pSecs, nSecsLen ) > UINT16_MAX ))
+        {
+            return false;
+        }
+        a_rScene.nAutoOffSecs = CStringUtils::AtoU32_10( pSecs, nSecsLen );
+    }
+    return true;
+}
@@ -0,0 +1,79 @@
+/**
+ * DIY Smart Home - light switch
+ * Scenes
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+
+
+
+/// Config file path
+#define FS_SCN_CFG          "scn_cfg"
+
+/// Number of the scene presets
+#define SCENE_PRESETS       8
+
+
+
+/**
+ * Scene: the target state of the addressed switch channels.
+ */
+struct SScene
+{
+    uint64_t nMask;         ///< Addressed channel ids
+    uint64_t nOnMask;       ///< Channel ids turned on, the other addressed ones are turned off
+    uint16_t nAutoOffSecs;  ///< Auto-off timer of the channels turned on, 0:disabled
+};
+
+
+
+/**
+ * Scene presets class.
+ * 
+ * A scene sets the on/off state of many switch channels, possibly on many devices, with a single
+ * group command: MQTT_CMD_GRP_SCENE carries the scene, MQTT_CMD_GRP_SCENE_RECALL the number of a preset
+ * stored on the devices. All the addressed channels of a device apply the scene in the same loop iteration.
+ * 
+ * The scene format (both the group command and the preset): <mask>/<on mask>[/<auto-off secs>],
+ * the masks are 64-bit hexadecimal (0x0123456789abcdef) channel id masks.
+ * The presets are configured in the scn_cfg file: scn0..scn7, - disabled.
+ */
+class CScenes
+{
+public:
+    CScenes() : m_arrbValid() {}
+
+    /**
+     * Read the configuration file. Missing file - no presets.
+     * 
+     * @param[in]   a_pszPath   Configuration file
+     * 
+     * @return  false if the file is missing or a preset is invalid (disabled).
+     */
+    bool ReadCfg( const char* a_pszPath = FS_SCN_CFG );
+
+    /**
+     * Get a preset.
+     * 
+     * @param[in]   a_nPreset   Preset number
+     * 
+     * @return  Scene, nullptr if not configured.
+     */
+    const SScene* Get( uint16_t a_nPreset );
+
+    /**
+     * Parse a scene.
+     * 
+     * @param[in]   payload     Scene: <mask>/<on mask>[/<auto-off secs>]
+     * @param[in]   len         Length of the scene
+     * @param[out]  a_rScene    Parsed scene
+     * 
+     * @return  false if the scene is malformed.
+     */
+    static bool Parse( const byte* payload, uint len, SScene& a_rScene );
+
+private:
+    SScene m_arrPresets[ SCENE_PRESETS ];   ///< Presets
+    bool m_arrbValid[ SCENE_PRESETS ];      ///< Configured presets
+};
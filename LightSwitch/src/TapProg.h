@@ -0,0 +1,318 @@
+/**
+ * DIY Smart Home - light switch
+ * Tap program
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+
+#include "Mqtt.h"
+#include "Scenes.h"
+#include "StringUtils.h"
+
+
+
+/// Max number of the instructions of all the tap programs of a channel, including the end instructions
+#define TAP_PROG_LEN        32
+
+/// Max number of the distinct group masks of all the tap programs of a channel
+#define TAP_PROG_MASKS      8
+
+/// No program - entry of a disabled tap event
+#define TAP_PROG_NONE       0xff
+
+/// Max length of a program source token
+#define TAP_PROG_TOKEN_LEN  MQTT_CMD_MASK_LEN
+
+static_assert( TAP_PROG_LEN < TAP_PROG_NONE, "TAP_PROG_LEN too big" );
+
+
+
+/**
+ * Tap program operation.
+ */
+enum class ETapOp : uint8_t
+{
+    eEnd,       ///< End of the program
+    eOn,        ///< Turn the output on with the armed auto-off timer
+    eOff,       ///< Turn the output off
+    eToggle,    ///< Toggle the output, turn on with the armed auto-off timer
+    eArm,       ///< Arm the auto-off timer: arg - secs per timer step, max( 1, taps# - 1 ) steps
+    eTurnOff,   ///< Send MQTT_CMD_GRP_TURN_OFF to the mask
+    eFwdShort,  ///< Send MQTT_CMD_GRP_FWD_SHORT_TAP with the taps# to the mask
+    eFwdLong,   ///< Send MQTT_CMD_GRP_FWD_LONG_TAP with the taps# to the mask
+    eScene,     ///< Send MQTT_CMD_GRP_SCENE_RECALL: arg - scene preset
+    eIfOn,      ///< Execute the next instruction only if the output was on before the program
+    eIfOff      ///< Execute the next instruction only if the output was off before the program
+};
+
+/**
+ * Tap program instruction - the operands are parsed at compile time.
+ */
+struct STapInsn
+{
+    ETapOp op;          ///< Operation
+    uint8_t nMask;      ///< Group mask index
+    uint16_t nArg;      ///< Numeric argument
+};
+
+
+
+/**
+ * Tap program class.
+ * 
+ * Holds the compiled tap programs of all the tap events of a channel: the instructions in one array,
+ * each program terminated with ETapOp::eEnd, and the pool of the group masks the instructions refer to.
+ * The programs are compiled once from the cfg, so executing a tap neither parses nor allocates.
+ * 
+ * Program source: space separated instructions:
+ * 1. on, off, tgl - turn the output on/off, toggle it.
+ * 2. arm <secs> - arm the auto-off timer of the following on/tgl for max( 1, taps# - 1 ) * secs.
+ * 3. tof <mask>, fst <mask>, flt <mask> - send the group command (MQTT_CMD_GRP_*) to the 64-bit hex mask.
+ *    scr <preset> - recall the scene preset on all the devices, see CScenes.
+ * 4. ifon, ifof - execute the next instruction only if the output was on/off before the program.
+ * e.g.: "ifof arm 600 tgl ifof tof 0x0000000000000006" - toggle, when turning on: with a 10 min auto-off
+ * and turn off the switches id 2, 3.
+ */
+class CTapProg
+{
+public:
+    CTapProg() { Clear(); }
+
+    /**
+     * Remove all the programs.
+     */
+    void Clear()
+    {
+        m_nLen = 0;
+        m_nMasks = 0;
+    }
+
+    /**
+     * Compile a program.
+     * 
+     * @param[in]   a_pszSrc        Program source
+     * @param[in]   a_nSelfMask     Bits cleared in all the masks - the channel's own id
+     * 
+     * @return  Program entry, TAP_PROG_NONE if the source is invalid or there is no room left.
+     *          Nothing is added in such a case.
+     */
+    uint8_t Compile( const char* a_pszSrc, uint64_t a_nSelfMask )
+    {
+        uint8_t nEntry = m_nLen;
+        uint8_t nMasks = m_nMasks;
+        bool bGuard = false;    // the previous instruction is a condition
+        char szToken[ TAP_PROG_TOKEN_LEN + 1 ];
+        const char* pc = a_pszSrc;
+        while( NextToken( pc, szToken ))
+        {
+            const SOpDef* pDef = FindOp( szToken );
+            if( !pDef )
+                return Rollback( nEntry, nMasks );
+            STapInsn insn = { pDef->op, 0, 0 };
+            bool bOk = true;
+            switch( pDef->operand )
+            {
+                case EOperand::eSecs:
+                    bOk = ( NextToken( pc, szToken )) && ( ParseNum( szToken, UINT16_MAX, insn.nArg ));
+                    break;
+
+                case EOperand::eScene:
+                    bOk = ( NextToken( pc, szToken )) && ( ParseNum( szToken, SCENE_PRESETS - 1, insn.nArg ));
+                    break;
+
+                case EOperand::eMask:
+                    bOk = ( NextToken( pc, szToken )) && ( AddMask( szToken, a_nSelfMask, insn.nMask ));
+                    break;
+
+                default:
+                    break;
+            }
+            if(( !bOk ) || ( m_nLen >= TAP_PROG_LEN - 1 ))
+                return Rollback( nEntry, nMasks );
+            m_arrInsns[ m_nLen++ ] = insn;
+            bGuard = ( insn.op == ETapOp::eIfOn ) || ( insn.op == ETapOp::eIfOff );
+        }
+        if(( m_nLen == nEntry ) || ( bGuard ))
+            return Rollback( nEntry, nMasks );    // empty or a dangling condition
+        m_arrInsns[ m_nLen++ ] = { ETapOp::eEnd, 0, 0 };
+        return nEntry;
+    }
+
+    /**
+     * Get an instruction.
+     * 
+     * @param[in]   a_nPc   Instruction index - a program entry or the following ones up to its end
+     */
+    const STapInsn& GetInsn( uint8_t a_nPc )
+    {
+        return m_arrInsns[ a_nPc ];
+    }
+
+    /**
+     * Get a group mask of an instruction.
+     */
+    uint64_t GetMask( const STapInsn& a_rInsn )
+    {
+        return m_arrMasks[ a_rInsn.nMask ];
+    }
+
+    /**
+     * Get the number of the instructions used, including the end instructions.
+     */
+    uint8_t GetLen()
+    {
+        return m_nLen;
+    }
+
+    /**
+     * Get the number of the group masks used.
+     */
+    uint8_t GetMasks()
+    {
+        return m_nMasks;
+    }
+
+private:
+    /**
+     * Operand kind of an operation.
+     */
+    enum class EOperand : uint8_t
+    {
+        eNone,
+        eSecs,  ///< Number of seconds
+        eScene, ///< Scene preset number
+        eMask   ///< Group mask
+    };
+
+    /**
+     * Operation definition: source name -> operation.
+     */
+    struct SOpDef
+    {
+        const char* pszName;    ///< Source name
+        ETapOp op;              ///< Operation
+        EOperand operand;       ///< Operand kind
+    };
+
+    /**
+     * Find the operation definition by the source name.
+     * 
+     * @return  Definition, nullptr if not found.
+     */
+    static const SOpDef* FindOp( const char* a_pszName )
+    {
+        static const SOpDef Sl_arrOps[] =
+        {
+            { "on", ETapOp::eOn, EOperand::eNone },
+            { "off", ETapOp::eOff, EOperand::eNone },
+            { "tgl", ETapOp::eToggle, EOperand::eNone },
+            { "arm", ETapOp::eArm, EOperand::eSecs },
+            { MQTT_CMD_GRP_TURN_OFF, ETapOp::eTurnOff, EOperand::eMask },
+            { MQTT_CMD_GRP_FWD_SHORT_TAP, ETapOp::eFwdShort, EOperand::eMask },
+            { MQTT_CMD_GRP_FWD_LONG_TAP, ETapOp::eFwdLong, EOperand::eMask },
+            { MQTT_CMD_GRP_SCENE_RECALL, ETapOp::eScene, EOperand::eScene },
+            { "ifon", ETapOp::eIfOn, EOperand::eNone },
+            { "ifof", ETapOp::eIfOff, EOperand::eNone }
+        };
+        for( const SOpDef& rDef : Sl_arrOps )
+        {
+            if( !strcmp( rDef.pszName, a_pszName ))
+                return &rDef;
+        }
+        return nullptr;
+    }
+
+    /**
+     * Extract the next space separated token.
+     * 
+     * @param[in,out]   a_rpc       Source position, moved past the token
+     * @param[out]      a_pszToken  Token - TAP_PROG_TOKEN_LEN chars max, a longer one is truncated
+     * 
+     * @return  false if there are no more tokens.
+     */
+    static bool NextToken( const char*& a_rpc, char* a_pszToken )
+    {
+        while( *a_rpc == ' ' )
+            a_rpc++;
+        uint16_t nLen = 0;
+        for( ; ( *a_rpc ) && ( *a_rpc != ' ' ); a_rpc++ )
+        {
+            if( nLen < TAP_PROG_TOKEN_LEN )
+                a_pszToken[ nLen ] = *a_rpc;
+            nLen++;
+        }
+        a_pszToken[ min( nLen, (uint16_t)TAP_PROG_TOKEN_LEN )] = 0;
+        if( nLen > TAP_PROG_TOKEN_LEN )
+            a_pszToken[ 0 ] = '?';  // never a valid token
+        return nLen;
+    }
+
+    /**
+     * Parse a decimal number.
+     * 
+     * @param[in]   a_pszToken  Number
+     * @param[in]   a_nMax      Max value of the operand
+     * @param[out]  a_rnNum     Value
+     * 
+     * @return  false if not a number or above the max - never wrapped.
+     */
+    static bool ParseNum( const char* a_pszToken, uint16_t a_nMax, uint16_t& a_rnNum )
+    {
+        uint nLen = strlen( a_pszToken );
+        if( !CStringUtils::IsU32_10((byte*)a_pszToken, nLen, 5 ))
+            return false;
+        uint32_t nNum = CStringUtils::AtoU32_10((byte*)a_pszToken, nLen );
+        if( nNum > a_nMax )
+            return false;
+        a_rnNum = nNum;
+        return true;
+    }
+
+    /**
+     * Parse a group mask and add it to the pool unless already there.
+     * 
+     * @param[in]   a_pszToken      Mask: 0x followed by 16 hex digits
+     * @param[in]   a_nSelfMask     Bits to be cleared
+     * @param[out]  a_rnMask        Mask index
+     * 
+     * @return  false if the mask is invalid or the pool is full.
+     */
+    bool AddMask( const char* a_pszToken, uint64_t a_nSelfMask, uint8_t& a_rnMask )
+    {
+        if(( strlen( a_pszToken ) != MQTT_CMD_MASK_LEN ) || ( a_pszToken[ 0 ] != '0' ) || ( a_pszToken[ 1 ] != 'x' ))
+            return false;
+        for( uint8_t nIdx = 2; nIdx < MQTT_CMD_MASK_LEN; nIdx++ )
+        {
+            if( !isxdigit( a_pszToken[ nIdx ]))
+                return false;
+        }
+        uint64_t nMask = CStringUtils::MaskToU64_16((const byte*)a_pszToken ) & ~a_nSelfMask;
+        for( a_rnMask = 0; a_rnMask < m_nMasks; a_rnMask++ )
+        {
+            if( m_arrMasks[ a_rnMask ] == nMask )
+                return true;
+        }
+        if( m_nMasks >= TAP_PROG_MASKS )
+            return false;
+        m_arrMasks[ m_nMasks++ ] = nMask;
+        return true;
+    }
+
+    /**
+     * Remove a partially compiled program.
+     * 
+     * @return  TAP_PROG_NONE
+     */
+    uint8_t Rollback( uint8_t a_nLen, uint8_t a_nMasks )
+    {
+        m_nLen = a_nLen;
+        m_nMasks = a_nMasks;
+        return TAP_PROG_NONE;
+    }
+
+    STapInsn m_arrInsns[ TAP_PROG_LEN ];    ///< Instructions of all the programs
+    uint64_t m_arrMasks[ TAP_PROG_MASKS ];  ///< Group masks
+    uint8_t m_nLen;                         ///< Number of the instructions used
+    uint8_t m_nMasks;                       ///< Number of the group masks used
+};
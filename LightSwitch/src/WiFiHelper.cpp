@@ -5,9 +5,12 @@
  */
 #include "WiFiHelper.h"
 #include "CfgUtils.h"
+#include "FlightRec.h"
+#include "BootProf.h"
+#include "Log.h"
 
 CWiFiHelper::CWiFiHelper()
-    : m_nCurAP( 0 )
+    : m_pszSsid( "" ), m_pszPwd( "" ), m_pszHostname( "" ), m_nCurAP( 0 ), m_nMetricsPort( 0 )
 {
 }
 
@@ -19,19 +22,24 @@ void CWiFiHelper::ReadCfg()
     File file = LittleFS.open( FS_WIFI_CFG, "r" );
     if( file )
     {
-        m_strHostname = CConfigUtils::ReadValue( file, "host" );
+        // The hostname first - its pointer is kept by the other modules, see GetHostName():
+        m_arena.Reset();
+        m_pszHostname = m_arena.Add( CConfigUtils::ReadValue( file, "host" ));
         m_nConnTimeout = CConfigUtils::ReadValue( file, "conn" ).toInt();
+        m_nMetricsPort = CConfigUtils::ReadValue( file, "met" ).toInt();
 
         const char* arrSsid[ WIFI_AP_CNT ] = { "ssid1", "ssid2" };
-        m_strSsid = CConfigUtils::ReadValue( file, arrSsid[ m_nCurAP ]);
+        m_pszSsid = m_arena.Add( CConfigUtils::ReadValue( file, arrSsid[ m_nCurAP ]));
 
         const char* arrPwd[ WIFI_AP_CNT ] = { "pwd1", "pwd2" };
-        m_strPwd = CConfigUtils::ReadValue( file, arrPwd[ m_nCurAP ]);
+        m_pszPwd = m_arena.Add( CConfigUtils::ReadValue( file, arrPwd[ m_nCurAP ]));
 
         file.close();
 
         DBGLOG5( "wifi cfg %d: ssid:'%s' pwd:'%s' timeo:%lus hostname:'%s'\n",
-            m_nCurAP, m_strSsid.c_str(), m_strPwd.c_str(), m_nConnTimeout, m_strHostname.c_str());
+            m_nCurAP, m_pszSsid, m_pszPwd, m_nConnTimeout, m_pszHostname );
+        if( m_arena.IsOverflow())
+            LOGE( "wifi cfg too long" );
         m_nConnTimeout *= 1000;
     }
     else
@@ -42,7 +50,8 @@ void CWiFiHelper::ReadCfg()
 
 void CWiFiHelper::AlternateCfg()
 {
-    if( LittleFS.begin())
+    // Not while an OTA update may be rewriting the FS partition - stalled, it is abandoned soon:
+    if(( !m_ota.IsActive()) && ( LittleFS.begin()))
     {
         m_nCurAP = 1 - m_nCurAP;
         ReadCfg();
@@ -50,6 +59,21 @@ void CWiFiHelper::AlternateCfg()
     }
 }
 
+bool CWiFiHelper::CheckCfg( const char* a_pszPath )
+{
+    File file = LittleFS.open( a_pszPath, "r" );
+    return ( file ) && ( !CConfigUtils::ReadValue( file, "host" ).isEmpty()) && ( !CConfigUtils::ReadValue( file, "ssid1" ).isEmpty());
+}
+
+void CWiFiHelper::Reload()
+{
+    // The last AP read, so the disconnection alternates to the first one:
+    m_nCurAP = WIFI_AP_CNT - 1;
+    ReadCfg();
+    Init( m_nConnTimeout );
+    WiFi.disconnect();
+}
+
 String CWiFiHelper::GetMac()
 {
     return WiFi.macAddress();
@@ -60,31 +84,51 @@ String CWiFiHelper::GetIp()
     return WiFi.localIP().toString();
 }
 
-String& CWiFiHelper::GetHostName()
+const char* CWiFiHelper::GetHostName()
+{
+    return m_pszHostname;
+}
+
+COta& CWiFiHelper::GetOta()
 {
-    return m_strHostname;
+    return m_ota;
 }
 
 void CWiFiHelper::Enable()
 {
     Init( m_nConnTimeout );
-    SetupSta( m_strSsid.c_str(), m_strPwd.c_str(), m_strHostname.c_str());
+    SetupSta( m_pszSsid, m_pszPwd, m_pszHostname);
+}
+
+void CWiFiHelper::OnAssoc()
+{
+    CBootProf::Mark( EBootPhase::eWiFiAssoc );
 }
 
 void CWiFiHelper::OnConnect()
 {
-    ArduinoOTA.setHostname( m_strHostname.c_str());
-    ArduinoOTA.begin();
-    DBGLOG1( "OTA begin: %s\n", ArduinoOTA.getHostname().c_str());
+    CBootProf::Mark( EBootPhase::eWiFiIp );
+    CFlightRec::Add( EFrEvent::eWiFiUp );
+    LOGI( "wifi up" );
+    m_ota.Begin( m_pszHostname );
+    m_metrics.Begin( m_nMetricsPort );
 }
 
 void CWiFiHelper::OnDisconnect()
 {
+    CFlightRec::Add( EFrEvent::eWiFiDown );
+    LOGW( "wifi down" );
     AlternateCfg();
-    SetupSta( m_strSsid.c_str(), m_strPwd.c_str(), m_strHostname.c_str());
+    SetupSta( m_pszSsid, m_pszPwd, m_pszHostname);
+}
+
+void CWiFiHelper::OnConnTimeout()
+{
+    CFlightRec::Add( EFrEvent::eReset, (uint16_t)EFrReset::eWiFi );
 }
 
 void CWiFiHelper::loop()
 {
-    ArduinoOTA.handle();
+    m_ota.loop();
+    m_metrics.loop();
 }
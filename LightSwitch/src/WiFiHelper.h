@@ -6,9 +6,11 @@
 #pragma once
 #include <Arduino.h>
 #include <LittleFS.h>
-#include <ArduinoOTA.h>
 
 #include "WiFiHelperBase.h"
+#include "StrArena.h"
+#include "Ota.h"
+#include "Metrics.h"
 #include "dbg.h"
 
 
@@ -19,6 +21,9 @@
 /// The number of APs defined in the config file
 #define WIFI_AP_CNT     2
 
+/// Config string arena length: the hostname, the SSID and the password of an AP
+#define WIFI_CFG_ARENA_LEN  136
+
 
 
 /**
@@ -26,7 +31,7 @@
  * 
  * Read the config file.
  * Enable the WIFI, configure host name.
- * Enable OTA FWU on WIFI connect.
+ * Enable OTA FWU and the metrics HTTP server on WIFI connect.
  * Reconnect on WIFI disconnect.
  */
 class CWiFiHelper : public CWiFiHelperBase
@@ -47,6 +52,23 @@ public:
      */
     void AlternateCfg();
 
+    /**
+     * Validate a configuration file: the hostname and the first AP are required.
+     * 
+     * @param[in]   a_pszPath   Configuration file
+     * 
+     * @return  false if invalid.
+     */
+    static bool CheckCfg( const char* a_pszPath );
+
+    /**
+     * Apply the stored configuration file live.
+     * 
+     * The connection timeout and the hostname are re-read, the WIFI is disconnected:
+     * the disconnection reconnects to the first AP configured, see OnDisconnect().
+     */
+    void Reload();
+
 
 
     /**
@@ -66,9 +88,18 @@ public:
     /**
      * Return the configured host name.
      * 
+     * The hostname is stored first in the config arena, so the pointer remains valid across the config re-reads.
+     * 
      * @return  Configured host hame.
      */
-    String& GetHostName();
+    const char* GetHostName();
+
+    /**
+     * Return the OTA FWU.
+     * 
+     * @return  OTA FWU.
+     */
+    COta& GetOta();
 
 
 
@@ -79,6 +110,11 @@ public:
 
 
 
+    /**
+     * WIFI associated callback - the boot phase is recorded, see CBootProf.
+     */
+    virtual void OnAssoc();
+
     /**
      * WIFI connected callback.
      */
@@ -89,19 +125,29 @@ public:
      */
     virtual void OnDisconnect();
 
+    /**
+     * WIFI connection timeout callback - the reset is recorded, see CFlightRec.
+     */
+    virtual void OnConnTimeout();
+
 
 
     /**
      * Main loop function.
      * 
-     * Execute OTA FWU.
+     * Execute OTA FWU - one image chunk per call, see COta.
+     * Serve the metrics - one response chunk per call, see CMetricsHttp.
      */
     void loop();
 
 protected:
-    String m_strSsid;       ///< Configured WIFI SSID
-    String m_strPwd;        ///< Configured WIFI password
-    String m_strHostname;   ///< Configured host name
+    CStrArena< WIFI_CFG_ARENA_LEN > m_arena;    ///< Config strings
+    const char* m_pszSsid;  ///< Configured WIFI SSID
+    const char* m_pszPwd;   ///< Configured WIFI password
+    const char* m_pszHostname;  ///< Configured host name
     ulong m_nConnTimeout;   ///< Configured WIFI connection timeout for MCU reset, 0:disable
     int m_nCurAP;           ///< Current WIFI AP
+    uint16_t m_nMetricsPort;    ///< Configured metrics HTTP port, 0:disable
+    COta m_ota;             ///< OTA FWU
+    CMetricsHttp m_metrics; ///< Metrics HTTP server
 };
@@ -7,10 +7,15 @@
 #include "WiFiHelper.h"
 #include "ManualSwitch.h"
 #include "Mqtt.h"
+#include "InputTrace.h"
+#include "FlightRec.h"
+#include "RtcLayout.h"
+#include "BootProf.h"
 #include "dbg.h"
 
 CWiFiHelper g_wifi;
 CMqtt g_mqtt;
+CInputTrace g_trace;
 
 CManualSwitch g_swChan0;
 CManualSwitch g_swChan1;
@@ -28,35 +33,31 @@ void EnableAll()
     g_swChan2.Enable();
 }
 
-/**
- * Disable all switches and MQTT client
- */
-void DisableAll()
-{
-    DBGLOG( "Disable btns" );
-    g_swChan0.Disable();
-    g_swChan1.Disable();
-    g_swChan2.Disable();
-    g_mqtt.Disable();
-}
-
 /**
  * Setup the MCU
  */
 void setup()
 {
+    CBootProf::Mark( EBootPhase::eRom );
+
     // Setup debug log:
     DbgLogSetup();
+    CFlightRec::Begin( RTC_FLIGHT_REC_OFFS );
+    g_mqtt.Attach( g_wifi, g_trace, g_swChan0, g_swChan1, g_swChan2 );
 
     // Read all cfg files:
     if( LittleFS.begin())
     {
+        CBootProf::Mark( EBootPhase::eFs );
         g_swChan0.ReadCfg( 0 );
         g_swChan1.ReadCfg( 1 );
         g_swChan2.ReadCfg( 2 );
+        CBootProf::Mark( EBootPhase::eCfgCh );
 
         g_wifi.ReadCfg();
+        CBootProf::Mark( EBootPhase::eCfgWiFi );
         g_mqtt.ReadCfg();
+        CBootProf::Mark( EBootPhase::eCfgMqtt );
 
         LittleFS.end();
 
@@ -70,29 +71,7 @@ void setup()
 
     // Enable all buttons and MQTT client:
     EnableAll();
-
-    // Enable OTA FWU:
-    ArduinoOTA.onStart(
-        []()
-        {
-            DisableAll();
-            if( ArduinoOTA.getCommand() == U_FLASH ) {
-                DBGLOG( "OTA flash" );
-            } else {
-                DBGLOG( "OTA fs" );
-            }
-        });
-    ArduinoOTA.onEnd(
-        []()
-        {
-            DBGLOG( "OTA end" );    // will reboot
-        });
-    ArduinoOTA.onError(
-        []( ota_error_t err )
-        {
-            EnableAll();
-            DBGLOG1( "OTA err %u\n", err );
-        });
+    CBootProf::Mark( EBootPhase::eEnable );
 }
 
 /**
@@ -100,6 +79,8 @@ void setup()
  */
 void loop()
 {
+    CFlightRec::loop();
+
     // Handle all the network services if connected.
     // Note this may reset the MCU if WIFI conn timeout was configured:
     if( g_wifi.Connected())
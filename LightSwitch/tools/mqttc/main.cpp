@@ -0,0 +1,182 @@
+/**
+ * DIY Smart Home - light switch
+ * Host MQTT client tool
+ * 2022 Łukasz Łasek
+ * 
+ * A mosquitto_pub/mosquitto_sub like tool built on top of the FW MQTT client (CMqttClient),
+ * used to exercise the client on Linux against a local broker:
+ *   mqttc [-h host] [-p port] [-i client-id] [-V 4|5] [TLS] [-q qos] [-r] [-n count] [-R count] pub <topic> <msg>
+ *   mqttc [-h host] [-p port] [-i client-id] [-V 4|5] [TLS] [-c count] sub <topic> [<topic>...]
+ *   TLS: -s (-f <sha1 fingerprint> | -k <public key PEM file>)
+ * 
+ * With -V 5 the published topic is registered as a topic alias; with -n count > 1 the message
+ * is published repeatedly, the repetitions go over the alias.
+ * With -R count > 1 the publication is repeated over new connections - the TLS handshakes
+ * after the first one are resumed, the handshake stats are printed at exit.
+ */
+#include <Arduino.h>
+#include <WiFiClient.h>
+#include <unistd.h>
+
+#include "MqttClient.h"
+#include "TlsClient.h"
+
+/// Tool exit timeout in ms
+#define MQTTC_TIMEOUT_MS    5000
+
+static void Usage()
+{
+    fprintf( stderr,
+        "usage: mqttc [-h host] [-p port] [-i client-id] [-V 4|5] [TLS] [-q qos] [-r] [-n count] [-R count] pub <topic> <msg>\n"
+        "       mqttc [-h host] [-p port] [-i client-id] [-V 4|5] [TLS] [-c count] sub <topic> [<topic>...]\n"
+        "       TLS: -s (-f <sha1 fingerprint> | -k <public key PEM file>)\n" );
+    exit( 2 );
+}
+
+int main( int argc, char** argv )
+{
+    const char* pszHost = "localhost";
+    uint16_t nPort = 1883;
+    const char* pszId = "mqttc";
+    uint8_t nQos = 0;
+    bool bRetain = false;
+    long nCnt = -1;
+    long nPubCnt = 1;
+    uint8_t nProto = MQTT_CLIENT_V311;
+    long nConnCnt = 1;
+    bool bTls = false;
+    const char* pszFp = nullptr;
+    const char* pszKeyFile = nullptr;
+
+    int nOpt;
+    while(( nOpt = getopt( argc, argv, "h:p:i:V:q:rc:n:R:sf:k:" )) != -1 )
+    {
+        switch( nOpt )
+        {
+            case 'h': pszHost = optarg; break;
+            case 'p': nPort = atoi( optarg ); break;
+            case 'i': pszId = optarg; break;
+            case 'q': nQos = atoi( optarg ) ? 1 : 0; break;
+            case 'r': bRetain = true; break;
+            case 'c': nCnt = atol( optarg ); break;
+            case 'n': nPubCnt = atol( optarg ); break;
+            case 'R': nConnCnt = atol( optarg ); break;
+            case 's': bTls = true; break;
+            case 'f': pszFp = optarg; break;
+            case 'k': pszKeyFile = optarg; break;
+            case 'V': nProto = ( atoi( optarg ) == MQTT_CLIENT_V5 ) ? MQTT_CLIENT_V5 : MQTT_CLIENT_V311; break;
+            default: Usage();
+        }
+    }
+    if( optind + 2 > argc )
+        Usage();
+
+    bool bPub = !strcmp( argv[ optind ], "pub" );
+    if(( !bPub ) && ( strcmp( argv[ optind ], "sub" )))
+        Usage();
+    if(( bPub ) && ( optind + 3 != argc ))
+        Usage();
+
+    WiFiClient wc;
+    wc.setTimeout( MQTTC_TIMEOUT_MS );
+    CTlsClient wcs;
+    wcs.setTimeout( MQTTC_TIMEOUT_MS );
+    BearSSL::PublicKey key;
+    CMqttClient mqtt( wc );
+    if( bTls )
+    {
+        if( pszFp )
+        {
+            if( !wcs.setFingerprint( pszFp ))
+                Usage();
+        }
+        else if( pszKeyFile )
+        {
+            FILE* pFile = fopen( pszKeyFile, "r" );
+            char szPem[ 4096 ] = {};
+            if(( !pFile ) || ( !fread( szPem, 1, sizeof( szPem ) - 1, pFile )) || ( !key.parse( szPem )))
+            {
+                fprintf( stderr, "invalid key file %s\n", pszKeyFile );
+                return 1;
+            }
+            fclose( pFile );
+            wcs.setKnownKey( &key );
+        }
+        else
+        {
+            Usage();
+        }
+        mqtt.SetClient( wcs );
+    }
+    mqtt.SetServer( pszHost, nPort );
+    mqtt.SetProtocol( nProto );
+    if( bPub )
+        mqtt.AddTopicAlias( argv[ optind + 1 ]);
+
+    bool bDone = false;
+    mqtt.SetCallback(
+        [ & ]( char* topic, byte* payload, uint len )
+        {
+            printf( "%s %.*s\n", topic, (int)len, (const char*)payload );
+            fflush( stdout );
+            if(( nCnt > 0 ) && ( !--nCnt ))
+                bDone = true;
+        });
+    mqtt.SetConnCallback(
+        [ & ]()
+        {
+            if( bPub )
+            {
+                for( long nIdx = 0; nIdx < nPubCnt; nIdx++ )
+                {
+                    if( !mqtt.Publish( argv[ optind + 1 ], argv[ optind + 2 ], bRetain, nQos ))
+                    {
+                        fprintf( stderr, "publish failed\n" );
+                        exit( 1 );
+                    }
+                }
+            }
+            else
+            {
+                for( int nIdx = optind + 1; nIdx < argc; nIdx++ )
+                    mqtt.Subscribe( argv[ nIdx ]);
+            }
+        });
+
+    for( long nConn = 0; nConn < nConnCnt; nConn++ )
+    {
+        if( !mqtt.Connect( pszId ))
+        {
+            fprintf( stderr, "connect to %s:%u failed\n", pszHost, nPort );
+            return 1;
+        }
+
+        CTimer tm;
+        bDone = false;
+        while( !bDone )
+        {
+            mqtt.loop();
+            if( !mqtt.Connected() && !mqtt.Connecting())
+            {
+                fprintf( stderr, "disconnected\n" );
+                return 1;
+            }
+
+            tm.UpdateCur();
+            if( bPub && mqtt.Connected() && !mqtt.GetOutboxCnt())
+                bDone = true;
+            else if( bPub && ( tm.Delta() > MQTTC_TIMEOUT_MS ))
+            {
+                fprintf( stderr, "timeout\n" );
+                return 1;
+            }
+            usleep( 1000 );
+        }
+        mqtt.Disconnect();
+        if( nConn + 1 < nConnCnt )
+            usleep( MQTT_CLIENT_RETRY_MS * 1000 );    // connection attempts are throttled
+    }
+    if( bTls )
+        fprintf( stderr, "tls %s\n", wcs.GetStats().c_str());
+    return 0;
+}
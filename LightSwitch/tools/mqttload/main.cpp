@@ -0,0 +1,381 @@
+/**
+ * DIY Smart Home - light switch
+ * MQTT load generator
+ * 2022 Łukasz Łasek
+ * 
+ * Sends commands to a switch at a configurable rate and pattern and measures the response latency
+ * and loss using the retained stat topics, to qualify a FW build against a local broker:
+ *   mqttload [-h host] [-p port] [-i client-id] [-V 4|5] [-q qos] [-t device-topic] [-g grp-topic]
+ *            [-m mgt-topic] [-I id0,id1,id2] [-k kinds] [-P steady|burst|random] [-r rate] [-b burst]
+ *            [-n count] [-T timeout-ms] [-s seed] [-v]
+ * 
+ * device-topic is the device topic suffix (default: testbed): the commands go to sw/cmd/<device>/chN,
+ * the states are read from sw/stat/<device>/chN. The group and mgt topics default to sw/grp/home
+ * and sw/mgt/home. ids are the group ids of the device channels (default: 0,64,63 as in data/),
+ * 0:channel not addressable by the group commands.
+ * 
+ * kinds is a comma separated list of the commands to send (default: ch,tof,fst,dir):
+ *   ch     channel on/off - the opposite of the current state
+ *   fst    group fwd short tap with a random mask covering the channel id - expects a toggle (ev-ss tgle)
+ *   flt    group fwd long tap with a random mask covering the channel id - expects a toggle (ev-ls tgle/tgof)
+ *   tof    group turn off with a random mask covering the channel id - sent to the channels which are on
+ *   dir    mgt discovery - expects the reply on <mgt>/stat
+ * The random masks never cover the other channels of the device.
+ * 
+ * Patterns: steady - rate commands/s evenly spaced, burst - bursts of burst commands rate/burst times/s,
+ * random - Poisson arrivals with the mean rate/s and random kinds.
+ * A target (channel, mgt) has at most one command in flight: a command due while all the targets are busy
+ * is skipped. Note the coalescing window and the dwell time of the channels add to the latency.
+ * A command without a response within the timeout (default: 2000 ms) is lost.
+ * count commands are sent (default: 100), then the latency percentiles and the loss are reported per kind.
+ */
+#include <Arduino.h>
+#include <WiFiClient.h>
+#include <algorithm>
+#include <random>
+#include <unistd.h>
+
+#include "MqttClient.h"
+#include "Mqtt.h"
+#include "StringUtils.h"
+
+/// Number of the switch channels
+#define LOAD_CHANNELS       3
+
+/// Target index of the mgt discovery
+#define LOAD_TARGET_MGT     LOAD_CHANNELS
+
+/// Number of the command targets: channels + mgt
+#define LOAD_TARGETS        ( LOAD_CHANNELS + 1 )
+
+/// Time to collect the retained channel states in ms
+#define LOAD_INIT_MS        2000
+
+/**
+ * Command kinds.
+ */
+enum class EKind
+{
+    eCh,
+    eFst,
+    eFlt,
+    eTof,
+    eDir,
+    eCnt
+};
+
+static const char* Sg_arrKindNames[ (int)EKind::eCnt ] = { "ch", "fst", "flt", "tof", "dir" };
+
+/**
+ * Command target: channel or mgt.
+ */
+struct STarget
+{
+    int nState = -1;            ///< Channel state: -1:unknown, 0:off, 1:on
+    bool bBusy = false;         ///< Command in flight
+    EKind kind;                 ///< Kind of the command in flight
+    bool bExpectOn;             ///< Expected channel state
+    uint64_t nSentUs;           ///< Time the command was sent
+};
+
+/**
+ * Per kind statistics.
+ */
+struct SStats
+{
+    uint32_t nSent = 0;                 ///< Commands sent
+    uint32_t nLost = 0;                 ///< Commands without a response
+    std::vector< uint32_t > vecLatUs;   ///< Response latencies
+};
+
+static void Usage()
+{
+    fprintf( stderr,
+        "usage: mqttload [-h host] [-p port] [-i client-id] [-V 4|5] [-q qos] [-t device-topic] [-g grp-topic]\n"
+        "                [-m mgt-topic] [-I id0,id1,id2] [-k kinds] [-P steady|burst|random] [-r rate] [-b burst]\n"
+        "                [-n count] [-T timeout-ms] [-s seed] [-v]\n" );
+    exit( 2 );
+}
+
+static uint32_t Percentile( std::vector< uint32_t >& a_rvecSorted, uint32_t a_nPct )
+{
+    if( a_rvecSorted.empty())
+        return 0;
+    size_t nIdx = ( a_rvecSorted.size() * a_nPct + 99 ) / 100;
+    return a_rvecSorted[ max((size_t)1, nIdx ) - 1 ];
+}
+
+int main( int argc, char** argv )
+{
+    const char* pszHost = "localhost";
+    uint16_t nPort = 1883;
+    const char* pszId = "mqttload";
+    uint8_t nProto = MQTT_CLIENT_V311;
+    uint8_t nQos = 0;
+    String strDevice( "testbed" );
+    String strGrp( "sw/grp/home" );
+    String strMgt( "sw/mgt/home" );
+    uint8_t arrIds[ LOAD_CHANNELS ] = { 0, 64, 63 };
+    bool arrKinds[ (int)EKind::eCnt ] = { true, true, false, true, true };
+    const char* pszPattern = "steady";
+    double dRate = 5;
+    uint32_t nBurst = 4;
+    uint32_t nCnt = 100;
+    uint32_t nTimeoutMs = 2000;
+    uint32_t nSeed = 1;
+    bool bVerbose = false;
+
+    int nOpt;
+    while(( nOpt = getopt( argc, argv, "h:p:i:V:q:t:g:m:I:k:P:r:b:n:T:s:v" )) != -1 )
+    {
+        switch( nOpt )
+        {
+            case 'h': pszHost = optarg; break;
+            case 'p': nPort = atoi( optarg ); break;
+            case 'i': pszId = optarg; break;
+            case 'V': nProto = ( atoi( optarg ) == MQTT_CLIENT_V5 ) ? MQTT_CLIENT_V5 : MQTT_CLIENT_V311; break;
+            case 'q': nQos = atoi( optarg ) ? 1 : 0; break;
+            case 't': strDevice = optarg; break;
+            case 'g': strGrp = optarg; break;
+            case 'm': strMgt = optarg; break;
+            case 'I':
+                if( sscanf( optarg, "%hhu,%hhu,%hhu", &arrIds[ 0 ], &arrIds[ 1 ], &arrIds[ 2 ]) != LOAD_CHANNELS )
+                    Usage();
+                break;
+            case 'k':
+                for( bool& rb : arrKinds )
+                    rb = false;
+                for( char* psz = strtok( optarg, "," ); psz; psz = strtok( nullptr, "," ))
+                {
+                    int nKind = 0;
+                    while(( nKind < (int)EKind::eCnt ) && ( strcmp( psz, Sg_arrKindNames[ nKind ])))
+                        nKind++;
+                    if( nKind == (int)EKind::eCnt )
+                        Usage();
+                    arrKinds[ nKind ] = true;
+                }
+                break;
+            case 'P': pszPattern = optarg; break;
+            case 'r': dRate = atof( optarg ); break;
+            case 'b': nBurst = max( 1, atoi( optarg )); break;
+            case 'n': nCnt = atol( optarg ); break;
+            case 'T': nTimeoutMs = atol( optarg ); break;
+            case 's': nSeed = atol( optarg ); break;
+            case 'v': bVerbose = true; break;
+            default: Usage();
+        }
+    }
+    bool bBurst = !strcmp( pszPattern, "burst" );
+    bool bRandom = !strcmp( pszPattern, "random" );
+    if(( optind != argc ) || ( dRate <= 0 ) || (( !bBurst ) && ( !bRandom ) && ( strcmp( pszPattern, "steady" ))))
+        Usage();
+
+    String strCmd( String( "sw/cmd/" ) + strDevice );
+    String strStat( String( "sw/stat/" ) + strDevice );
+    String arrCmdTopics[ LOAD_CHANNELS ];
+    String arrStatTopics[ LOAD_CHANNELS ];
+    for( int nChan = 0; nChan < LOAD_CHANNELS; nChan++ )
+    {
+        arrCmdTopics[ nChan ] = strCmd + "/ch" + String( nChan );
+        arrStatTopics[ nChan ] = strStat + "/ch" + String( nChan );
+    }
+    String strMgtCmd( strMgt + "/cmd" );
+    String strMgtStat( strMgt + "/stat" );
+
+    // Channel bits of the device - never set in the random masks:
+    uint64_t nDevMask = 0;
+    for( uint8_t nId : arrIds )
+    {
+        if( nId )
+            nDevMask |= 1ull << ( nId - 1 );
+    }
+
+    STarget arrTargets[ LOAD_TARGETS ];
+    SStats arrStats[ (int)EKind::eCnt ];
+    std::mt19937_64 rnd( nSeed );
+
+    WiFiClient wc;
+    CMqttClient mqtt( wc );
+    mqtt.SetServer( pszHost, nPort );
+    mqtt.SetProtocol( nProto );
+    mqtt.SetCallback(
+        [ & ]( char* topic, byte* payload, uint len )
+        {
+            uint64_t nNowUs = micros();
+            STarget* pTarget = nullptr;
+            for( int nChan = 0; nChan < LOAD_CHANNELS; nChan++ )
+            {
+                if( arrStatTopics[ nChan ] == topic )
+                {
+                    pTarget = &arrTargets[ nChan ];
+                    pTarget->nState = CStringUtils::IsEqual( MQTT_CMD_CH_ON, MQTT_CMD_CH_ON_LEN, payload, len ) ? 1 : 0;
+                }
+            }
+            if(( !pTarget ) && ( strMgtStat == topic ) && ( arrTargets[ LOAD_TARGET_MGT ].bBusy ))
+                pTarget = &arrTargets[ LOAD_TARGET_MGT ];
+
+            // Response to the command in flight:
+            if(( pTarget ) && ( pTarget->bBusy ) && (( pTarget->kind == EKind::eDir ) || ( pTarget->nState == pTarget->bExpectOn )))
+            {
+                uint32_t nLatUs = nNowUs - pTarget->nSentUs;
+                arrStats[ (int)pTarget->kind ].vecLatUs.push_back( nLatUs );
+                pTarget->bBusy = false;
+                if( bVerbose )
+                    printf( "%-3s %s %.*s %.1f ms\n", Sg_arrKindNames[ (int)pTarget->kind ], topic, (int)len, (const char*)payload, nLatUs / 1000.0 );
+            }
+        });
+    mqtt.SetConnCallback(
+        [ & ]()
+        {
+            for( int nChan = 0; nChan < LOAD_CHANNELS; nChan++ )
+                mqtt.Subscribe( arrStatTopics[ nChan ].c_str());
+            mqtt.Subscribe( strMgtStat.c_str());
+        });
+
+    if( !mqtt.Connect( pszId ))
+    {
+        fprintf( stderr, "connect to %s:%u failed\n", pszHost, nPort );
+        return 1;
+    }
+
+    // Send a command to a free target, return false if all the targets are busy:
+    auto fnSend =
+        [ & ]( EKind a_kind ) -> bool
+        {
+            std::vector< int > vecFree;
+            for( int nTarget = 0; nTarget < LOAD_TARGETS; nTarget++ )
+            {
+                STarget& rTarget = arrTargets[ nTarget ];
+                bool bOk = !rTarget.bBusy;
+                if( a_kind == EKind::eDir )
+                    bOk &= ( nTarget == LOAD_TARGET_MGT );
+                else
+                    bOk &= ( nTarget != LOAD_TARGET_MGT ) && (( a_kind == EKind::eCh ) || ( arrIds[ nTarget ]));
+                if( a_kind == EKind::eTof )
+                    bOk &= ( rTarget.nState == 1 );
+                if( bOk )
+                    vecFree.push_back( nTarget );
+            }
+            if( vecFree.empty())
+                return false;
+
+            int nTarget = vecFree[ rnd() % vecFree.size()];
+            STarget& rTarget = arrTargets[ nTarget ];
+            String strTopic;
+            String strMsg;
+            if( a_kind == EKind::eDir )
+            {
+                strTopic = strMgtCmd;
+                strMsg = MQTT_CMD_MGT_DISCOVERY;
+            }
+            else if( a_kind == EKind::eCh )
+            {
+                rTarget.bExpectOn = ( rTarget.nState != 1 );
+                strTopic = arrCmdTopics[ nTarget ];
+                strMsg = rTarget.bExpectOn ? MQTT_CMD_CH_ON : MQTT_CMD_CH_OFF;
+            }
+            else
+            {
+                rTarget.bExpectOn = ( a_kind != EKind::eTof ) && ( rTarget.nState != 1 );
+                uint64_t nMask = ( rnd() & ~nDevMask ) | ( 1ull << ( arrIds[ nTarget ] - 1 ));
+                char szMask[ MQTT_CMD_MASK_LEN + 1 ];
+                snprintf( szMask, sizeof( szMask ), "0x%016llx", (unsigned long long)nMask );
+                strTopic = strGrp;
+                strMsg = Sg_arrKindNames[ (int)a_kind ];
+                strMsg += MQTT_CMD_SEPARATOR;
+                strMsg += szMask;
+                strMsg += MQTT_CMD_SEPARATOR "1";
+            }
+            rTarget.bBusy = true;
+            rTarget.kind = a_kind;
+            rTarget.nSentUs = micros();
+            arrStats[ (int)a_kind ].nSent++;
+            mqtt.Publish( strTopic.c_str(), strMsg.c_str(), false, nQos );
+            return true;
+        };
+
+    // Pick a kind of the next command - round robin or random:
+    std::vector< EKind > vecKinds;
+    for( int nKind = 0; nKind < (int)EKind::eCnt; nKind++ )
+    {
+        if( arrKinds[ nKind ])
+            vecKinds.push_back((EKind)nKind );
+    }
+    if( vecKinds.empty())
+        Usage();
+    uint32_t nNextKind = 0;
+    auto fnKind =
+        [ & ]() -> EKind
+        {
+            return vecKinds[ ( bRandom ? rnd() : nNextKind++ ) % vecKinds.size()];
+        };
+
+    std::exponential_distribution< double > distArrival( dRate );
+    uint64_t nStartUs = micros();
+    uint64_t nNextUs = nStartUs + LOAD_INIT_MS * 1000;
+    uint32_t nIssued = 0;
+    uint32_t nSkipped = 0;
+    for( ;; )
+    {
+        mqtt.loop();
+        if(( !mqtt.Connected()) && ( !mqtt.Connecting()))
+        {
+            fprintf( stderr, "disconnected\n" );
+            return 1;
+        }
+
+        uint64_t nNowUs = micros();
+        for( STarget& rTarget : arrTargets )
+        {
+            if(( rTarget.bBusy ) && ( nNowUs - rTarget.nSentUs > nTimeoutMs * 1000ull ))
+            {
+                rTarget.bBusy = false;
+                arrStats[ (int)rTarget.kind ].nLost++;
+                if( bVerbose )
+                    printf( "%-3s lost\n", Sg_arrKindNames[ (int)rTarget.kind ]);
+            }
+        }
+
+        bool bBusy = std::any_of( std::begin( arrTargets ), std::end( arrTargets ), []( STarget& a_r ) { return a_r.bBusy; });
+        if(( nIssued >= nCnt ) && ( !bBusy ))
+            break;
+
+        if(( nIssued < nCnt ) && ( nNowUs >= nNextUs ) && ( mqtt.Connected()))
+        {
+            uint32_t nBatch = bBurst ? min( nBurst, nCnt - nIssued ) : 1;
+            for( uint32_t nIdx = 0; nIdx < nBatch; nIdx++, nIssued++ )
+            {
+                if( !fnSend( fnKind()))
+                    nSkipped++;
+            }
+            if( bRandom )
+                nNextUs += (uint64_t)( distArrival( rnd ) * 1e6 );
+            else
+                nNextUs += (uint64_t)( nBatch * 1e6 / dRate );
+        }
+        usleep( 100 );
+    }
+
+    double dSecs = ( micros() - nStartUs ) / 1e6 - LOAD_INIT_MS / 1000.0;
+    printf( "%s %u cmds in %.1f s, %.1f cmd/s, skipped (busy): %u\n", pszPattern, nIssued, dSecs, nIssued / dSecs, nSkipped );
+    printf( "%-4s %6s %6s %6s %8s %8s %8s %8s %8s\n", "kind", "sent", "lost", "loss%", "p50 ms", "p90 ms", "p99 ms", "max ms", "avg ms" );
+    uint32_t nLost = 0;
+    for( int nKind = 0; nKind < (int)EKind::eCnt; nKind++ )
+    {
+        SStats& rStats = arrStats[ nKind ];
+        if( !rStats.nSent )
+            continue;
+        std::vector< uint32_t >& rvec = rStats.vecLatUs;
+        std::sort( rvec.begin(), rvec.end());
+        double dAvg = 0;
+        for( uint32_t nLat : rvec )
+            dAvg += nLat;
+        dAvg = rvec.empty() ? 0 : dAvg / rvec.size();
+        printf( "%-4s %6u %6u %6.1f %8.1f %8.1f %8.1f %8.1f %8.1f\n", Sg_arrKindNames[ nKind ], rStats.nSent, rStats.nLost,
+            100.0 * rStats.nLost / rStats.nSent, Percentile( rvec, 50 ) / 1000.0, Percentile( rvec, 90 ) / 1000.0,
+            Percentile( rvec, 99 ) / 1000.0, rvec.empty() ? 0 : rvec.back() / 1000.0, dAvg / 1000.0 );
+        nLost += rStats.nLost;
+    }
+    mqtt.Disconnect();
+    return nLost ? 1 : 0;
+}
@@ -0,0 +1,402 @@
+/**
+ * DIY Smart Home - light switch
+ * Host microbenchmarks
+ * 2022 Łukasz Łasek
+ * 
+ * Measures the FW parsing and dispatch hot paths on the host - the FW runs on the virtual clock
+ * against the in-process MQTT broker, the benchmarks use realistic payload corpora and the cfg files:
+ *   swbench [-d cfg-dir] [-t ms] [-b baseline] [-w baseline] [-r pct] [filter]
+ * 
+ * The cfg files are read from cfg-dir (default: data). Every benchmark runs for at least ms
+ * (default: 300) in batches; the best batch gives ns/op, all batches give the heap allocations/op
+ * (malloc/calloc/realloc calls). Only the benchmarks with the name containing filter are run.
+ * 
+ * -w writes the results as the new baseline file. -b compares the results with the baseline file:
+ * a benchmark regresses if its ns/op grows by more than pct % (default: 25) or its allocs/op grows
+ * by more than 1 % (the corpus entries of the batches differ slightly). The exit code is 1 if any
+ * benchmark regressed.
+ * The ns/op are machine specific - regenerate the baseline on the machine comparing the results.
+ */
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <HostSim.h>
+#include <HostBroker.h>
+#include <chrono>
+#include <map>
+#include <unistd.h>
+
+#include "ManualSwitch.h"
+#include "Mqtt.h"
+#include "CfgUtils.h"
+#include "StringUtils.h"
+
+/// Default min benchmark duration in ms
+#define SWBENCH_TIME_MS         300
+
+/// Min batch duration in ns
+#define SWBENCH_BATCH_NS        1000000
+
+/// Default regression threshold in %
+#define SWBENCH_THRESHOLD_PCT   25
+
+/// Virtual time advanced between the batches in ms - lets the coalesced commands and the auto-off timers expire
+#define SWBENCH_SETTLE_MS       300
+
+void setup();
+void loop();
+
+extern CMqtt g_mqtt;
+extern CManualSwitch g_swChan0;
+extern CManualSwitch g_swChan1;
+extern CManualSwitch g_swChan2;
+
+// Heap allocation counting - glibc allows replacing the allocator entry points:
+extern "C" void* __libc_malloc( size_t a_nSize );
+extern "C" void* __libc_calloc( size_t a_nCnt, size_t a_nSize );
+extern "C" void* __libc_realloc( void* a_p, size_t a_nSize );
+static uint64_t Sg_nAllocCnt = 0;
+
+extern "C" void* malloc( size_t a_nSize )
+{
+    Sg_nAllocCnt++;
+    return __libc_malloc( a_nSize );
+}
+
+extern "C" void* calloc( size_t a_nCnt, size_t a_nSize )
+{
+    Sg_nAllocCnt++;
+    return __libc_calloc( a_nCnt, a_nSize );
+}
+
+extern "C" void* realloc( void* a_p, size_t a_nSize )
+{
+    Sg_nAllocCnt++;
+    return __libc_realloc( a_p, a_nSize );
+}
+
+/**
+ * Access to the protected CManualSwitch members.
+ */
+class CBenchSwitch : public CManualSwitch
+{
+public:
+    typedef bool (CManualSwitch::*GroupMaskMatchFn)( byte* payload );
+
+    static GroupMaskMatchFn GetGroupMaskMatch() { return &CBenchSwitch::GroupMaskMatch; }
+};
+
+/**
+ * MQTT message of a corpus.
+ */
+struct SMsg
+{
+    std::string strTopic;   ///< Topic
+    std::string strMsg;     ///< Payload
+};
+
+/**
+ * Benchmark.
+ */
+struct SBench
+{
+    const char* pszName;                            ///< Name
+    std::function< void( uint32_t a_nIdx )> fnOp;   ///< Operation, a_nIdx: op index to pick the corpus entry
+};
+
+/**
+ * Benchmark result.
+ */
+struct SResult
+{
+    double dNsPerOp;        ///< Best batch ns/op
+    double dAllocsPerOp;    ///< Heap allocations/op
+};
+
+// Group command corpus: all cmds, masks matching none, some and all the channels (ch1 id 64, ch2 id 63), malformed
+static const char* Sg_arrGrpCmds[] =
+{
+    "fst/0x8000000000000000/1",
+    "fst/0x0000000000000001/1",
+    "fst/0x00000000000000f0/2",
+    "flt/0x4000000000000000/1",
+    "flt/0x000000000000ff00/1",
+    "tof/0xc000000000000000/1",
+    "tof/0x0000000000000000/1",
+    "tof/0xffffffffffffffff/1",
+    "fst/0x0123456789abcdef/3",
+    "tof/0xFEDCBA9876543210/1",
+    "fst/0x80000000",
+    "xyz/0x8000000000000000/1",
+};
+
+// Management command corpus:
+static const char* Sg_arrMgtCmds[] = { "dir", "rst/other-host", "tls", "dir/x" };
+
+// Cfg file keys, as read by the FW:
+static const char* Sg_arrChKeys[] = { "id", "long", "next", "coalesce", "dwell", "ev-ss", "arg-ss", "ev-sm", "arg-sm", "ev-ls", "arg-ls", "missing" };
+static const char* Sg_arrMqttKeys[] = { "srv", "port", "conn", "init", "qos", "ver", "bat", "tls", "cli", "sub", "pub", "grp", "mgt" };
+static const char* Sg_arrWiFiKeys[] = { "host", "conn", "ssid1", "pwd1", "ssid2", "pwd2" };
+
+#define ARRAY_CNT( a_arr )  ( sizeof( a_arr ) / sizeof( a_arr[ 0 ]))
+
+static CHostBroker& Sg_broker = *new CHostBroker();   // never destroyed: the FW clients close their connections at exit
+static volatile uint32_t Sg_nSink;                      // Defeats optimizing the results away
+
+static void Settle()
+{
+    for( uint32_t nMs = 0; nMs < SWBENCH_SETTLE_MS; nMs++ )
+    {
+        CHostClock::Advance( 1000 );
+        loop();
+    }
+}
+
+static SResult Run( const SBench& a_rBench, uint32_t a_nTimeMs )
+{
+    uint32_t nIdx = 0;
+    uint32_t nBatch = 1;
+    double dBestNs = 0;
+    uint64_t nOps = 0;
+    uint64_t nAllocs = 0;
+    uint64_t nTotalNs = 0;
+    while( nTotalNs < (uint64_t)a_nTimeMs * 1000000 )
+    {
+        Settle();
+        uint64_t nAllocCnt = Sg_nAllocCnt;
+        auto tmStart = std::chrono::steady_clock::now();
+        for( uint32_t nOp = 0; nOp < nBatch; nOp++ )
+            a_rBench.fnOp( nIdx++ );
+        uint64_t nNs = std::chrono::duration_cast< std::chrono::nanoseconds >( std::chrono::steady_clock::now() - tmStart ).count();
+        uint64_t nBatchAllocs = Sg_nAllocCnt - nAllocCnt;
+
+        if( nNs < SWBENCH_BATCH_NS )
+        {
+            // Calibrating - too short a batch to measure:
+            nBatch *= 2;
+            continue;
+        }
+        double dNs = (double)nNs / nBatch;
+        if(( !nOps ) || ( dNs < dBestNs ))
+            dBestNs = dNs;
+        nOps += nBatch;
+        nAllocs += nBatchAllocs;
+        nTotalNs += nNs;
+    }
+    return { dBestNs, (double)nAllocs / nOps };
+}
+
+static std::map< std::string, SResult > ReadBaseline( const char* a_pszPath )
+{
+    std::map< std::string, SResult > mapBase;
+    FILE* pFile = fopen( a_pszPath, "r" );
+    if( !pFile )
+    {
+        fprintf( stderr, "cannot open %s\n", a_pszPath );
+        exit( 2 );
+    }
+    char szLine[ 256 ];
+    while( fgets( szLine, sizeof( szLine ), pFile ))
+    {
+        char szName[ 128 ];
+        SResult res;
+        if(( szLine[ 0 ] != '#' ) && ( sscanf( szLine, "%127s %lf %lf", szName, &res.dNsPerOp, &res.dAllocsPerOp ) == 3 ))
+            mapBase[ szName ] = res;
+    }
+    fclose( pFile );
+    return mapBase;
+}
+
+static void Usage()
+{
+    fprintf( stderr, "usage: swbench [-d cfg-dir] [-t ms] [-b baseline] [-w baseline] [-r pct] [filter]\n" );
+    exit( 2 );
+}
+
+int main( int argc, char** argv )
+{
+    const char* pszCfgDir = "data";
+    uint32_t nTimeMs = SWBENCH_TIME_MS;
+    const char* pszBase = nullptr;
+    const char* pszWrite = nullptr;
+    double dThreshold = SWBENCH_THRESHOLD_PCT;
+    int nOpt;
+    while(( nOpt = getopt( argc, argv, "d:t:b:w:r:" )) != -1 )
+    {
+        switch( nOpt )
+        {
+            case 'd': pszCfgDir = optarg; break;
+            case 't': nTimeMs = atoi( optarg ); break;
+            case 'b': pszBase = optarg; break;
+            case 'w': pszWrite = optarg; break;
+            case 'r': dThreshold = atof( optarg ); break;
+            default: Usage();
+        }
+    }
+    if( optind + 1 < argc )
+        Usage();
+    const char* pszFilter = ( optind < argc ) ? argv[ optind ] : "";
+    std::map< std::string, SResult > mapBase;
+    if( pszBase )
+        mapBase = ReadBaseline( pszBase );
+
+    // Start the FW and connect it to the broker:
+    CHostClock::SetVirtual();
+    LittleFS.SetRoot( pszCfgDir );
+    CHostNet::Sm_pNet = &Sg_broker;
+    setup();
+    for( uint32_t nMs = 0; nMs < 2000; nMs++ )
+    {
+        CHostClock::Advance( 1000 );
+        loop();
+    }
+
+    // Corpora:
+    std::vector< SMsg > vecChMsgs;
+    for( const char* pszChan : { "/ch0", "/ch1", "/ch2", "/ch3" })
+    {
+        for( const char* pszCmd : { "on", "off", "onn", "on/600", "off/30", "tgl", "pulse/500", "on/x" })
+            vecChMsgs.push_back({ std::string( "sw/cmd/testbed" ) + pszChan, pszCmd });
+    }
+    std::vector< SMsg > vecGrpMsgs;
+    for( const char* pszCmd : Sg_arrGrpCmds )
+        vecGrpMsgs.push_back({ "sw/grp/home", pszCmd });
+    std::vector< SMsg > vecMgtMsgs;
+    for( const char* pszCmd : Sg_arrMgtCmds )
+        vecMgtMsgs.push_back({ "sw/mgt/home", pszCmd });
+    std::vector< SMsg > vecMixMsgs;
+    vecMixMsgs.insert( vecMixMsgs.end(), vecChMsgs.begin(), vecChMsgs.end());
+    vecMixMsgs.insert( vecMixMsgs.end(), vecGrpMsgs.begin(), vecGrpMsgs.end());
+    vecMixMsgs.insert( vecMixMsgs.end(), vecMgtMsgs.begin(), vecMgtMsgs.end());
+    vecMixMsgs.push_back({ "sw/other/topic", "on" });
+
+    std::vector< std::string > vecMasks;
+    for( const char* pszCmd : Sg_arrGrpCmds )
+    {
+        if( strlen( pszCmd ) >= 4 + MQTT_CMD_MASK_LEN )
+            vecMasks.push_back( pszCmd + 4 );
+    }
+    std::vector< std::string > vecNums = { "1", "12", "250", "3600", "65535", "0", "x1", "" };
+
+    File fileCh = LittleFS.open( FS_CH1_CFG, "r" );
+    File fileMqtt = LittleFS.open( FS_MQTT_CFG, "r" );
+    File fileWiFi = LittleFS.open( "wifi_cfg", "r" );
+    if(( !fileCh ) || ( !fileMqtt ) || ( !fileWiFi ))
+    {
+        fprintf( stderr, "cfg files missing in %s\n", pszCfgDir );
+        return 2;
+    }
+
+    // The callbacks get mutable copies, just like the ones handed over by the MQTT client:
+    char szTopic[ 128 ];
+    byte arrPayload[ 128 ];
+    auto fnMqttCb =
+        [ & ]( const std::vector< SMsg >& a_rvecMsgs, uint32_t a_nIdx )
+        {
+            const SMsg& rMsg = a_rvecMsgs[ a_nIdx % a_rvecMsgs.size()];
+            memcpy( szTopic, rMsg.strTopic.c_str(), rMsg.strTopic.length() + 1 );
+            memcpy( arrPayload, rMsg.strMsg.data(), rMsg.strMsg.length());
+            g_mqtt.MqttCb( szTopic, arrPayload, rMsg.strMsg.length());
+        };
+    CBenchSwitch::GroupMaskMatchFn pfnGroupMaskMatch = CBenchSwitch::GetGroupMaskMatch();
+
+    std::vector< SBench > vecBench =
+    {
+        { "str/AtoU16_10",
+            [ & ]( uint32_t a_nIdx )
+            {
+                std::string& rstr = vecNums[ a_nIdx % vecNums.size()];
+                Sg_nSink = CStringUtils::AtoU16_10((byte*)rstr.data(), rstr.length());
+            }},
+        { "str/NibbleToU8_16",
+            [ & ]( uint32_t a_nIdx )
+            {
+                Sg_nSink = CStringUtils::NibbleToU8_16( "0123456789abcdefABCDEF"[ a_nIdx % 22 ]);
+            }},
+        { "sw/GroupMaskMatch",
+            [ & ]( uint32_t a_nIdx )
+            {
+                std::string& rstrMask = vecMasks[ a_nIdx % vecMasks.size()];
+                Sg_nSink = ( g_swChan1.*pfnGroupMaskMatch )((byte*)rstrMask.data());
+            }},
+        { "sw/OnGroupCmd",
+            [ & ]( uint32_t a_nIdx )
+            {
+                const SMsg& rMsg = vecGrpMsgs[ a_nIdx % vecGrpMsgs.size()];
+                memcpy( arrPayload, rMsg.strMsg.data(), rMsg.strMsg.length());
+                g_swChan2.OnGroupCmd( arrPayload, rMsg.strMsg.length());
+            }},
+        { "sw/OnTap",
+            [ & ]( uint32_t a_nIdx )
+            {
+                // All the channels and the classic tap events - every tap op of the shipped cfg:
+                CManualSwitch* arrpSw[ SW_CHANNELS ] = { &g_swChan0, &g_swChan1, &g_swChan2 };
+                arrpSw[ a_nIdx % SW_CHANNELS ]->OnTap(( a_nIdx / SW_CHANNELS ) % ( SW_TAP_EVENT_LONG_SINGLE + 1 ), 1 + a_nIdx % 4 );
+            }},
+        { "mqtt/MqttCb/ch",   [ & ]( uint32_t a_nIdx ) { fnMqttCb( vecChMsgs, a_nIdx ); }},
+        { "mqtt/MqttCb/grp",  [ & ]( uint32_t a_nIdx ) { fnMqttCb( vecGrpMsgs, a_nIdx ); }},
+        { "mqtt/MqttCb/mgt",  [ & ]( uint32_t a_nIdx ) { fnMqttCb( vecMgtMsgs, a_nIdx ); }},
+        { "mqtt/MqttCb/mix",  [ & ]( uint32_t a_nIdx ) { fnMqttCb( vecMixMsgs, a_nIdx ); }},
+        { "cfg/ReadValue/ch",
+            [ & ]( uint32_t a_nIdx )
+            {
+                Sg_nSink = CConfigUtils::ReadValue( fileCh, Sg_arrChKeys[ a_nIdx % ARRAY_CNT( Sg_arrChKeys )]).length();
+            }},
+        { "cfg/ReadValue/mqtt",
+            [ & ]( uint32_t a_nIdx )
+            {
+                Sg_nSink = CConfigUtils::ReadValue( fileMqtt, Sg_arrMqttKeys[ a_nIdx % ARRAY_CNT( Sg_arrMqttKeys )]).length();
+            }},
+        { "cfg/ReadValue/wifi",
+            [ & ]( uint32_t a_nIdx )
+            {
+                Sg_nSink = CConfigUtils::ReadValue( fileWiFi, Sg_arrWiFiKeys[ a_nIdx % ARRAY_CNT( Sg_arrWiFiKeys )]).length();
+            }},
+        { "cfg/ReadCfg/ch",
+            [ & ]( uint32_t a_nIdx )
+            {
+                CManualSwitch sw;
+                sw.ReadCfg( a_nIdx % SW_CHANNELS );
+            }},
+    };
+
+    FILE* pWrite = nullptr;
+    if( pszWrite )
+    {
+        pWrite = fopen( pszWrite, "w" );
+        if( !pWrite )
+        {
+            fprintf( stderr, "cannot create %s\n", pszWrite );
+            return 2;
+        }
+        fprintf( pWrite, "# swbench baseline: <name> <ns/op> <allocs/op>\n" );
+    }
+
+    uint32_t nRegressCnt = 0;
+    printf( "%-22s %10s %10s %10s %8s\n", "benchmark", "ns/op", "allocs/op", "base ns/op", "delta" );
+    for( const SBench& rBench : vecBench )
+    {
+        if( !strstr( rBench.pszName, pszFilter ))
+            continue;
+        SResult res = Run( rBench, nTimeMs );
+        printf( "%-22s %10.1f %10.2f", rBench.pszName, res.dNsPerOp, res.dAllocsPerOp );
+        if( pWrite )
+            fprintf( pWrite, "%s %.1f %.2f\n", rBench.pszName, res.dNsPerOp, res.dAllocsPerOp );
+
+        auto it = mapBase.find( rBench.pszName );
+        if( it != mapBase.end())
+        {
+            double dDelta = ( res.dNsPerOp / it->second.dNsPerOp - 1.0 ) * 100.0;
+            bool bRegress = ( dDelta > dThreshold ) || ( res.dAllocsPerOp > it->second.dAllocsPerOp * 1.01 + 0.01 );
+            printf( " %10.1f %+7.1f%%%s", it->second.dNsPerOp, dDelta, bRegress ? " REGRESSION" : "" );
+            if( bRegress )
+                nRegressCnt++;
+        }
+        printf( "\n" );
+        fflush( stdout );
+    }
+    if( pWrite )
+        fclose( pWrite );
+    if( nRegressCnt )
+        fprintf( stderr, "%u regression(s), threshold %.0f%%\n", nRegressCnt, dThreshold );
+    return nRegressCnt ? 1 : 0;
+}
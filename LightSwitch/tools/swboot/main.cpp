@@ -0,0 +1,255 @@
+/**
+ * DIY Smart Home - light switch
+ * Host boot profiler
+ * 
+ * Boots the FW (setup()/loop()) on the real clock against the in-process MQTT broker, captures its boot report
+ * (CBootProf) and prints the boot phase trend of the runs kept in a history file:
+ *   swboot [-d cfg-dir] [-t ms] [-a history] [-l label] [-n runs] [-r pct]
+ * 
+ * The cfg files are read from cfg-dir (default: data). The FW is run until it publishes the boot report,
+ * at most ms (default: 10000). The phases on the host measure the FW code only: the WIFI connects instantly,
+ * the broker replies in-process, so the init stat delay of the mqtt cfg dominates the boot time.
+ * 
+ * -a appends the report to the history file, one run per line: <unix time> <label> <report>, and prints
+ * the trend: the last runs (default: 5) of the history per phase, the median of the history and the delta
+ * of this run vs the median. -l labels the run, e.g. with the optimization measured (default: -).
+ * -r fails the run (exit code 1) if the boot time grows by more than pct % vs the median of the history.
+ */
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <HostSim.h>
+#include <HostBroker.h>
+#include <algorithm>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "BootProf.h"
+
+/// Default boot timeout in ms
+#define SWBOOT_TIMEOUT_MS   10000
+
+/// Default number of the history runs shown
+#define SWBOOT_RUNS         5
+
+/// Real time slept between the loop() calls in us
+#define SWBOOT_STEP_US      100
+
+void setup();
+void loop();
+
+/**
+ * Boot run: a boot report parsed.
+ */
+struct SRun
+{
+    std::string strLabel;   ///< Run label
+    long nReadyMs;          ///< Boot time (ms)
+    std::vector< std::pair< std::string, long >> vecPhases;     ///< Phase durations (us), -1: phase not reached
+};
+
+static CHostBroker& Sg_broker = *new CHostBroker();   // never destroyed: the FW clients close their connections at exit
+static std::string Sg_strReport;    // Boot report captured: <ready ms> <phase>:<us>|- ...
+
+/**
+ * Parse a boot report: <ready ms> <phase>:<us>|- ...
+ */
+static bool Parse( const char* a_pszReport, SRun& a_rRun )
+{
+    char* pszEnd;
+    a_rRun.nReadyMs = strtol( a_pszReport, &pszEnd, 10 );
+    if( pszEnd == a_pszReport )
+        return false;
+    a_rRun.vecPhases.clear();
+    std::string strReport( pszEnd );
+    for( char* pszTok = strtok( &strReport[ 0 ], " \t\r\n" ); pszTok; pszTok = strtok( nullptr, " \t\r\n" ))
+    {
+        char* pszSep = strchr( pszTok, ':' );
+        if( !pszSep )
+            return false;
+        *pszSep = '\0';
+        a_rRun.vecPhases.push_back({ pszTok, ( pszSep[ 1 ] == '-' ) ? -1 : atol( pszSep + 1 )});
+    }
+    return true;
+}
+
+/**
+ * Read the history: <unix time> <label> <report> per line.
+ */
+static std::vector< SRun > ReadHistory( const char* a_pszPath )
+{
+    std::vector< SRun > vecRuns;
+    FILE* pFile = fopen( a_pszPath, "r" );
+    if( !pFile )
+        return vecRuns;
+    char szLine[ 512 ];
+    while( fgets( szLine, sizeof( szLine ), pFile ))
+    {
+        char szLabel[ 64 ];
+        int nOffs = 0;
+        SRun run;
+        if(( sscanf( szLine, "%*u %63s %n", szLabel, &nOffs ) >= 1 ) && ( nOffs ) && ( Parse( szLine + nOffs, run )))
+        {
+            run.strLabel = szLabel;
+            vecRuns.push_back( run );
+        }
+    }
+    fclose( pFile );
+    return vecRuns;
+}
+
+/**
+ * Get a phase duration of a run.
+ * 
+ * @return  Duration (us), -1: phase not reached or not in the run.
+ */
+static long GetPhase( const SRun& a_rRun, const std::string& a_rstrPhase )
+{
+    for( const auto& rPhase : a_rRun.vecPhases )
+    {
+        if( rPhase.first == a_rstrPhase )
+            return rPhase.second;
+    }
+    return -1;
+}
+
+/**
+ * Get the median of the values reached.
+ * 
+ * @return  Median, -1: none.
+ */
+static long Median( std::vector< long > a_vecVals )
+{
+    a_vecVals.erase( std::remove( a_vecVals.begin(), a_vecVals.end(), -1 ), a_vecVals.end());
+    if( a_vecVals.empty())
+        return -1;
+    std::sort( a_vecVals.begin(), a_vecVals.end());
+    return a_vecVals[ a_vecVals.size() / 2 ];
+}
+
+static void PrintVal( long a_nVal )
+{
+    if( a_nVal < 0 )
+        printf( " %10s", "-" );
+    else
+        printf( " %10ld", a_nVal );
+}
+
+static void PrintRow( const char* a_pszName, const std::vector< long >& a_rvecVals, long a_nMedian )
+{
+    printf( "%-8s", a_pszName );
+    for( long nVal : a_rvecVals )
+        PrintVal( nVal );
+    PrintVal( a_nMedian );
+    if(( a_nMedian > 0 ) && ( a_rvecVals.back() >= 0 ))
+        printf( " %+7.1f%%", ( (double)a_rvecVals.back() / a_nMedian - 1.0 ) * 100.0 );
+    printf( "\n" );
+}
+
+static void Usage()
+{
+    fprintf( stderr, "usage: swboot [-d cfg-dir] [-t ms] [-a history] [-l label] [-n runs] [-r pct]\n" );
+    exit( 2 );
+}
+
+int main( int argc, char** argv )
+{
+    const char* pszCfgDir = "data";
+    uint32_t nTimeoutMs = SWBOOT_TIMEOUT_MS;
+    const char* pszHistory = nullptr;
+    const char* pszLabel = "-";
+    size_t nRuns = SWBOOT_RUNS;
+    double dThreshold = -1;
+    int nOpt;
+    while(( nOpt = getopt( argc, argv, "d:t:a:l:n:r:" )) != -1 )
+    {
+        switch( nOpt )
+        {
+            case 'd': pszCfgDir = optarg; break;
+            case 't': nTimeoutMs = atoi( optarg ); break;
+            case 'a': pszHistory = optarg; break;
+            case 'l': pszLabel = optarg; break;
+            case 'n': nRuns = max( 1, atoi( optarg )); break;
+            case 'r': dThreshold = atof( optarg ); break;
+            default: Usage();
+        }
+    }
+    if( optind != argc )
+        Usage();
+
+    LittleFS.SetRoot( pszCfgDir );
+    CHostNet::Sm_pNet = &Sg_broker;
+    Sg_broker.m_fnOnPub =
+        []( int a_nConn, const char* a_pszTopic, const byte* a_pPayload, uint a_nLen, bool a_bRetained )
+        {
+            // <hostname> boot <report>:
+            std::string strMsg((const char*)a_pPayload, a_nLen );
+            size_t nPos = strMsg.find( " " BOOT_PROF_REPORT " " );
+            if(( Sg_strReport.empty()) && ( nPos != std::string::npos ) && ( strMsg.find( ' ' ) == nPos ))
+                Sg_strReport = strMsg.substr( nPos + sizeof( BOOT_PROF_REPORT ) + 1 );
+        };
+
+    setup();
+    while(( Sg_strReport.empty()) && ( millis() < nTimeoutMs ))
+    {
+        loop();
+        usleep( SWBOOT_STEP_US );
+    }
+    SRun run;
+    if(( Sg_strReport.empty()) || ( !Parse( Sg_strReport.c_str(), run )))
+    {
+        fprintf( stderr, "no boot report in %u ms - check the mqtt cfg in %s\n", nTimeoutMs, pszCfgDir );
+        return 2;
+    }
+    run.strLabel = pszLabel;
+    printf( "boot %s\n", Sg_strReport.c_str());
+    if( !pszHistory )
+        return 0;
+
+    std::vector< SRun > vecRuns = ReadHistory( pszHistory );
+    vecRuns.push_back( run );
+    FILE* pFile = fopen( pszHistory, "a" );
+    if( !pFile )
+    {
+        fprintf( stderr, "cannot append to %s\n", pszHistory );
+        return 2;
+    }
+    fprintf( pFile, "%lu %s %s\n", (unsigned long)time( nullptr ), pszLabel, Sg_strReport.c_str());
+    fclose( pFile );
+
+    // Trend: the last runs shown, the median of all the runs:
+    size_t nFirst = ( vecRuns.size() > nRuns ) ? vecRuns.size() - nRuns : 0;
+    printf( "\n%-8s", "phase us" );
+    for( size_t nIdx = nFirst; nIdx < vecRuns.size(); nIdx++ )
+        printf( " %10.10s", vecRuns[ nIdx ].strLabel.c_str());
+    printf( " %10s %8s\n", "median", "delta" );
+    for( const auto& rPhase : run.vecPhases )
+    {
+        std::vector< long > vecShown, vecAll;
+        for( size_t nIdx = 0; nIdx < vecRuns.size(); nIdx++ )
+        {
+            long nVal = GetPhase( vecRuns[ nIdx ], rPhase.first );
+            vecAll.push_back( nVal );
+            if( nIdx >= nFirst )
+                vecShown.push_back( nVal );
+        }
+        PrintRow( rPhase.first.c_str(), vecShown, Median( vecAll ));
+    }
+    std::vector< long > vecShown, vecAll;
+    for( size_t nIdx = 0; nIdx < vecRuns.size(); nIdx++ )
+    {
+        vecAll.push_back( vecRuns[ nIdx ].nReadyMs );
+        if( nIdx >= nFirst )
+            vecShown.push_back( vecRuns[ nIdx ].nReadyMs );
+    }
+    long nMedian = Median( vecAll );
+    PrintRow( "ready ms", vecShown, nMedian );
+
+    if(( dThreshold >= 0 ) && ( nMedian > 0 ) && ( run.nReadyMs > nMedian * ( 1.0 + dThreshold / 100.0 )))
+    {
+        fprintf( stderr, "boot time regression: %ld ms vs median %ld ms, threshold %.0f%%\n", run.nReadyMs, nMedian, dThreshold );
+        return 1;
+    }
+    return 0;
+}
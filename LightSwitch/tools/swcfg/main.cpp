@@ -0,0 +1,177 @@
+/**
+ * DIY Smart Home - light switch
+ * Config push tool
+ * 2022 Łukasz Łasek
+ * 
+ * Pushes a config value or a whole config file to a device over the device management topic (see CCfgPush),
+ * the device stores and applies it without a reset:
+ *   swcfg [-h host] [-p port] [-i client-id] [-m mgt-topic] [-T timeout-ms] <hostname> set <file> <name> <value>
+ *   swcfg [-h host] [-p port] [-i client-id] [-m mgt-topic] [-T timeout-ms] <hostname> put <file> [<local file>]
+ * 
+ * file: ch0_cfg, ch1_cfg, ch2_cfg, wifi_cfg, mqtt_cfg, scn_cfg. The local file defaults to data/<file>.
+ * The file is sent in CFG_PUSH_CHUNK_LEN chunks, each one acked by the device, followed by its length and CRC32.
+ * The exit code is 1 if the device rejects the config or does not reply.
+ */
+#include <Arduino.h>
+#include <WiFiClient.h>
+#include <unistd.h>
+#include <string>
+
+#include "MqttClient.h"
+#include "Crc32.h"
+#include "Mqtt.h"
+
+/// Default reply timeout in ms
+#define SWCFG_TIMEOUT_MS    5000
+
+static void Usage()
+{
+    fprintf( stderr,
+        "usage: swcfg [-h host] [-p port] [-i client-id] [-m mgt-topic] [-T timeout-ms] <hostname> set <file> <name> <value>\n"
+        "       swcfg [-h host] [-p port] [-i client-id] [-m mgt-topic] [-T timeout-ms] <hostname> put <file> [<local file>]\n" );
+    exit( 2 );
+}
+
+int main( int argc, char** argv )
+{
+    const char* pszHost = "localhost";
+    uint16_t nPort = 1883;
+    const char* pszId = "swcfg";
+    std::string strMgt = "sw/mgt/home";
+    long nTimeoutMs = SWCFG_TIMEOUT_MS;
+
+    int nOpt;
+    while(( nOpt = getopt( argc, argv, "h:p:i:m:T:" )) != -1 )
+    {
+        switch( nOpt )
+        {
+            case 'h': pszHost = optarg; break;
+            case 'p': nPort = atoi( optarg ); break;
+            case 'i': pszId = optarg; break;
+            case 'm': strMgt = optarg; break;
+            case 'T': nTimeoutMs = atol( optarg ); break;
+            default: Usage();
+        }
+    }
+    if( optind + 3 > argc )
+        Usage();
+    const char* pszHostname = argv[ optind ];
+    const char* pszMode = argv[ optind + 1 ];
+    const char* pszFile = argv[ optind + 2 ];
+    bool bSet = !strcmp( pszMode, "set" );
+    if(( bSet ) ? ( optind + 5 != argc ) : (( strcmp( pszMode, "put" )) || ( optind + 4 < argc )))
+        Usage();
+
+    std::string strData;
+    if( !bSet )
+    {
+        std::string strPath = ( optind + 4 == argc ) ? argv[ optind + 3 ] : std::string( "data/" ) + pszFile;
+        FILE* pFile = fopen( strPath.c_str(), "rb" );
+        if( !pFile )
+        {
+            fprintf( stderr, "cannot open %s\n", strPath.c_str());
+            return 2;
+        }
+        char arrBuf[ 1024 ];
+        size_t nLen;
+        while(( nLen = fread( arrBuf, 1, sizeof( arrBuf ), pFile )) > 0 )
+            strData.append( arrBuf, nLen );
+        fclose( pFile );
+    }
+
+    std::string strCmdTopic = strMgt + "/cmd";
+    std::string strStatTopic = strMgt + "/stat";
+    std::string strReplyPrefix = std::string( pszHostname ) + " " MQTT_CMD_MGT_CFG " " + pszFile + " ";
+
+    WiFiClient wc;
+    wc.setTimeout( nTimeoutMs );
+    CMqttClient mqtt( wc );
+    mqtt.SetServer( pszHost, nPort );
+
+    // Cmd of the next step: a chunk, the end of the file or the value:
+    size_t nPos = 0;
+    bool bEnd = false;
+    auto fnSend = [ & ]()
+    {
+        std::string strCmd;
+        if( bSet )
+        {
+            strCmd = MQTT_CMD_MGT_CFG_SET MQTT_CMD_SEPARATOR + std::string( pszHostname ) + MQTT_CMD_SEPARATOR + pszFile +
+                MQTT_CMD_SEPARATOR + argv[ optind + 3 ] + MQTT_CMD_SEPARATOR + argv[ optind + 4 ];
+        }
+        else if( nPos < strData.size())
+        {
+            strCmd = MQTT_CMD_MGT_CFG_PUT MQTT_CMD_SEPARATOR + std::string( pszHostname ) + MQTT_CMD_SEPARATOR + pszFile +
+                MQTT_CMD_SEPARATOR + std::to_string( nPos ) + MQTT_CMD_SEPARATOR + strData.substr( nPos, CFG_PUSH_CHUNK_LEN );
+        }
+        else
+        {
+            char szCrc[ 9 ];
+            snprintf( szCrc, sizeof( szCrc ), "%08x", CCrc32::Calc( strData.data(), strData.size()));
+            strCmd = MQTT_CMD_MGT_CFG_END MQTT_CMD_SEPARATOR + std::string( pszHostname ) + MQTT_CMD_SEPARATOR + pszFile +
+                MQTT_CMD_SEPARATOR + std::to_string( strData.size()) + MQTT_CMD_SEPARATOR + szCrc;
+            bEnd = true;
+        }
+        if( !mqtt.Publish( strCmdTopic.c_str(), (const byte*)strCmd.data(), strCmd.size(), false, 1 ))
+        {
+            fprintf( stderr, "publish failed\n" );
+            exit( 1 );
+        }
+    };
+
+    CTimer tm;
+    int nRet = -1;
+    mqtt.SetCallback(
+        [ & ]( char* topic, byte* payload, uint len )
+        {
+            std::string strReply((const char*)payload, len );
+            if(( strStatTopic != topic ) || ( strReply.compare( 0, strReplyPrefix.size(), strReplyPrefix )))
+                return;
+            std::string strResult = strReply.substr( strReplyPrefix.size());
+            tm.UpdateAll();
+            if(( !bSet ) && ( !bEnd ) && ( isdigit( strResult[ 0 ])))
+            {
+                size_t nNext = strtoul( strResult.c_str(), nullptr, 10 );
+                if( nNext == min( nPos + CFG_PUSH_CHUNK_LEN, strData.size()))
+                {
+                    nPos = nNext;
+                    fnSend();
+                    return;
+                }
+            }
+            printf( "%s\n", strReply.c_str());
+            nRet = ( strResult == "ok" ) ? 0 : 1;
+        });
+    mqtt.SetConnCallback(
+        [ & ]()
+        {
+            mqtt.Subscribe( strStatTopic.c_str());
+            fnSend();
+        });
+
+    if( !mqtt.Connect( pszId ))
+    {
+        fprintf( stderr, "connect to %s:%u failed\n", pszHost, nPort );
+        return 1;
+    }
+    tm.UpdateAll();
+    while( nRet < 0 )
+    {
+        mqtt.loop();
+        if( !mqtt.Connected() && !mqtt.Connecting())
+        {
+            fprintf( stderr, "disconnected\n" );
+            return 1;
+        }
+        tm.UpdateCur();
+        if( tm.Delta() > (ulong)nTimeoutMs )
+        {
+            fprintf( stderr, "timeout at %zu/%zu\n", nPos, strData.size());
+            return 1;
+        }
+        usleep( 1000 );
+    }
+    mqtt.loop();
+    mqtt.Disconnect();
+    return nRet;
+}
@@ -0,0 +1,457 @@
+/**
+ * DIY Smart Home - light switch
+ * Fleet simulator
+ * 2022 Łukasz Łasek
+ * 
+ * Runs N virtual switches - each a full copy of the FW logic (CWiFiHelper, CMqtt, 3x CManualSwitch)
+ * with its own cfg, client id and GPIO bank - in one process, drives random taps and reports
+ * the group protocol scaling:
+ *   swfleet [-h host] [-p port] [-N n[,n...]] [-i ids] [-c chain] [-t taps] [-g gap-ms] [-l long-pct]
+ *           [-q qos] [-V 4|5] [-j dir-jitter-ms] [-o] [-s seed] [-v]
+ * 
+ * Without -h the fleet runs on the virtual clock against the in-process MQTT broker - deterministic,
+ * exact broker counters. With -h the fleet runs in real time against the broker at host:port
+ * (e.g. a local mosquitto) - the broker load is read from its $SYS topics if published.
+ * 
+ * The fleet is simulated for every n of the -N list (default: 10,50,100). Channel c of device d
+ * gets the group id (d * 3 + c) % ids + 1 (default ids: 64), i.e. the ids repeat with more than
+ * ids channels. Every channel toggles on short taps and toggles + turns off all other ids
+ * (tgof 0xff..ff) on long taps. The channel 0 of the first chain devices (-c, default: 0)
+ * forwards its short tap to the channel 0 of the next device (fwte) - a tap at the chain head
+ * travels the whole chain.
+ * 
+ * taps taps (default: 20) are injected at random channels gap-ms apart (default: 1500),
+ * long-pct % of them are long (default: 30). The report per n:
+ *   msgs/tap - broker publications, group and state publications, deliveries to the devices
+ *   relay changes/tap - local (the tapped device) and remote (caused by the group commands)
+ *   group latency - tap start to every remote relay change, percentiles
+ * 
+ * With -o (in-process broker only) the broker drops all the connections after the taps, as upon a broker restart,
+ * the fleet recovery is reported: the time until every device is online again, the publications during
+ * the recovery and their peak rate - overall and on the mgt topic (the discovery replies, spread over
+ * dir-jitter-ms by the device, default: 2000 as in data/).
+ */
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <HostSim.h>
+#include <HostBroker.h>
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "WiFiHelper.h"
+#include "ManualSwitch.h"
+#include "Mqtt.h"
+
+/// Group topic of the fleet
+#define FLEET_GRP_TOPIC     "sw/grp/home"
+
+/// Short tap duration in ms
+#define FLEET_SHORT_TAP_MS  50
+
+/// Long tap duration in ms
+#define FLEET_LONG_TAP_MS   400
+
+/// Fleet start-up time - connections, initial state publications - in ms
+#define FLEET_STARTUP_MS    3000
+
+/// Recovery time observed after the broker drops the connections, in ms
+#define FLEET_OUTAGE_MS     5000
+
+/// Publication rate bucket of the recovery, in ms
+#define FLEET_OUTAGE_BUCKET_MS  100
+
+/**
+ * Virtual switch: the FW objects of src/main.cpp.
+ */
+struct SDevice
+{
+    CWiFiHelper wifi;                           ///< WIFI helper
+    CMqtt mqtt;                                 ///< MQTT client
+    CInputTrace trace;                          ///< Input trace
+    CManualSwitch arrChans[ SW_CHANNELS ];      ///< Switch channels
+};
+
+/**
+ * Fleet run statistics.
+ */
+struct SStats
+{
+    uint32_t nTaps = 0;                 ///< Taps injected
+    uint32_t nLongTaps = 0;             ///< Long taps injected
+    uint32_t nPubs = 0;                 ///< Publications seen by the broker
+    uint32_t nGrpPubs = 0;              ///< Group publications
+    uint32_t nStatPubs = 0;             ///< Channel state publications
+    uint32_t nLocal = 0;                ///< Relay changes of the tapped device
+    uint32_t nRemote = 0;               ///< Relay changes of the other devices
+    std::vector< uint32_t > vecLatUs;   ///< Tap to remote relay change latencies
+};
+
+/**
+ * Fleet recovery statistics - after the broker drops the connections.
+ */
+struct SOutage
+{
+    uint64_t nStartUs = 0;              ///< Connections dropped
+    uint64_t nOnlineUs = 0;             ///< Last device online again
+    uint32_t nOnline = 0;               ///< Devices online again
+    uint32_t nPubs = 0;                 ///< Publications
+    uint32_t nMgtPubs = 0;              ///< Publications on the mgt topic
+    std::vector< uint32_t > vecPubs;    ///< Publications per FLEET_OUTAGE_BUCKET_MS
+    std::vector< uint32_t > vecMgtPubs; ///< Mgt topic publications per FLEET_OUTAGE_BUCKET_MS
+};
+
+static const uint8_t Sg_arrPinIn[ SW_CHANNELS ] = { PIN_IN0, PIN_IN1, PIN_IN2 };
+
+static uint64_t Sg_nTapUs = 0;          // Start of the last tap
+static int Sg_nTapDev = -1;             // Device of the last tap
+static SStats Sg_stats;
+static SOutage* Sg_pOutage = nullptr;   // Recovery in progress
+static bool Sg_bVerbose = false;
+static CMqttClient* Sg_pMon = nullptr; // Monitor client of a real broker
+
+static uint64_t Now()
+{
+    return micros();
+}
+
+static void WriteCfg( const std::string& a_rstrPath, const std::vector< std::pair< const char*, std::string >>& a_rvecEntries )
+{
+    FILE* pFile = fopen( a_rstrPath.c_str(), "w" );
+    if( !pFile )
+    {
+        fprintf( stderr, "cannot create %s\n", a_rstrPath.c_str());
+        exit( 2 );
+    }
+    for( auto& rEntry : a_rvecEntries )
+        fprintf( pFile, "// %s:\n%s\n\n", rEntry.first, rEntry.second.c_str());
+    fclose( pFile );
+}
+
+static std::string Mask( uint8_t a_nId )
+{
+    char szMask[ MQTT_CMD_MASK_LEN + 1 ];
+    snprintf( szMask, sizeof( szMask ), "0x%016llx", 1ull << ( a_nId - 1 ));
+    return szMask;
+}
+
+static void Loop( std::vector< std::unique_ptr< SDevice >>& a_rvecDevs )
+{
+    for( size_t nDev = 0; nDev < a_rvecDevs.size(); nDev++ )
+    {
+        // Mirrors loop() of src/main.cpp:
+        SDevice& rDev = *a_rvecDevs[ nDev ];
+        CHostGpio::SetBank( nDev );
+        if( rDev.wifi.Connected())
+        {
+            rDev.wifi.loop();
+            rDev.mqtt.loop();
+        }
+        for( CManualSwitch& rChan : rDev.arrChans )
+            rChan.loop();
+    }
+}
+
+static void Wait( std::vector< std::unique_ptr< SDevice >>& a_rvecDevs, uint64_t a_nUs )
+{
+    for( uint64_t nEnd = Now() + a_nUs; Now() < nEnd; )
+    {
+        if( CHostClock::IsVirtual())
+            CHostClock::Advance( min((uint64_t)1000, nEnd - Now()));
+        Loop( a_rvecDevs );
+        if( Sg_pMon )
+            Sg_pMon->loop();
+        if( !CHostClock::IsVirtual())
+            usleep( 100 );
+    }
+}
+
+static uint32_t Percentile( std::vector< uint32_t >& a_rvecSorted, uint32_t a_nPct )
+{
+    if( a_rvecSorted.empty())
+        return 0;
+    size_t nIdx = ( a_rvecSorted.size() * a_nPct + 99 ) / 100;
+    return a_rvecSorted[ max((size_t)1, nIdx ) - 1 ];
+}
+
+static void Usage()
+{
+    fprintf( stderr,
+        "usage: swfleet [-h host] [-p port] [-N n[,n...]] [-i ids] [-c chain] [-t taps] [-g gap-ms] [-l long-pct]\n"
+        "               [-q qos] [-V 4|5] [-j dir-jitter-ms] [-o] [-s seed] [-v]\n" );
+    exit( 2 );
+}
+
+int main( int argc, char** argv )
+{
+    const char* pszHost = nullptr;
+    uint16_t nPort = 1883;
+    std::vector< uint32_t > vecSizes;
+    uint32_t nIds = SW_MAX_ID;
+    uint32_t nChain = 0;
+    uint32_t nTaps = 20;
+    uint32_t nGapMs = 1500;
+    uint32_t nLongPct = 30;
+    uint32_t nQos = 1;
+    uint32_t nProto = MQTT_CLIENT_V311;
+    uint32_t nSeed = 1;
+    uint32_t nDirJitterMs = 2000;
+    bool bOutage = false;
+
+    int nOpt;
+    while(( nOpt = getopt( argc, argv, "h:p:N:i:c:t:g:l:q:V:j:os:v" )) != -1 )
+    {
+        switch( nOpt )
+        {
+            case 'h': pszHost = optarg; break;
+            case 'p': nPort = atoi( optarg ); break;
+            case 'N':
+                for( char* psz = strtok( optarg, "," ); psz; psz = strtok( nullptr, "," ))
+                    vecSizes.push_back( max( 1, atoi( psz )));
+                break;
+            case 'i': nIds = min( max( atoi( optarg ), 1 ), SW_MAX_ID ); break;
+            case 'c': nChain = atoi( optarg ); break;
+            case 't': nTaps = atoi( optarg ); break;
+            case 'g': nGapMs = atoi( optarg ); break;
+            case 'l': nLongPct = atoi( optarg ); break;
+            case 'q': nQos = atoi( optarg ) ? 1 : 0; break;
+            case 'V': nProto = ( atoi( optarg ) == MQTT_CLIENT_V5 ) ? MQTT_CLIENT_V5 : MQTT_CLIENT_V311; break;
+            case 'j': nDirJitterMs = atoi( optarg ); break;
+            case 'o': bOutage = true; break;
+            case 's': nSeed = atol( optarg ); break;
+            case 'v': Sg_bVerbose = true; break;
+            default: Usage();
+        }
+    }
+    if(( optind != argc ) || (( bOutage ) && ( pszHost )))
+        Usage();
+    if( vecSizes.empty())
+        vecSizes = { 10, 50, 100 };
+
+    char szRoot[] = "/tmp/swfleet.XXXXXX";
+    if( !mkdtemp( szRoot ))
+    {
+        perror( "mkdtemp" );
+        return 2;
+    }
+
+    if( !pszHost )
+        CHostClock::SetVirtual();
+    CHostGpio::Sm_fnOnOutput =
+        []( uint8_t a_nPin, uint8_t a_nVal )
+        {
+            if( Sg_nTapDev < 0 )
+                return;
+            if( CHostGpio::GetBank() == Sg_nTapDev )
+            {
+                Sg_stats.nLocal++;
+            }
+            else
+            {
+                Sg_stats.nRemote++;
+                Sg_stats.vecLatUs.push_back( Now() - Sg_nTapUs );
+            }
+            if( Sg_bVerbose )
+                printf( "%10.3f dev %u pin %u %s\n", Now() / 1e6, CHostGpio::GetBank(), a_nPin, a_nVal ? "on" : "off" );
+        };
+
+    // Broker load - the in-process broker counters or the $SYS topics of a real broker:
+    uint32_t nSysSent = 0;
+    uint32_t nSysRcvd = 0;
+    auto fnOnPub =
+        [ & ]( const char* a_pszTopic, const byte* a_pPayload, uint a_nLen )
+        {
+            if( Sg_pOutage )
+            {
+                SOutage& rOutage = *Sg_pOutage;
+                size_t nBucket = ( Now() - rOutage.nStartUs ) / ( FLEET_OUTAGE_BUCKET_MS * 1000 );
+                if( rOutage.vecPubs.size() <= nBucket )
+                {
+                    rOutage.vecPubs.resize( nBucket + 1 );
+                    rOutage.vecMgtPubs.resize( nBucket + 1 );
+                }
+                rOutage.nPubs++;
+                rOutage.vecPubs[ nBucket ]++;
+                if( !strncmp( a_pszTopic, "sw/mgt/", 7 ))
+                {
+                    rOutage.nMgtPubs++;
+                    rOutage.vecMgtPubs[ nBucket ]++;
+                }
+                else if(( !strncmp( a_pszTopic, "sw/stat/", 8 )) && ( !strstr( a_pszTopic, MQTT_TOPIC_CHANNEL ))
+                    && ( a_nLen == strlen( MQTT_STAT_ONLINE )) && ( !memcmp( a_pPayload, MQTT_STAT_ONLINE, a_nLen )))
+                {
+                    rOutage.nOnline++;
+                    rOutage.nOnlineUs = Now();
+                }
+            }
+            if( Sg_nTapDev < 0 )
+                return;
+            Sg_stats.nPubs++;
+            if( !strcmp( a_pszTopic, FLEET_GRP_TOPIC ))
+                Sg_stats.nGrpPubs++;
+            else if( strstr( a_pszTopic, MQTT_TOPIC_CHANNEL ))
+                Sg_stats.nStatPubs++;
+        };
+    WiFiClient wcMon;
+    CMqttClient mqttMon( wcMon );
+    if( pszHost )
+    {
+        mqttMon.SetServer( pszHost, nPort );
+        mqttMon.SetCallback(
+            [ & ]( char* topic, byte* payload, uint len )
+            {
+                if( !strcmp( topic, "$SYS/broker/messages/sent" ))
+                    nSysSent = atol( std::string((const char*)payload, len ).c_str());
+                else if( !strcmp( topic, "$SYS/broker/messages/received" ))
+                    nSysRcvd = atol( std::string((const char*)payload, len ).c_str());
+                else
+                    fnOnPub( topic, payload, len );
+            });
+        mqttMon.SetConnCallback(
+            [ & ]()
+            {
+                mqttMon.Subscribe( "sw/#" );
+                mqttMon.Subscribe( "$SYS/broker/messages/sent" );
+                mqttMon.Subscribe( "$SYS/broker/messages/received" );
+            });
+        if( !mqttMon.Connect( "sw_fleet_mon" ))
+        {
+            fprintf( stderr, "connect to %s:%u failed\n", pszHost, nPort );
+            return 1;
+        }
+        Sg_pMon = &mqttMon;
+    }
+
+    printf( "%6s %5s %6s %8s %8s %8s %8s %8s %8s %8s %8s %8s\n", "n", "taps", "pub/t", "grp/t", "stat/t", "dlv/t",
+        "local/t", "remote/t", "p50 ms", "p90 ms", "p99 ms", "max ms" );
+    for( uint32_t nSize : vecSizes )
+    {
+        std::unique_ptr< CHostBroker > pBroker;
+        if( !pszHost )
+        {
+            pBroker.reset( new CHostBroker());
+            pBroker->m_fnOnPub =
+                [ & ]( int a_nConn, const char* a_pszTopic, const byte* a_pPayload, uint a_nLen, bool a_bRetained )
+                {
+                    fnOnPub( a_pszTopic, a_pPayload, a_nLen );
+                };
+            CHostNet::Sm_pNet = pBroker.get();
+        }
+
+        // Bring up the fleet - mirrors setup() of src/main.cpp:
+        Sg_nTapDev = -1;
+        Sg_stats = SStats();
+        std::vector< std::unique_ptr< SDevice >> vecDevs;
+        for( uint32_t nDev = 0; nDev < nSize; nDev++ )
+        {
+            std::string strDir = std::string( szRoot ) + "/" + std::to_string( nDev );
+            mkdir( strDir.c_str(), 0700 );
+            std::string strId = "fleet" + std::to_string( nDev );
+            WriteCfg( strDir + "/" FS_MQTT_CFG, {
+                { "srv", pszHost ? pszHost : "broker" }, { "port", std::to_string( nPort )}, { "conn timeout ms", "1000" },
+                { "init stat pub delay ms", "1000" }, { "client id", "sw_" + strId }, { "sub topic", "sw/cmd/" + strId },
+                { "pub topic", "sw/stat/" + strId }, { "grp topic", FLEET_GRP_TOPIC }, { "mgt topic", "sw/mgt/home" },
+                { "qos", std::to_string( nQos )}, { "ver", std::to_string( nProto )}, { "dir reply jitter ms", std::to_string( nDirJitterMs )}});
+            WriteCfg( strDir + "/" FS_WIFI_CFG, {
+                { "hostname", "sw-" + strId }, { "conn timeout in sec - reset", "0" }, { "ssid1", "ssid" }, { "pwd1", "pwd" }});
+            for( uint32_t nChan = 0; nChan < SW_CHANNELS; nChan++ )
+            {
+                uint8_t nId = ( nDev * SW_CHANNELS + nChan ) % nIds + 1;
+                bool bFwd = ( nChan == 0 ) && ( nDev + 1 < min( nChain, nSize ));
+                const char* arrCfgFile[ SW_CHANNELS ] = { FS_CH0_CFG, FS_CH1_CFG, FS_CH2_CFG };
+                WriteCfg( strDir + "/" + arrCfgFile[ nChan ], {
+                    { "id", std::to_string( nId )},
+                    { "ev-ss tap", bFwd ? "fwte" : "tgle" },
+                    { "arg-ss tap", bFwd ? Mask(( nDev + 1 ) * SW_CHANNELS % nIds + 1 ) : "-" },
+                    { "ev-sm tap", "tgle" }, { "arg-sm tap", "-" },
+                    { "ev-ls tap", "tgof" }, { "arg-ls tap", "0xffffffffffffffff" },
+                    { "long tap ms", "250" }, { "next tap ms", "250" }});
+            }
+
+            vecDevs.emplace_back( new SDevice());
+            SDevice& rDev = *vecDevs.back();
+            CHostGpio::SetBank( nDev );
+            LittleFS.SetRoot( strDir.c_str());
+            rDev.mqtt.Attach( rDev.wifi, rDev.trace, rDev.arrChans[ 0 ], rDev.arrChans[ 1 ], rDev.arrChans[ 2 ]);
+            LittleFS.begin();
+            for( uint32_t nChan = 0; nChan < SW_CHANNELS; nChan++ )
+                rDev.arrChans[ nChan ].ReadCfg( nChan );
+            rDev.wifi.ReadCfg();
+            rDev.mqtt.ReadCfg();
+            LittleFS.end();
+            rDev.wifi.Enable();
+            rDev.mqtt.Enable();
+            for( CManualSwitch& rChan : rDev.arrChans )
+                rChan.Enable();
+        }
+        Wait( vecDevs, FLEET_STARTUP_MS * 1000 );
+
+        // Taps:
+        std::mt19937 rnd( nSeed );
+        uint32_t nDlvStart = pBroker ? pBroker->m_nDeliverCnt : nSysSent;
+        uint32_t nRcvdStart = nSysRcvd;
+        for( uint32_t nTap = 0; nTap < nTaps; nTap++ )
+        {
+            // The chain head gets every other tap:
+            uint32_t nDev = (( nChain > 1 ) && ( nTap & 1 )) ? 0 : rnd() % nSize;
+            uint32_t nChan = (( nChain > 1 ) && ( nTap & 1 )) ? 0 : rnd() % SW_CHANNELS;
+            bool bLong = (( nChain <= 1 ) || !( nTap & 1 )) && ( rnd() % 100 < nLongPct );
+            Sg_nTapUs = Now();
+            Sg_nTapDev = nDev;
+            Sg_stats.nTaps++;
+            Sg_stats.nLongTaps += bLong;
+            if( Sg_bVerbose )
+                printf( "%10.3f tap dev %u ch %u %s\n", Now() / 1e6, nDev, nChan, bLong ? "long" : "short" );
+
+            CHostGpio::SetBank( nDev );
+            CHostGpio::SetInput( Sg_arrPinIn[ nChan ], HIGH );
+            Wait( vecDevs, ( bLong ? FLEET_LONG_TAP_MS : FLEET_SHORT_TAP_MS ) * 1000 );
+            CHostGpio::SetBank( nDev );
+            CHostGpio::SetInput( Sg_arrPinIn[ nChan ], LOW );
+            Wait( vecDevs, ( nGapMs - ( bLong ? FLEET_LONG_TAP_MS : FLEET_SHORT_TAP_MS )) * 1000 );
+        }
+
+        SStats& rStats = Sg_stats;
+        std::sort( rStats.vecLatUs.begin(), rStats.vecLatUs.end());
+        double dTaps = max( 1u, rStats.nTaps );
+        double dDlv = ( pBroker ? pBroker->m_nDeliverCnt : nSysSent ) - nDlvStart;
+        printf( "%6u %5u %6.1f %8.1f %8.1f %8.1f %8.2f %8.2f %8.1f %8.1f %8.1f %8.1f\n", nSize, rStats.nTaps,
+            rStats.nPubs / dTaps, rStats.nGrpPubs / dTaps, rStats.nStatPubs / dTaps, dDlv / dTaps,
+            rStats.nLocal / dTaps, rStats.nRemote / dTaps, Percentile( rStats.vecLatUs, 50 ) / 1000.0,
+            Percentile( rStats.vecLatUs, 90 ) / 1000.0, Percentile( rStats.vecLatUs, 99 ) / 1000.0,
+            rStats.vecLatUs.empty() ? 0.0 : rStats.vecLatUs.back() / 1000.0 );
+        if(( pszHost ) && ( nSysRcvd > nRcvdStart ))
+            printf( "%6s broker $SYS: received %u, sent %u\n", "", nSysRcvd - nRcvdStart, nSysSent - (uint32_t)nDlvStart );
+        if( pBroker )
+            printf( "%6s broker: %u pubs in, %u deliveries out, %.1f kB in\n", "", pBroker->m_nPubCnt, pBroker->m_nDeliverCnt, pBroker->m_nBytes / 1024.0 );
+
+        // Broker restart - all the connections dropped:
+        if( bOutage )
+        {
+            SOutage outage;
+            Sg_nTapDev = -1;
+            Sg_pOutage = &outage;
+            outage.nStartUs = Now();
+            for( int nConn = 0; nConn < pBroker->GetConnCnt(); nConn++ )
+                pBroker->Drop( nConn );
+            Wait( vecDevs, FLEET_OUTAGE_MS * 1000 );
+            Sg_pOutage = nullptr;
+            printf( "%6s outage: %u/%u online in %.1f ms, %u pubs (mgt %u), peak %u pubs (mgt %u) per %u ms\n", "",
+                outage.nOnline, nSize, ( outage.nOnlineUs - outage.nStartUs ) / 1000.0, outage.nPubs, outage.nMgtPubs,
+                outage.vecPubs.empty() ? 0 : *std::max_element( outage.vecPubs.begin(), outage.vecPubs.end()),
+                outage.vecMgtPubs.empty() ? 0 : *std::max_element( outage.vecMgtPubs.begin(), outage.vecMgtPubs.end()),
+                FLEET_OUTAGE_BUCKET_MS );
+        }
+        fflush( stdout );
+
+        // Tear down - the devices close their connections before the broker goes:
+        Sg_nTapDev = -1;
+        vecDevs.clear();
+        CHostNet::Sm_pNet = nullptr;
+    }
+
+    std::string strRm = std::string( "rm -rf " ) + szRoot;
+    return system( strRm.c_str()) ? 1 : 0;
+}
@@ -0,0 +1,138 @@
+/**
+ * DIY Smart Home - light switch
+ * Group cmd latency tool
+ * 2022 Łukasz Łasek
+ * 
+ * The reference clock of the group cmd latency tracing (see CClockSync) and the latency stats collector (see CGrpTrace):
+ *   swlat [-h host] [-p port] [-i client-id] [-m mgt-topic] [-s secs] [-c] [<hostname>...]
+ * 
+ * Answers the clock sync requests of all the devices with the host clock (ms) - run it next to the broker,
+ * so the RTT to the reference clock is the RTT to the broker. The devices trace their group cmds once
+ * the "lat" period is set in their mqtt cfg and the clock is synced.
+ * Every secs (default: 10) requests the latency stats of the hostnames given and prints them, -c clears them
+ * on the devices once sent. Without the hostnames the clock is served only.
+ */
+#include <Arduino.h>
+#include <WiFiClient.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "MqttClient.h"
+#include "Mqtt.h"
+
+/// Default stats poll period in s
+#define SWLAT_PERIOD_S      10
+
+static void Usage()
+{
+    fprintf( stderr, "usage: swlat [-h host] [-p port] [-i client-id] [-m mgt-topic] [-s secs] [-c] [<hostname>...]\n" );
+    exit( 2 );
+}
+
+/**
+ * Get the reference time: the host clock (ms), wraps as millis() does.
+ */
+static uint32_t RefMs()
+{
+    struct timeval tv;
+    gettimeofday( &tv, nullptr );
+    return (uint32_t)((uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000 );
+}
+
+int main( int argc, char** argv )
+{
+    const char* pszHost = "localhost";
+    uint16_t nPort = 1883;
+    const char* pszId = "swlat";
+    std::string strMgt = "sw/mgt/home";
+    ulong nPeriodMs = SWLAT_PERIOD_S * 1000;
+    bool bClear = false;
+
+    int nOpt;
+    while(( nOpt = getopt( argc, argv, "h:p:i:m:s:c" )) != -1 )
+    {
+        switch( nOpt )
+        {
+            case 'h': pszHost = optarg; break;
+            case 'p': nPort = atoi( optarg ); break;
+            case 'i': pszId = optarg; break;
+            case 'm': strMgt = optarg; break;
+            case 's': nPeriodMs = max( 1, atoi( optarg )) * 1000; break;
+            case 'c': bClear = true; break;
+            default: Usage();
+        }
+    }
+    std::vector< std::string > vecHostnames( argv + optind, argv + argc );
+
+    std::string strCmdTopic = strMgt + "/cmd";
+    std::string strStatTopic = strMgt + "/stat";
+
+    WiFiClient wc;
+    CMqttClient mqtt( wc );
+    mqtt.SetServer( pszHost, nPort );
+    auto fnPub = [ & ]( const std::string& a_rstrCmd )
+    {
+        if( !mqtt.Publish( strCmdTopic.c_str(), (const byte*)a_rstrCmd.data(), a_rstrCmd.size(), false, 0 ))
+            fprintf( stderr, "publish failed\n" );
+    };
+
+    uint32_t nSyncs = 0;
+    mqtt.SetCallback(
+        [ & ]( char* topic, byte* payload, uint len )
+        {
+            if( strStatTopic != topic )
+                return;
+            // <hostname> clk <request local ms> - the reply is sent at once, the reply path adds to the RTT only:
+            uint32_t nRefMs = RefMs();
+            std::string strMsg((const char*)payload, len );
+            size_t nPos = strMsg.find( ' ' );
+            if( nPos == std::string::npos )
+                return;
+            std::string strHostname = strMsg.substr( 0, nPos );
+            std::string strRest = strMsg.substr( nPos + 1 );
+            if( !strRest.compare( 0, MQTT_CMD_MGT_CLOCK_LEN + 1, MQTT_CMD_MGT_CLOCK " " ))
+            {
+                fnPub( MQTT_CMD_MGT_CLOCK MQTT_CMD_SEPARATOR + strHostname + MQTT_CMD_SEPARATOR + strRest.substr( MQTT_CMD_MGT_CLOCK_LEN + 1 ) +
+                    MQTT_CMD_SEPARATOR + std::to_string( nRefMs ));
+                nSyncs++;
+            }
+            else if( !strRest.compare( 0, MQTT_CMD_MGT_LATENCY_LEN + 1, MQTT_CMD_MGT_LATENCY " " ))
+            {
+                printf( "%s\n", strMsg.c_str());
+                fflush( stdout );
+            }
+        });
+    mqtt.SetConnCallback(
+        [ & ]()
+        {
+            mqtt.Subscribe( strStatTopic.c_str());
+        });
+
+    if( !mqtt.Connect( pszId ))
+    {
+        fprintf( stderr, "connect to %s:%u failed\n", pszHost, nPort );
+        return 1;
+    }
+    CTimer tm;
+    for( ;; )
+    {
+        mqtt.loop();
+        if( !mqtt.Connected() && !mqtt.Connecting())
+        {
+            fprintf( stderr, "disconnected\n" );
+            return 1;
+        }
+        tm.UpdateCur();
+        if( tm.Delta() >= nPeriodMs )
+        {
+            tm.UpdateLast();
+            printf( "# %u clock syncs served\n", nSyncs );
+            for( const std::string& rstrHostname : vecHostnames )
+                fnPub( MQTT_CMD_MGT_LATENCY MQTT_CMD_SEPARATOR + rstrHostname + (( bClear ) ? MQTT_CMD_SEPARATOR "clr" : "" ));
+            fflush( stdout );
+        }
+        usleep( 1000 );
+    }
+}
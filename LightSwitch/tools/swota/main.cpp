@@ -0,0 +1,542 @@
+/**
+ * DIY Smart Home - light switch
+ * OTA image tool
+ * 2022 Łukasz Łasek
+ * 
+ * Generates the delta patches and the compressed images (see CDeltaPatch), applies them on the host,
+ * and pushes them - or the plain images - to the devices over the espota protocol (see COta):
+ *   swota [-F] [-s source] diff <target> <patch>
+ *   swota [-s source] apply <patch> <target>
+ *   swota [-F] [-r fallback] [-T timeout-ms] push <file> <host>...
+ * 
+ * diff: the target image is encoded as a patch against the source image - the running FW (firmware.bin)
+ * of the devices, or as a compressed image without -s. With -F the image is an FS (littlefs.bin) one,
+ * compressed only: the FS is rewritten in place on the device, which refuses the FS patches with a source.
+ * The patch is verified by applying it, the sizes and the number of the target flash sectors differing
+ * from the source (written on the device, the rest is skipped) are printed.
+ * apply: the patch is applied to the source, the source and the target MD5 are verified.
+ * push: the file is uploaded to every host in turn, -F for the FS partition. The transfer time is printed
+ * per host. A host rejecting the file (e.g. a patch against another source) gets the fallback file if given.
+ * The exit code is the number of the hosts failed.
+ */
+#include <Arduino.h>
+#include <MD5Builder.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+
+#include "DeltaPatch.h"
+#include "Ota.h"
+
+/// Bytes hashed to find the copy candidates
+#define SWOTA_HASH_LEN      8
+
+/// Min copy length - a shorter one costs more than the literal bytes
+#define SWOTA_MIN_COPY      12
+
+/// Min fill length
+#define SWOTA_MIN_FILL      6
+
+/// Max copy candidates per hash
+#define SWOTA_CANDIDATES    8
+
+/// Default reply timeout in ms - a long copy of the patch may take a while on the device
+#define SWOTA_TIMEOUT_MS    60000
+
+typedef std::vector< uint8_t > Bytes;
+
+static void Usage()
+{
+    fprintf( stderr,
+        "usage: swota [-F] [-s source] diff <target> <patch>\n"
+        "       swota [-s source] apply <patch> <target>\n"
+        "       swota [-F] [-r fallback] [-T timeout-ms] push <file> <host>...\n" );
+    exit( 2 );
+}
+
+/**
+ * Read a whole file, exit on an error.
+ */
+static Bytes ReadFile( const char* a_pszPath )
+{
+    Bytes vec;
+    FILE* pFile = fopen( a_pszPath, "rb" );
+    if( !pFile )
+    {
+        fprintf( stderr, "cannot open %s\n", a_pszPath );
+        exit( 2 );
+    }
+    uint8_t arrBuf[ 4096 ];
+    size_t nLen;
+    while(( nLen = fread( arrBuf, 1, sizeof( arrBuf ), pFile )) > 0 )
+        vec.insert( vec.end(), arrBuf, arrBuf + nLen );
+    fclose( pFile );
+    return vec;
+}
+
+/**
+ * Write a whole file, exit on an error.
+ */
+static void WriteFile( const char* a_pszPath, const Bytes& a_rvec )
+{
+    FILE* pFile = fopen( a_pszPath, "wb" );
+    if(( !pFile ) || ( fwrite( a_rvec.data(), 1, a_rvec.size(), pFile ) != a_rvec.size()))
+    {
+        fprintf( stderr, "cannot write %s\n", a_pszPath );
+        exit( 2 );
+    }
+    fclose( pFile );
+}
+
+/**
+ * Calculate the MD5.
+ */
+static void Md5( const Bytes& a_rvec, uint8_t* a_pMd5 )
+{
+    MD5Builder md5;
+    md5.begin();
+    for( size_t nPos = 0; nPos < a_rvec.size(); nPos += 0x8000 )
+        md5.add( a_rvec.data() + nPos, min( a_rvec.size() - nPos, (size_t)0x8000 ));
+    md5.calculate();
+    md5.getBytes( a_pMd5 );
+}
+
+/**
+ * Calculate the MD5 - hex.
+ */
+static String Md5Hex( const Bytes& a_rvec )
+{
+    uint8_t arrMd5[ DELTA_MD5_LEN ];
+    Md5( a_rvec, arrMd5 );
+    char sz[ 2 * DELTA_MD5_LEN + 1 ];
+    for( uint8_t nIdx = 0; nIdx < DELTA_MD5_LEN; nIdx++ )
+        snprintf( sz + 2 * nIdx, 3, "%02x", arrMd5[ nIdx ]);
+    return String( sz );
+}
+
+/**
+ * Patch encoder.
+ */
+class CPatchWriter
+{
+public:
+    CPatchWriter() : m_nSrcPos( 0 ), m_nAdds( 0 ), m_nCopies( 0 ), m_nFills( 0 ) {}
+
+    void Header( uint8_t a_nCmd, const Bytes& a_rvecSrc, const Bytes& a_rvecDst )
+    {
+        uint8_t arrHdr[ DELTA_HDR_LEN ] = {};
+        memcpy( arrHdr, DELTA_MAGIC, DELTA_MAGIC_LEN );
+        arrHdr[ 4 ] = DELTA_VERSION;
+        arrHdr[ 5 ] = a_nCmd;
+        CDeltaPatch::PutU32( arrHdr + 8, a_rvecSrc.size());
+        Md5( a_rvecSrc, arrHdr + 12 );
+        CDeltaPatch::PutU32( arrHdr + 28, a_rvecDst.size());
+        Md5( a_rvecDst, arrHdr + 32 );
+        CDeltaPatch::PutU32( arrHdr + DELTA_HDR_LEN - 4, CCrc32::Calc( arrHdr, DELTA_HDR_LEN - 4 ));
+        m_vec.insert( m_vec.end(), arrHdr, arrHdr + DELTA_HDR_LEN );
+    }
+
+    void Add( const uint8_t* a_pData, uint32_t a_nLen )
+    {
+        if( !a_nLen )
+            return;
+        Op( DELTA_OP_ADD, a_nLen );
+        m_vec.insert( m_vec.end(), a_pData, a_pData + a_nLen );
+        m_nAdds += a_nLen;
+    }
+
+    void Copy( uint32_t a_nSrc, uint32_t a_nLen )
+    {
+        Op( DELTA_OP_COPY, a_nLen );
+        int32_t nDelta = (int32_t)( a_nSrc - m_nSrcPos );
+        Var(( (uint32_t)nDelta << 1 ) ^ (uint32_t)( nDelta >> 31 ));
+        m_nSrcPos = a_nSrc + a_nLen;
+        m_nCopies += a_nLen;
+    }
+
+    void Fill( uint8_t a_nByte, uint32_t a_nLen )
+    {
+        Op( DELTA_OP_FILL, a_nLen );
+        m_vec.push_back( a_nByte );
+        m_nFills += a_nLen;
+    }
+
+    void End()
+    {
+        m_vec.push_back( DELTA_OP_END );
+    }
+
+    Bytes m_vec;            ///< Patch
+    uint32_t m_nSrcPos;     ///< Source position after the last copy
+    uint32_t m_nAdds;       ///< Target bytes added
+    uint32_t m_nCopies;     ///< Target bytes copied
+    uint32_t m_nFills;      ///< Target bytes filled
+
+private:
+    void Op( uint8_t a_nType, uint32_t a_nLen )
+    {
+        uint8_t b = ( a_nType << ( DELTA_OP_LEN_BITS + 1 )) | ( a_nLen & (( 1 << DELTA_OP_LEN_BITS ) - 1 ));
+        a_nLen >>= DELTA_OP_LEN_BITS;
+        m_vec.push_back(( a_nLen ) ? ( b | DELTA_OP_LEN_MORE ) : b );
+        if( a_nLen )
+            Var( a_nLen );
+    }
+
+    void Var( uint32_t a_n )
+    {
+        do
+        {
+            uint8_t b = a_n & 0x7f;
+            a_n >>= 7;
+            m_vec.push_back(( a_n ) ? ( b | 0x80 ) : b );
+        }
+        while( a_n );
+    }
+};
+
+/**
+ * Load SWOTA_HASH_LEN bytes as the hash key.
+ */
+static uint64_t HashKey( const uint8_t* a_p )
+{
+    uint64_t nKey;
+    memcpy( &nKey, a_p, sizeof( nKey ));
+    return nKey;
+}
+
+/**
+ * Encode the target as a patch against the source.
+ * 
+ * Greedy: at every target position a fill, or the longest copy among the continuation of the previous copy
+ * and the source positions sharing the hash, or a literal byte.
+ */
+static Bytes Diff( const Bytes& a_rvecSrc, const Bytes& a_rvecDst, bool a_bFs, CPatchWriter& a_rWriter )
+{
+    std::unordered_map< uint64_t, std::vector< uint32_t >> mapIdx;
+    for( size_t nPos = 0; nPos + SWOTA_HASH_LEN <= a_rvecSrc.size(); nPos++ )
+    {
+        const uint8_t* p = a_rvecSrc.data() + nPos;
+        if( !memcmp( p, p + 1, SWOTA_HASH_LEN - 1 ))
+            continue;   // a fill
+        std::vector< uint32_t >& rvec = mapIdx[ HashKey( p )];
+        if( rvec.size() < SWOTA_CANDIDATES )
+            rvec.push_back( nPos );
+    }
+
+    a_rWriter.Header(( a_bFs ) ? U_FS : U_FLASH, a_rvecSrc, a_rvecDst );
+    const uint8_t* pDst = a_rvecDst.data();
+    size_t nDstLen = a_rvecDst.size();
+    size_t nLit = 0;        // literal bytes start
+    size_t nLastDst = 0;    // target position after the last copy
+    size_t nPos = 0;
+    while( nPos < nDstLen )
+    {
+        size_t nRun = 1;
+        while(( nPos + nRun < nDstLen ) && ( pDst[ nPos + nRun ] == pDst[ nPos ]))
+            nRun++;
+        if( nRun >= SWOTA_MIN_FILL )
+        {
+            a_rWriter.Add( pDst + nLit, nPos - nLit );
+            a_rWriter.Fill( pDst[ nPos ], nRun );
+            nPos += nRun;
+            nLit = nPos;
+            continue;
+        }
+
+        std::vector< uint32_t > vecCand;
+        vecCand.push_back( a_rWriter.m_nSrcPos + ( nPos - nLastDst ));
+        if( nPos + SWOTA_HASH_LEN <= nDstLen )
+        {
+            auto it = mapIdx.find( HashKey( pDst + nPos ));
+            if( it != mapIdx.end())
+                vecCand.insert( vecCand.end(), it->second.begin(), it->second.end());
+        }
+        size_t nBestLen = 0;
+        uint32_t nBestSrc = 0;
+        for( uint32_t nSrc : vecCand )
+        {
+            if( nSrc >= a_rvecSrc.size())
+                continue;
+            size_t nLen = 0;
+            size_t nMax = min( a_rvecSrc.size() - nSrc, nDstLen - nPos );
+            while(( nLen < nMax ) && ( a_rvecSrc[ nSrc + nLen ] == pDst[ nPos + nLen ]))
+                nLen++;
+            if( nLen > nBestLen )
+            {
+                nBestLen = nLen;
+                nBestSrc = nSrc;
+            }
+        }
+        if( nBestLen >= SWOTA_MIN_COPY )
+        {
+            a_rWriter.Add( pDst + nLit, nPos - nLit );
+            a_rWriter.Copy( nBestSrc, nBestLen );
+            nPos += nBestLen;
+            nLit = nLastDst = nPos;
+            continue;
+        }
+        nPos++;
+    }
+    a_rWriter.Add( pDst + nLit, nPos - nLit );
+    a_rWriter.End();
+    return a_rWriter.m_vec;
+}
+
+/**
+ * Apply the patch to the source the way the device does: in OTA_CHUNK_LEN patch chunks, OTA_CHUNK_LEN
+ * target bytes per step.
+ * 
+ * @return  false if the patch is malformed or the source/target MD5 do not match.
+ */
+static bool Apply( const Bytes& a_rvecSrc, const Bytes& a_rvecPatch, Bytes& a_rvecDst )
+{
+    CDeltaPatch patch;
+    patch.Begin(
+        [ & ]( uint32_t a_nOffs, uint8_t* a_pBuf, size_t a_nLen )
+        {
+            if( a_nOffs + a_nLen > a_rvecSrc.size())
+                return false;
+            memcpy( a_pBuf, a_rvecSrc.data() + a_nOffs, a_nLen );
+            return true;
+        },
+        [ & ]( const uint8_t* a_pBuf, size_t a_nLen )
+        {
+            a_rvecDst.insert( a_rvecDst.end(), a_pBuf, a_pBuf + a_nLen );
+            return true;
+        });
+    size_t nPos = 0;
+    bool bHeader = false;
+    while(( patch.GetState() != CDeltaPatch::EState::eDone ) && ( patch.GetState() != CDeltaPatch::EState::eError ))
+    {
+        size_t nLen = min( a_rvecPatch.size() - nPos, (size_t)OTA_CHUNK_LEN );
+        uint32_t nOut = patch.GetOut();
+        size_t nIn = patch.Apply( a_rvecPatch.data() + nPos, nLen, OTA_CHUNK_LEN );
+        nPos += nIn;
+        if(( !nIn ) && ( nOut == patch.GetOut()) && ( patch.HasHeader() == bHeader ))
+            break;  // truncated
+        if(( !bHeader ) && ( patch.HasHeader()))
+        {
+            bHeader = true;
+            uint8_t arrMd5[ DELTA_MD5_LEN ];
+            Md5( a_rvecSrc, arrMd5 );
+            const SDeltaHeader& rHdr = patch.GetHeader();
+            if(( rHdr.nSrcSize != a_rvecSrc.size()) || ( memcmp( arrMd5, rHdr.arrSrcMd5, DELTA_MD5_LEN )))
+            {
+                fprintf( stderr, "source mismatch\n" );
+                return false;
+            }
+        }
+    }
+    if(( patch.GetState() != CDeltaPatch::EState::eDone ) || ( nPos != a_rvecPatch.size()))
+    {
+        fprintf( stderr, "malformed patch at %zu\n", nPos );
+        return false;
+    }
+    uint8_t arrMd5[ DELTA_MD5_LEN ];
+    Md5( a_rvecDst, arrMd5 );
+    if( memcmp( arrMd5, patch.GetHeader().arrDstMd5, DELTA_MD5_LEN ))
+    {
+        fprintf( stderr, "target MD5 mismatch\n" );
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Wait for a socket to become readable.
+ */
+static bool WaitRead( int a_nFd, int a_nTimeoutMs )
+{
+    pollfd pfd = { a_nFd, POLLIN, 0 };
+    return poll( &pfd, 1, a_nTimeoutMs ) == 1;
+}
+
+/**
+ * Upload a file to a host over the espota protocol.
+ * 
+ * @return  Reply of the host: OK, ERR <err>, or the local error.
+ */
+static String Push( const char* a_pszHost, const Bytes& a_rvecFile, bool a_bFs, int a_nTimeoutMs )
+{
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo* pai = nullptr;
+    char szPort[ 8 ];
+    snprintf( szPort, sizeof( szPort ), "%u", OTA_PORT );
+    if( getaddrinfo( a_pszHost, szPort, &hints, &pai ) || !pai )
+        return String( "unknown host" );
+
+    // Uploader TCP server the device connects to:
+    int nSrv = socket( AF_INET, SOCK_STREAM, 0 );
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    socklen_t nAddrLen = sizeof( addr );
+    if(( bind( nSrv, (sockaddr*)&addr, sizeof( addr )) < 0 ) || ( listen( nSrv, 1 ) < 0 ) ||
+        ( getsockname( nSrv, (sockaddr*)&addr, &nAddrLen ) < 0 ))
+    {
+        close( nSrv );
+        freeaddrinfo( pai );
+        return String( "server failed" );
+    }
+
+    int nUdp = socket( AF_INET, SOCK_DGRAM, 0 );
+    char szInvite[ OTA_INVITE_LEN ];
+    snprintf( szInvite, sizeof( szInvite ), "%d %u %zu %s\n", ( a_bFs ) ? U_FS : U_FLASH, ntohs( addr.sin_port ),
+        a_rvecFile.size(), Md5Hex( a_rvecFile ).c_str());
+    sendto( nUdp, szInvite, strlen( szInvite ), 0, pai->ai_addr, pai->ai_addrlen );
+    freeaddrinfo( pai );
+    char szReply[ 64 ] = {};
+    bool bOk = ( WaitRead( nUdp, 10000 )) && ( recv( nUdp, szReply, sizeof( szReply ) - 1, 0 ) > 0 ) && ( !strcmp( szReply, "OK" ));
+    close( nUdp );
+    int nConn = -1;
+    if(( bOk ) && ( WaitRead( nSrv, 10000 )))
+        nConn = accept( nSrv, nullptr, nullptr );
+    close( nSrv );
+    if( nConn < 0 )
+        return String(( bOk ) ? "no connection" : "no invitation reply" );
+
+    String strRet( "timeout" );
+    size_t nPos = 0;
+    while( nPos < a_rvecFile.size())
+    {
+        size_t nLen = min( a_rvecFile.size() - nPos, (size_t)OTA_CHUNK_LEN );
+        if( send( nConn, a_rvecFile.data() + nPos, nLen, MSG_NOSIGNAL ) != (ssize_t)nLen )
+            break;
+        nPos += nLen;
+        ssize_t nRet = ( WaitRead( nConn, a_nTimeoutMs )) ? recv( nConn, szReply, sizeof( szReply ) - 1, 0 ) : -1;
+        if( nRet <= 0 )
+            break;
+        szReply[ nRet ] = 0;
+        if( strstr( szReply, "ERR" ))
+            break;
+    }
+    // The final reply, possibly sent together with the last ack:
+    for( String strReply( szReply ); ; )
+    {
+        const char* pszErr = strstr( strReply.c_str(), "ERR" );
+        if(( !pszErr ) && ( strstr( strReply.c_str(), "OK" )))
+        {
+            strRet = String( "OK" );
+            break;
+        }
+        // The error reply is complete once the device closes the connection:
+        ssize_t nRet = ( WaitRead( nConn, a_nTimeoutMs )) ? recv( nConn, szReply, sizeof( szReply ) - 1, 0 ) : -1;
+        if( nRet <= 0 )
+        {
+            if( pszErr )
+                strRet = String( pszErr );
+            break;
+        }
+        szReply[ nRet ] = 0;
+        strReply += szReply;
+    }
+    close( nConn );
+    return strRet;
+}
+
+int main( int argc, char** argv )
+{
+    const char* pszSrc = nullptr;
+    const char* pszFallback = nullptr;
+    bool bFs = false;
+    int nTimeoutMs = SWOTA_TIMEOUT_MS;
+
+    int nOpt;
+    while(( nOpt = getopt( argc, argv, "Fs:r:T:" )) != -1 )
+    {
+        switch( nOpt )
+        {
+            case 'F': bFs = true; break;
+            case 's': pszSrc = optarg; break;
+            case 'r': pszFallback = optarg; break;
+            case 'T': nTimeoutMs = atoi( optarg ); break;
+            default: Usage();
+        }
+    }
+    if( optind + 3 > argc )
+        Usage();
+    const char* pszMode = argv[ optind ];
+    Bytes vecSrc;
+    if( pszSrc )
+        vecSrc = ReadFile( pszSrc );
+
+    if( !strcmp( pszMode, "diff" ))
+    {
+        if( optind + 3 != argc )
+            Usage();
+        if(( bFs ) && ( pszSrc ))
+        {
+            fprintf( stderr, "FS patches are refused by the devices - compress the FS image without -s\n" );
+            return 2;
+        }
+        Bytes vecDst = ReadFile( argv[ optind + 1 ]);
+        CPatchWriter writer;
+        Bytes vecPatch = Diff( vecSrc, vecDst, bFs, writer );
+        Bytes vecCheck;
+        if( !Apply( vecSrc, vecPatch, vecCheck ))
+            return 1;
+        WriteFile( argv[ optind + 2 ], vecPatch );
+
+        uint32_t nSectors = ( vecDst.size() + FLASH_SECTOR_SIZE - 1 ) / FLASH_SECTOR_SIZE;
+        uint32_t nChanged = 0;
+        for( uint32_t nSector = 0; nSector < nSectors; nSector++ )
+        {
+            size_t nOffs = nSector * FLASH_SECTOR_SIZE;
+            size_t nLen = min( vecDst.size() - nOffs, (size_t)FLASH_SECTOR_SIZE );
+            if(( nOffs + nLen > vecSrc.size()) || ( memcmp( vecSrc.data() + nOffs, vecDst.data() + nOffs, nLen )))
+                nChanged++;
+        }
+        printf( "target %zu patch %zu (%.1f%%) add:%u copy:%u fill:%u sectors:%u/%u\n",
+            vecDst.size(), vecPatch.size(), 100.0 * vecPatch.size() / max( vecDst.size(), (size_t)1 ),
+            writer.m_nAdds, writer.m_nCopies, writer.m_nFills, nChanged, nSectors );
+        return 0;
+    }
+
+    if( !strcmp( pszMode, "apply" ))
+    {
+        if( optind + 3 != argc )
+            Usage();
+        Bytes vecDst;
+        if( !Apply( vecSrc, ReadFile( argv[ optind + 1 ]), vecDst ))
+            return 1;
+        WriteFile( argv[ optind + 2 ], vecDst );
+        printf( "target %zu md5 %s\n", vecDst.size(), Md5Hex( vecDst ).c_str());
+        return 0;
+    }
+
+    if( strcmp( pszMode, "push" ))
+        Usage();
+    Bytes vecFile = ReadFile( argv[ optind + 1 ]);
+    Bytes vecFallback;
+    if( pszFallback )
+        vecFallback = ReadFile( pszFallback );
+    int nFails = 0;
+    for( int nIdx = optind + 2; nIdx < argc; nIdx++ )
+    {
+        const Bytes* pvec = &vecFile;
+        for( ; ; )
+        {
+            auto tmStart = std::chrono::steady_clock::now();
+            String strRet = Push( argv[ nIdx ], *pvec, bFs, nTimeoutMs );
+            long nMs = std::chrono::duration_cast< std::chrono::milliseconds >( std::chrono::steady_clock::now() - tmStart ).count();
+            printf( "%s %s %zu bytes %ld ms%s\n", argv[ nIdx ], strRet.c_str(), pvec->size(), nMs, ( pvec == &vecFile ) ? "" : " (fallback)" );
+            if( strRet == "OK" )
+                break;
+            if(( pvec == &vecFile ) && ( pszFallback ) && ( strRet.c_str()[ 0 ] == 'E' ))
+            {
+                pvec = &vecFallback;
+                continue;
+            }
+            nFails++;
+            break;
+        }
+        fflush( stdout );
+    }
+    return nFails;
+}
@@ -0,0 +1,358 @@
+/**
+ * DIY Smart Home - light switch
+ * Host simulator
+ * 2022 Łukasz Łasek
+ * 
+ * Runs the FW (setup()/loop()) on the virtual clock against the in-process MQTT broker,
+ * driven by a scenario script read from a file or stdin:
+ *   swsim [-d cfg-dir] [-s step-us] [-q] [scenario]
+ * 
+ * The cfg files are read from a scratch copy of cfg-dir (default: data), removed at exit - the cfg pushed
+ * by a scenario (cfs/cfp/cfe) does not change cfg-dir. Every loop() iteration advances the virtual
+ * clock by step-us (default: 1000). The relay transitions and the MQTT traffic are logged with
+ * the virtual timestamps unless -q is given.
+ * 
+ * Scenario commands, one per line, # starts a comment:
+ *   press <ch>                 touch btn press (rising edge)
+ *   release <ch>               touch btn release (falling edge)
+ *   tap <ch> [ms]              press, wait ms (default: 50), release
+ *   wait <ms>                  advance the virtual time
+ *   pub <topic> <msg> [r]      publish a message on behalf of the broker, r:retained, "<msg>": with spaces, \n
+ *   drop                       drop the FW MQTT connections, the FW reconnects
+ *   serve <ms>                 run in real time, so the host tools can talk to the FW, e.g. curl the metrics
+ *   expect relay <ch> on|off   check the relay state
+ *   expect pub <topic> <msg>   check the FW has published the message since the previous expect pub
+ *   expect nopub <topic>       check the FW has published nothing on the topic since the previous expect pub
+ *   mark                       skip the publications so far for expect pub/nopub
+ * 
+ * The exit code is 1 if any expectation failed.
+ */
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <HostSim.h>
+#include <HostBroker.h>
+#include <ESP8266WiFi.h>
+#include <chrono>
+#include <filesystem>
+#include <unistd.h>
+
+#include "ManualSwitch.h"
+
+/// Default tap duration in ms
+#define SWSIM_TAP_MS        50
+
+/// Default virtual time step per loop() in us
+#define SWSIM_STEP_US       1000
+
+void setup();
+void loop();
+
+/**
+ * Publication captured from the FW.
+ */
+struct SPub
+{
+    uint64_t nUs;           ///< Virtual time
+    std::string strTopic;   ///< Topic
+    std::string strMsg;     ///< Payload
+    bool bRetained;         ///< Retain flag
+};
+
+static const uint8_t Sg_arrPinIn[ SW_CHANNELS ] = { PIN_IN0, PIN_IN1, PIN_IN2 };
+static const uint8_t Sg_arrPinOut[ SW_CHANNELS ] = { PIN_OUT0, PIN_OUT1, PIN_OUT2 };
+
+static CHostBroker& Sg_broker = *new CHostBroker();   // never destroyed: the FW clients close their connections at exit
+static std::vector< SPub > Sg_vecPubs;  // Captured publications
+static size_t Sg_nPubMark = 0;          // First publication not checked yet
+static uint64_t Sg_nStepUs = SWSIM_STEP_US;
+static bool Sg_bQuiet = false;
+static uint32_t Sg_nFailCnt = 0;
+static uint32_t Sg_nLine = 0;
+
+static void Log( const char* a_pszFmt, ... )
+{
+    if( Sg_bQuiet )
+        return;
+    uint64_t nUs = CHostClock::Micros();
+    printf( "[%6lu.%06lu] ", (unsigned long)( nUs / 1000000 ), (unsigned long)( nUs % 1000000 ));
+    va_list args;
+    va_start( args, a_pszFmt );
+    vprintf( a_pszFmt, args );
+    va_end( args );
+    putchar( '\n' );
+}
+
+static void Fail( const char* a_pszFmt, ... )
+{
+    Sg_nFailCnt++;
+    fprintf( stderr, "line %u: FAIL: ", Sg_nLine );
+    va_list args;
+    va_start( args, a_pszFmt );
+    vfprintf( stderr, a_pszFmt, args );
+    va_end( args );
+    fputc( '\n', stderr );
+}
+
+static void Wait( uint64_t a_nUs )
+{
+    for( uint64_t nEnd = CHostClock::Micros() + a_nUs; CHostClock::Micros() < nEnd; )
+    {
+        CHostClock::Advance( min( Sg_nStepUs, nEnd - CHostClock::Micros()));
+        loop();
+    }
+}
+
+static int GetChan( const char* a_pszChan )
+{
+    int nChan = a_pszChan ? atoi( a_pszChan ) : -1;
+    if(( nChan < 0 ) || ( nChan >= SW_CHANNELS ))
+    {
+        Fail( "invalid channel %s", a_pszChan ? a_pszChan : "-" );
+        return -1;
+    }
+    return nChan;
+}
+
+static void Expect( char* a_pszArgs )
+{
+    const char* pszWhat = strtok( a_pszArgs, " \t" );
+    if( !pszWhat )
+    {
+        Fail( "expect what?" );
+    }
+    else if( !strcmp( pszWhat, "relay" ))
+    {
+        int nChan = GetChan( strtok( nullptr, " \t" ));
+        const char* pszState = strtok( nullptr, " \t" );
+        if(( nChan < 0 ) || ( !pszState ))
+            return;
+        bool bOn = CHostGpio::Get( Sg_arrPinOut[ nChan ]) == HIGH;
+        if( bOn != !strcmp( pszState, "on" ))
+            Fail( "relay %d is %s", nChan, bOn ? "on" : "off" );
+    }
+    else if(( !strcmp( pszWhat, "pub" )) || ( !strcmp( pszWhat, "nopub" )))
+    {
+        bool bPub = !strcmp( pszWhat, "pub" );
+        const char* pszTopic = strtok( nullptr, " \t" );
+        const char* pszMsg = strtok( nullptr, "" );
+        if(( !pszTopic ) || (( bPub ) && ( !pszMsg )))
+        {
+            Fail( "expect %s: missing args", pszWhat );
+            return;
+        }
+        for( size_t nIdx = Sg_nPubMark; nIdx < Sg_vecPubs.size(); nIdx++ )
+        {
+            SPub& rPub = Sg_vecPubs[ nIdx ];
+            if( !CHostBroker::Match( pszTopic, rPub.strTopic.c_str()))
+                continue;
+            if( !bPub )
+            {
+                Fail( "unexpected pub %s %s", rPub.strTopic.c_str(), rPub.strMsg.c_str());
+                return;
+            }
+            if( rPub.strMsg == pszMsg )
+            {
+                Sg_nPubMark = nIdx + 1;
+                return;
+            }
+        }
+        if( bPub )
+            Fail( "no pub %s %s", pszTopic, pszMsg );
+    }
+    else
+    {
+        Fail( "expect %s?", pszWhat );
+    }
+}
+
+static void RunLine( char* a_pszLine )
+{
+    char* pszComment = strchr( a_pszLine, '#' );
+    if( pszComment )
+        *pszComment = '\0';
+    char* pszCmd = strtok( a_pszLine, " \t\r\n" );
+    if( !pszCmd )
+        return;
+    char* pszArgs = strtok( nullptr, "\r\n" );
+
+    if( !strcmp( pszCmd, "wait" ))
+    {
+        Wait( strtoull( pszArgs ? pszArgs : "0", nullptr, 10 ) * 1000 );
+    }
+    else if(( !strcmp( pszCmd, "press" )) || ( !strcmp( pszCmd, "release" )) || ( !strcmp( pszCmd, "tap" )))
+    {
+        int nChan = GetChan( strtok( pszArgs, " \t" ));
+        if( nChan < 0 )
+            return;
+        if( *pszCmd != 'r' )
+        {
+            Log( "btn %d press", nChan );
+            CHostGpio::SetInput( Sg_arrPinIn[ nChan ], HIGH );
+        }
+        if( *pszCmd == 't' )
+        {
+            const char* pszMs = strtok( nullptr, " \t" );
+            Wait((uint64_t)( pszMs ? atoi( pszMs ) : SWSIM_TAP_MS ) * 1000 );
+        }
+        if( *pszCmd != 'p' )
+        {
+            Log( "btn %d release", nChan );
+            CHostGpio::SetInput( Sg_arrPinIn[ nChan ], LOW );
+        }
+    }
+    else if( !strcmp( pszCmd, "pub" ))
+    {
+        const char* pszTopic = strtok( pszArgs, " \t" );
+        char* pszRest = strtok( nullptr, "" );
+        while(( pszRest ) && (( *pszRest == ' ' ) || ( *pszRest == '\t' )))
+            pszRest++;
+        // A message with spaces is quoted, \n stands for a new line in it, e.g. a cfg file chunk:
+        bool bQuoted = ( pszRest ) && ( *pszRest == '"' );
+        char* pszMsg = ( bQuoted ) ? strtok( pszRest + 1, "\"" ) : strtok( pszRest, " \t" );
+        if(( bQuoted ) && ( pszMsg ))
+        {
+            char* pszDst = pszMsg;
+            for( const char* pszSrc = pszMsg; *pszSrc; pszSrc++ )
+            {
+                if(( pszSrc[ 0 ] == '\\' ) && ( pszSrc[ 1 ] == 'n' ))
+                {
+                    *pszDst++ = '\n';
+                    pszSrc++;
+                }
+                else
+                {
+                    *pszDst++ = *pszSrc;
+                }
+            }
+            *pszDst = 0;
+        }
+        const char* pszRetain = strtok( nullptr, " \t" );
+        if(( !pszTopic ) || ( !pszMsg ))
+        {
+            Fail( "pub: missing args" );
+            return;
+        }
+        Log( "broker pub %s %s", pszTopic, pszMsg );
+        Sg_broker.Publish( pszTopic, pszMsg, pszRetain && ( *pszRetain == 'r' ));
+    }
+    else if( !strcmp( pszCmd, "drop" ))
+    {
+        Log( "broker drop" );
+        for( int nConn = 0; nConn < Sg_broker.GetConnCnt(); nConn++ )
+            Sg_broker.Drop( nConn );
+    }
+    else if( !strcmp( pszCmd, "serve" ))
+    {
+        uint64_t nMs = strtoull( pszArgs ? pszArgs : "0", nullptr, 10 );
+        Log( "serve %lu ms", (unsigned long)nMs );
+        for( auto tmEnd = std::chrono::steady_clock::now() + std::chrono::milliseconds( nMs ); std::chrono::steady_clock::now() < tmEnd; )
+        {
+            Wait( Sg_nStepUs );
+            usleep( Sg_nStepUs );
+        }
+    }
+    else if( !strcmp( pszCmd, "expect" ))
+    {
+        Expect( pszArgs ? pszArgs : (char*)"" );
+    }
+    else if( !strcmp( pszCmd, "mark" ))
+    {
+        Sg_nPubMark = Sg_vecPubs.size();
+    }
+    else
+    {
+        Fail( "unknown command %s", pszCmd );
+    }
+}
+
+static void Usage()
+{
+    fprintf( stderr, "usage: swsim [-d cfg-dir] [-s step-us] [-q] [scenario]\n" );
+    exit( 2 );
+}
+
+int main( int argc, char** argv )
+{
+    const char* pszCfgDir = "data";
+    int nOpt;
+    while(( nOpt = getopt( argc, argv, "d:s:q" )) != -1 )
+    {
+        switch( nOpt )
+        {
+            case 'd': pszCfgDir = optarg; break;
+            case 's': Sg_nStepUs = max( 1ul, strtoul( optarg, nullptr, 10 )); break;
+            case 'q': Sg_bQuiet = true; break;
+            default: Usage();
+        }
+    }
+    if( optind + 1 < argc )
+        Usage();
+    FILE* pFile = ( optind < argc ) ? fopen( argv[ optind ], "r" ) : stdin;
+    if( !pFile )
+    {
+        fprintf( stderr, "cannot open %s\n", argv[ optind ]);
+        return 2;
+    }
+
+    // The FW writes the cfg pushed - to a scratch copy:
+    std::string strTmpl = ( std::filesystem::temp_directory_path() / "swsim.XXXXXX" ).string();
+    std::error_code err;
+    if( !mkdtemp( &strTmpl[ 0 ]))
+    {
+        fprintf( stderr, "cannot create the scratch cfg dir\n" );
+        return 2;
+    }
+    std::filesystem::copy( pszCfgDir, strTmpl, std::filesystem::copy_options::recursive, err );
+    if( err )
+    {
+        fprintf( stderr, "cannot copy %s: %s\n", pszCfgDir, err.message().c_str());
+        std::filesystem::remove_all( strTmpl, err );
+        return 2;
+    }
+
+    CHostClock::SetVirtual();
+    LittleFS.SetRoot( strTmpl.c_str());
+    CHostNet::Sm_pNet = &Sg_broker;
+    Sg_broker.m_fnOnPub =
+        []( int a_nConn, const char* a_pszTopic, const byte* a_pPayload, uint a_nLen, bool a_bRetained )
+        {
+            Sg_vecPubs.push_back({ CHostClock::Micros(), a_pszTopic, std::string((const char*)a_pPayload, a_nLen ), a_bRetained });
+            Log( "pub %s %.*s%s", a_pszTopic, (int)a_nLen, (const char*)a_pPayload, a_bRetained ? " (r)" : "" );
+        };
+    // The station leaving the AP drops the TCP connections:
+    WiFi.m_fnOnDisconnect =
+        []()
+        {
+            Log( "wifi down" );
+            for( int nConn = 0; nConn < Sg_broker.GetConnCnt(); nConn++ )
+                Sg_broker.Drop( nConn );
+        };
+    CHostGpio::Sm_fnOnOutput =
+        []( uint8_t a_nPin, uint8_t a_nVal )
+        {
+            for( int nChan = 0; nChan < SW_CHANNELS; nChan++ )
+            {
+                if( Sg_arrPinOut[ nChan ] == a_nPin )
+                    Log( "relay %d %s", nChan, ( a_nVal == HIGH ) ? "on" : "off" );
+            }
+        };
+
+    auto tmStart = std::chrono::steady_clock::now();
+    setup();
+
+    char szLine[ 512 ];
+    while( fgets( szLine, sizeof( szLine ), pFile ))
+    {
+        Sg_nLine++;
+        RunLine( szLine );
+    }
+    if( pFile != stdin )
+        fclose( pFile );
+    std::filesystem::remove_all( strTmpl, err );
+
+    double dReal = std::chrono::duration< double >( std::chrono::steady_clock::now() - tmStart ).count();
+    double dSim = CHostClock::Micros() / 1e6;
+    fprintf( stderr, "sim %.3f s, real %.3f s, %.0f sim-s/s, pubs %zu, fails %u\n",
+        dSim, dReal, ( dReal > 0 ) ? dSim / dReal : 0.0, Sg_vecPubs.size(), Sg_nFailCnt );
+    return Sg_nFailCnt ? 1 : 0;
+}
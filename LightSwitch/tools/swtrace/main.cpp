@@ -0,0 +1,513 @@
+/**
+ * DIY Smart Home - light switch
+ * Input trace tool
+ * 2022 Łukasz Łasek
+ * 
+ * Downloads the input trace of a device (touch btn edges, classified taps, relay transitions) over the mgt topic,
+ * or replays a downloaded trace through CTouchBtn on the virtual clock:
+ *   swtrace -g hostname [-h host] [-p port] [-i client-id] [-m mgt-topic] [-T timeout-ms] [trace-file]
+ *   swtrace [-l long-ms] [-n next-ms] [-G ch:pattern,...] [-H hold-ms] [-s step-us] [-v] [trace-file]
+ * 
+ * Download (-g): the trace range is requested with trc/<hostname>, then the records are requested in chunks
+ * with trc/<hostname>/<seq> until the end seq of the range. The trace is written to the trace file (default: stdout):
+ *   # swtrace <hostname> <first seq> <end seq>
+ *   chan <ch> <long ms>/<next ms> | -
+ *   <seq> <8 hex digit record>
+ * The records overwritten on the device during the download are missing from the file.
+ * 
+ * Replay: the trace is read from the trace file (default: stdin). The edges are fed to a touch btn per channel
+ * with the recorded tap timing, or the one given with -l/-n to evaluate a tuning change. Note the recorded timing
+ * is the one at the download - with the auto tuning enabled it may have changed during the trace. The custom
+ * gestures configured on the device are given per channel with -G as the comma separated gst0.. patterns
+ * (see CGestures, - for none), with the hold repeat period -H (default: 500). Every step-us
+ * (default: 1000) of the recorded time the btn loop() is executed as the FW does.
+ * The replayed taps are aligned with the recorded ones (LCS) and the differences are reported per channel;
+ * -v lists every tap. The exit code is 1 if any tap differs.
+ */
+#include <Arduino.h>
+#include <WiFiClient.h>
+#include <HostSim.h>
+#include <unistd.h>
+
+#include "MqttClient.h"
+#include "Mqtt.h"
+#include "TouchBtn.h"
+#include "InputTrace.h"
+
+/// Number of the switch channels
+#define TRACE_CHANNELS      3
+
+/// Number of the request retries during the download
+#define TRACE_RETRIES       3
+
+/// Default virtual time step per loop() in us
+#define TRACE_STEP_US       1000
+
+/// Virtual time of the first record in us - a non-zero start as on the device
+#define TRACE_START_US      1000000
+
+/// Default hold gesture repeat period in ms
+#define TRACE_HOLD_MS       500
+
+static const uint8_t Sg_arrPinIn[ TRACE_CHANNELS ] = { D5, D6, D7 };
+
+/**
+ * Classified tap.
+ */
+struct STap
+{
+    uint64_t nUs;       ///< Time of the classification
+    uint8_t nEvent;     ///< Gesture event: TOUCH_GESTURE_SHORT, TOUCH_GESTURE_LONG, TOUCH_GESTURE_CUSTOM + custom gesture index
+    uint16_t nCnt;      ///< Tap cnt
+};
+
+/**
+ * Trace channel: the recorded timing and taps, the replayed taps.
+ */
+struct SChan
+{
+    bool bEnabled = false;      ///< Channel enabled on the device
+    uint16_t nLongTapMs = 0;    ///< Recorded long tap duration
+    uint16_t nNextTapMs = 0;    ///< Recorded next tap delay
+    bool bEdgeSeen = false;     ///< An edge has been replayed
+    std::vector< STap > vecRec; ///< Recorded taps
+    std::vector< STap > vecRep; ///< Replayed taps
+    uint32_t nEdges = 0;        ///< Edges replayed
+    uint32_t nRelays = 0;       ///< Relay transitions recorded
+};
+
+/**
+ * Replay touch btn - collects the classified taps.
+ */
+class CReplayBtn : public CTouchBtn
+{
+public:
+    CReplayBtn() : m_pChan( nullptr ) {}
+
+    void SetChan( SChan* a_pChan ) { m_pChan = a_pChan; }
+
+    virtual void OnShortTap( uint16_t a_nCnt )
+    {
+        m_pChan->vecRep.push_back({ CHostClock::Micros(), TOUCH_GESTURE_SHORT, a_nCnt });
+    }
+
+    virtual void OnLongTap()
+    {
+        m_pChan->vecRep.push_back({ CHostClock::Micros(), TOUCH_GESTURE_LONG, 1 });
+    }
+
+    virtual void OnGesture( uint8_t a_nEvent, uint16_t a_nCnt )
+    {
+        m_pChan->vecRep.push_back({ CHostClock::Micros(), a_nEvent, a_nCnt });
+    }
+
+private:
+    SChan* m_pChan;     ///< Channel the taps are collected for
+};
+
+static void Usage()
+{
+    fprintf( stderr,
+        "usage: swtrace -g hostname [-h host] [-p port] [-i client-id] [-m mgt-topic] [-T timeout-ms] [trace-file]\n"
+        "       swtrace [-l long-ms] [-n next-ms] [-G ch:pattern,...] [-H hold-ms] [-s step-us] [-v] [trace-file]\n" );
+    exit( 2 );
+}
+
+static bool TapEqual( const STap& a_rA, const STap& a_rB )
+{
+    // Recorded short tap cnts are saturated, custom gesture tap cnts are not recorded:
+    return ( a_rA.nEvent == a_rB.nEvent ) && (( a_rA.nEvent != TOUCH_GESTURE_SHORT ) || ( min( a_rA.nCnt, (uint16_t)INPUT_TRACE_ARG_MAX ) == min( a_rB.nCnt, (uint16_t)INPUT_TRACE_ARG_MAX )));
+}
+
+static void PrintTap( const char* a_pszWhat, uint8_t a_nChan, const STap& a_rTap )
+{
+    uint64_t nUs = a_rTap.nUs - TRACE_START_US;
+    printf( "%-4s ch%u [%6lu.%06lu] ", a_pszWhat, a_nChan, (unsigned long)( nUs / 1000000 ), (unsigned long)( nUs % 1000000 ));
+    if( a_rTap.nEvent == TOUCH_GESTURE_SHORT )
+        printf( "short x%u\n", a_rTap.nCnt );
+    else if( a_rTap.nEvent == TOUCH_GESTURE_LONG )
+        printf( "long\n" );
+    else
+        printf( "gst%u\n", a_rTap.nEvent - TOUCH_GESTURE_CUSTOM );
+}
+
+static int Download( const char* a_pszHostName, const char* a_pszHost, uint16_t a_nPort, const char* a_pszId,
+    const String& a_rstrMgt, uint32_t a_nTimeoutMs, FILE* a_pOut )
+{
+    String strMgtCmd( a_rstrMgt + "/cmd" );
+    String strMgtStat( a_rstrMgt + "/stat" );
+    String strPrefix( a_pszHostName );
+    strPrefix += " " MQTT_CMD_MGT_TRACE " ";
+    String strReply;
+    bool bReply = false;
+
+    WiFiClient wc;
+    CMqttClient mqtt( wc );
+    mqtt.SetServer( a_pszHost, a_nPort );
+    mqtt.SetCallback(
+        [ & ]( char* topic, byte* payload, uint len )
+        {
+            String strMsg;
+            strMsg.concat((const char*)payload, len );
+            if(( strMgtStat == topic ) && ( strMsg.startsWith( strPrefix )))
+            {
+                strReply = strMsg.substring( strPrefix.length());
+                bReply = true;
+            }
+        });
+    mqtt.SetConnCallback(
+        [ & ]()
+        {
+            mqtt.Subscribe( strMgtStat.c_str());
+        });
+    if( !mqtt.Connect( a_pszId ))
+    {
+        fprintf( stderr, "connect to %s:%u failed\n", a_pszHost, a_nPort );
+        return 1;
+    }
+    while( mqtt.Connecting())
+        mqtt.loop();
+
+    // Send the request, wait for the reply:
+    auto fnRequest =
+        [ & ]( const String& a_rstrCmd ) -> bool
+        {
+            for( int nTry = 0; nTry < TRACE_RETRIES; nTry++ )
+            {
+                bReply = false;
+                mqtt.Publish( strMgtCmd.c_str(), a_rstrCmd.c_str(), false, MQTT_QOS_AT_LEAST_ONCE );
+                for( uint64_t nStart = millis(); millis() - nStart < a_nTimeoutMs; )
+                {
+                    mqtt.loop();
+                    if( bReply )
+                        return true;
+                    if(( !mqtt.Connected()) && ( !mqtt.Connecting()))
+                        return false;
+                    delay( 1 );
+                }
+            }
+            return false;
+        };
+
+    String strCmd( MQTT_CMD_MGT_TRACE MQTT_CMD_SEPARATOR );
+    strCmd += a_pszHostName;
+    if( !fnRequest( strCmd ))
+    {
+        fprintf( stderr, "no reply from %s\n", a_pszHostName );
+        return 1;
+    }
+    unsigned long nFirst = 0;
+    unsigned long nEnd = 0;
+    char arrszChans[ TRACE_CHANNELS ][ 16 ];
+    if( sscanf( strReply.c_str(), "%lu %lu %15s %15s %15s", &nFirst, &nEnd, arrszChans[ 0 ], arrszChans[ 1 ], arrszChans[ 2 ]) != 5 )
+    {
+        fprintf( stderr, "invalid reply: %s\n", strReply.c_str());
+        return 1;
+    }
+    fprintf( a_pOut, "# swtrace %s %lu %lu\n", a_pszHostName, nFirst, nEnd );
+    for( int nChan = 0; nChan < TRACE_CHANNELS; nChan++ )
+        fprintf( a_pOut, "chan %d %s\n", nChan, arrszChans[ nChan ]);
+
+    uint32_t nLost = 0;
+    for( unsigned long nSeq = nFirst; nSeq < nEnd; )
+    {
+        String strChunk( strCmd );
+        strChunk += MQTT_CMD_SEPARATOR;
+        strChunk += (uint32_t)nSeq;
+        if( !fnRequest( strChunk ))
+        {
+            fprintf( stderr, "no reply for seq %lu\n", nSeq );
+            return 1;
+        }
+        const char* pszReply = strReply.c_str();
+        char* pszRecs;
+        unsigned long nReplySeq = strtoul( pszReply, &pszRecs, 10 );
+        while( *pszRecs == ' ' )
+            pszRecs++;
+        size_t nRecs = strlen( pszRecs ) / 8;
+        if(( nReplySeq < nSeq ) || ( !nRecs ))
+        {
+            fprintf( stderr, "invalid reply for seq %lu: %s\n", nSeq, pszReply );
+            return 1;
+        }
+        nLost += nReplySeq - nSeq;
+        for( size_t nIdx = 0; ( nIdx < nRecs ) && ( nReplySeq + nIdx < nEnd ); nIdx++ )
+            fprintf( a_pOut, "%lu %.8s\n", nReplySeq + nIdx, pszRecs + nIdx * 8 );
+        nSeq = nReplySeq + nRecs;
+    }
+    mqtt.Disconnect();
+    fprintf( stderr, "%lu records, %u lost during the download\n", nEnd - nFirst - nLost, nLost );
+    return 0;
+}
+
+static int Replay( FILE* a_pIn, uint16_t a_nLongTapMs, uint16_t a_nNextTapMs, const char* const* a_ppszGestures, uint16_t a_nHoldMs,
+    uint64_t a_nStepUs, bool a_bVerbose )
+{
+    SChan arrChans[ TRACE_CHANNELS ];
+    std::vector< uint32_t > vecRecs;
+    uint32_t nLost = 0;
+    long nPrevSeq = -1;
+
+    char szLine[ 256 ];
+    while( fgets( szLine, sizeof( szLine ), a_pIn ))
+    {
+        int nChan;
+        unsigned int nLong;
+        unsigned int nNext;
+        unsigned long nSeq;
+        unsigned int nRec;
+        if( szLine[ 0 ] == '#' )
+            continue;
+        if( sscanf( szLine, "chan %d %u/%u", &nChan, &nLong, &nNext ) == 3 )
+        {
+            if(( nChan >= 0 ) && ( nChan < TRACE_CHANNELS ))
+                arrChans[ nChan ] = SChan{ true, (uint16_t)nLong, (uint16_t)nNext };
+        }
+        else if( sscanf( szLine, "%lu %x", &nSeq, &nRec ) == 2 )
+        {
+            // A missing record breaks the time deltas - restart the timeline with a zero delta:
+            if(( nPrevSeq >= 0 ) && ( (long)nSeq != nPrevSeq + 1 ))
+            {
+                nLost += nSeq - nPrevSeq - 1;
+                nRec &= ~INPUT_TRACE_DELTA_MAX;
+            }
+            nPrevSeq = nSeq;
+            vecRecs.push_back( nRec );
+        }
+    }
+    if( vecRecs.empty())
+    {
+        fprintf( stderr, "no records\n" );
+        return 2;
+    }
+
+    // Initial input state - the first edge of a channel tells:
+    CHostClock::SetVirtual();
+    CHostClock::Advance( TRACE_START_US );
+    bool arrbInit[ TRACE_CHANNELS ] = {};
+    for( uint32_t nRec : vecRecs )
+    {
+        uint8_t nChan = CInputTrace::GetChan( nRec );
+        CInputTrace::EType type = CInputTrace::GetType( nRec );
+        if(( nChan < TRACE_CHANNELS ) && ( !arrbInit[ nChan ]) && (( type == CInputTrace::EType::eRise ) || ( type == CInputTrace::EType::eFall )))
+        {
+            CHostGpio::SetInput( Sg_arrPinIn[ nChan ], ( type == CInputTrace::EType::eFall ) ? HIGH : LOW );
+            arrbInit[ nChan ] = true;
+        }
+    }
+
+    CReplayBtn arrBtns[ TRACE_CHANNELS ];
+    uint16_t nMaxNextMs = 0;
+    for( int nChan = 0; nChan < TRACE_CHANNELS; nChan++ )
+    {
+        SChan& rChan = arrChans[ nChan ];
+        if( !rChan.bEnabled )
+            continue;
+        uint16_t nLongTapMs = ( a_nLongTapMs ) ? a_nLongTapMs : rChan.nLongTapMs;
+        uint16_t nNextTapMs = ( a_nNextTapMs ) ? a_nNextTapMs : rChan.nNextTapMs;
+        nMaxNextMs = max( nMaxNextMs, nNextTapMs );
+        arrBtns[ nChan ].SetChan( &rChan );
+        arrBtns[ nChan ].SetHoldMs( a_nHoldMs );
+        if( a_ppszGestures[ nChan ])
+        {
+            String strGestures( a_ppszGestures[ nChan ]);
+            uint8_t nGesture = 0;
+            for( int nPos = 0; nPos <= (int)strGestures.length(); nGesture++ )
+            {
+                int nEnd = strGestures.indexOf( ',', nPos );
+                if( nEnd < 0 )
+                    nEnd = strGestures.length();
+                String strPattern = strGestures.substring( nPos, nEnd );
+                if(( strPattern.length()) && ( strPattern != "-" ) && ( !arrBtns[ nChan ].GetGestures().Add( strPattern.c_str(), TOUCH_GESTURE_CUSTOM + nGesture )))
+                {
+                    // Disabled on the device too:
+                    fprintf( stderr, "ch%d: invalid gesture ignored: %s\n", nChan, strPattern.c_str());
+                }
+                nPos = nEnd + 1;
+            }
+        }
+        arrBtns[ nChan ].Enable( Sg_arrPinIn[ nChan ], nLongTapMs, nNextTapMs );
+    }
+
+    auto fnWaitUntil =
+        [ & ]( uint64_t a_nUs )
+        {
+            while( CHostClock::Micros() < a_nUs )
+            {
+                CHostClock::Advance( min( a_nStepUs, a_nUs - CHostClock::Micros()));
+                for( CReplayBtn& rBtn : arrBtns )
+                {
+                    if( rBtn.IsEnabled())
+                        rBtn.loop();
+                }
+            }
+        };
+
+    uint64_t nUs = TRACE_START_US;
+    for( size_t nIdx = 0; nIdx < vecRecs.size(); nIdx++ )
+    {
+        uint32_t nRec = vecRecs[ nIdx ];
+        if( nIdx )
+            nUs += CInputTrace::GetDeltaUs( nRec );
+        fnWaitUntil( nUs );
+
+        uint8_t nChan = CInputTrace::GetChan( nRec );
+        if( nChan >= TRACE_CHANNELS )
+            continue;
+        SChan& rChan = arrChans[ nChan ];
+        switch( CInputTrace::GetType( nRec ))
+        {
+            case CInputTrace::EType::eRise:
+            case CInputTrace::EType::eFall:
+                rChan.bEdgeSeen = true;
+                rChan.nEdges++;
+                CHostGpio::SetInput( Sg_arrPinIn[ nChan ], ( CInputTrace::GetType( nRec ) == CInputTrace::EType::eRise ) ? HIGH : LOW );
+                break;
+
+            case CInputTrace::EType::eShortTap:
+                // Taps classified from the edges preceding the trace cannot be replayed:
+                if( rChan.bEdgeSeen )
+                    rChan.vecRec.push_back({ nUs, TOUCH_GESTURE_SHORT, CInputTrace::GetArg( nRec )});
+                break;
+
+            case CInputTrace::EType::eLongTap:
+                if( rChan.bEdgeSeen )
+                    rChan.vecRec.push_back({ nUs, TOUCH_GESTURE_LONG, 1 });
+                break;
+
+            case CInputTrace::EType::eGesture:
+                if( rChan.bEdgeSeen )
+                    rChan.vecRec.push_back({ nUs, (uint8_t)CInputTrace::GetArg( nRec ), 0 });
+                break;
+
+            case CInputTrace::EType::eRelayOn:
+            case CInputTrace::EType::eRelayOff:
+                rChan.nRelays++;
+                break;
+
+            default:
+                break;
+        }
+    }
+    fnWaitUntil( nUs + ( nMaxNextMs + 1 ) * 1000ull );  // flush the pending multi taps
+
+    // Align the recorded and the replayed taps:
+    uint32_t nDiffTotal = 0;
+    for( int nChan = 0; nChan < TRACE_CHANNELS; nChan++ )
+    {
+        SChan& rChan = arrChans[ nChan ];
+        if( !rChan.bEnabled )
+            continue;
+        const std::vector< STap >& rvecA = rChan.vecRec;
+        const std::vector< STap >& rvecB = rChan.vecRep;
+        size_t nA = rvecA.size();
+        size_t nB = rvecB.size();
+        std::vector< uint32_t > vecLcs(( nA + 1 ) * ( nB + 1 ), 0 );
+        auto fnLcs = [ & ]( size_t a_nI, size_t a_nJ ) -> uint32_t& { return vecLcs[ a_nI * ( nB + 1 ) + a_nJ ]; };
+        for( size_t nI = nA; nI-- > 0; )
+        {
+            for( size_t nJ = nB; nJ-- > 0; )
+            {
+                fnLcs( nI, nJ ) = TapEqual( rvecA[ nI ], rvecB[ nJ ])
+                    ? fnLcs( nI + 1, nJ + 1 ) + 1
+                    : max( fnLcs( nI + 1, nJ ), fnLcs( nI, nJ + 1 ));
+            }
+        }
+        size_t nI = 0;
+        size_t nJ = 0;
+        while(( nI < nA ) || ( nJ < nB ))
+        {
+            if(( nI < nA ) && ( nJ < nB ) && ( TapEqual( rvecA[ nI ], rvecB[ nJ ])))
+            {
+                if( a_bVerbose )
+                    PrintTap( "=", nChan, rvecB[ nJ ]);
+                nI++;
+                nJ++;
+            }
+            else if(( nJ >= nB ) || (( nI < nA ) && ( fnLcs( nI + 1, nJ ) >= fnLcs( nI, nJ + 1 ))))
+            {
+                PrintTap( "rec", nChan, rvecA[ nI++ ]);
+            }
+            else
+            {
+                PrintTap( "rep", nChan, rvecB[ nJ++ ]);
+            }
+        }
+        uint32_t nSame = fnLcs( 0, 0 );
+        uint32_t nDiff = ( nA - nSame ) + ( nB - nSame );
+        nDiffTotal += nDiff;
+        printf( "ch%d: long %u next %u: edges %u, relays %u, taps recorded %zu, replayed %zu, same %u, diff %u\n",
+            nChan, arrBtns[ nChan ].GetLongTapMs(), arrBtns[ nChan ].GetNextTapMs(), rChan.nEdges, rChan.nRelays, nA, nB, nSame, nDiff );
+    }
+    if( nLost )
+        fprintf( stderr, "%u records missing from the trace\n", nLost );
+    return nDiffTotal ? 1 : 0;
+}
+
+int main( int argc, char** argv )
+{
+    const char* pszGet = nullptr;
+    const char* pszHost = "localhost";
+    uint16_t nPort = 1883;
+    const char* pszId = "swtrace";
+    String strMgt( "sw/mgt/home" );
+    uint32_t nTimeoutMs = 2000;
+    uint16_t nLongTapMs = 0;
+    uint16_t nNextTapMs = 0;
+    const char* arrpszGestures[ TRACE_CHANNELS ] = {};
+    uint16_t nHoldMs = TRACE_HOLD_MS;
+    uint64_t nStepUs = TRACE_STEP_US;
+    bool bVerbose = false;
+
+    int nOpt;
+    while(( nOpt = getopt( argc, argv, "g:h:p:i:m:T:l:n:G:H:s:v" )) != -1 )
+    {
+        switch( nOpt )
+        {
+            case 'g': pszGet = optarg; break;
+            case 'h': pszHost = optarg; break;
+            case 'p': nPort = atoi( optarg ); break;
+            case 'i': pszId = optarg; break;
+            case 'm': strMgt = optarg; break;
+            case 'T': nTimeoutMs = strtoul( optarg, nullptr, 10 ); break;
+            case 'l': nLongTapMs = atoi( optarg ); break;
+            case 'n': nNextTapMs = atoi( optarg ); break;
+            case 'G':
+                if(( optarg[ 0 ] < '0' ) || ( optarg[ 0 ] >= '0' + TRACE_CHANNELS ) || ( optarg[ 1 ] != ':' ))
+                    Usage();
+                arrpszGestures[ optarg[ 0 ] - '0' ] = optarg + 2;
+                break;
+            case 'H': nHoldMs = atoi( optarg ); break;
+            case 's': nStepUs = max( 1ul, strtoul( optarg, nullptr, 10 )); break;
+            case 'v': bVerbose = true; break;
+            default: Usage();
+        }
+    }
+    if( optind + 1 < argc )
+        Usage();
+
+    if( pszGet )
+    {
+        FILE* pOut = ( optind < argc ) ? fopen( argv[ optind ], "w" ) : stdout;
+        if( !pOut )
+        {
+            fprintf( stderr, "cannot create %s\n", argv[ optind ]);
+            return 2;
+        }
+        int nRet = Download( pszGet, pszHost, nPort, pszId, strMgt, nTimeoutMs, pOut );
+        if( pOut != stdout )
+            fclose( pOut );
+        return nRet;
+    }
+
+    FILE* pIn = ( optind < argc ) ? fopen( argv[ optind ], "r" ) : stdin;
+    if( !pIn )
+    {
+        fprintf( stderr, "cannot open %s\n", argv[ optind ]);
+        return 2;
+    }
+    int nRet = Replay( pIn, nLongTapMs, nNextTapMs, arrpszGestures, nHoldMs, nStepUs, bVerbose );
+    if( pIn != stdin )
+        fclose( pIn );
+    return nRet;
+}
@@ -37,4 +37,50 @@ public:
         }
         return a_pszDefault;
     }
+
+    /**
+     * Copy a config file, replacing a value.
+     * 
+     * The value read by ReadValue() for the name is replaced, an entry not found is appended.
+     * Every line of the copy is terminated with '\n'.
+     * 
+     * @param[in]   a_rSrc          Opened source configuration file
+     * @param[in]   a_rDst          Opened destination file
+     * @param[in]   a_pszName       The beginning of a value name/description entry
+     * @param[in]   a_pszValue      The new value - a single line
+     * 
+     * @return  false on a write error.
+     */
+    static bool WriteValue( File& a_rSrc, File& a_rDst, const char* a_pszName, const char* a_pszValue )
+    {
+        String strPrefix( a_pszName );
+        bool bOk = true;
+        auto fnWriteLine = [ & ]( const String& a_rstrLine )
+        {
+            bOk &= ( a_rDst.print( a_rstrLine ) == a_rstrLine.length()) && ( a_rDst.print( '\n' ) == 1 );
+        };
+
+        bool bFound = false;
+        a_rSrc.seek( 0 );
+        while( a_rSrc.available())
+        {
+            String str = a_rSrc.readStringUntil( '\n' );
+            fnWriteLine( str );
+            if(( !bFound ) && ( str.length() > 3 ) && ( CStringUtils::BeginsWith( strPrefix, (byte*)str.c_str() + 3, str.length())))
+            {
+                bFound = true;
+                a_rSrc.readStringUntil( '\n' );     // skip the old value
+                fnWriteLine( a_pszValue );
+            }
+        }
+        if( !bFound )
+        {
+            String strName( "// " );
+            strName += strPrefix;
+            strName += ":";
+            fnWriteLine( strName );
+            fnWriteLine( a_pszValue );
+        }
+        return bOk;
+    }
 };
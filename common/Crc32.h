@@ -0,0 +1,41 @@
+/**
+ * CRC32 utility class
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+
+
+
+/**
+ * CRC32 (IEEE 802.3) class.
+ * 
+ * A small table-less implementation - meant for short records, e.g. the ones kept in the RTC memory.
+ */
+class CCrc32
+{
+public:
+    /**
+     * Calculate the CRC32 of the data.
+     * 
+     * @param[in]   a_pData     Data.
+     * @param[in]   a_nLen      Length of the data.
+     * @param[in]   a_nCrc      CRC32 of the preceding data - allows for a chained calculation.
+     * 
+     * @return  CRC32 of the data.
+     */
+    static uint32_t Calc( const void* a_pData, size_t a_nLen, uint32_t a_nCrc = 0 )
+    {
+        const uint8_t* pData = (const uint8_t*)a_pData;
+        uint32_t nCrc = ~a_nCrc;
+        while( a_nLen-- )
+        {
+            nCrc ^= *pData++;
+            for( uint8_t nBit = 0; nBit < 8; nBit++ )
+            {
+                nCrc = ( nCrc >> 1 ) ^ ( 0xedb88320 & ( 0 - ( nCrc & 1 )));
+            }
+        }
+        return ~nCrc;
+    }
+};
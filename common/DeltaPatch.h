@@ -0,0 +1,412 @@
+/**
+ * Delta patch
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+#include "Crc32.h"
+
+
+
+/// Patch magic - never the start of a FW image (0xe9) or a LittleFS image
+#define DELTA_MAGIC         "SWDP"
+
+/// Patch magic length
+#define DELTA_MAGIC_LEN     4
+
+/// Patch format version
+#define DELTA_VERSION       1
+
+/// MD5 length in bytes
+#define DELTA_MD5_LEN       16
+
+/// Header length: magic:4, version:1, cmd:1, reserved:2, source size:4, source MD5:16, target size:4, target MD5:16, CRC32:4
+#define DELTA_HDR_LEN       52
+
+/// Op type: end of the patch - the op byte is 0
+#define DELTA_OP_END        0
+
+/// Op type: add the literal bytes following the op
+#define DELTA_OP_ADD        1
+
+/// Op type: copy the bytes from the source
+#define DELTA_OP_COPY       2
+
+/// Op type: fill with the byte following the op
+#define DELTA_OP_FILL       3
+
+/// Number of the op length bits in the op byte
+#define DELTA_OP_LEN_BITS   5
+
+/// Op byte flag: the length continues in the following LEB128 bytes
+#define DELTA_OP_LEN_MORE   0x20
+
+/// Source read buffer of the copy op - on the stack
+#define DELTA_COPY_BUF_LEN  256
+
+
+
+/**
+ * Delta patch header.
+ */
+struct SDeltaHeader
+{
+    uint8_t nCmd;                           ///< Target partition: U_FLASH, U_FS
+    uint32_t nSrcSize;                      ///< Source image size, 0: no source - a compressed image
+    uint8_t arrSrcMd5[ DELTA_MD5_LEN ];     ///< Source image MD5
+    uint32_t nDstSize;                      ///< Target image size
+    uint8_t arrDstMd5[ DELTA_MD5_LEN ];     ///< Target image MD5
+};
+
+
+
+/**
+ * Delta patch class.
+ * 
+ * Rebuilds a target image from a source image (the one running on the device) and a patch holding the differences,
+ * or from a patch alone (no source) - a compressed image. The patch is a header followed by the ops:
+ * 1. op byte: type:2 (DELTA_OP_...), more:1, length:5 - the length continues in LEB128 bytes if more is set,
+ * 2. ADD: the literal bytes, COPY: the source offset relative to the end of the previous copy - zigzag LEB128,
+ *    FILL: the fill byte,
+ * 3. END: the 0 op byte - the target size must be reached.
+ * All the multi-byte header fields are little-endian, the header is protected with a CRC32.
+ * 
+ * The patch is applied as it streams in: Apply() takes any part of the patch and produces a bounded number of
+ * the target bytes per call, so a long copy spans many calls. The source is read and the target is written
+ * via the callbacks - the same code runs on the device and on the host. The target MD5 is verified by the caller.
+ */
+class CDeltaPatch
+{
+public:
+    /**
+     * Source read callback.
+     * 
+     * @param[in]   a_nOffs     Source offset
+     * @param[out]  a_pBuf      Buffer - DELTA_COPY_BUF_LEN bytes, 4-byte aligned
+     * @param[in]   a_nLen      Number of the bytes to read
+     * 
+     * @return  false on an error.
+     */
+    typedef std::function< bool( uint32_t a_nOffs, uint8_t* a_pBuf, size_t a_nLen )> ReadCb;
+
+    /**
+     * Target write callback.
+     * 
+     * @param[in]   a_pBuf      Target bytes
+     * @param[in]   a_nLen      Number of the bytes
+     * 
+     * @return  false on an error.
+     */
+    typedef std::function< bool( const uint8_t* a_pBuf, size_t a_nLen )> WriteCb;
+
+    /**
+     * Patch decoder state.
+     */
+    enum class EState : uint8_t
+    {
+        eHeader,    ///< Reading the header
+        eOp,        ///< Reading an op byte
+        eLen,       ///< Reading the op length
+        eOffs,      ///< Reading the copy offset
+        eFillByte,  ///< Reading the fill byte
+        eAdd,       ///< Adding the literal bytes
+        eCopy,      ///< Copying the source bytes
+        eFill,      ///< Filling
+        eDone,      ///< Patch applied
+        eError      ///< Malformed patch or a callback failed
+    };
+
+    CDeltaPatch() { Begin( nullptr, nullptr ); }
+
+    /**
+     * Check if the data starts with the patch magic.
+     */
+    static bool IsPatch( const uint8_t* a_pData, size_t a_nLen )
+    {
+        return ( a_nLen >= DELTA_MAGIC_LEN ) && ( !memcmp( a_pData, DELTA_MAGIC, DELTA_MAGIC_LEN ));
+    }
+
+    /**
+     * Start applying a patch.
+     * 
+     * @param[in]   a_fnRead    Source read callback
+     * @param[in]   a_fnWrite   Target write callback
+     */
+    void Begin( ReadCb a_fnRead, WriteCb a_fnWrite )
+    {
+        m_fnRead = a_fnRead;
+        m_fnWrite = a_fnWrite;
+        m_state = EState::eHeader;
+        m_nHdrLen = 0;
+        m_nOut = 0;
+        m_nSrcPos = 0;
+    }
+
+    /**
+     * Apply the next part of the patch.
+     * 
+     * Returns right after the header, so the caller can check it (GetHeader()) before any target byte is written.
+     * A pending copy or fill continues without any input.
+     * 
+     * @param[in]   a_pIn       Patch bytes
+     * @param[in]   a_nLen      Number of the patch bytes
+     * @param[in]   a_nMaxOut   Max number of the target bytes to write
+     * 
+     * @return  Number of the patch bytes consumed - the rest is to be passed again.
+     */
+    size_t Apply( const uint8_t* a_pIn, size_t a_nLen, size_t a_nMaxOut )
+    {
+        size_t nIn = 0;
+        while(( m_state != EState::eDone ) && ( m_state != EState::eError ))
+        {
+            if(( m_state == EState::eAdd ) || ( m_state == EState::eCopy ) || ( m_state == EState::eFill ))
+            {
+                size_t nOut = min((size_t)m_nLeft, a_nMaxOut );
+                if( m_state == EState::eAdd )
+                    nOut = min( nOut, a_nLen - nIn );
+                if( !nOut )
+                    break;
+                if( !Produce( a_pIn + nIn, nOut ))
+                {
+                    m_state = EState::eError;
+                    break;
+                }
+                if( m_state == EState::eAdd )
+                    nIn += nOut;
+                a_nMaxOut -= nOut;
+                m_nLeft -= nOut;
+                if( !m_nLeft )
+                    m_state = EState::eOp;
+                continue;
+            }
+
+            if( nIn >= a_nLen )
+                break;
+            uint8_t b = a_pIn[ nIn++ ];
+            switch( m_state )
+            {
+                case EState::eHeader:
+                    m_arrHdr[ m_nHdrLen++ ] = b;
+                    if( m_nHdrLen < DELTA_HDR_LEN )
+                        break;
+                    m_state = ( ParseHeader()) ? EState::eOp : EState::eError;
+                    return nIn;
+
+                case EState::eOp:
+                    m_nOp = b >> ( DELTA_OP_LEN_BITS + 1 );
+                    if( m_nOp == DELTA_OP_END )
+                    {
+                        m_state = (( !b ) && ( m_nOut == m_hdr.nDstSize )) ? EState::eDone : EState::eError;
+                        break;
+                    }
+                    m_nLeft = b & (( 1 << DELTA_OP_LEN_BITS ) - 1 );
+                    m_nVar = 0;
+                    m_nShift = DELTA_OP_LEN_BITS;
+                    if( b & DELTA_OP_LEN_MORE )
+                        m_state = EState::eLen;
+                    else
+                        StartOp();
+                    break;
+
+                case EState::eLen:
+                    if( AddVarByte( b ))
+                    {
+                        m_nLeft |= m_nVar;
+                        StartOp();
+                    }
+                    break;
+
+                case EState::eOffs:
+                    if( AddVarByte( b ))
+                        StartCopy();
+                    break;
+
+                case EState::eFillByte:
+                    m_nFill = b;
+                    m_state = EState::eFill;
+                    break;
+
+                default:
+                    break;
+            }
+        }
+        return nIn;
+    }
+
+    /**
+     * Get the decoder state.
+     */
+    EState GetState()
+    {
+        return m_state;
+    }
+
+    /**
+     * Check if the header has been read - GetHeader() is valid.
+     */
+    bool HasHeader()
+    {
+        return ( m_state != EState::eHeader ) && ( m_nHdrLen == DELTA_HDR_LEN );
+    }
+
+    /**
+     * Get the header.
+     */
+    const SDeltaHeader& GetHeader()
+    {
+        return m_hdr;
+    }
+
+    /**
+     * Get the number of the target bytes written.
+     */
+    uint32_t GetOut()
+    {
+        return m_nOut;
+    }
+
+    /**
+     * Read a little-endian 32-bit number.
+     */
+    static uint32_t GetU32( const uint8_t* a_p )
+    {
+        return a_p[ 0 ] | ( a_p[ 1 ] << 8 ) | ( a_p[ 2 ] << 16 ) | ((uint32_t)a_p[ 3 ] << 24 );
+    }
+
+    /**
+     * Write a little-endian 32-bit number.
+     */
+    static void PutU32( uint8_t* a_p, uint32_t a_n )
+    {
+        for( uint8_t nIdx = 0; nIdx < 4; nIdx++, a_n >>= 8 )
+            a_p[ nIdx ] = a_n & 0xff;
+    }
+
+private:
+    /**
+     * Parse and verify the header.
+     */
+    bool ParseHeader()
+    {
+        if(( memcmp( m_arrHdr, DELTA_MAGIC, DELTA_MAGIC_LEN )) || ( m_arrHdr[ 4 ] != DELTA_VERSION ) ||
+            ( CCrc32::Calc( m_arrHdr, DELTA_HDR_LEN - 4 ) != GetU32( m_arrHdr + DELTA_HDR_LEN - 4 )))
+        {
+            return false;
+        }
+        m_hdr.nCmd = m_arrHdr[ 5 ];
+        m_hdr.nSrcSize = GetU32( m_arrHdr + 8 );
+        memcpy( m_hdr.arrSrcMd5, m_arrHdr + 12, DELTA_MD5_LEN );
+        m_hdr.nDstSize = GetU32( m_arrHdr + 28 );
+        memcpy( m_hdr.arrDstMd5, m_arrHdr + 32, DELTA_MD5_LEN );
+        return true;
+    }
+
+    /**
+     * Add a LEB128 byte to the variable length number.
+     * 
+     * @return  true if the number is complete.
+     */
+    bool AddVarByte( uint8_t a_b )
+    {
+        if( m_nShift > 31 )
+        {
+            m_state = EState::eError;
+            return false;
+        }
+        m_nVar |= (uint32_t)( a_b & 0x7f ) << m_nShift;
+        m_nShift += 7;
+        return !( a_b & 0x80 );
+    }
+
+    /**
+     * Start the op once its length is known.
+     */
+    void StartOp()
+    {
+        if(( !m_nLeft ) || ( m_nLeft > m_hdr.nDstSize - m_nOut ))
+        {
+            m_state = EState::eError;
+            return;
+        }
+        switch( m_nOp )
+        {
+            case DELTA_OP_ADD:
+                m_state = EState::eAdd;
+                break;
+
+            case DELTA_OP_COPY:
+                m_nVar = 0;
+                m_nShift = 0;
+                m_state = EState::eOffs;
+                break;
+
+            default:
+                m_state = EState::eFillByte;
+                break;
+        }
+    }
+
+    /**
+     * Start the copy once its zigzag source offset is known.
+     */
+    void StartCopy()
+    {
+        int64_t nPos = (int64_t)m_nSrcPos + (int32_t)(( m_nVar >> 1 ) ^ ( 0 - ( m_nVar & 1 )));
+        if(( nPos < 0 ) || ( nPos + m_nLeft > m_hdr.nSrcSize ))
+        {
+            m_state = EState::eError;
+            return;
+        }
+        m_nSrcPos = nPos;
+        m_state = EState::eCopy;
+    }
+
+    /**
+     * Produce the target bytes of the current op.
+     * 
+     * @param[in]   a_pIn   Literal bytes of the add op
+     * @param[in]   a_nLen  Number of the bytes
+     */
+    bool Produce( const uint8_t* a_pIn, size_t a_nLen )
+    {
+        if( m_state == EState::eAdd )
+        {
+            m_nOut += a_nLen;
+            return m_fnWrite( a_pIn, a_nLen );
+        }
+        uint32_t arrBuf[ DELTA_COPY_BUF_LEN / 4 ];
+        while( a_nLen )
+        {
+            size_t nLen = min( a_nLen, (size_t)DELTA_COPY_BUF_LEN );
+            if( m_state == EState::eFill )
+            {
+                memset( arrBuf, m_nFill, nLen );
+            }
+            else
+            {
+                if( !m_fnRead( m_nSrcPos, (uint8_t*)arrBuf, nLen ))
+                    return false;
+                m_nSrcPos += nLen;
+            }
+            if( !m_fnWrite((const uint8_t*)arrBuf, nLen ))
+                return false;
+            m_nOut += nLen;
+            a_nLen -= nLen;
+        }
+        return true;
+    }
+
+    ReadCb m_fnRead;                        ///< Source read callback
+    WriteCb m_fnWrite;                      ///< Target write callback
+    EState m_state;                         ///< Decoder state
+    uint8_t m_arrHdr[ DELTA_HDR_LEN ];      ///< Raw header
+    uint8_t m_nHdrLen;                      ///< Number of the header bytes read
+    SDeltaHeader m_hdr;                     ///< Parsed header
+    uint8_t m_nOp;                          ///< Current op type
+    uint8_t m_nFill;                        ///< Fill byte
+    uint8_t m_nShift;                       ///< Next LEB128 bit position
+    uint32_t m_nVar;                        ///< LEB128 number being read
+    uint32_t m_nLeft;                       ///< Bytes left to produce by the current op
+    uint32_t m_nOut;                        ///< Target bytes written
+    uint32_t m_nSrcPos;                     ///< Source position of the copy
+};
@@ -0,0 +1,224 @@
+/**
+ * Touch gesture automaton
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+
+
+
+/// Max number of the automaton nodes, including the root
+#define GESTURE_NODES       24
+
+/// No node/no event
+#define GESTURE_NONE        0xff
+
+/// Root node - no taps yet
+#define GESTURE_ROOT        0
+
+/// Gesture pattern element: short tap
+#define GESTURE_SHORT       's'
+
+/// Gesture pattern element: long tap
+#define GESTURE_LONG        'l'
+
+/// Gesture pattern element: the preceding short tap repeated any number of times - must be the last element
+#define GESTURE_REPEAT      '+'
+
+/// Gesture pattern element: btn held for the long tap duration, repeated while held - must be the last element
+#define GESTURE_HOLD        'h'
+
+
+
+/**
+ * Touch gesture automaton class.
+ * 
+ * A gesture is a pattern of short/long taps, e.g.: "sss" - triple tap, "sl" - short then long tap,
+ * "ss+" - two or more short taps, "h" - hold with auto-repeat, "sh" - short tap then hold.
+ * The patterns are compiled into a trie: a node per pattern prefix, a transition per tap element.
+ * A node accepts the gesture ending there, and optionally fires a hold gesture while the btn is held.
+ * A repeat loops its node on the short tap and yields to the longer patterns added later: the loop is unrolled
+ * past them, e.g. "ss+" then "sss" gives: ss - repeat, sss - triple tap, ssss and more - repeat.
+ * Classifying a tap is a single table lookup - the cost does not depend on the number of gestures.
+ * The lookups used by the touch btn ISR are in IRAM.
+ */
+class CGestures
+{
+public:
+    /**
+     * Tap element - transition of the automaton.
+     */
+    enum EElem : uint8_t
+    {
+        eShort,
+        eLong,
+        eElems
+    };
+
+    CGestures() { Clear(); }
+
+    /**
+     * Remove all the gestures.
+     */
+    void Clear()
+    {
+        m_nNodes = 1;
+        InitNode( GESTURE_ROOT );
+    }
+
+    /**
+     * Compile a gesture into the automaton.
+     * 
+     * @param[in]   a_pszPattern    Gesture pattern: GESTURE_SHORT/LONG elements, optionally ending with GESTURE_REPEAT or GESTURE_HOLD.
+     * @param[in]   a_nEvent        Event fired when the gesture is recognized (< GESTURE_NONE).
+     * 
+     * @return  false if the pattern is invalid, conflicts with another gesture or there are too many nodes.
+     *          A gesture ending on a repeat overrides it for its tap count only. The nodes added before the failure
+     *          are kept - they do not accept any gesture.
+     */
+    bool Add( const char* a_pszPattern, uint8_t a_nEvent )
+    {
+        uint8_t nNode = GESTURE_ROOT;
+        for( const char* pc = a_pszPattern; *pc; pc++ )
+        {
+            bool bLast = !pc[ 1 ];
+            // A repeat node changed by another pattern applies the change to its own tap count only:
+            if(( *pc != GESTURE_REPEAT ) && ( !Unroll( nNode )))
+                return false;
+            switch( *pc )
+            {
+                case GESTURE_SHORT:
+                case GESTURE_LONG:
+                {
+                    uint8_t& rnNext = m_arrNodes[ nNode ].arrNext[ ( *pc == GESTURE_SHORT ) ? eShort : eLong ];
+                    if( rnNext == GESTURE_NONE )
+                    {
+                        if( m_nNodes >= GESTURE_NODES )
+                            return false;
+                        InitNode( m_nNodes );
+                        rnNext = m_nNodes++;
+                    }
+                    nNode = rnNext;
+                    break;
+                }
+
+                case GESTURE_REPEAT:
+                {
+                    // Loop the short tap: the node must have been entered with a short tap and have no short tap successor:
+                    uint8_t& rnNext = m_arrNodes[ nNode ].arrNext[ eShort ];
+                    if(( !bLast ) || ( pc == a_pszPattern ) || ( pc[ -1 ] != GESTURE_SHORT ) || (( rnNext != GESTURE_NONE ) && ( rnNext != nNode )))
+                        return false;
+                    SNode& rNode = m_arrNodes[ nNode ];
+                    if(( rNode.nAccept != GESTURE_NONE ) && ( rNode.nAccept != a_nEvent ))
+                        return false;
+                    rnNext = nNode;
+                    rNode.nAccept = a_nEvent;
+                    rNode.bRepeat = true;
+                    return true;
+                }
+
+                case GESTURE_HOLD:
+                {
+                    uint8_t& rnHold = m_arrNodes[ nNode ].nHold;
+                    if(( !bLast ) || (( rnHold != GESTURE_NONE ) && ( rnHold != a_nEvent )))
+                        return false;
+                    rnHold = a_nEvent;
+                    return true;
+                }
+
+                default:
+                    return false;
+            }
+        }
+        if(( nNode == GESTURE_ROOT ) || ( !Unroll( nNode )))
+            return false;
+        SNode& rNode = m_arrNodes[ nNode ];
+        if(( !rNode.bRepeat ) && ( rNode.nAccept != GESTURE_NONE ) && ( rNode.nAccept != a_nEvent ))
+            return false;
+        rNode.nAccept = a_nEvent;
+        rNode.bRepeat = false;
+        return true;
+    }
+
+    /**
+     * Get the next node.
+     * 
+     * @param[in]   a_nNode     Current node
+     * @param[in]   a_elem      Tap element
+     * 
+     * @return  Next node, GESTURE_NONE if no gesture continues with the element.
+     */
+    uint8_t IRAM_ATTR Next( uint8_t a_nNode, EElem a_elem )
+    {
+        return m_arrNodes[ a_nNode ].arrNext[ a_elem ];
+    }
+
+    /**
+     * Get the event of the gesture ending at the node, GESTURE_NONE if none.
+     */
+    uint8_t IRAM_ATTR GetAccept( uint8_t a_nNode )
+    {
+        return m_arrNodes[ a_nNode ].nAccept;
+    }
+
+    /**
+     * Get the event of the hold gesture at the node, GESTURE_NONE if none.
+     */
+    uint8_t GetHold( uint8_t a_nNode )
+    {
+        return m_arrNodes[ a_nNode ].nHold;
+    }
+
+    /**
+     * Check if no gesture continues past the node - no need to wait for the next tap.
+     */
+    bool IRAM_ATTR IsLeaf( uint8_t a_nNode )
+    {
+        SNode& rNode = m_arrNodes[ a_nNode ];
+        return ( rNode.arrNext[ eShort ] == GESTURE_NONE ) && ( rNode.arrNext[ eLong ] == GESTURE_NONE ) && ( rNode.nHold == GESTURE_NONE );
+    }
+
+private:
+    /**
+     * Automaton node.
+     */
+    struct SNode
+    {
+        uint8_t arrNext[ eElems ];  ///< Next node per tap element
+        uint8_t nAccept;            ///< Event of the gesture ending here
+        uint8_t nHold;              ///< Event of the hold gesture here
+        bool bRepeat;               ///< True if nAccept is set by a repeat - a longer pattern may override it
+    };
+
+    /**
+     * Initialize a node without transitions and events.
+     */
+    void InitNode( uint8_t a_nNode )
+    {
+        memset( &m_arrNodes[ a_nNode ], GESTURE_NONE, sizeof( SNode ));
+        m_arrNodes[ a_nNode ].bRepeat = false;
+    }
+
+    /**
+     * Unroll the short tap loop of a repeat node by one tap: the loop moves to a copy of the node.
+     * A node without the loop is kept.
+     * 
+     * @return  false if there are too many nodes.
+     */
+    bool Unroll( uint8_t a_nNode )
+    {
+        SNode& rNode = m_arrNodes[ a_nNode ];
+        if( rNode.arrNext[ eShort ] != a_nNode )
+            return true;
+        if( m_nNodes >= GESTURE_NODES )
+            return false;
+        uint8_t nCopy = m_nNodes++;
+        m_arrNodes[ nCopy ] = rNode;
+        m_arrNodes[ nCopy ].arrNext[ eShort ] = nCopy;
+        rNode.arrNext[ eShort ] = nCopy;
+        return true;
+    }
+
+    SNode m_arrNodes[ GESTURE_NODES ];  ///< Automaton
+    uint8_t m_nNodes;                   ///< Number of the nodes used
+};
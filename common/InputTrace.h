@@ -0,0 +1,186 @@
+/**
+ * Input trace ring buffer
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+
+
+
+/// Number of the records kept in RAM (4 bytes each) - must be a power of 2
+#ifndef INPUT_TRACE_LEN
+#define INPUT_TRACE_LEN         2048
+#endif
+
+/// Number of the time delta bits of a record
+#define INPUT_TRACE_DELTA_BITS  23
+
+/// Number of the argument bits of a record
+#define INPUT_TRACE_ARG_BITS    4
+
+/// Number of the channel bits of a record
+#define INPUT_TRACE_CHAN_BITS   2
+
+/// Max time delta of a record in us
+#define INPUT_TRACE_DELTA_MAX   (( 1ul << INPUT_TRACE_DELTA_BITS ) - 1 )
+
+/// Max argument of a record
+#define INPUT_TRACE_ARG_MAX     (( 1ul << INPUT_TRACE_ARG_BITS ) - 1 )
+
+/// Max gap of a gap record in ms
+#define INPUT_TRACE_GAP_MAX     (( 1ul << ( INPUT_TRACE_DELTA_BITS + INPUT_TRACE_ARG_BITS )) - 1 )
+
+/// Time since the previous record in ms above which a gap record is inserted - the us delta must still fit
+#define INPUT_TRACE_GAP_MS      8000
+
+static_assert(( INPUT_TRACE_LEN & ( INPUT_TRACE_LEN - 1 )) == 0, "INPUT_TRACE_LEN must be a power of 2" );
+static_assert( INPUT_TRACE_GAP_MS * 1000ul + 1000 < INPUT_TRACE_DELTA_MAX, "INPUT_TRACE_GAP_MS too long" );
+
+
+
+/**
+ * Input trace class.
+ * 
+ * Records the touch btn edges, the classified taps and the relay transitions with us timestamps
+ * in a ring buffer of compact 32-bit records, so the input can be downloaded and replayed off the device.
+ * 
+ * Record layout (MSB to LSB): type:3, channel:2, argument:4, time delta:23.
+ * The time delta is in us since the previous record. An idle time longer than INPUT_TRACE_GAP_MS is stored
+ * as a separate gap record holding the time in ms in both the argument and the time delta bits.
+ * The records are numbered with a sequence number growing since boot, the last INPUT_TRACE_LEN records are kept.
+ * 
+ * Add() may be called from any context, including the ISR - it runs with the interrupts masked, from IRAM.
+ */
+class CInputTrace
+{
+public:
+    /**
+     * Record type.
+     */
+    enum class EType : uint8_t
+    {
+        eGap,       ///< Idle time: ms since the previous record
+        eRise,      ///< Touch btn press - rising edge
+        eFall,      ///< Touch btn release - falling edge
+        eShortTap,  ///< Short tap(s) classified: argument - tap cnt (saturated)
+        eLongTap,   ///< Long tap classified
+        eRelayOn,   ///< Relay turned on
+        eRelayOff,  ///< Relay turned off
+        eGesture,   ///< Custom gesture recognized: argument - gesture event (saturated)
+        eCnt
+    };
+
+    CInputTrace() : m_nSeq( 0 ), m_nLastUs( 0 ), m_nLastMs( 0 ) {}
+
+    /**
+     * Add a record timestamped with the current time.
+     * 
+     * @param[in]   a_type      Record type
+     * @param[in]   a_nChan     Channel
+     * @param[in]   a_nArg      Argument - saturated to INPUT_TRACE_ARG_MAX
+     */
+    void IRAM_ATTR Add( EType a_type, uint8_t a_nChan, uint16_t a_nArg = 0 )
+    {
+        uint32_t nPs = xt_rsil( 15 );   // mask the interrupts, restore the previous level when done
+        uint32_t nUs = micros();
+        uint32_t nMs = millis();
+        uint32_t nDeltaUs = nUs - m_nLastUs;
+        uint32_t nDeltaMs = nMs - m_nLastMs;
+        if( nDeltaMs >= INPUT_TRACE_GAP_MS )
+        {
+            Put( Pack( EType::eGap, 0, 0, min( nDeltaMs, (uint32_t)INPUT_TRACE_GAP_MAX )));
+            nDeltaUs = 0;
+        }
+        Put( Pack( a_type, a_nChan, min( a_nArg, (uint16_t)INPUT_TRACE_ARG_MAX ), min( nDeltaUs, (uint32_t)INPUT_TRACE_DELTA_MAX )));
+        m_nLastUs = nUs;
+        m_nLastMs = nMs;
+        xt_wsr_ps( nPs );
+    }
+
+    /**
+     * Get the sequence number of the oldest record kept.
+     */
+    uint32_t GetFirst()
+    {
+        return ( m_nSeq > INPUT_TRACE_LEN ) ? m_nSeq - INPUT_TRACE_LEN : 0;
+    }
+
+    /**
+     * Get the sequence number of the next record to be added.
+     */
+    uint32_t GetEnd()
+    {
+        return m_nSeq;
+    }
+
+    /**
+     * Get a record.
+     * 
+     * @param[in]   a_nSeq  Sequence number - must be within [GetFirst(), GetEnd())
+     * 
+     * @return  Packed record.
+     */
+    uint32_t Get( uint32_t a_nSeq )
+    {
+        return m_arrRec[ a_nSeq & ( INPUT_TRACE_LEN - 1 )];
+    }
+
+    /**
+     * Pack a record.
+     */
+    static uint32_t IRAM_ATTR Pack( EType a_type, uint8_t a_nChan, uint32_t a_nArg, uint32_t a_nDelta )
+    {
+        return ((uint32_t)a_type << ( INPUT_TRACE_CHAN_BITS + INPUT_TRACE_ARG_BITS + INPUT_TRACE_DELTA_BITS )) |
+            ((uint32_t)( a_nChan & (( 1 << INPUT_TRACE_CHAN_BITS ) - 1 )) << ( INPUT_TRACE_ARG_BITS + INPUT_TRACE_DELTA_BITS )) |
+            ( a_nArg << INPUT_TRACE_DELTA_BITS ) | a_nDelta;
+    }
+
+    /**
+     * Unpack the record type.
+     */
+    static EType GetType( uint32_t a_nRec )
+    {
+        return (EType)( a_nRec >> ( INPUT_TRACE_CHAN_BITS + INPUT_TRACE_ARG_BITS + INPUT_TRACE_DELTA_BITS ));
+    }
+
+    /**
+     * Unpack the record channel.
+     */
+    static uint8_t GetChan( uint32_t a_nRec )
+    {
+        return ( a_nRec >> ( INPUT_TRACE_ARG_BITS + INPUT_TRACE_DELTA_BITS )) & (( 1 << INPUT_TRACE_CHAN_BITS ) - 1 );
+    }
+
+    /**
+     * Unpack the record argument.
+     */
+    static uint16_t GetArg( uint32_t a_nRec )
+    {
+        return ( a_nRec >> INPUT_TRACE_DELTA_BITS ) & INPUT_TRACE_ARG_MAX;
+    }
+
+    /**
+     * Unpack the time since the previous record in us.
+     */
+    static uint64_t GetDeltaUs( uint32_t a_nRec )
+    {
+        if( GetType( a_nRec ) == EType::eGap )
+            return ( a_nRec & INPUT_TRACE_GAP_MAX ) * 1000ull;
+        return a_nRec & INPUT_TRACE_DELTA_MAX;
+    }
+
+private:
+    /**
+     * Store a packed record, overwrite the oldest one if full.
+     */
+    void IRAM_ATTR Put( uint32_t a_nRec )
+    {
+        m_arrRec[ m_nSeq & ( INPUT_TRACE_LEN - 1 )] = a_nRec;
+        m_nSeq++;
+    }
+
+    uint32_t m_arrRec[ INPUT_TRACE_LEN ];   ///< Ring buffer of packed records
+    uint32_t m_nSeq;                        ///< Sequence number of the next record
+    uint32_t m_nLastUs;                     ///< Timestamp of the previous record in us
+    uint32_t m_nLastMs;                     ///< Timestamp of the previous record in ms
+};
@@ -0,0 +1,902 @@
+/**
+ * MQTT client
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+#include <Client.h>
+#include "MqttOutbox.h"
+#include "Timer.h"
+
+
+
+/// Receive buffer length - the max length of a received packet, longer packets are dropped
+#ifndef MQTT_CLIENT_RX_BUF_LEN
+#define MQTT_CLIENT_RX_BUF_LEN      512
+#endif
+
+/// Transmit buffer length - the max length of a sent packet
+#ifndef MQTT_CLIENT_TX_BUF_LEN
+#define MQTT_CLIENT_TX_BUF_LEN      256
+#endif
+
+/// Keep alive interval in seconds
+#ifndef MQTT_CLIENT_KEEPALIVE_S
+#define MQTT_CLIENT_KEEPALIVE_S     15
+#endif
+
+/// CONNACK wait timeout in ms
+#ifndef MQTT_CLIENT_CONNACK_MS
+#define MQTT_CLIENT_CONNACK_MS      5000
+#endif
+
+/// Minimum delay between connection attempts in ms
+#ifndef MQTT_CLIENT_RETRY_MS
+#define MQTT_CLIENT_RETRY_MS        1000
+#endif
+
+/// Max number of packets dispatched per loop() call
+#ifndef MQTT_CLIENT_LOOP_PKTS
+#define MQTT_CLIENT_LOOP_PKTS       4
+#endif
+
+/// Max number of registered outgoing topic aliases (MQTT 5), up to 32
+#ifndef MQTT_CLIENT_TOPIC_ALIASES
+#define MQTT_CLIENT_TOPIC_ALIASES   8
+#endif
+
+static_assert( MQTT_CLIENT_TOPIC_ALIASES <= 32, "Topic aliases are tracked in a 32-bit mask" );
+
+/// MQTT protocol levels
+#define MQTT_CLIENT_V311            4
+#define MQTT_CLIENT_V5              5
+
+/// First packet id used by the QoS 1 outbox - keeps the outbox ids apart from the SUBSCRIBE ids
+#define MQTT_CLIENT_OUTBOX_FIRST_PKT_ID 0x8000
+
+
+
+/**
+ * MQTT 3.1.1/5 client class.
+ * 
+ * A small non-blocking MQTT client working on top of any Arduino Client, e.g. a WiFiClient.
+ * MQTT 3.1.1 is used by default, MQTT 5 is optional and only adds the outgoing topic aliases:
+ * a registered topic is sent in full once per connection, and then replaced by a 2-byte alias.
+ * The number of aliases used is limited by the topic alias maximum received from the broker.
+ * 
+ * The received and sent packets use separate buffers. A received packet is parsed incrementally,
+ * as the bytes arrive, so loop() never waits for the rest of a packet.
+ * The topic and payload passed to the message callback point into the receive buffer (zero-copy)
+ * and stay valid for the whole callback, even if the callback publishes messages.
+ * 
+ * The connection is established in two steps: Connect() opens the TCP connection and sends
+ * the CONNECT packet, while loop() waits for the CONNACK and calls the connect callback.
+ * Note the TCP connect itself is bounded by the underlying client timeout.
+ * 
+ * QoS 0 messages are sent directly, QoS 1 messages are sent through the outbox, see CMqttOutbox.
+ * Received QoS 1 messages are acknowledged after the message callback returns.
+ */
+class CMqttClient
+{
+public:
+    /**
+     * Message callback.
+     * 
+     * @param[in]   topic       Null-terminated topic.
+     * @param[in]   payload     Payload - NOT null-terminated.
+     * @param[in]   len         Length of the payload.
+     */
+    typedef std::function< void( char* topic, byte* payload, uint len )> MsgCb;
+
+    /**
+     * Connection established callback.
+     */
+    typedef std::function< void()> ConnCb;
+
+    CMqttClient( Client& a_rClient )
+        : m_pClient( &a_rClient ), m_state( EState::eDisconnected ), m_pszHost( nullptr ), m_nPort( 1883 ),
+          m_nKeepAliveS( MQTT_CLIENT_KEEPALIVE_S ), m_nNextPktId( 1 ), m_bRetry( false ),
+          m_nProtoLevel( MQTT_CLIENT_V311 ), m_nAliasCnt( 0 ), m_nAliasMax( 0 ), m_nAliasSent( 0 )
+    {
+        m_outbox.SetFirstPktId( MQTT_CLIENT_OUTBOX_FIRST_PKT_ID );
+        m_outbox.SetAliasMask( &m_nAliasSent );
+    }
+
+    /**
+     * Replace the underlying network client, e.g. with a TLS client. To be called while disconnected.
+     * 
+     * @param[in]   a_rClient   Network client - must remain valid.
+     */
+    void SetClient( Client& a_rClient )
+    {
+        m_pClient = &a_rClient;
+    }
+
+    /**
+     * Configure the MQTT server.
+     * 
+     * @param[in]   a_pszHost   Server hostname or IP - must remain valid.
+     * @param[in]   a_nPort     Server port.
+     */
+    void SetServer( const char* a_pszHost, uint16_t a_nPort )
+    {
+        m_pszHost = a_pszHost;
+        m_nPort = a_nPort;
+    }
+
+    /**
+     * Configure the message callback.
+     * 
+     * @param[in]   a_fnCb  Callback.
+     */
+    void SetCallback( MsgCb a_fnCb )
+    {
+        m_fnMsgCb = a_fnCb;
+    }
+
+    /**
+     * Configure the connection established callback.
+     * 
+     * @param[in]   a_fnCb  Callback.
+     */
+    void SetConnCallback( ConnCb a_fnCb )
+    {
+        m_fnConnCb = a_fnCb;
+    }
+
+    /**
+     * Configure the keep alive interval.
+     * 
+     * @param[in]   a_nKeepAliveS   Keep alive in seconds.
+     */
+    void SetKeepAlive( uint16_t a_nKeepAliveS )
+    {
+        m_nKeepAliveS = a_nKeepAliveS;
+    }
+
+    /**
+     * Configure the protocol level used by the next connection.
+     * 
+     * @param[in]   a_nProtoLevel   MQTT_CLIENT_V311 or MQTT_CLIENT_V5.
+     */
+    void SetProtocol( uint8_t a_nProtoLevel )
+    {
+        m_nProtoLevel = ( a_nProtoLevel == MQTT_CLIENT_V5 ) ? MQTT_CLIENT_V5 : MQTT_CLIENT_V311;
+    }
+
+    /**
+     * Register an outgoing topic alias (MQTT 5).
+     * 
+     * The aliases are assigned in the registration order, starting with 1.
+     * The messages published to the topic use the alias if the broker allows for it.
+     * 
+     * @param[in]   a_pszTopic  Topic name - must remain valid.
+     * 
+     * @return  false if all the aliases are used.
+     */
+    bool AddTopicAlias( const char* a_pszTopic )
+    {
+        if( m_nAliasCnt >= MQTT_CLIENT_TOPIC_ALIASES )
+        {
+            return false;
+        }
+        m_arrAliasTopics[ m_nAliasCnt++ ] = a_pszTopic;
+        return true;
+    }
+
+    /**
+     * Unregister all topic aliases. To be called while disconnected.
+     */
+    void ClearTopicAliases()
+    {
+        m_nAliasCnt = 0;
+    }
+
+    /**
+     * Start a connection to the configured server.
+     * 
+     * Open a TCP connection and send the CONNECT packet. The connection is established once
+     * loop() receives the CONNACK.
+     * The attempts are throttled to one per MQTT_CLIENT_RETRY_MS.
+     * 
+     * @param[in]   a_pszClientId   Client id.
+     * @param[in]   a_pszWillTopic  LWT topic or nullptr.
+     * @param[in]   a_nWillQos      LWT QoS.
+     * @param[in]   a_bWillRetain   LWT retain flag.
+     * @param[in]   a_pszWillMsg    LWT message.
+     * 
+     * @return  true if the CONNECT packet was sent.
+     */
+    bool Connect( const char* a_pszClientId, const char* a_pszWillTopic = nullptr, uint8_t a_nWillQos = 0,
+        bool a_bWillRetain = false, const char* a_pszWillMsg = nullptr )
+    {
+        if(( m_state != EState::eDisconnected ) || ( !m_pszHost ))
+        {
+            return false;
+        }
+
+        m_tmRetry.UpdateCur();
+        if(( m_bRetry ) && ( m_tmRetry.Delta() < MQTT_CLIENT_RETRY_MS ))
+        {
+            return false;
+        }
+        m_bRetry = true;
+        m_tmRetry.UpdateAll();
+
+        if( !m_pClient->connect( m_pszHost, m_nPort ))
+        {
+            return false;
+        }
+
+        uint16_t nIdLen = strlen( a_pszClientId );
+        uint16_t nWillTopicLen = ( a_pszWillTopic ) ? strlen( a_pszWillTopic ) : 0;
+        uint16_t nWillMsgLen = ( a_pszWillTopic && a_pszWillMsg ) ? strlen( a_pszWillMsg ) : 0;
+        bool bV5 = m_nProtoLevel == MQTT_CLIENT_V5;
+        uint nRemLen = 10 + (( bV5 ) ? 1 : 0 ) + 2 + nIdLen;  // + empty properties
+        byte nFlags = 0x02; // clean session
+        if( a_pszWillTopic )
+        {
+            nRemLen += (( bV5 ) ? 1 : 0 ) + 2 + nWillTopicLen + 2 + nWillMsgLen;
+            nFlags |= 0x04 | (( a_nWillQos & 3 ) << 3 ) | (( a_bWillRetain ) ? 0x20 : 0 );
+        }
+
+        byte* pPkt = BeginPkt( MQTT_PKT_CONNECT, nRemLen );
+        if( !pPkt )
+        {
+            m_pClient->stop();
+            return false;
+        }
+        pPkt = PutStr( pPkt, "MQTT", 4 );
+        *pPkt++ = m_nProtoLevel;
+        *pPkt++ = nFlags;
+        *pPkt++ = m_nKeepAliveS >> 8;
+        *pPkt++ = m_nKeepAliveS & 0xff;
+        if( bV5 )
+            *pPkt++ = 0;    // properties
+        pPkt = PutStr( pPkt, a_pszClientId, nIdLen );
+        if( a_pszWillTopic )
+        {
+            if( bV5 )
+                *pPkt++ = 0;    // will properties
+            pPkt = PutStr( pPkt, a_pszWillTopic, nWillTopicLen );
+            pPkt = PutStr( pPkt, a_pszWillMsg, nWillMsgLen );
+        }
+        if( !EndPkt( pPkt ))
+        {
+            m_pClient->stop();
+            return false;
+        }
+
+        ResetParser();
+        m_nAliasMax = 0;
+        m_nAliasSent = 0;
+        m_state = EState::eConnecting;
+        m_tmRx.UpdateAll();
+        return true;
+    }
+
+    /**
+     * Disconnect from the server.
+     */
+    void Disconnect()
+    {
+        if( m_state == EState::eConnected )
+        {
+            byte* pPkt = BeginPkt( MQTT_PKT_DISCONNECT, 0 );
+            if( pPkt )
+            {
+                EndPkt( pPkt );
+            }
+        }
+        Close();
+    }
+
+    /**
+     * Test if the connection is established, i.e. CONNACK received.
+     * 
+     * @return  true if connected.
+     */
+    bool Connected()
+    {
+        if(( m_state != EState::eDisconnected ) && ( !m_pClient->connected()))
+        {
+            Close();
+        }
+        return m_state == EState::eConnected;
+    }
+
+    /**
+     * Test if the connection is in progress, i.e. waiting for the CONNACK.
+     * 
+     * @return  true if connecting.
+     */
+    bool Connecting()
+    {
+        Connected();
+        return m_state == EState::eConnecting;
+    }
+
+    /**
+     * Publish a message.
+     * 
+     * @param[in]   a_pszTopic  Topic.
+     * @param[in]   a_pPayload  Payload.
+     * @param[in]   a_nLen      Length of the payload.
+     * @param[in]   a_bRetained Retain flag.
+     * @param[in]   a_nQos      QoS: 0 or 1.
+     * 
+     * @return  true if sent (QoS 0) or queued (QoS 1).
+     */
+    bool Publish( const char* a_pszTopic, const byte* a_pPayload, uint a_nLen, bool a_bRetained = false, uint8_t a_nQos = 0 )
+    {
+        if( !Connected())
+        {
+            return false;
+        }
+
+        bool bV5 = m_nProtoLevel == MQTT_CLIENT_V5;
+        uint16_t nAlias = GetTopicAlias( a_pszTopic );
+        if( a_nQos )
+        {
+            return m_outbox.Publish( *m_pClient, a_pszTopic, a_pPayload, a_nLen, a_bRetained, bV5, nAlias );
+        }
+
+        uint32_t nAliasBit = ( nAlias ) ? ( 1UL << ( nAlias - 1 )) : 0;
+        uint16_t nTopicLen = ( nAliasBit & m_nAliasSent ) ? 0 : strlen( a_pszTopic );
+        uint nLen = CMqttOutbox::EncodePublish( m_arrTx, MQTT_CLIENT_TX_BUF_LEN, ( a_bRetained ) ? MQTT_PUBLISH_RETAIN : 0,
+            a_pszTopic, nTopicLen, 0, bV5, nAlias, a_pPayload, a_nLen );
+        if(( !nLen ) || ( !EndPkt( m_arrTx + nLen )))
+        {
+            return false;
+        }
+        m_nAliasSent |= nAliasBit;
+        return true;
+    }
+
+    /**
+     * Publish a string message.
+     * 
+     * @param[in]   a_pszTopic  Topic.
+     * @param[in]   a_pszMsg    Message.
+     * @param[in]   a_bRetained Retain flag.
+     * @param[in]   a_nQos      QoS: 0 or 1.
+     * 
+     * @return  true if sent (QoS 0) or queued (QoS 1).
+     */
+    bool Publish( const char* a_pszTopic, const char* a_pszMsg, bool a_bRetained = false, uint8_t a_nQos = 0 )
+    {
+        return Publish( a_pszTopic, (const byte*)a_pszMsg, strlen( a_pszMsg ), a_bRetained, a_nQos );
+    }
+
+    /**
+     * Subscribe to a topic.
+     * 
+     * @param[in]   a_pszTopic  Topic filter.
+     * @param[in]   a_nQos      Requested QoS.
+     * 
+     * @return  true if the SUBSCRIBE packet was sent.
+     */
+    bool Subscribe( const char* a_pszTopic, uint8_t a_nQos = 0 )
+    {
+        if( !Connected())
+        {
+            return false;
+        }
+
+        uint16_t nTopicLen = strlen( a_pszTopic );
+        uint8_t nPropsLen = ( m_nProtoLevel == MQTT_CLIENT_V5 ) ? 1 : 0;
+        byte* pPkt = BeginPkt( MQTT_PKT_SUBSCRIBE | 0x02, 2 + nPropsLen + 2 + nTopicLen + 1 );
+        if( !pPkt )
+        {
+            return false;
+        }
+        uint16_t nPktId = m_nNextPktId++;
+        if( m_nNextPktId >= MQTT_CLIENT_OUTBOX_FIRST_PKT_ID )
+        {
+            m_nNextPktId = 1;
+        }
+        *pPkt++ = nPktId >> 8;
+        *pPkt++ = nPktId & 0xff;
+        if( nPropsLen )
+        {
+            *pPkt++ = 0;    // no properties
+        }
+        pPkt = PutStr( pPkt, a_pszTopic, nTopicLen );
+        *pPkt++ = a_nQos;
+        return EndPkt( pPkt );
+    }
+
+    /**
+     * Return the number of QoS 1 messages not acknowledged yet.
+     * 
+     * @return  Number of messages in the outbox.
+     */
+    uint8_t GetOutboxCnt()
+    {
+        return m_outbox.GetCnt();
+    }
+
+    /**
+     * Main loop function.
+     * 
+     * Read the available bytes and dispatch the complete packets.
+     * Handle the CONNACK timeout, the keep alive and the QoS 1 outbox.
+     */
+    void loop()
+    {
+        Connected();
+        if( m_state == EState::eDisconnected )
+        {
+            return;
+        }
+
+        uint8_t nPkts = 0;
+        while(( nPkts < MQTT_CLIENT_LOOP_PKTS ) && ( m_state != EState::eDisconnected ) && ( m_pClient->available() > 0 ))
+        {
+            if( Parse())
+            {
+                nPkts++;
+                m_tmRx.UpdateAll();
+                Dispatch();
+                ResetParser();
+            }
+        }
+
+        if( m_state == EState::eConnecting )
+        {
+            m_tmRx.UpdateCur();
+            if( m_tmRx.Delta() >= MQTT_CLIENT_CONNACK_MS )
+            {
+                Close();
+            }
+        }
+        else if( m_state == EState::eConnected )
+        {
+            KeepAlive();
+            m_outbox.loop( *m_pClient );
+        }
+    }
+
+protected:
+    /**
+     * Connection state.
+     */
+    enum class EState : uint8_t
+    {
+        eDisconnected,  ///< No connection
+        eConnecting,    ///< CONNECT sent, waiting for the CONNACK
+        eConnected,     ///< Connection established
+    };
+
+    /**
+     * Incoming packet parser state.
+     */
+    enum class EParserState : uint8_t
+    {
+        eHdr,       ///< Waiting for the fixed header
+        eRemLen,    ///< Reading the remaining length
+        eBody,      ///< Reading the packet body into the receive buffer
+        eSkip,      ///< Skipping the body of a packet too long for the receive buffer
+    };
+
+    /**
+     * Close the connection.
+     */
+    void Close()
+    {
+        m_pClient->stop();
+        m_state = EState::eDisconnected;
+    }
+
+    /**
+     * Reset the incoming packet parser, i.e. expect a fixed header.
+     */
+    void ResetParser()
+    {
+        m_parser = EParserState::eHdr;
+    }
+
+    /**
+     * Parse the available bytes.
+     * 
+     * @return  true if a complete packet was received into the receive buffer.
+     */
+    bool Parse()
+    {
+        switch( m_parser )
+        {
+            case EParserState::eHdr:
+            {
+                int b = m_pClient->read();
+                if( b < 0 )
+                    return false;
+                m_nPktHdr = b;
+                m_nRemLen = m_nRxLen = 0;
+                m_nRemLenShift = 0;
+                m_parser = EParserState::eRemLen;
+                return false;
+            }
+
+            case EParserState::eRemLen:
+            {
+                int b = m_pClient->read();
+                if( b < 0 )
+                    return false;
+                m_nRemLen |= ((uint32_t)( b & 0x7f )) << m_nRemLenShift;
+                m_nRemLenShift += 7;
+                if( b & 0x80 )
+                {
+                    if( m_nRemLenShift > 21 )
+                    {
+                        Close();    // malformed
+                    }
+                    return false;
+                }
+                if( !m_nRemLen )
+                    return true;
+                m_parser = ( m_nRemLen <= MQTT_CLIENT_RX_BUF_LEN ) ? EParserState::eBody : EParserState::eSkip;
+                return false;
+            }
+
+            case EParserState::eBody:
+            {
+                int nRead = m_pClient->read( m_arrRx + m_nRxLen, m_nRemLen - m_nRxLen );
+                if( nRead > 0 )
+                    m_nRxLen += nRead;
+                return m_nRxLen == m_nRemLen;
+            }
+
+            case EParserState::eSkip:
+            {
+                byte arrSkip[ 32 ];
+                int nRead = m_pClient->read( arrSkip, min( sizeof( arrSkip ), (size_t)( m_nRemLen - m_nRxLen )));
+                if( nRead > 0 )
+                    m_nRxLen += nRead;
+                if( m_nRxLen == m_nRemLen )
+                    ResetParser();
+                return false;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Dispatch a complete packet from the receive buffer.
+     */
+    void Dispatch()
+    {
+        switch( m_nPktHdr & 0xf0 )
+        {
+            case MQTT_PKT_CONNACK:
+                if(( m_state == EState::eConnecting ) && ( m_nRxLen >= 2 ) && ( m_arrRx[ 1 ] == 0 ))
+                {
+                    if( m_nProtoLevel == MQTT_CLIENT_V5 )
+                    {
+                        uint32_t nAliasMax = 0;
+                        FindProp( m_arrRx + 2, m_arrRx + m_nRxLen, MQTT_PROP_TOPIC_ALIAS_MAX, nAliasMax );
+                        m_nAliasMax = nAliasMax;
+                    }
+                    m_state = EState::eConnected;
+                    m_bPingSent = false;
+                    m_tmTx.UpdateAll();
+                    m_outbox.Resend();
+                    if( m_fnConnCb )
+                        m_fnConnCb();
+                }
+                else
+                {
+                    Close();    // refused
+                }
+                break;
+
+            case MQTT_PKT_PUBLISH:
+                OnPublish();
+                break;
+
+            case MQTT_PKT_PUBACK:
+                if( m_nRxLen >= 2 )
+                    m_outbox.OnPubAck(( m_arrRx[ 0 ] << 8 ) | m_arrRx[ 1 ]);
+                break;
+
+            case MQTT_PKT_PINGRESP:
+                m_bPingSent = false;
+                break;
+
+            case MQTT_PKT_DISCONNECT:
+                Close();
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    /**
+     * Handle a received PUBLISH packet.
+     * 
+     * Null-terminate the topic in place by moving it over its length field,
+     * call the message callback and acknowledge a QoS 1 message.
+     */
+    void OnPublish()
+    {
+        if( m_nRxLen < 2 )
+            return;
+
+        uint16_t nTopicLen = ( m_arrRx[ 0 ] << 8 ) | m_arrRx[ 1 ];
+        uint8_t nQos = ( m_nPktHdr >> 1 ) & 3;
+        uint nOffs = 2 + nTopicLen + (( nQos ) ? 2 : 0 );
+        if( nOffs > m_nRxLen )
+            return;
+        if( m_nProtoLevel == MQTT_CLIENT_V5 )
+        {
+            // Skip the properties - no incoming topic aliases are allowed, i.e. the topic is always present:
+            uint32_t nPropsLen;
+            const byte* pProps = DecodeVarInt( m_arrRx + nOffs, m_arrRx + m_nRxLen, nPropsLen );
+            if(( !pProps ) || ( nPropsLen > (uint32_t)( m_arrRx + m_nRxLen - pProps )))
+                return;
+            nOffs = pProps + nPropsLen - m_arrRx;
+        }
+
+        uint16_t nPktId = ( nQos ) ? (( m_arrRx[ 2 + nTopicLen ] << 8 ) | m_arrRx[ 3 + nTopicLen ]) : 0;
+        char* pszTopic = (char*)m_arrRx;
+        memmove( pszTopic, m_arrRx + 2, nTopicLen );
+        pszTopic[ nTopicLen ] = 0;
+
+        if( m_fnMsgCb )
+            m_fnMsgCb( pszTopic, m_arrRx + nOffs, m_nRxLen - nOffs );
+
+        if( nQos == 1 )
+        {
+            byte* pPkt = BeginPkt( MQTT_PKT_PUBACK, 2 );
+            if( pPkt )
+            {
+                *pPkt++ = nPktId >> 8;
+                *pPkt++ = nPktId & 0xff;
+                EndPkt( pPkt );
+            }
+        }
+    }
+
+    /**
+     * Return the topic alias to use for a topic.
+     * 
+     * @param[in]   a_pszTopic  Topic name.
+     * 
+     * @return  Topic alias, 0:none.
+     */
+    uint16_t GetTopicAlias( const char* a_pszTopic )
+    {
+        if( m_nProtoLevel != MQTT_CLIENT_V5 )
+            return 0;
+
+        for( uint8_t nIdx = 0; ( nIdx < m_nAliasCnt ) && ( nIdx < m_nAliasMax ); nIdx++ )
+        {
+            if(( m_arrAliasTopics[ nIdx ] == a_pszTopic ) || ( !strcmp( m_arrAliasTopics[ nIdx ], a_pszTopic )))
+                return nIdx + 1;
+        }
+        return 0;
+    }
+
+    /**
+     * Decode a variable byte integer.
+     * 
+     * @param[in]   a_p     Input.
+     * @param[in]   a_pEnd  End of the input.
+     * @param[out]  a_rnVal Decoded value.
+     * 
+     * @return  Pointer past the integer or nullptr if malformed.
+     */
+    static const byte* DecodeVarInt( const byte* a_p, const byte* a_pEnd, uint32_t& a_rnVal )
+    {
+        a_rnVal = 0;
+        for( uint8_t nShift = 0; ( a_p < a_pEnd ) && ( nShift <= 21 ); nShift += 7 )
+        {
+            byte b = *a_p++;
+            a_rnVal |= ((uint32_t)( b & 0x7f )) << nShift;
+            if( !( b & 0x80 ))
+                return a_p;
+        }
+        return nullptr;
+    }
+
+    /**
+     * Skip a length prefixed string or binary data field.
+     * 
+     * @param[in]   a_p     Field, starting with the 2 byte length.
+     * @param[in]   a_pEnd  End of the properties.
+     * 
+     * @return  Next field, nullptr if the field overruns the end.
+     */
+    static const byte* SkipString( const byte* a_p, const byte* a_pEnd )
+    {
+        if( a_pEnd - a_p < 2 )
+            return nullptr;
+        uint16_t nLen = ( a_p[ 0 ] << 8 ) | a_p[ 1 ];
+        if( a_pEnd - a_p - 2 < nLen )
+            return nullptr;
+        return a_p + 2 + nLen;
+    }
+
+    /**
+     * Find an integer property in the properties field (MQTT 5).
+     * 
+     * @param[in]   a_p     Properties field, starting with the properties length.
+     * @param[in]   a_pEnd  End of the packet.
+     * @param[in]   a_nId   Property id.
+     * @param[out]  a_rnVal Property value, unchanged if not found.
+     * 
+     * @return  true if found.
+     */
+    static bool FindProp( const byte* a_p, const byte* a_pEnd, byte a_nId, uint32_t& a_rnVal )
+    {
+        uint32_t nLen;
+        a_p = DecodeVarInt( a_p, a_pEnd, nLen );
+        if(( !a_p ) || ( nLen > (uint32_t)( a_pEnd - a_p )))
+            return false;
+
+        // Every field is checked against the end - a malformed packet must not read past it:
+        a_pEnd = a_p + nLen;
+        while( a_p < a_pEnd )
+        {
+            byte nId = *a_p++;
+            uint32_t nVal = 0;
+            switch( nId )
+            {
+                case 0x01: case 0x17: case 0x19: case 0x24: case 0x25: case 0x28: case 0x29: case 0x2a:
+                    if( a_pEnd - a_p < 1 )
+                        return false;
+                    nVal = a_p[ 0 ];
+                    a_p += 1;
+                    break;
+
+                case 0x13: case 0x21: case 0x22: case 0x23:
+                    if( a_pEnd - a_p < 2 )
+                        return false;
+                    nVal = ( a_p[ 0 ] << 8 ) | a_p[ 1 ];
+                    a_p += 2;
+                    break;
+
+                case 0x02: case 0x11: case 0x18: case 0x27:
+                    if( a_pEnd - a_p < 4 )
+                        return false;
+                    nVal = ((uint32_t)a_p[ 0 ] << 24 ) | ((uint32_t)a_p[ 1 ] << 16 ) | ( a_p[ 2 ] << 8 ) | a_p[ 3 ];
+                    a_p += 4;
+                    break;
+
+                case 0x0b:
+                    a_p = DecodeVarInt( a_p, a_pEnd, nVal );
+                    if( !a_p )
+                        return false;
+                    break;
+
+                case 0x26:  // string pair
+                    a_p = SkipString( a_p, a_pEnd );
+                    if( !a_p )
+                        return false;
+                    // fall through
+                case 0x03: case 0x08: case 0x09: case 0x12: case 0x15: case 0x16: case 0x1a: case 0x1c: case 0x1f:
+                    a_p = SkipString( a_p, a_pEnd );
+                    if( !a_p )
+                        return false;
+                    break;
+
+                default:
+                    return false;   // unknown property
+            }
+            if( nId == a_nId )
+            {
+                a_rnVal = nVal;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Send a PINGREQ when idle and drop the connection if the PINGRESP does not arrive in time.
+     */
+    void KeepAlive()
+    {
+        if( !m_nKeepAliveS )
+            return;
+
+        ulong nKeepAliveMs = m_nKeepAliveS * 1000UL;
+        m_tmTx.UpdateCur();
+        m_tmRx.UpdateCur();
+        if(( m_bPingSent ) && ( m_tmRx.Delta() >= nKeepAliveMs ))
+        {
+            Close();
+        }
+        else if(( !m_bPingSent ) && (( m_tmTx.Delta() >= nKeepAliveMs ) || ( m_tmRx.Delta() >= nKeepAliveMs )))
+        {
+            byte* pPkt = BeginPkt( MQTT_PKT_PINGREQ, 0 );
+            if(( pPkt ) && ( EndPkt( pPkt )))
+            {
+                m_bPingSent = true;
+                m_tmRx.UpdateAll();
+            }
+        }
+    }
+
+    /**
+     * Start a packet in the transmit buffer.
+     * 
+     * @param[in]   a_nHdr      Fixed header byte.
+     * @param[in]   a_nRemLen   Remaining length.
+     * 
+     * @return  Pointer to the packet body or nullptr if the packet does not fit.
+     */
+    byte* BeginPkt( byte a_nHdr, uint a_nRemLen )
+    {
+        if( 1 + CMqttOutbox::RemLenSize( a_nRemLen ) + a_nRemLen > MQTT_CLIENT_TX_BUF_LEN )
+            return nullptr;
+        m_arrTx[ 0 ] = a_nHdr;
+        return CMqttOutbox::EncodeRemLen( m_arrTx + 1, a_nRemLen );
+    }
+
+    /**
+     * Send the packet from the transmit buffer.
+     * 
+     * The packet is dropped if it does not fit in the client's send buffer.
+     * 
+     * @param[in]   a_pEnd  Pointer past the end of the packet.
+     * 
+     * @return  true if sent.
+     */
+    bool EndPkt( byte* a_pEnd )
+    {
+        size_t nLen = a_pEnd - m_arrTx;
+        if( m_pClient->availableForWrite() < (int)nLen )
+            return false;
+        if( m_pClient->write( m_arrTx, nLen ) != nLen )
+            return false;
+        m_tmTx.UpdateAll();
+        return true;
+    }
+
+    /**
+     * Put a length-prefixed string.
+     * 
+     * @param[out]  a_pBuf  Output buffer.
+     * @param[in]   a_psz   String.
+     * @param[in]   a_nLen  Length of the string.
+     * 
+     * @return  Pointer past the string.
+     */
+    static byte* PutStr( byte* a_pBuf, const char* a_psz, uint16_t a_nLen )
+    {
+        *a_pBuf++ = a_nLen >> 8;
+        *a_pBuf++ = a_nLen & 0xff;
+        memcpy( a_pBuf, a_psz, a_nLen );
+        return a_pBuf + a_nLen;
+    }
+
+    Client* m_pClient;          ///< Underlying network client
+    EState m_state;             ///< Connection state
+    const char* m_pszHost;      ///< Server hostname or IP
+    uint16_t m_nPort;           ///< Server port
+    uint16_t m_nKeepAliveS;     ///< Keep alive interval in seconds
+    uint16_t m_nNextPktId;      ///< Next SUBSCRIBE packet id
+    bool m_bRetry;              ///< True if a connection was attempted before
+    bool m_bPingSent;           ///< True if waiting for the PINGRESP
+    CTimer m_tmRetry;           ///< Connection attempt throttling timer
+    CTimer m_tmRx;              ///< Time since the last received packet
+    CTimer m_tmTx;              ///< Time since the last sent packet
+    MsgCb m_fnMsgCb;            ///< Message callback
+    ConnCb m_fnConnCb;          ///< Connection established callback
+    CMqttOutbox m_outbox;       ///< QoS 1 outbox
+
+    uint8_t m_nProtoLevel;      ///< Protocol level: MQTT_CLIENT_V311, MQTT_CLIENT_V5
+    uint8_t m_nAliasCnt;        ///< Number of registered topic aliases
+    uint16_t m_nAliasMax;       ///< Topic alias maximum allowed by the broker
+    uint32_t m_nAliasSent;      ///< Bit mask of the aliases established on the connection
+    const char* m_arrAliasTopics[ MQTT_CLIENT_TOPIC_ALIASES ];  ///< Registered topic aliases
+
+    EParserState m_parser;      ///< Incoming packet parser state
+    byte m_nPktHdr;             ///< Fixed header of the incoming packet
+    uint8_t m_nRemLenShift;     ///< Current remaining length byte shift
+    uint32_t m_nRemLen;         ///< Remaining length of the incoming packet
+    uint32_t m_nRxLen;          ///< Bytes of the incoming packet body received so far
+    byte m_arrRx[ MQTT_CLIENT_RX_BUF_LEN ]; ///< Receive buffer
+    byte m_arrTx[ MQTT_CLIENT_TX_BUF_LEN ]; ///< Transmit buffer
+};
@@ -0,0 +1,427 @@
+/**
+ * MQTT QoS 1 outbox
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+#include <Client.h>
+#include "Timer.h"
+
+
+
+/// Max number of QoS 1 messages queued or in flight at a time
+#ifndef MQTT_OUTBOX_SLOTS
+#define MQTT_OUTBOX_SLOTS       4
+#endif
+
+/// Max length of an encoded PUBLISH packet kept for retransmission
+#ifndef MQTT_OUTBOX_PKT_LEN
+#define MQTT_OUTBOX_PKT_LEN     128
+#endif
+
+/// PUBACK timeout after which an in-flight message is retransmitted
+#ifndef MQTT_OUTBOX_RETRY_MS
+#define MQTT_OUTBOX_RETRY_MS    3000
+#endif
+
+
+
+/// MQTT control packet types (the high nibble of the fixed header)
+#define MQTT_PKT_CONNECT        0x10
+#define MQTT_PKT_CONNACK        0x20
+#define MQTT_PKT_PUBLISH        0x30
+#define MQTT_PKT_PUBACK         0x40
+#define MQTT_PKT_SUBSCRIBE      0x80
+#define MQTT_PKT_SUBACK         0x90
+#define MQTT_PKT_PINGREQ        0xc0
+#define MQTT_PKT_PINGRESP       0xd0
+#define MQTT_PKT_DISCONNECT     0xe0
+
+/// MQTT 5 property ids
+#define MQTT_PROP_TOPIC_ALIAS_MAX   0x22
+#define MQTT_PROP_TOPIC_ALIAS       0x23
+
+/// PUBLISH fixed header flags
+#define MQTT_PUBLISH_RETAIN     0x01
+#define MQTT_PUBLISH_QOS1       0x02
+#define MQTT_PUBLISH_DUP        0x08
+
+
+
+/**
+ * MQTT QoS 1 outbox.
+ * 
+ * Keep the encoded PUBLISH packets until the broker acknowledges them with a PUBACK.
+ * The messages are pipelined, i.e. up to MQTT_OUTBOX_SLOTS messages are sent without waiting for
+ * the PUBACK of the previous one.
+ * 
+ * The outbox never blocks: a message is written to the client only if there is enough room
+ * in the client's send buffer, otherwise it stays pending and is sent from loop().
+ * An unacknowledged message is retransmitted with the DUP flag set after MQTT_OUTBOX_RETRY_MS
+ * and after every reconnect.
+ */
+class CMqttOutbox
+{
+public:
+    CMqttOutbox() : m_nFirstPktId( 1 ), m_nNextPktId( 1 ), m_pnAliasSent( nullptr ) { Reset(); }
+
+    /**
+     * Drop all the queued and in-flight messages.
+     */
+    void Reset()
+    {
+        for( uint8_t nIdx = 0; nIdx < MQTT_OUTBOX_SLOTS; nIdx++ )
+        {
+            m_arrSlots[ nIdx ].state = ESlotState::eFree;
+        }
+    }
+
+    /**
+     * Set the first packet id to use.
+     * 
+     * Allows to keep the outbox packet ids apart from the ids used by the other packets of the session.
+     * 
+     * @param[in]   a_nPktId    The first packet id, must not be 0.
+     */
+    void SetFirstPktId( uint16_t a_nPktId )
+    {
+        m_nFirstPktId = a_nPktId;
+        m_nNextPktId = a_nPktId;
+    }
+
+    /**
+     * Configure the topic alias tracking (MQTT 5).
+     * 
+     * The outbox sends a message with an alias-only (empty) topic if the alias was already established
+     * on the connection, i.e. its bit in the mask is set. Otherwise it sends the full topic with
+     * the alias and sets the bit. The owner clears the mask on every new connection.
+     * 
+     * @param[in]   a_pnAliasSent   Bit mask of established aliases: bit# = alias - 1, nullptr:aliases not used.
+     */
+    void SetAliasMask( uint32_t* a_pnAliasSent )
+    {
+        m_pnAliasSent = a_pnAliasSent;
+    }
+
+    /**
+     * Queue a QoS 1 message and send it if possible.
+     * 
+     * @param[in]   a_rClient   Connected client.
+     * @param[in]   a_pszTopic  Topic name.
+     * @param[in]   a_pPayload  Payload.
+     * @param[in]   a_nLen      Length of the payload.
+     * @param[in]   a_bRetained Retain flag.
+     * @param[in]   a_bProps    True if the packet has the properties field (MQTT 5).
+     * @param[in]   a_nAlias    Topic alias (MQTT 5), 0:none.
+     * 
+     * @return  false if the outbox is full or the message is too long, true otherwise.
+     */
+    bool Publish( Client& a_rClient, const char* a_pszTopic, const byte* a_pPayload, uint a_nLen, bool a_bRetained,
+        bool a_bProps = false, uint16_t a_nAlias = 0 )
+    {
+        SSlot* pSlot = GetFreeSlot();
+        if( !pSlot )
+        {
+            return false;
+        }
+
+        uint16_t nPktId = m_nNextPktId;
+        uint16_t nTopicLen = strlen( a_pszTopic );
+        uint nLen = EncodePublish( pSlot->arrPkt, MQTT_OUTBOX_PKT_LEN, MQTT_PUBLISH_QOS1 | (( a_bRetained ) ? MQTT_PUBLISH_RETAIN : 0 ),
+            a_pszTopic, nTopicLen, nPktId, a_bProps, a_nAlias, a_pPayload, a_nLen );
+        if( !nLen )
+        {
+            return false;
+        }
+
+        AllocPktId();
+        pSlot->nPktId = nPktId;
+        pSlot->nLen = nLen;
+        pSlot->nTopicLen = nTopicLen;
+        pSlot->nAlias = a_nAlias;
+        pSlot->state = ESlotState::ePending;
+        Send( a_rClient, *pSlot );
+        return true;
+    }
+
+    /**
+     * Release the message acknowledged by the broker.
+     * 
+     * @param[in]   a_nPktId    Packet id received in a PUBACK.
+     */
+    void OnPubAck( uint16_t a_nPktId )
+    {
+        for( uint8_t nIdx = 0; nIdx < MQTT_OUTBOX_SLOTS; nIdx++ )
+        {
+            SSlot& rSlot = m_arrSlots[ nIdx ];
+            if(( rSlot.state == ESlotState::eInFlight ) && ( rSlot.nPktId == a_nPktId ))
+            {
+                rSlot.state = ESlotState::eFree;
+                return;
+            }
+        }
+    }
+
+    /**
+     * Mark all the in-flight messages for retransmission, e.g. after a reconnect.
+     */
+    void Resend()
+    {
+        for( uint8_t nIdx = 0; nIdx < MQTT_OUTBOX_SLOTS; nIdx++ )
+        {
+            SSlot& rSlot = m_arrSlots[ nIdx ];
+            if( rSlot.state == ESlotState::eInFlight )
+            {
+                rSlot.arrPkt[ 0 ] |= MQTT_PUBLISH_DUP;
+                rSlot.state = ESlotState::ePending;
+            }
+        }
+    }
+
+    /**
+     * Main loop function.
+     * 
+     * Send the pending messages and retransmit the expired in-flight messages.
+     * 
+     * @param[in]   a_rClient   Connected client.
+     */
+    void loop( Client& a_rClient )
+    {
+        for( uint8_t nIdx = 0; nIdx < MQTT_OUTBOX_SLOTS; nIdx++ )
+        {
+            SSlot& rSlot = m_arrSlots[ nIdx ];
+            if( rSlot.state == ESlotState::eInFlight )
+            {
+                rSlot.tmSent.UpdateCur();
+                if( rSlot.tmSent.Delta() >= MQTT_OUTBOX_RETRY_MS )
+                {
+                    rSlot.arrPkt[ 0 ] |= MQTT_PUBLISH_DUP;
+                    rSlot.state = ESlotState::ePending;
+                }
+            }
+            if( rSlot.state == ESlotState::ePending )
+            {
+                Send( a_rClient, rSlot );
+            }
+        }
+    }
+
+    /**
+     * Return the number of queued and in-flight messages.
+     * 
+     * @return  Number of messages not acknowledged yet.
+     */
+    uint8_t GetCnt()
+    {
+        uint8_t nCnt = 0;
+        for( uint8_t nIdx = 0; nIdx < MQTT_OUTBOX_SLOTS; nIdx++ )
+        {
+            if( m_arrSlots[ nIdx ].state != ESlotState::eFree )
+            {
+                nCnt++;
+            }
+        }
+        return nCnt;
+    }
+
+    /**
+     * Encode a PUBLISH packet.
+     * 
+     * @param[out]  a_pBuf      Output buffer.
+     * @param[in]   a_nBufLen   Length of the output buffer.
+     * @param[in]   a_nFlags    PUBLISH fixed header flags: MQTT_PUBLISH_*.
+     * @param[in]   a_pszTopic  Topic name, not null-terminated.
+     * @param[in]   a_nTopicLen Length of the topic name, 0:alias-only topic.
+     * @param[in]   a_nPktId    Packet id, used if QoS > 0.
+     * @param[in]   a_bProps    True if the packet has the properties field (MQTT 5).
+     * @param[in]   a_nAlias    Topic alias property (MQTT 5), 0:none.
+     * @param[in]   a_pPayload  Payload.
+     * @param[in]   a_nLen      Length of the payload.
+     * 
+     * @return  Length of the encoded packet, 0 if the packet does not fit in the buffer.
+     */
+    static uint EncodePublish( byte* a_pBuf, uint a_nBufLen, byte a_nFlags, const char* a_pszTopic, uint16_t a_nTopicLen,
+        uint16_t a_nPktId, bool a_bProps, uint16_t a_nAlias, const byte* a_pPayload, uint a_nLen )
+    {
+        uint nPropsLen = ( a_nAlias ) ? 3 : 0;
+        uint nRemLen = 2 + a_nTopicLen + (( a_nFlags & MQTT_PUBLISH_QOS1 ) ? 2 : 0 ) + (( a_bProps ) ? 1 + nPropsLen : 0 ) + a_nLen;
+        uint nLen = 1 + RemLenSize( nRemLen ) + nRemLen;
+        if( nLen > a_nBufLen )
+        {
+            return 0;
+        }
+
+        byte* pPkt = a_pBuf;
+        *pPkt++ = MQTT_PKT_PUBLISH | a_nFlags;
+        pPkt = EncodeRemLen( pPkt, nRemLen );
+        *pPkt++ = a_nTopicLen >> 8;
+        *pPkt++ = a_nTopicLen & 0xff;
+        memcpy( pPkt, a_pszTopic, a_nTopicLen );
+        pPkt += a_nTopicLen;
+        if( a_nFlags & MQTT_PUBLISH_QOS1 )
+        {
+            *pPkt++ = a_nPktId >> 8;
+            *pPkt++ = a_nPktId & 0xff;
+        }
+        if( a_bProps )
+        {
+            *pPkt++ = nPropsLen;
+            if( a_nAlias )
+            {
+                *pPkt++ = MQTT_PROP_TOPIC_ALIAS;
+                *pPkt++ = a_nAlias >> 8;
+                *pPkt++ = a_nAlias & 0xff;
+            }
+        }
+        memcpy( pPkt, a_pPayload, a_nLen );
+        return nLen;
+    }
+
+    /**
+     * Return the size of the encoded remaining length field.
+     * 
+     * @param[in]   a_nRemLen   Remaining length.
+     * 
+     * @return  Number of bytes: 1-4.
+     */
+    static uint RemLenSize( uint a_nRemLen )
+    {
+        uint nSize = 1;
+        while( a_nRemLen >= 128 )
+        {
+            a_nRemLen >>= 7;
+            nSize++;
+        }
+        return nSize;
+    }
+
+    /**
+     * Encode the remaining length field.
+     * 
+     * @param[out]  a_pBuf      Output buffer.
+     * @param[in]   a_nRemLen   Remaining length.
+     * 
+     * @return  Pointer past the encoded field.
+     */
+    static byte* EncodeRemLen( byte* a_pBuf, uint a_nRemLen )
+    {
+        do
+        {
+            byte b = a_nRemLen & 0x7f;
+            a_nRemLen >>= 7;
+            if( a_nRemLen )
+            {
+                b |= 0x80;
+            }
+            *a_pBuf++ = b;
+        } while( a_nRemLen );
+        return a_pBuf;
+    }
+
+protected:
+    /**
+     * Outbox slot state.
+     */
+    enum class ESlotState : uint8_t
+    {
+        eFree,      ///< Slot available
+        ePending,   ///< Message waiting to be (re)sent
+        eInFlight,  ///< Message sent, waiting for the PUBACK
+    };
+
+    /**
+     * Outbox slot.
+     */
+    struct SSlot
+    {
+        ESlotState state;                   ///< Slot state
+        uint16_t nPktId;                    ///< Packet id
+        uint16_t nLen;                      ///< Encoded packet length
+        uint16_t nTopicLen;                 ///< Topic length
+        uint16_t nAlias;                    ///< Topic alias (MQTT 5), 0:none
+        CTimer tmSent;                      ///< Time since the last (re)transmission
+        byte arrPkt[ MQTT_OUTBOX_PKT_LEN ]; ///< Encoded PUBLISH packet
+    };
+
+    /**
+     * Find a free slot.
+     * 
+     * @return  A free slot or nullptr if the outbox is full.
+     */
+    SSlot* GetFreeSlot()
+    {
+        for( uint8_t nIdx = 0; nIdx < MQTT_OUTBOX_SLOTS; nIdx++ )
+        {
+            if( m_arrSlots[ nIdx ].state == ESlotState::eFree )
+            {
+                return &m_arrSlots[ nIdx ];
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * Allocate the next packet id, wrapping to the first one - the ids below are the client's.
+     * 
+     * @return  Packet id.
+     */
+    uint16_t AllocPktId()
+    {
+        uint16_t nPktId = m_nNextPktId++;
+        if( !m_nNextPktId )
+        {
+            m_nNextPktId = m_nFirstPktId;
+        }
+        return nPktId;
+    }
+
+    /**
+     * Send the slot's packet if it fits in the client's send buffer.
+     * 
+     * The slot always keeps the packet with the full topic. If the slot's topic alias is already
+     * established on the connection, the packet is sent with an alias-only topic instead.
+     * 
+     * @param[in]   a_rClient   Connected client.
+     * @param[in]   a_rSlot     Pending slot.
+     */
+    void Send( Client& a_rClient, SSlot& a_rSlot )
+    {
+        const byte* pPkt = a_rSlot.arrPkt;
+        uint nLen = a_rSlot.nLen;
+        byte arrAliasPkt[ MQTT_OUTBOX_PKT_LEN ];
+        uint32_t nAliasBit = ( a_rSlot.nAlias && m_pnAliasSent ) ? ( 1UL << ( a_rSlot.nAlias - 1 )) : 0;
+        if(( nAliasBit ) && ( *m_pnAliasSent & nAliasBit ))
+        {
+            // Rebuild as: fixed header, remaining length, empty topic, the rest of the packet:
+            uint nHdrLen = 1;
+            while( pPkt[ nHdrLen++ ] & 0x80 );
+            uint nRestOffs = nHdrLen + 2 + a_rSlot.nTopicLen;
+            uint nRemLen = nLen - nHdrLen - a_rSlot.nTopicLen;
+            byte* pAliasPkt = arrAliasPkt;
+            *pAliasPkt++ = pPkt[ 0 ];
+            pAliasPkt = EncodeRemLen( pAliasPkt, nRemLen );
+            *pAliasPkt++ = 0;
+            *pAliasPkt++ = 0;
+            memcpy( pAliasPkt, pPkt + nRestOffs, nLen - nRestOffs );
+            nLen = pAliasPkt - arrAliasPkt + nLen - nRestOffs;
+            pPkt = arrAliasPkt;
+        }
+
+        if(( !a_rClient.connected()) || ( a_rClient.availableForWrite() < (int)nLen ))
+        {
+            return;
+        }
+        a_rClient.write( pPkt, nLen );
+        if( nAliasBit )
+        {
+            *m_pnAliasSent |= nAliasBit;
+        }
+        a_rSlot.tmSent.UpdateAll();
+        a_rSlot.state = ESlotState::eInFlight;
+    }
+
+    SSlot m_arrSlots[ MQTT_OUTBOX_SLOTS ];  ///< Outbox slots
+    uint16_t m_nFirstPktId;                 ///< First packet id, see SetFirstPktId()
+    uint16_t m_nNextPktId;                  ///< Next packet id
+    uint32_t* m_pnAliasSent;                ///< Established topic aliases bit mask (MQTT 5)
+};
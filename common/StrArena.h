@@ -0,0 +1,88 @@
+/**
+ * String arena
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+
+
+
+/**
+ * String arena class.
+ * 
+ * A fixed buffer the long-lived strings, e.g. the configuration values, are stored in one after another.
+ * Nothing is allocated on the heap, so the configuration re-read e.g. on each WIFI disconnection does not
+ * leave holes between the transient allocations. The strings are dropped all at once, see Reset().
+ * 
+ * @param   TLen    Arena length, including the string terminators
+ */
+template< uint16_t TLen >
+class CStrArena
+{
+public:
+    CStrArena() { Reset(); }
+
+    /**
+     * Drop all the strings - the pointers returned by Add() become invalid.
+     */
+    void Reset()
+    {
+        m_nUsed = 0;
+        m_bOverflow = false;
+        m_arrBuf[ TLen - 1 ] = 0;
+    }
+
+    /**
+     * Store a string with an optional suffix, e.g. a topic name with a subtopic.
+     * 
+     * @param[in]   a_pszStr    String
+     * @param[in]   a_pszSuffix Suffix appended to the string
+     * 
+     * @return  Stored string, an empty string if the arena is full - see IsOverflow().
+     */
+    const char* Add( const char* a_pszStr, const char* a_pszSuffix = "" )
+    {
+        size_t nLen = strlen( a_pszStr );
+        size_t nSuffixLen = strlen( a_pszSuffix );
+        // The last byte is kept as the empty string returned on overflow:
+        if( m_nUsed + nLen + nSuffixLen + 1 > TLen - 1 )
+        {
+            m_bOverflow = true;
+            return m_arrBuf + TLen - 1;
+        }
+        char* pszStr = m_arrBuf + m_nUsed;
+        memcpy( pszStr, a_pszStr, nLen );
+        memcpy( pszStr + nLen, a_pszSuffix, nSuffixLen + 1 );
+        m_nUsed += nLen + nSuffixLen + 1;
+        return pszStr;
+    }
+
+    /**
+     * Store a string with an optional suffix.
+     */
+    const char* Add( const String& a_rstr, const char* a_pszSuffix = "" )
+    {
+        return Add( a_rstr.c_str(), a_pszSuffix );
+    }
+
+    /**
+     * Get the number of the bytes used.
+     */
+    uint16_t GetUsed() const
+    {
+        return m_nUsed;
+    }
+
+    /**
+     * Check if a string did not fit since the last Reset().
+     */
+    bool IsOverflow() const
+    {
+        return m_bOverflow;
+    }
+
+protected:
+    char m_arrBuf[ TLen ];  ///< Strings, each one terminated
+    uint16_t m_nUsed;       ///< Bytes used
+    bool m_bOverflow;       ///< True if a string did not fit
+};
@@ -95,6 +95,59 @@ public:
         return nRet;
     }
 
+    /**
+     * Convert a string into a base 10 uint32
+     * 
+     * @param[in]   payload     Input string
+     * @param[in]   len         Length of the input string
+     * 
+     * @return  Base 10 uint32 value
+     */
+    static uint32_t AtoU32_10( byte *payload, uint len )
+    {
+        uint32_t nRet = 0;
+        for( uint nIdx = 0; nIdx < len; nIdx++ )
+        {
+            byte b = payload[ nIdx ];
+            if(( b >= '0' ) && ( b <= '9' ))
+            {
+                nRet *= 10;
+                nRet += ( b - '0' );
+            }
+            else
+            {
+                nRet = 0;
+                break;
+            }
+        }
+        return nRet;
+    }
+
+    /**
+     * Check if a string is a base 10 uint32
+     * 
+     * @param[in]   payload     Input string
+     * @param[in]   len         Length of the input string
+     * @param[in]   a_nDigits   Max number of digits
+     * 
+     * @return  true if the string consists of 1 to a_nDigits digits
+     */
+    static bool IsU32_10( byte *payload, uint len, uint a_nDigits )
+    {
+        if(( !len ) || ( len > a_nDigits ))
+        {
+            return false;
+        }
+        for( uint nIdx = 0; nIdx < len; nIdx++ )
+        {
+            if(( payload[ nIdx ] < '0' ) || ( payload[ nIdx ] > '9' ))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
     /**
      * Convert a nibble char (i.e. half a byte, base 16) into a value
      * 
@@ -130,4 +183,38 @@ public:
     {
         return "0123456789abcdef"[ a_nNibble & 0xf ];
     }
+
+    /**
+     * Convert a 64-bit hex mask string (0x0123456789abcdef) into a value
+     * 
+     * @param[in]   payload     Input string - 18 characters, not validated
+     * 
+     * @return  Mask value
+     */
+    static uint64_t MaskToU64_16( const byte* payload )
+    {
+        uint64_t nRet = 0;
+        for( uint nIdx = 2; nIdx < 18; nIdx++ )
+        {
+            nRet = ( nRet << 4 ) | NibbleToU8_16( payload[ nIdx ]);
+        }
+        return nRet;
+    }
+
+    /**
+     * Convert a value into a 64-bit hex mask string (0x0123456789abcdef)
+     * 
+     * @param[in]   a_nMask     Mask value
+     * @param[out]  a_pszMask   Output string - 19 characters including the terminator
+     */
+    static void U64ToMask_16( uint64_t a_nMask, char* a_pszMask )
+    {
+        a_pszMask[ 0 ] = '0';
+        a_pszMask[ 1 ] = 'x';
+        for( int nIdx = 17; nIdx >= 2; nIdx--, a_nMask >>= 4 )
+        {
+            a_pszMask[ nIdx ] = U8ToNibble_16( a_nMask & 0xf );
+        }
+        a_pszMask[ 18 ] = 0;
+    }
 };
@@ -0,0 +1,123 @@
+/**
+ * Tap timing histogram
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+#include <limits.h>
+
+
+
+/// Number of the histogram buckets, the last one collects all the longer samples
+#define TAP_HIST_BUCKETS    32
+
+/// Width of a histogram bucket in ms
+#define TAP_HIST_BUCKET_MS  32
+
+/// Number of the samples at which all the buckets are halved - the older samples fade out
+#define TAP_HIST_DECAY_CNT  512
+
+
+
+/**
+ * Tap timing histogram class.
+ * 
+ * A streaming quantile sketch of tap timings (press durations, inter-tap gaps) in ms:
+ * fixed width buckets with an exponential decay, so the quantiles follow the recent samples.
+ * The quantiles are interpolated linearly within a bucket.
+ * Cheap enough to be updated from the ISR - Add() is in IRAM.
+ */
+class CTapHist
+{
+public:
+    CTapHist() { Clear(); }
+
+    /**
+     * Remove all the samples.
+     */
+    void Clear()
+    {
+        memset( m_arrBuckets, 0, sizeof( m_arrBuckets ));
+        m_nCnt = 0;
+    }
+
+    /**
+     * Add a sample.
+     * 
+     * @param[in]   a_nMs   Sample in ms
+     */
+    void IRAM_ATTR Add( ulong a_nMs )
+    {
+        m_arrBuckets[ min( a_nMs / TAP_HIST_BUCKET_MS, (ulong)( TAP_HIST_BUCKETS - 1 ))]++;
+        if( ++m_nCnt >= TAP_HIST_DECAY_CNT )
+        {
+            m_nCnt = 0;
+            for( uint16_t& rnBucket : m_arrBuckets )
+            {
+                rnBucket /= 2;
+                m_nCnt += rnBucket;
+            }
+        }
+    }
+
+    /**
+     * Get the number of the samples below the limit.
+     * 
+     * @param[in]   a_nLimitMs  Limit in ms - rounded up to the bucket width
+     * 
+     * @return  Sample cnt
+     */
+    uint16_t GetCnt( ulong a_nLimitMs = ULONG_MAX )
+    {
+        uint16_t nCnt = 0;
+        for( uint8_t nIdx = 0; nIdx < GetBuckets( a_nLimitMs ); nIdx++ )
+            nCnt += m_arrBuckets[ nIdx ];
+        return nCnt;
+    }
+
+    /**
+     * Get a quantile of the samples below the limit.
+     * 
+     * @param[in]   a_nPct      Quantile in percent
+     * @param[in]   a_nLimitMs  Limit in ms - rounded up to the bucket width
+     * 
+     * @return  Quantile in ms, 0 if no samples
+     */
+    uint16_t Quantile( uint8_t a_nPct, ulong a_nLimitMs = ULONG_MAX )
+    {
+        uint32_t nRank = ((uint32_t)GetCnt( a_nLimitMs ) * a_nPct + 99 ) / 100;  // 1-based rank of the sample
+        uint32_t nCum = 0;
+        for( uint8_t nIdx = 0; ( nRank ) && ( nIdx < GetBuckets( a_nLimitMs )); nIdx++ )
+        {
+            uint16_t nBucket = m_arrBuckets[ nIdx ];
+            if( nCum + nBucket >= nRank )
+                return nIdx * TAP_HIST_BUCKET_MS + ( nRank - nCum ) * TAP_HIST_BUCKET_MS / nBucket;
+            nCum += nBucket;
+        }
+        return 0;
+    }
+
+    /**
+     * Get a bucket.
+     * 
+     * @param[in]   a_nIdx  Bucket index - covers [a_nIdx * TAP_HIST_BUCKET_MS, (a_nIdx + 1) * TAP_HIST_BUCKET_MS) ms
+     * 
+     * @return  Sample cnt of the bucket
+     */
+    uint16_t GetBucket( uint8_t a_nIdx )
+    {
+        return m_arrBuckets[ a_nIdx ];
+    }
+
+private:
+    /**
+     * Get the number of the buckets below the limit.
+     */
+    static uint8_t GetBuckets( ulong a_nLimitMs )
+    {
+        return min( a_nLimitMs / TAP_HIST_BUCKET_MS + (( a_nLimitMs % TAP_HIST_BUCKET_MS ) ? 1 : 0 ), (ulong)TAP_HIST_BUCKETS );
+    }
+
+    uint16_t m_arrBuckets[ TAP_HIST_BUCKETS ];  ///< Sample cnts
+    uint16_t m_nCnt;                            ///< Total sample cnt
+};
@@ -11,7 +11,7 @@
 /**
  * Timer class.
  * 
- * Track the time passed between updates.
+ * Track the time passed between updates - usable from the ISR, in IRAM.
  */
 class CTimer
 {
@@ -24,7 +24,7 @@ public:
     /**
      * Update the current timestamp.
      */
-    void UpdateCur()
+    void IRAM_ATTR UpdateCur()
     {
         m_tmCur = millis();
         if( m_tmCur < m_tmLast )
@@ -48,7 +48,7 @@ public:
      * 
      * This resets the timer.
      */
-    void UpdateAll()
+    void IRAM_ATTR UpdateAll()
     {
         m_tmCur = m_tmLast = millis();
     }
@@ -56,7 +56,7 @@ public:
     /**
      * Calculate the time elapsed between the last expire time and last update of current timestamp.
      */
-    ulong Delta()
+    ulong IRAM_ATTR Delta()
     {
         return m_tmCur - m_tmLast;
     }
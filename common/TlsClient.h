@@ -0,0 +1,198 @@
+/**
+ * TLS client with session resumption
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+#include <WiFiClientSecure.h>
+#include "Crc32.h"
+#include "dbg.h"
+
+
+
+/// Default BearSSL receive buffer size - the max fragment length requested from the server
+#ifndef TLS_CLIENT_RX_BUF_LEN
+#define TLS_CLIENT_RX_BUF_LEN       1024
+#endif
+
+/// Default BearSSL transmit buffer size
+#ifndef TLS_CLIENT_TX_BUF_LEN
+#define TLS_CLIENT_TX_BUF_LEN       512
+#endif
+
+/// Size of the session cache record in the RTC memory - in 4-byte blocks
+#define TLS_CLIENT_RTC_BLOCKS       24
+
+
+
+/**
+ * TLS client class.
+ * 
+ * A BearSSL client with the session resumption: the session parameters negotiated by the last full handshake
+ * are cached in RAM and, optionally, in the RTC memory, so they survive a reset.
+ * A reconnect offers the cached session ID; if the server still knows the session, the handshake is resumed,
+ * i.e. the costly public key operations are skipped. BearSSL does not support session tickets.
+ * 
+ * The RTC record is tied to the server by the CRC seed, a different server invalidates the record.
+ * 
+ * The duration of the full and the resumed handshakes is tracked, see GetStats().
+ */
+class CTlsClient : public BearSSL::WiFiClientSecure
+{
+public:
+    CTlsClient()
+        : m_nRtcOffs( -1 ), m_bRtcLoaded( false ), m_nFullCnt( 0 ), m_nResumedCnt( 0 ), m_nFailCnt( 0 ),
+          m_nFullMs( 0 ), m_nResumedMs( 0 ), m_nFreeHeap( 0 )
+    {
+        setSession( &m_session );
+        setBufferSizes( TLS_CLIENT_RX_BUF_LEN, TLS_CLIENT_TX_BUF_LEN );
+    }
+
+    /**
+     * Enable the session cache in the RTC memory.
+     * 
+     * @param[in]   a_nOffs     Offset in the RTC user memory (4-byte blocks), TLS_CLIENT_RTC_BLOCKS are used.
+     */
+    void SetRtcCache( uint32_t a_nOffs )
+    {
+        m_nRtcOffs = a_nOffs;
+        m_bRtcLoaded = false;
+    }
+
+    using BearSSL::WiFiClientSecure::connect;
+
+    /**
+     * Connect to the server - a full or a resumed handshake.
+     * 
+     * The handshake is blocking, bounded by the stream timeout.
+     * 
+     * @param[in]   host    Server hostname or IP.
+     * @param[in]   port    Server port.
+     * 
+     * @return  1 if connected, 0 otherwise.
+     */
+    virtual int connect( const char* host, uint16_t port ) override
+    {
+        uint32_t nSeed = CCrc32::Calc( host, strlen( host ), port );
+        if(( m_nRtcOffs >= 0 ) && ( !m_bRtcLoaded ))
+        {
+            LoadRtc( nSeed );
+            m_bRtcLoaded = true;
+        }
+
+        br_ssl_session_parameters* pParams = GetParams();
+        uint8_t arrPrevId[ sizeof( pParams->session_id )];
+        uint8_t nPrevIdLen = pParams->session_id_len;
+        memcpy( arrPrevId, pParams->session_id, sizeof( arrPrevId ));
+
+        unsigned long nStart = millis();
+        int nRet = BearSSL::WiFiClientSecure::connect( host, port );
+        unsigned long nMs = millis() - nStart;
+        if( !nRet )
+        {
+            m_nFailCnt++;
+            DBGLOG2( "tls conn failed err:%d ms:%lu\n", getLastSSLError(), nMs );
+            return nRet;
+        }
+
+        m_nFreeHeap = ESP.getFreeHeap();
+        if(( nPrevIdLen ) && ( nPrevIdLen == pParams->session_id_len ) && ( !memcmp( arrPrevId, pParams->session_id, nPrevIdLen )))
+        {
+            m_nResumedCnt++;
+            m_nResumedMs = nMs;
+            DBGLOG2( "tls resumed ms:%lu heap:%u\n", nMs, m_nFreeHeap );
+        }
+        else
+        {
+            m_nFullCnt++;
+            m_nFullMs = nMs;
+            DBGLOG2( "tls full handshake ms:%lu heap:%u\n", nMs, m_nFreeHeap );
+            SaveRtc( nSeed );
+        }
+        return nRet;
+    }
+
+    /**
+     * Return the handshake statistics.
+     * 
+     * @return  full:<cnt>/<last ms> res:<cnt>/<last ms> fail:<cnt> heap:<free heap after the last handshake>
+     */
+    String GetStats()
+    {
+        char szStats[ 96 ];
+        snprintf( szStats, sizeof( szStats ), "full:%u/%lu res:%u/%lu fail:%u heap:%u",
+            m_nFullCnt, m_nFullMs, m_nResumedCnt, m_nResumedMs, m_nFailCnt, m_nFreeHeap );
+        return String( szStats );
+    }
+
+
+
+protected:
+    /**
+     * Session cache record in the RTC memory.
+     */
+    struct SRtcSession
+    {
+        uint32_t nCrc;                      ///< CRC of the session parameters, seeded with the server
+        br_ssl_session_parameters params;   ///< Session parameters
+    };
+    static_assert( sizeof( SRtcSession ) <= TLS_CLIENT_RTC_BLOCKS * 4, "Review TLS_CLIENT_RTC_BLOCKS" );
+    static_assert( sizeof( BearSSL::Session ) == sizeof( br_ssl_session_parameters ), "Review the BearSSL session" );
+
+    /**
+     * Return the parameters of the cached session.
+     * 
+     * BearSSL::Session only wraps the parameters, but does not expose them.
+     */
+    br_ssl_session_parameters* GetParams()
+    {
+        return reinterpret_cast< br_ssl_session_parameters* >( &m_session );
+    }
+
+    /**
+     * Restore the cached session from the RTC memory.
+     * 
+     * @param[in]   a_nSeed     CRC seed - identifies the server.
+     */
+    void LoadRtc( uint32_t a_nSeed )
+    {
+        uint32_t arrRec[ TLS_CLIENT_RTC_BLOCKS ];
+        SRtcSession* pRec = (SRtcSession*)arrRec;
+        if(( ESP.rtcUserMemoryRead( m_nRtcOffs, arrRec, sizeof( arrRec )))
+            && ( pRec->nCrc == CCrc32::Calc( &pRec->params, sizeof( pRec->params ), a_nSeed )))
+        {
+            memcpy( GetParams(), &pRec->params, sizeof( pRec->params ));
+            DBGLOG( "tls session restored" );
+        }
+    }
+
+    /**
+     * Store the cached session in the RTC memory.
+     * 
+     * @param[in]   a_nSeed     CRC seed - identifies the server.
+     */
+    void SaveRtc( uint32_t a_nSeed )
+    {
+        if( m_nRtcOffs < 0 )
+            return;
+
+        uint32_t arrRec[ TLS_CLIENT_RTC_BLOCKS ] = {};
+        SRtcSession* pRec = (SRtcSession*)arrRec;
+        memcpy( &pRec->params, GetParams(), sizeof( pRec->params ));
+        pRec->nCrc = CCrc32::Calc( &pRec->params, sizeof( pRec->params ), a_nSeed );
+        ESP.rtcUserMemoryWrite( m_nRtcOffs, arrRec, sizeof( arrRec ));
+    }
+
+
+
+    BearSSL::Session m_session; ///< Session cache in RAM
+    int16_t m_nRtcOffs;         ///< Session cache offset in the RTC memory, -1:disabled
+    bool m_bRtcLoaded;          ///< True if the RTC cache was read
+
+    uint16_t m_nFullCnt;        ///< Number of full handshakes
+    uint16_t m_nResumedCnt;     ///< Number of resumed handshakes
+    uint16_t m_nFailCnt;        ///< Number of failed connections
+    unsigned long m_nFullMs;    ///< Duration of the last full handshake (ms)
+    unsigned long m_nResumedMs; ///< Duration of the last resumed handshake (ms)
+    uint32_t m_nFreeHeap;       ///< Free heap after the last handshake
+};
@@ -5,6 +5,37 @@
 #pragma once
 #include <Arduino.h>
 #include "Timer.h"
+#include "InputTrace.h"
+#include "TapHist.h"
+#include "Gestures.h"
+
+
+
+/// Quantile of the learned timings the thresholds are derived from, in percent
+#define TOUCH_TUNE_PCT          95
+
+/// Next tap delay margin over the gap quantile, in percent
+#define TOUCH_TUNE_NEXT_MARGIN  125
+
+/// Long tap duration margin over the short press duration quantile, in percent
+#define TOUCH_TUNE_LONG_MARGIN  150
+
+/// Min number of the samples to tune a threshold
+#define TOUCH_TUNE_MIN_CNT      16
+
+
+
+/// Gesture event: short tap(s) - OnShortTap()
+#define TOUCH_GESTURE_SHORT     0
+
+/// Gesture event: long tap - OnLongTap()
+#define TOUCH_GESTURE_LONG      1
+
+/// First custom gesture event - OnGesture()
+#define TOUCH_GESTURE_CUSTOM    2
+
+/// Max number of the gesture events recognized between two loop() calls
+#define TOUCH_GESTURE_QUEUE     2
 
 
 
@@ -22,11 +53,87 @@
  *    and no more than a configured next tap duration apart from the last one.
  * 2. Single long tap - lasting for at least a configured long tap duraction.
  * See the state machine diagram for details - TouchBtn.png
+ * 
+ * The taps are classified by a gesture automaton (CGestures): every release steps it with a short/long tap,
+ * the next tap timeout accepts the gesture reached. The patterns above are always compiled: "s", "ss+" and "l";
+ * custom gestures are added with the events from TOUCH_GESTURE_CUSTOM, e.g. "sss", "sl", "h". A custom short tap pattern
+ * takes its tap count over from "ss+", e.g. with "sss" the multi tap is reported for 2, 4 and more taps.
+ * - A gesture no other gesture continues is reported on release - without waiting for the next tap.
+ * - A long press in a sequence no gesture continues with a long tap counts as a short one, as in 1.
+ * - A tap no gesture continues with ends the sequence: the gesture reached so far is reported, and the tap
+ *   starts a new sequence.
+ * - A hold gesture is reported once the press lasts for the long tap duration, then every hold ms while held;
+ *   the press does not count as a tap then.
+ * The gestures are reported from loop(), the taps are classified in the ISR - the methods it calls are IRAM_ATTR.
+ * 
+ * The press durations and the release to the next press gaps are collected in histograms.
+ * With the auto tuning enabled, the thresholds follow the learned timings within the configured bounds:
+ * - next tap delay: TOUCH_TUNE_PCT quantile of the gaps shorter than the max bound, plus TOUCH_TUNE_NEXT_MARGIN,
+ *   i.e. the shortest window still separating the real multi taps - a single tap is reported that much sooner,
+ * - long tap duration: TOUCH_TUNE_PCT quantile of the short presses, plus TOUCH_TUNE_LONG_MARGIN.
+ * The thresholds are tuned in loop() when the button is idle.
  */
 class CTouchBtn
 {
 public:
-    CTouchBtn() { m_state = EState::eDisabled; }
+    CTouchBtn() : m_nHoldMs( 0 ), m_nNode( GESTURE_ROOT ), m_nHoldCnt( 0 ), m_nFireCnt( 0 ),
+        m_pTrace( nullptr ), m_nTraceChan( 0 ), m_bTune( false ), m_bTuneDue( false ), m_bGapValid( false ),
+        m_nLongMinMs( 0 ), m_nLongMaxMs( 0 ), m_nNextMinMs( 0 ), m_nNextMaxMs( 0 )
+    {
+        m_state = EState::eDisabled;
+        ResetGestures();
+    }
+
+    virtual ~CTouchBtn() {}
+
+    /**
+     * Reset the gesture automaton to the short/multi/long tap gestures.
+     */
+    void ResetGestures()
+    {
+        InitGestures( m_gestures );
+    }
+
+    /**
+     * Reset a gesture automaton to the short/multi/long tap gestures, e.g. to validate the custom ones.
+     */
+    static void InitGestures( CGestures& a_rGestures )
+    {
+        a_rGestures.Clear();
+        a_rGestures.Add( "s", TOUCH_GESTURE_SHORT );
+        a_rGestures.Add( "ss+", TOUCH_GESTURE_SHORT );
+        a_rGestures.Add( "l", TOUCH_GESTURE_LONG );
+    }
+
+    /**
+     * Get the gesture automaton - to add the custom gestures.
+     */
+    CGestures& GetGestures()
+    {
+        return m_gestures;
+    }
+
+    /**
+     * Set the hold gesture repeat period.
+     * 
+     * @param[in]   a_nHoldMs   Repeat period in ms, 0:no repeat
+     */
+    void SetHoldMs( uint16_t a_nHoldMs )
+    {
+        m_nHoldMs = a_nHoldMs;
+    }
+
+    /**
+     * Record the input edges and the classified taps.
+     * 
+     * @param[in]   a_pTrace    Input trace, nullptr:disabled
+     * @param[in]   a_nChan     Channel number stored in the trace records
+     */
+    void SetTrace( CInputTrace* a_pTrace, uint8_t a_nChan )
+    {
+        m_pTrace = a_pTrace;
+        m_nTraceChan = a_nChan;
+    }
 
     /**
      * Enable the touch button.
@@ -71,11 +178,79 @@ public:
         return m_state != EState::eDisabled;
     }
 
+    /**
+     * Enable/disable the auto tuning of the thresholds.
+     * 
+     * @param[in]   a_bEnable       True to enable
+     * @param[in]   a_nLongMinMs    Min long tap duration
+     * @param[in]   a_nLongMaxMs    Max long tap duration
+     * @param[in]   a_nNextMinMs    Min next tap delay
+     * @param[in]   a_nNextMaxMs    Max next tap delay - the gaps are learned up to this delay
+     */
+    void SetAutoTune( bool a_bEnable, uint16_t a_nLongMinMs, uint16_t a_nLongMaxMs, uint16_t a_nNextMinMs, uint16_t a_nNextMaxMs )
+    {
+        m_bTune = a_bEnable;
+        m_nLongMinMs = a_nLongMinMs;
+        m_nLongMaxMs = max( a_nLongMinMs, a_nLongMaxMs );
+        m_nNextMinMs = a_nNextMinMs;
+        m_nNextMaxMs = max( a_nNextMinMs, a_nNextMaxMs );
+    }
+
+    /**
+     * Check if the auto tuning is enabled.
+     */
+    bool IsAutoTune()
+    {
+        return m_bTune;
+    }
+
+    /**
+     * Get the auto tuning max next tap delay in ms - the limit of the learned gaps.
+     */
+    uint16_t GetNextMaxMs()
+    {
+        return m_nNextMaxMs;
+    }
+
+    /**
+     * Get the press duration histogram.
+     */
+    CTapHist& GetPressHist()
+    {
+        return m_histPress;
+    }
+
+    /**
+     * Get the release to the next press gap histogram.
+     */
+    CTapHist& GetGapHist()
+    {
+        return m_histGap;
+    }
+
+    /**
+     * Get the current long tap duration in ms.
+     */
+    uint16_t GetLongTapMs()
+    {
+        return m_nLongTapMs;
+    }
+
+    /**
+     * Get the current next tap maximum delay in ms.
+     */
+    uint16_t GetNextTapMs()
+    {
+        return m_nNextTapMs;
+    }
+
     /**
      * Main loop function.
      * 
-     * Track the time passed since the last short tap finished.
-     * Execute OnShortTap(tap cnt) callback when time threshold exceeded for a multi tap pattern.
+     * Track the time passed since the last tap finished - accept the gesture reached when the next tap
+     * time threshold is exceeded.
+     * Track the duration of the press - fire the hold gesture.
+     * Report the recognized gestures.
      */
     void loop()
     {
@@ -86,66 +261,211 @@ public:
             ulong nPressDuration = m_tmPress.Delta();
             if( nPressDuration >= m_nNextTapMs )
             {
-                OnShortTap( m_nPressCnt );
-                // SetStateIdle();
+                Accept();
             }
         }
+        else if(( m_state == EState::eBtnPressed ) && ( m_nLongTapMs ) && ( m_gestures.GetHold( m_nNode ) != GESTURE_NONE ))
+        {
+            m_tmPress.UpdateCur();
+            ulong nPressDuration = m_tmPress.Delta();
+            if(( nPressDuration >= m_nLongTapMs + (ulong)m_nHoldCnt * m_nHoldMs ) && (( !m_nHoldCnt ) || ( m_nHoldMs )))
+            {
+                Fire( m_gestures.GetHold( m_nNode ), ++m_nHoldCnt );
+            }
+        }
+        for( uint8_t nIdx = 0; nIdx < m_nFireCnt; nIdx++ )
+        {
+            Dispatch( m_arrFire[ nIdx ].nEvent, m_arrFire[ nIdx ].nCnt );
+        }
+        m_nFireCnt = 0;
+        if(( m_bTuneDue ) && ( m_state == EState::eIdle ))
+        {
+            Tune();
+        }
         interrupts();
     }
 
     /**
      * Short tap callback.
      * 
-     * Set the state back to idle.
-     * 
      * @param[in]   a_nCnt  The number of subsequent short taps.
      */
     virtual void OnShortTap( uint16_t a_nCnt )
     {
-        SetStateIdle();
     }
 
     /**
      * Long tap callback.
-     * 
-     * Set the state back to idle.
      */
     virtual void OnLongTap()
     {
-        SetStateIdle();
+    }
+
+    /**
+     * Custom gesture callback.
+     * 
+     * @param[in]   a_nEvent    Gesture event - TOUCH_GESTURE_CUSTOM and above.
+     * @param[in]   a_nCnt      The number of the taps of the gesture, the repeat number of a hold gesture.
+     */
+    virtual void OnGesture( uint8_t a_nEvent, uint16_t a_nCnt )
+    {
     }
 
 protected:
     /**
-     * Set the state to idle.
-     * Reset the tap counter.
+     * Tune the thresholds from the learned timings if enabled.
+     * 
+     * A disabled (0) threshold is not tuned.
      */
-    void SetStateIdle()
+    void Tune()
     {
-        m_state = EState::eIdle;
-        m_nPressCnt = 0;
+        m_bTuneDue = false;
+        if( !m_bTune )
+            return;
+        if(( m_nNextTapMs ) && ( m_histGap.GetCnt( m_nNextMaxMs ) >= TOUCH_TUNE_MIN_CNT ))
+        {
+            ulong nMs = (ulong)m_histGap.Quantile( TOUCH_TUNE_PCT, m_nNextMaxMs ) * TOUCH_TUNE_NEXT_MARGIN / 100;
+            m_nNextTapMs = constrain( nMs, m_nNextMinMs, m_nNextMaxMs );
+        }
+        if(( m_nLongTapMs ) && ( m_histPress.GetCnt( m_nLongTapMs ) >= TOUCH_TUNE_MIN_CNT ))
+        {
+            ulong nMs = (ulong)m_histPress.Quantile( TOUCH_TUNE_PCT, m_nLongTapMs ) * TOUCH_TUNE_LONG_MARGIN / 100;
+            m_nLongTapMs = constrain( nMs, m_nLongMinMs, m_nLongMaxMs );
+        }
     }
 
     /**
-     * Set the state to button pressed.
-     * Update the timestamp to track the duration of the tap.
+     * Learn the gap since the last short tap release.
+     * 
+     * Note m_tmPress holds the release time until the next press.
      */
-    void SetStateBtnPressed()
+    void IRAM_ATTR LearnGap()
     {
-        m_state = EState::eBtnPressed;
-        m_tmPress.UpdateAll();
+        if( !m_bGapValid )
+            return;
+        m_tmPress.UpdateCur();
+        m_histGap.Add( m_tmPress.Delta());
+        m_bGapValid = false;
+        m_bTuneDue = true;
+    }
+
+    /**
+     * Queue a recognized gesture to be reported from loop().
+     * 
+     * @param[in]   a_nEvent    Gesture event
+     * @param[in]   a_nCnt      Tap cnt/hold repeat number
+     */
+    void IRAM_ATTR Fire( uint8_t a_nEvent, uint16_t a_nCnt )
+    {
+        if( m_nFireCnt < TOUCH_GESTURE_QUEUE )
+        {
+            m_arrFire[ m_nFireCnt ].nEvent = a_nEvent;
+            m_arrFire[ m_nFireCnt ].nCnt = a_nCnt;
+            m_nFireCnt++;
+        }
+    }
+
+    /**
+     * Report a recognized gesture: record it in the trace, execute the callback.
+     * 
+     * @param[in]   a_nEvent    Gesture event
+     * @param[in]   a_nCnt      Tap cnt/hold repeat number
+     */
+    void Dispatch( uint8_t a_nEvent, uint16_t a_nCnt )
+    {
+        switch( a_nEvent )
+        {
+            case TOUCH_GESTURE_SHORT:
+                if( m_pTrace )
+                    m_pTrace->Add( CInputTrace::EType::eShortTap, m_nTraceChan, a_nCnt );
+                OnShortTap( a_nCnt );
+                break;
+
+            case TOUCH_GESTURE_LONG:
+                if( m_pTrace )
+                    m_pTrace->Add( CInputTrace::EType::eLongTap, m_nTraceChan );
+                OnLongTap();
+                break;
+
+            default:
+                if( m_pTrace )
+                    m_pTrace->Add( CInputTrace::EType::eGesture, m_nTraceChan, a_nEvent );
+                OnGesture( a_nEvent, a_nCnt );
+                break;
+        }
+    }
+
+    /**
+     * Accept the gesture reached, if any, and set the state to idle.
+     */
+    void IRAM_ATTR Accept()
+    {
+        uint8_t nEvent = m_gestures.GetAccept( m_nNode );
+        if( nEvent != GESTURE_NONE )
+        {
+            Fire( nEvent, m_nPressCnt );
+        }
+        SetStateIdle();
     }
 
     /**
-     * Set the state to button released.
-     * Increase the tap counter.
-     * Update the timestamp to track the multitap sequence.
+     * Step the gesture automaton with a tap.
+     * 
+     * @param[in]   a_elem  Short/long tap
      */
-    void SetStateBtnReleased()
+    void IRAM_ATTR Step( CGestures::EElem a_elem )
     {
-        m_state = EState::eBtnReleased;
+        uint8_t nNext = m_gestures.Next( m_nNode, a_elem );
+        if(( nNext == GESTURE_NONE ) && ( m_nNode != GESTURE_ROOT ) && ( a_elem == CGestures::eLong ))
+        {
+            nNext = m_gestures.Next( m_nNode, CGestures::eShort );  // counts as a short tap within a sequence
+        }
+        if(( nNext == GESTURE_NONE ) && ( m_nNode != GESTURE_ROOT ))
+        {
+            // The sequence ends - the tap starts a new one:
+            Accept();
+            nNext = m_gestures.Next( GESTURE_ROOT, a_elem );
+        }
+
+        m_tmPress.UpdateAll();  // release time
+        m_bGapValid = a_elem == CGestures::eShort;
+        if( nNext == GESTURE_NONE )
+        {
+            SetStateIdle();
+            return;
+        }
+        m_nNode = nNext;
         m_nPressCnt++;
+        if( m_gestures.IsLeaf( m_nNode ))
+        {
+            Accept();
+        }
+        else
+        {
+            m_state = EState::eBtnReleased;
+        }
+    }
+
+    /**
+     * Set the state to idle.
+     * Reset the tap counter and the gesture automaton.
+     */
+    void IRAM_ATTR SetStateIdle()
+    {
+        m_state = EState::eIdle;
+        m_nPressCnt = 0;
+        m_nNode = GESTURE_ROOT;
+    }
+
+    /**
+     * Set the state to button pressed.
+     * Update the timestamp to track the duration of the tap.
+     */
+    void IRAM_ATTR SetStateBtnPressed()
+    {
+        m_state = EState::eBtnPressed;
         m_tmPress.UpdateAll();
+        m_nHoldCnt = 0;
     }
 
     /**
@@ -153,15 +473,21 @@ protected:
      * 
      * Invoked whenever the logical state changes.
      * The input must be debounced.
+     * Stays armed while the flash cache is off (an OTA sector erase/write), so the whole call chain is IRAM_ATTR.
      */
-    void OnIsr()
+    void IRAM_ATTR OnIsr()
     {
         EPinState nPin = (EPinState)digitalRead( m_nPin );
+        if( m_pTrace )
+            m_pTrace->Add(( nPin == EPinState::eBtnPress ) ? CInputTrace::EType::eRise : CInputTrace::EType::eFall, m_nTraceChan );
         switch( m_state )
         {
             case EState::eIdle:
                 if( nPin == EPinState::eBtnPress )
+                {
+                    LearnGap();
                     SetStateBtnPressed();
+                }
                 break;
 
             case EState::eBtnPressed:
@@ -169,15 +495,16 @@ protected:
                 {
                     m_tmPress.UpdateCur();
                     ulong nPressDuration = m_tmPress.Delta();
-                    if(( m_nPressCnt > 0 ) || ( nPressDuration < m_nLongTapMs ) || ( m_nLongTapMs == 0 ))
+                    m_histPress.Add( nPressDuration );
+                    m_bTuneDue = true;
+                    if( m_nHoldCnt )
                     {
-                        SetStateBtnReleased();
-                        // for m_nLongTapMs == 0 case, the OnShortTap() will be called from within loop()
+                        SetStateIdle();     // the press was a hold gesture
                     }
-                    else if(( m_nPressCnt == 0 ) && ( nPressDuration >= m_nLongTapMs ))
+                    else
                     {
-                        OnLongTap();
-                        // SetStateIdle();
+                        // for m_nLongTapMs == 0 case, all the taps are short:
+                        Step((( m_nLongTapMs ) && ( nPressDuration >= m_nLongTapMs )) ? CGestures::eLong : CGestures::eShort );
                     }
                 }
                 break;
@@ -187,8 +514,12 @@ protected:
                 {
                     m_tmPress.UpdateCur();
                     ulong nPressDuration = m_tmPress.Delta();
-                    if( nPressDuration < m_nNextTapMs )
-                        SetStateBtnPressed();
+                    if( nPressDuration >= m_nNextTapMs )
+                    {
+                        Accept();   // loop() has not caught the timeout yet
+                    }
+                    LearnGap();
+                    SetStateBtnPressed();
                 }
                 break;
 
@@ -231,4 +562,33 @@ protected:
     uint16_t m_nNextTapMs;  ///< The maximum time for the next tap in a multitap sequence
     uint16_t m_nPressCnt;   ///< The tap counter in a multitap sequence
     CTimer m_tmPress;       ///< Timer for long/multi tap
+
+    CGestures m_gestures;   ///< Gesture automaton
+    uint16_t m_nHoldMs;     ///< Hold gesture repeat period in ms, 0:no repeat
+    uint8_t m_nNode;        ///< Current node of the gesture automaton
+    uint16_t m_nHoldCnt;    ///< Hold gesture repeats fired during the current press
+
+    /**
+     * Recognized gesture to be reported.
+     */
+    struct SFire
+    {
+        uint8_t nEvent;     ///< Gesture event
+        uint16_t nCnt;      ///< Tap cnt/hold repeat number
+    };
+    SFire m_arrFire[ TOUCH_GESTURE_QUEUE ];     ///< Gestures to be reported from loop()
+    uint8_t m_nFireCnt;     ///< Number of the gestures to be reported
+
+    CInputTrace* m_pTrace;  ///< Input trace, nullptr:disabled
+    uint8_t m_nTraceChan;   ///< Channel number stored in the trace records
+
+    CTapHist m_histPress;   ///< Press durations
+    CTapHist m_histGap;     ///< Short tap release to the next press gaps
+    bool m_bTune;           ///< Auto tuning enabled
+    bool m_bTuneDue;        ///< New samples learned since the last tuning
+    bool m_bGapValid;       ///< m_tmPress holds a short tap release time
+    uint16_t m_nLongMinMs;  ///< Auto tuning min long tap duration
+    uint16_t m_nLongMaxMs;  ///< Auto tuning max long tap duration
+    uint16_t m_nNextMinMs;  ///< Auto tuning min next tap delay
+    uint16_t m_nNextMaxMs;  ///< Auto tuning max next tap delay
 };
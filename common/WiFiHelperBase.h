@@ -35,6 +35,7 @@ public:
             [ this ]( const WiFiEventStationModeConnected& arg )
             {
                 DBGLOG1( "Wifi connected: %lu\n", m_tm.Delta());
+                OnAssoc();
             });
         m_evtDisconn = WiFi.onStationModeDisconnected(
             [ this ]( const WiFiEventStationModeDisconnected& arg )
@@ -78,6 +79,11 @@ public:
         WiFi.begin( a_pszSsid, a_pszPwd );
     }
 
+    /**
+     * WIFI associated callback - the IP is not set yet
+     */
+    virtual void OnAssoc() {}
+
     /**
      * WIFI connected callback
      */
@@ -88,6 +94,11 @@ public:
      */
     virtual void OnDisconnect() {}
 
+    /**
+     * WIFI connection timeout callback - called before the MCU reset
+     */
+    virtual void OnConnTimeout() {}
+
     /**
      * Test for the WIFI connection, track connection timeout and issue MCU reset
      * 
@@ -106,6 +117,7 @@ public:
             if(( m_nConnTimeout ) && ( m_tm.Delta() > m_nConnTimeout ))
             {
                 DBGLOG1( "Wifi retry failed for %lu - issue reset\n", m_tm.Delta());
+                OnConnTimeout();
                 ESP.reset();
             }
         }
@@ -0,0 +1,66 @@
+/**
+ * Host-native Arduino shim
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <algorithm>
+#include <functional>
+#include <string>
+
+typedef uint8_t byte;
+typedef bool boolean;
+typedef unsigned long ulong;
+
+using std::min;
+using std::max;
+
+template< typename T, typename L, typename H >
+inline T constrain( T a_x, L a_lo, H a_hi ) { return ( a_x < a_lo ) ? a_lo : (( a_x > a_hi ) ? a_hi : a_x ); }
+
+#define HIGH        1
+#define LOW         0
+#define INPUT       0
+#define OUTPUT      1
+#define CHANGE      3
+
+#define D0  16
+#define D1  5
+#define D2  4
+#define D3  0
+#define D4  2
+#define D5  14
+#define D6  12
+#define D7  13
+#define D8  15
+
+#define IRAM_ATTR
+#define ICACHE_RAM_ATTR
+#define PROGMEM
+#define PSTR( s )   ( s )
+#define F( s )      ( s )
+
+unsigned long millis();
+unsigned long micros();
+void delay( unsigned long a_nMs );
+void yield();
+void pinMode( uint8_t a_nPin, uint8_t a_nMode );
+int digitalRead( uint8_t a_nPin );
+void digitalWrite( uint8_t a_nPin, uint8_t a_nVal );
+inline int digitalPinToInterrupt( int a_nPin ) { return a_nPin; }
+void attachInterruptArg( uint8_t a_nPin, void (*a_fnIsr)( void* ), void* a_pArg, int a_nMode );
+void detachInterrupt( uint8_t a_nPin );
+void noInterrupts();
+void interrupts();
+inline uint32_t xt_rsil( uint32_t a_nLevel ) { return 0; }   // no interrupt levels on the host
+inline void xt_wsr_ps( uint32_t a_nPs ) {}
+
+#include "WString.h"
+#include "Print.h"
+#include "Esp.h"
@@ -0,0 +1,57 @@
+/**
+ * Host-native Arduino shim - ESP8266WiFi
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+#include <memory>
+#include <vector>
+#include "IPAddress.h"
+#include "WiFiClient.h"
+#include "WiFiServer.h"
+
+#define WIFI_STA    1
+
+struct WiFiEventStationModeConnected {};
+struct WiFiEventStationModeDisconnected {};
+struct WiFiEventStationModeGotIP {};
+
+typedef std::shared_ptr< void > WiFiEventHandler;
+
+/**
+ * ESP8266 WiFi class subset.
+ * 
+ * The station connects instantly: begin() fires the connected and got-ip events,
+ * disconnect() fires the disconnected event if connected.
+ */
+class ESP8266WiFiClass
+{
+public:
+    WiFiEventHandler onStationModeConnected( std::function< void( const WiFiEventStationModeConnected& )> a_fn );
+    WiFiEventHandler onStationModeDisconnected( std::function< void( const WiFiEventStationModeDisconnected& )> a_fn );
+    WiFiEventHandler onStationModeGotIP( std::function< void( const WiFiEventStationModeGotIP& )> a_fn );
+    WiFiEventHandler onStationModeDHCPTimeout( std::function< void()> a_fn );
+
+    bool mode( int ) { return true; }
+    bool disconnect( bool a_bWifiOff = false );
+    bool hostname( const char* a_pszHostname ) { m_strHostname = a_pszHostname; return true; }
+    String hostname() { return m_strHostname; }
+    int begin( const char* a_pszSsid, const char* a_pszPwd );
+    IPAddress localIP() { return m_ip; }
+    String macAddress() { return m_strMac; }
+    int32_t RSSI() { return m_nRssi; }
+
+    IPAddress m_ip = IPAddress( 127, 0, 0, 1 );     ///< Host IP reported to the FW
+    String m_strMac = "de:ad:be:ef:00:01";          ///< Host MAC reported to the FW
+    int32_t m_nRssi = -60;                          ///< Host RSSI reported to the FW
+    std::function< void()> m_fnOnDisconnect;        ///< Called on a disconnect before the event, e.g. to drop the connections
+
+private:
+    String m_strHostname;
+    bool m_bConnected = false;
+    std::function< void( const WiFiEventStationModeConnected& )> m_fnConn;
+    std::function< void( const WiFiEventStationModeDisconnected& )> m_fnDisconn;
+    std::function< void( const WiFiEventStationModeGotIP& )> m_fnGotIp;
+    std::function< void()> m_fnDhcpTimeout;
+};
+extern ESP8266WiFiClass WiFi;
@@ -0,0 +1,18 @@
+/**
+ * Host-native Arduino shim - ESP8266mDNS
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+
+/**
+ * mDNS responder stub - the host resolves the simulated devices by IP only.
+ */
+class MDNSResponder
+{
+public:
+    bool begin( const char* a_pszHostname ) { return true; }
+    bool enableArduino( uint16_t a_nPort, bool a_bAuthUpload = false ) { return true; }
+    bool update() { return true; }
+};
+extern MDNSResponder MDNS;
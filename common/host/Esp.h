@@ -0,0 +1,82 @@
+/**
+ * Host-native Arduino shim - ESP class
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <stdint.h>
+
+/// Host RTC user memory size in bytes - same as ESP8266
+#define HOST_RTC_USER_MEM_SIZE  512
+
+/// Host flash size in bytes - same as ESP-12E
+#define HOST_FLASH_SIZE         ( 4 * 1024 * 1024 )
+
+/// Flash sector size - same as ESP8266
+#define FLASH_SECTOR_SIZE       4096
+
+/// Host RTC user memory - mapped at RTC_USER_MEM as on ESP8266
+extern uint32_t g_arrHostRtcMem[ HOST_RTC_USER_MEM_SIZE / 4 ];
+
+/// RTC user memory - same as ESP8266
+#define RTC_USER_MEM            g_arrHostRtcMem
+
+/**
+ * Reset reasons - same as ESP8266.
+ */
+enum rst_reason
+{
+    REASON_DEFAULT_RST = 0,
+    REASON_WDT_RST,
+    REASON_EXCEPTION_RST,
+    REASON_SOFT_WDT_RST,
+    REASON_SOFT_RESTART,
+    REASON_DEEP_SLEEP_AWAKE,
+    REASON_EXT_SYS_RST
+};
+
+/**
+ * Reset info - same as ESP8266.
+ */
+struct rst_info
+{
+    uint32_t reason;
+    uint32_t exccause;
+    uint32_t epc1;
+    uint32_t epc2;
+    uint32_t epc3;
+    uint32_t excvaddr;
+    uint32_t depc;
+};
+
+/**
+ * ESP8266 ESP class subset.
+ * 
+ * The reset is reported to the host via a callback, by default the process exits.
+ * The flash is kept in RAM, erased at start. The running sketch is the first m_nSketchSize bytes of it.
+ * The RTC user memory persists for the process lifetime, the reset info is set by the host.
+ */
+class EspClass
+{
+public:
+    void reset();
+    void restart() { reset(); }
+    uint32_t getFreeHeap() { return 40 * 1024; }
+    uint32_t getMaxFreeBlockSize() { return 32 * 1024; }
+    uint8_t getHeapFragmentation() { return 0; }
+    uint32_t getChipId() { return 0x00c0ffee; }
+    uint32_t getCycleCount();
+    uint8_t getCpuFreqMHz() { return 80; }
+    bool rtcUserMemoryRead( uint32_t a_nOffset, uint32_t* a_pData, size_t a_nSize );
+    bool rtcUserMemoryWrite( uint32_t a_nOffset, uint32_t* a_pData, size_t a_nSize );
+    rst_info* getResetInfoPtr() { return &m_rstInfo; }
+    uint32_t getSketchSize() { return m_nSketchSize; }
+    bool flashEraseSector( uint32_t a_nSector );
+    bool flashWrite( uint32_t a_nAddr, const uint32_t* a_pData, size_t a_nSize );
+    bool flashRead( uint32_t a_nAddr, uint32_t* a_pData, size_t a_nSize ) { return flashRead( a_nAddr, (uint8_t*)a_pData, a_nSize ); }
+    bool flashRead( uint32_t a_nAddr, uint8_t* a_pData, size_t a_nSize );
+
+    std::function< void()> m_fnOnReset; ///< Host reset handler
+    uint32_t m_nSketchSize = 0;         ///< Host running sketch size
+    rst_info m_rstInfo = {};            ///< Host reset info - power on unless set
+};
+extern EspClass ESP;
@@ -0,0 +1,219 @@
+/**
+ * Host-native Arduino shim - core functions
+ * 2022 Łukasz Łasek
+ */
+#include <Arduino.h>
+#include <HostSim.h>
+#include <chrono>
+#include <vector>
+#include <thread>
+
+HardwareSerial Serial;
+EspClass ESP;
+
+CHostGpio::OutputCb CHostGpio::Sm_fnOnOutput;
+
+/**
+ * GPIO bank - the pins of one simulated device.
+ */
+struct SGpioBank
+{
+    uint8_t arrPinVal[ HOST_GPIO_PINS ];        ///< Pin levels
+    uint8_t arrPinMode[ HOST_GPIO_PINS ];       ///< Pin modes
+    void (*arrIsr[ HOST_GPIO_PINS ])( void* );  ///< Pin ISRs
+    void* arrIsrArg[ HOST_GPIO_PINS ];          ///< Pin ISR args
+};
+
+static std::vector< SGpioBank > Sg_vecBanks( 1 );       // GPIO banks
+static uint16_t Sg_nBank = 0;                           // Current GPIO bank
+static SGpioBank* Sg_pBank = &Sg_vecBanks[ 0 ];         // Current GPIO bank
+uint32_t g_arrHostRtcMem[ HOST_RTC_USER_MEM_SIZE / 4 ];     // RTC user memory
+static bool Sg_bVirtualClock = false;                   // Virtual clock in use
+static uint64_t Sg_nVirtualUs = 0;                      // Virtual clock
+static auto Sg_tmStart = std::chrono::steady_clock::now();  // Real clock start
+
+void CHostClock::SetVirtual( uint64_t a_nStartUs )
+{
+    Sg_bVirtualClock = true;
+    Sg_nVirtualUs = a_nStartUs;
+}
+
+bool CHostClock::IsVirtual()
+{
+    return Sg_bVirtualClock;
+}
+
+void CHostClock::Advance( uint64_t a_nUs )
+{
+    Sg_nVirtualUs += a_nUs;
+}
+
+uint64_t CHostClock::Micros()
+{
+    if( Sg_bVirtualClock )
+        return Sg_nVirtualUs;
+
+    return std::chrono::duration_cast< std::chrono::microseconds >( std::chrono::steady_clock::now() - Sg_tmStart ).count();
+}
+
+void CHostGpio::SetBank( uint16_t a_nBank )
+{
+    if( a_nBank >= Sg_vecBanks.size())
+        Sg_vecBanks.resize( a_nBank + 1 );
+    Sg_nBank = a_nBank;
+    Sg_pBank = &Sg_vecBanks[ a_nBank ];
+}
+
+uint16_t CHostGpio::GetBank()
+{
+    return Sg_nBank;
+}
+
+void CHostGpio::SetInput( uint8_t a_nPin, uint8_t a_nVal )
+{
+    if(( a_nPin >= HOST_GPIO_PINS ) || ( Sg_pBank->arrPinVal[ a_nPin ] == a_nVal ))
+        return;
+    Sg_pBank->arrPinVal[ a_nPin ] = a_nVal;
+    if( Sg_pBank->arrIsr[ a_nPin ])
+        Sg_pBank->arrIsr[ a_nPin ]( Sg_pBank->arrIsrArg[ a_nPin ]);
+}
+
+uint8_t CHostGpio::Get( uint8_t a_nPin )
+{
+    return ( a_nPin < HOST_GPIO_PINS ) ? Sg_pBank->arrPinVal[ a_nPin ] : LOW;
+}
+
+unsigned long millis()
+{
+    return CHostClock::Micros() / 1000;
+}
+
+unsigned long micros()
+{
+    return CHostClock::Micros();
+}
+
+void delay( unsigned long a_nMs )
+{
+    if( CHostClock::IsVirtual())
+        CHostClock::Advance((uint64_t)a_nMs * 1000 );
+    else
+        std::this_thread::sleep_for( std::chrono::milliseconds( a_nMs ));
+}
+
+void yield()
+{
+}
+
+void pinMode( uint8_t a_nPin, uint8_t a_nMode )
+{
+    if( a_nPin < HOST_GPIO_PINS )
+        Sg_pBank->arrPinMode[ a_nPin ] = a_nMode;
+}
+
+int digitalRead( uint8_t a_nPin )
+{
+    return ( a_nPin < HOST_GPIO_PINS ) ? Sg_pBank->arrPinVal[ a_nPin ] : LOW;
+}
+
+void digitalWrite( uint8_t a_nPin, uint8_t a_nVal )
+{
+    if(( a_nPin >= HOST_GPIO_PINS ) || ( Sg_pBank->arrPinMode[ a_nPin ] != OUTPUT ))
+        return;
+    a_nVal = ( a_nVal ) ? HIGH : LOW;
+    if( Sg_pBank->arrPinVal[ a_nPin ] == a_nVal )
+        return;
+    Sg_pBank->arrPinVal[ a_nPin ] = a_nVal;
+    if( CHostGpio::Sm_fnOnOutput )
+        CHostGpio::Sm_fnOnOutput( a_nPin, a_nVal );
+}
+
+void attachInterruptArg( uint8_t a_nPin, void (*a_fnIsr)( void* ), void* a_pArg, int a_nMode )
+{
+    if( a_nPin < HOST_GPIO_PINS )
+    {
+        Sg_pBank->arrIsr[ a_nPin ] = a_fnIsr;
+        Sg_pBank->arrIsrArg[ a_nPin ] = a_pArg;
+    }
+}
+
+void detachInterrupt( uint8_t a_nPin )
+{
+    if( a_nPin < HOST_GPIO_PINS )
+        Sg_pBank->arrIsr[ a_nPin ] = nullptr;
+}
+
+void noInterrupts()
+{
+}
+
+void interrupts()
+{
+}
+
+void EspClass::reset()
+{
+    if( m_fnOnReset )
+        m_fnOnReset();
+    exit( 0 );
+}
+
+uint32_t EspClass::getCycleCount()
+{
+    // 80 MHz - the real clock gives the cycle resolution:
+    if( CHostClock::IsVirtual())
+        return (uint32_t)( micros() * 80 );
+    return (uint32_t)( std::chrono::duration_cast< std::chrono::nanoseconds >( std::chrono::steady_clock::now() - Sg_tmStart ).count() * 80 / 1000 );
+}
+
+bool EspClass::rtcUserMemoryRead( uint32_t a_nOffset, uint32_t* a_pData, size_t a_nSize )
+{
+    if( a_nOffset * 4 + a_nSize > sizeof( g_arrHostRtcMem ))
+        return false;
+    memcpy( a_pData, g_arrHostRtcMem + a_nOffset, a_nSize );
+    return true;
+}
+
+/**
+ * Return the host flash, erased on the first use.
+ */
+static uint8_t* GetFlash()
+{
+    static std::vector< uint8_t > Sl_vecFlash( HOST_FLASH_SIZE, 0xff );
+    return Sl_vecFlash.data();
+}
+
+bool EspClass::flashEraseSector( uint32_t a_nSector )
+{
+    if(( a_nSector + 1 ) * FLASH_SECTOR_SIZE > HOST_FLASH_SIZE )
+        return false;
+    memset( GetFlash() + a_nSector * FLASH_SECTOR_SIZE, 0xff, FLASH_SECTOR_SIZE );
+    return true;
+}
+
+bool EspClass::flashWrite( uint32_t a_nAddr, const uint32_t* a_pData, size_t a_nSize )
+{
+    if(( a_nAddr % 4 ) || ( a_nSize % 4 ) || ( a_nAddr + a_nSize > HOST_FLASH_SIZE ))
+        return false;
+    const uint8_t* pData = (const uint8_t*)a_pData;
+    uint8_t* pFlash = GetFlash() + a_nAddr;
+    for( size_t nIdx = 0; nIdx < a_nSize; nIdx++ )
+        pFlash[ nIdx ] &= pData[ nIdx ];    // NOR flash: the writes only clear bits
+    return true;
+}
+
+bool EspClass::flashRead( uint32_t a_nAddr, uint8_t* a_pData, size_t a_nSize )
+{
+    if( a_nAddr + a_nSize > HOST_FLASH_SIZE )
+        return false;
+    memcpy( a_pData, GetFlash() + a_nAddr, a_nSize );
+    return true;
+}
+
+bool EspClass::rtcUserMemoryWrite( uint32_t a_nOffset, uint32_t* a_pData, size_t a_nSize )
+{
+    if( a_nOffset * 4 + a_nSize > sizeof( g_arrHostRtcMem ))
+        return false;
+    memcpy( g_arrHostRtcMem + a_nOffset, a_pData, a_nSize );
+    return true;
+}
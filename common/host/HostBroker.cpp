@@ -0,0 +1,338 @@
+/**
+ * Host-native Arduino shim - in-process MQTT broker
+ * 2022 Łukasz Łasek
+ */
+#include <HostBroker.h>
+
+static bool DecodeVarInt( const uint8_t*& a_rp, const uint8_t* a_pEnd, uint32_t& a_rnVal )
+{
+    a_rnVal = 0;
+    for( uint8_t nShift = 0; ( a_rp < a_pEnd ) && ( nShift < 28 ); nShift += 7 )
+    {
+        uint8_t b = *a_rp++;
+        a_rnVal |= (uint32_t)( b & 0x7f ) << nShift;
+        if( !( b & 0x80 ))
+            return true;
+    }
+    return false;
+}
+
+static bool GetStr( const uint8_t*& a_rp, const uint8_t* a_pEnd, std::string& a_rstr )
+{
+    if( a_pEnd - a_rp < 2 )
+        return false;
+    uint16_t nLen = ( a_rp[ 0 ] << 8 ) | a_rp[ 1 ];
+    if( a_pEnd - a_rp < 2 + nLen )
+        return false;
+    a_rstr.assign((const char*)a_rp + 2, nLen );
+    a_rp += 2 + nLen;
+    return true;
+}
+
+static void PutStr( std::string& a_rstr, const std::string& a_rstrVal )
+{
+    a_rstr += (char)( a_rstrVal.length() >> 8 );
+    a_rstr += (char)( a_rstrVal.length() & 0xff );
+    a_rstr += a_rstrVal;
+}
+
+int CHostBroker::Connect( const char* a_pszHost, uint16_t a_nPort )
+{
+    m_vecConns.emplace_back();
+    return m_vecConns.size() - 1;
+}
+
+int CHostBroker::Send( int a_nConn, const uint8_t* a_pBuf, size_t a_nSize )
+{
+    if(( a_nConn < 0 ) || ( a_nConn >= (int)m_vecConns.size()) || ( !m_vecConns[ a_nConn ].bOpen ))
+        return -1;
+    m_nBytes += a_nSize;
+    m_vecConns[ a_nConn ].strIn.append((const char*)a_pBuf, a_nSize );
+    Process( a_nConn );
+    return a_nSize;
+}
+
+int CHostBroker::Recv( int a_nConn, uint8_t* a_pBuf, size_t a_nSize )
+{
+    if(( a_nConn < 0 ) || ( a_nConn >= (int)m_vecConns.size()))
+        return -1;
+    SConn& rConn = m_vecConns[ a_nConn ];
+    if(( !rConn.bOpen ) && ( rConn.strOut.empty()))
+        return -1;
+    size_t nLen = min( a_nSize, rConn.strOut.length());
+    memcpy( a_pBuf, rConn.strOut.data(), nLen );
+    rConn.strOut.erase( 0, nLen );
+    return nLen;
+}
+
+int CHostBroker::Available( int a_nConn )
+{
+    if(( a_nConn < 0 ) || ( a_nConn >= (int)m_vecConns.size()))
+        return -1;
+    SConn& rConn = m_vecConns[ a_nConn ];
+    if(( !rConn.bOpen ) && ( rConn.strOut.empty()))
+        return -1;
+    return rConn.strOut.length();
+}
+
+void CHostBroker::Close( int a_nConn )
+{
+    Drop( a_nConn );
+    if(( a_nConn >= 0 ) && ( a_nConn < (int)m_vecConns.size()))
+        m_vecConns[ a_nConn ].strOut.clear();
+}
+
+void CHostBroker::Drop( int a_nConn )
+{
+    if(( a_nConn < 0 ) || ( a_nConn >= (int)m_vecConns.size()) || ( !m_vecConns[ a_nConn ].bOpen ))
+        return;
+    SConn& rConn = m_vecConns[ a_nConn ];
+    rConn.bOpen = false;
+    rConn.vecSubs.clear();
+    if( !rConn.strWillTopic.empty())
+    {
+        std::string strTopic, strMsg;
+        strTopic.swap( rConn.strWillTopic );
+        strMsg.swap( rConn.strWillMsg );
+        Route( strTopic, strMsg, rConn.bWillRetain );
+    }
+}
+
+void CHostBroker::Publish( const char* a_pszTopic, const char* a_pszMsg, bool a_bRetained )
+{
+    Route( a_pszTopic, a_pszMsg, a_bRetained );
+}
+
+const std::string& CHostBroker::GetClientId( int a_nConn )
+{
+    static const std::string Sl_strNone;
+    return (( a_nConn >= 0 ) && ( a_nConn < (int)m_vecConns.size())) ? m_vecConns[ a_nConn ].strId : Sl_strNone;
+}
+
+std::string CHostBroker::GetRetained( const char* a_pszTopic )
+{
+    auto it = m_mapRetained.find( a_pszTopic );
+    return ( it != m_mapRetained.end()) ? it->second : std::string();
+}
+
+bool CHostBroker::Match( const std::string& a_rstrFilter, const char* a_pszTopic )
+{
+    const char* pszFilter = a_rstrFilter.c_str();
+    while( *pszFilter )
+    {
+        if( *pszFilter == '#' )
+            return true;
+        if( *pszFilter == '+' )
+        {
+            while(( *a_pszTopic ) && ( *a_pszTopic != '/' ))
+                a_pszTopic++;
+            pszFilter++;
+            continue;
+        }
+        if( *pszFilter != *a_pszTopic )
+        {
+            // "a/#" matches "a" as well:
+            return ( !*a_pszTopic ) && ( !strcmp( pszFilter, "/#" ));
+        }
+        pszFilter++;
+        a_pszTopic++;
+    }
+    return !*a_pszTopic;
+}
+
+void CHostBroker::Process( int a_nConn )
+{
+    for( ;; )
+    {
+        std::string& rstrIn = m_vecConns[ a_nConn ].strIn;
+        const uint8_t* p = (const uint8_t*)rstrIn.data();
+        const uint8_t* pEnd = p + rstrIn.length();
+        if( p == pEnd )
+            return;
+        uint8_t nHdr = *p++;
+        uint32_t nLen;
+        if(( !DecodeVarInt( p, pEnd, nLen )) || ((uint32_t)( pEnd - p ) < nLen ))
+            return;
+
+        std::string strPkt( (const char*)p, nLen );
+        rstrIn.erase( 0, ( p - (const uint8_t*)rstrIn.data()) + nLen );
+        OnPacket( a_nConn, nHdr, (const uint8_t*)strPkt.data(), nLen );
+        if( !m_vecConns[ a_nConn ].bOpen )
+            return;
+    }
+}
+
+void CHostBroker::OnPacket( int a_nConn, uint8_t a_nHdr, const uint8_t* a_pBody, size_t a_nLen )
+{
+    const uint8_t* p = a_pBody;
+    const uint8_t* pEnd = a_pBody + a_nLen;
+    switch( a_nHdr & 0xf0 )
+    {
+        case 0x10:  // CONNECT
+        {
+            SConn& rConn = m_vecConns[ a_nConn ];
+            std::string strProto;
+            if(( !GetStr( p, pEnd, strProto )) || ( pEnd - p < 4 ))
+                break;
+            rConn.nProto = p[ 0 ];
+            uint8_t nFlags = p[ 1 ];
+            p += 4;
+            uint32_t nPropsLen;
+            if(( rConn.nProto == 5 ) && (( !DecodeVarInt( p, pEnd, nPropsLen )) || ( ( p += nPropsLen ) > pEnd )))
+                break;
+            GetStr( p, pEnd, rConn.strId );
+            if( nFlags & 0x04 )
+            {
+                if(( rConn.nProto == 5 ) && (( !DecodeVarInt( p, pEnd, nPropsLen )) || ( ( p += nPropsLen ) > pEnd )))
+                    break;
+                GetStr( p, pEnd, rConn.strWillTopic );
+                GetStr( p, pEnd, rConn.strWillMsg );
+                rConn.bWillRetain = nFlags & 0x20;
+            }
+            // CONNACK, MQTT 5: topic alias maximum 10
+            PutPkt( rConn.strOut, 0x20, ( rConn.nProto == 5 ) ? std::string( "\x00\x00\x03\x22\x00\x0a", 6 ) : std::string( "\x00\x00", 2 ));
+            break;
+        }
+
+        case 0x30:  // PUBLISH
+        {
+            SConn& rConn = m_vecConns[ a_nConn ];
+            std::string strTopic;
+            if( !GetStr( p, pEnd, strTopic ))
+                break;
+            uint8_t nQos = ( a_nHdr >> 1 ) & 3;
+            std::string strPktId;
+            if( nQos )
+            {
+                if( pEnd - p < 2 )
+                    break;
+                strPktId.assign((const char*)p, 2 );
+                p += 2;
+            }
+            if( rConn.nProto == 5 )
+            {
+                uint32_t nPropsLen;
+                if(( !DecodeVarInt( p, pEnd, nPropsLen )) || ( p + nPropsLen > pEnd ))
+                    break;
+                for( const uint8_t* pProp = p; pProp + 3 <= p + nPropsLen; pProp += 3 )
+                {
+                    if( *pProp != 0x23 )
+                        break;  // only the topic alias is expected
+                    uint16_t nAlias = ( pProp[ 1 ] << 8 ) | pProp[ 2 ];
+                    if( strTopic.empty())
+                        strTopic = rConn.mapAliases[ nAlias ];
+                    else
+                        rConn.mapAliases[ nAlias ] = strTopic;
+                }
+                p += nPropsLen;
+            }
+            if( nQos == 1 )
+                PutPkt( rConn.strOut, 0x40, strPktId );
+
+            std::string strPayload( (const char*)p, pEnd - p );
+            bool bRetained = a_nHdr & 0x01;
+            m_nPubCnt++;
+            if( m_fnOnPub )
+                m_fnOnPub( a_nConn, strTopic.c_str(), (const byte*)strPayload.data(), strPayload.length(), bRetained );
+            Route( strTopic, strPayload, bRetained );
+            break;
+        }
+
+        case 0x80:  // SUBSCRIBE
+        {
+            SConn& rConn = m_vecConns[ a_nConn ];
+            if( pEnd - p < 2 )
+                break;
+            std::string strAck( (const char*)p, 2 );
+            p += 2;
+            uint32_t nPropsLen;
+            if( rConn.nProto == 5 )
+            {
+                if(( !DecodeVarInt( p, pEnd, nPropsLen )) || ( ( p += nPropsLen ) > pEnd ))
+                    break;
+                strAck += '\0';
+            }
+            std::vector< std::string > vecNew;
+            std::string strFilter;
+            while(( GetStr( p, pEnd, strFilter )) && ( p < pEnd ))
+            {
+                p++;    // options
+                rConn.vecSubs.push_back( strFilter );
+                vecNew.push_back( strFilter );
+                strAck += '\0';
+            }
+            PutPkt( rConn.strOut, 0x90, strAck );
+            for( auto& rstrNew : vecNew )
+            {
+                for( auto& rRet : m_mapRetained )
+                {
+                    if( Match( rstrNew, rRet.first.c_str()))
+                        Deliver( m_vecConns[ a_nConn ], rRet.first, rRet.second, true );
+                }
+            }
+            break;
+        }
+
+        case 0xc0:  // PINGREQ
+            PutPkt( m_vecConns[ a_nConn ].strOut, 0xd0, std::string());
+            break;
+
+        case 0xe0:  // DISCONNECT
+            m_vecConns[ a_nConn ].strWillTopic.clear();
+            m_vecConns[ a_nConn ].bOpen = false;
+            m_vecConns[ a_nConn ].vecSubs.clear();
+            break;
+
+        default:    // PUBACK etc.
+            break;
+    }
+}
+
+void CHostBroker::Route( const std::string& a_rstrTopic, const std::string& a_rstrPayload, bool a_bRetained )
+{
+    if( a_bRetained )
+    {
+        if( a_rstrPayload.empty())
+            m_mapRetained.erase( a_rstrTopic );
+        else
+            m_mapRetained[ a_rstrTopic ] = a_rstrPayload;
+    }
+
+    for( auto& rConn : m_vecConns )
+    {
+        if( !rConn.bOpen )
+            continue;
+        for( auto& rstrFilter : rConn.vecSubs )
+        {
+            if( Match( rstrFilter, a_rstrTopic.c_str()))
+            {
+                Deliver( rConn, a_rstrTopic, a_rstrPayload, false );
+                break;
+            }
+        }
+    }
+}
+
+void CHostBroker::Deliver( SConn& a_rConn, const std::string& a_rstrTopic, const std::string& a_rstrPayload, bool a_bRetained )
+{
+    std::string strBody;
+    PutStr( strBody, a_rstrTopic );
+    if( a_rConn.nProto == 5 )
+        strBody += '\0';    // no properties
+    strBody += a_rstrPayload;
+    PutPkt( a_rConn.strOut, 0x30 | ( a_bRetained ? 0x01 : 0x00 ), strBody );
+    m_nDeliverCnt++;
+}
+
+void CHostBroker::PutPkt( std::string& a_rstrOut, uint8_t a_nHdr, const std::string& a_rstrBody )
+{
+    a_rstrOut += (char)a_nHdr;
+    uint32_t nLen = a_rstrBody.length();
+    do
+    {
+        uint8_t b = nLen & 0x7f;
+        nLen >>= 7;
+        a_rstrOut += (char)(( nLen ) ? ( b | 0x80 ) : b );
+    } while( nLen );
+    a_rstrOut += a_rstrBody;
+}
@@ -0,0 +1,123 @@
+/**
+ * Host-native Arduino shim - in-process MQTT broker
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <WiFiClient.h>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * In-process MQTT 3.1.1/5 broker.
+ * 
+ * Installed as the host network hook, it serves every WiFiClient connection of the process,
+ * regardless of the host/port, without any sockets - the packets are processed synchronously
+ * as they are sent, so a simulation using the broker is deterministic.
+ * 
+ * Supported: QoS 0/1 publications (delivered with QoS 0), retained messages, + and # wildcards,
+ * LWT, MQTT 5 topic aliases sent by the clients.
+ */
+class CHostBroker : public CHostNet
+{
+public:
+    /**
+     * Publication callback - invoked for every message published by a client.
+     * 
+     * @param[in]   a_nConn     Connection.
+     * @param[in]   a_pszTopic  Topic.
+     * @param[in]   a_pPayload  Payload.
+     * @param[in]   a_nLen      Length of the payload.
+     * @param[in]   a_bRetained Retain flag.
+     */
+    typedef std::function< void( int a_nConn, const char* a_pszTopic, const byte* a_pPayload, uint a_nLen, bool a_bRetained )> PubCb;
+
+    virtual int Connect( const char* a_pszHost, uint16_t a_nPort );
+    virtual int Send( int a_nConn, const uint8_t* a_pBuf, size_t a_nSize );
+    virtual int Recv( int a_nConn, uint8_t* a_pBuf, size_t a_nSize );
+    virtual int Available( int a_nConn );
+    virtual void Close( int a_nConn );
+
+    /**
+     * Publish a message on behalf of the broker, e.g. a command to the simulated devices.
+     * 
+     * @param[in]   a_pszTopic  Topic.
+     * @param[in]   a_pszMsg    Payload.
+     * @param[in]   a_bRetained Retain flag.
+     */
+    void Publish( const char* a_pszTopic, const char* a_pszMsg, bool a_bRetained = false );
+
+    /**
+     * Drop a connection as if the network failed - the LWT is published.
+     * 
+     * @param[in]   a_nConn     Connection.
+     */
+    void Drop( int a_nConn );
+
+    /**
+     * Return the number of connections, including the closed ones.
+     * 
+     * @return  Number of connections.
+     */
+    int GetConnCnt() { return m_vecConns.size(); }
+
+    /**
+     * Return the client id of the connection.
+     * 
+     * @param[in]   a_nConn     Connection.
+     * 
+     * @return  Client id, empty if unknown.
+     */
+    const std::string& GetClientId( int a_nConn );
+
+    /**
+     * Return the retained message.
+     * 
+     * @param[in]   a_pszTopic  Topic.
+     * 
+     * @return  Retained payload, empty if none.
+     */
+    std::string GetRetained( const char* a_pszTopic );
+
+    /**
+     * Check the topic against the topic filter.
+     * 
+     * @param[in]   a_rstrFilter    Topic filter, may contain + and # wildcards.
+     * @param[in]   a_pszTopic      Topic.
+     * 
+     * @return  true if the topic matches.
+     */
+    static bool Match( const std::string& a_rstrFilter, const char* a_pszTopic );
+
+    PubCb m_fnOnPub;                ///< Publication callback
+    uint32_t m_nPubCnt = 0;         ///< Number of messages published by the clients
+    uint32_t m_nDeliverCnt = 0;     ///< Number of messages delivered to the clients
+    uint64_t m_nBytes = 0;          ///< Number of bytes received from the clients
+
+protected:
+    /**
+     * Client connection.
+     */
+    struct SConn
+    {
+        bool bOpen = true;                          ///< Connection open
+        uint8_t nProto = 4;                         ///< MQTT protocol level
+        std::string strId;                          ///< Client id
+        std::string strIn;                          ///< Received bytes not processed yet
+        std::string strOut;                         ///< Bytes to be read by the client
+        std::vector< std::string > vecSubs;         ///< Topic filters
+        std::map< uint16_t, std::string > mapAliases;   ///< Topic aliases
+        std::string strWillTopic;                   ///< LWT topic, empty:none
+        std::string strWillMsg;                     ///< LWT payload
+        bool bWillRetain = false;                   ///< LWT retain flag
+    };
+
+    void Process( int a_nConn );
+    void OnPacket( int a_nConn, uint8_t a_nHdr, const uint8_t* a_pBody, size_t a_nLen );
+    void Route( const std::string& a_rstrTopic, const std::string& a_rstrPayload, bool a_bRetained );
+    void Deliver( SConn& a_rConn, const std::string& a_rstrTopic, const std::string& a_rstrPayload, bool a_bRetained );
+    static void PutPkt( std::string& a_rstrOut, uint8_t a_nHdr, const std::string& a_rstrBody );
+
+    std::vector< SConn > m_vecConns;                    ///< Connections, the index is the handle
+    std::map< std::string, std::string > m_mapRetained; ///< Retained messages
+};
@@ -0,0 +1,87 @@
+/**
+ * Host-native Arduino shim - LittleFS on a host directory
+ * 2022 Łukasz Łasek
+ */
+#include <LittleFS.h>
+#include <stdio.h>
+
+CHostFS LittleFS;
+
+size_t File::size()
+{
+    if( !m_pFile )
+        return 0;
+    long nPos = ftell( m_pFile );
+    fseek( m_pFile, 0, SEEK_END );
+    long nSize = ftell( m_pFile );
+    fseek( m_pFile, nPos, SEEK_SET );
+    return nSize;
+}
+
+int File::available()
+{
+    return m_pFile ? size() - ftell( m_pFile ) : 0;
+}
+
+int File::peek()
+{
+    if( !m_pFile )
+        return -1;
+    int c = fgetc( m_pFile );
+    if( c != EOF )
+        ungetc( c, m_pFile );
+    return c;
+}
+
+String File::readStringUntil( char a_cTerm )
+{
+    String str;
+    int c;
+    while(( c = read()) >= 0 )
+    {
+        if( c == a_cTerm )
+            break;
+        str += (char)c;
+    }
+    return str;
+}
+
+String CHostFS::GetPath( const char* a_pszPath )
+{
+    if( m_strRoot.isEmpty())
+    {
+        const char* pszRoot = getenv( "SW_FS_ROOT" );
+        m_strRoot = ( pszRoot ) ? pszRoot : "data";
+    }
+    String strPath( m_strRoot );
+    if( *a_pszPath != '/' )
+        strPath += "/";
+    strPath += a_pszPath;
+    return strPath;
+}
+
+File CHostFS::open( const char* a_pszPath, const char* a_pszMode )
+{
+    // Text mode "r"/"w"/"a" on LittleFS is binary on the host:
+    char szMode[ 4 ] = {};
+    snprintf( szMode, sizeof( szMode ), "%sb", a_pszMode );
+    return File( fopen( GetPath( a_pszPath ).c_str(), szMode ));
+}
+
+bool CHostFS::exists( const char* a_pszPath )
+{
+    FILE* pFile = fopen( GetPath( a_pszPath ).c_str(), "rb" );
+    if( pFile )
+        fclose( pFile );
+    return pFile != nullptr;
+}
+
+bool CHostFS::remove( const char* a_pszPath )
+{
+    return !::remove( GetPath( a_pszPath ).c_str());
+}
+
+bool CHostFS::rename( const char* a_pszFrom, const char* a_pszTo )
+{
+    return !::rename( GetPath( a_pszFrom ).c_str(), GetPath( a_pszTo ).c_str());
+}
@@ -0,0 +1,37 @@
+/**
+ * Host-native Arduino shim - MD5Builder on OpenSSL
+ * 2022 Łukasz Łasek
+ */
+#include <MD5Builder.h>
+#include <openssl/evp.h>
+
+MD5Builder::~MD5Builder()
+{
+    EVP_MD_CTX_free((EVP_MD_CTX*)m_pCtx );
+}
+
+void MD5Builder::begin()
+{
+    if( !m_pCtx )
+        m_pCtx = EVP_MD_CTX_new();
+    EVP_DigestInit_ex((EVP_MD_CTX*)m_pCtx, EVP_md5(), nullptr );
+}
+
+void MD5Builder::add( const uint8_t* a_pData, uint16_t a_nLen )
+{
+    EVP_DigestUpdate((EVP_MD_CTX*)m_pCtx, a_pData, a_nLen );
+}
+
+void MD5Builder::calculate()
+{
+    unsigned int nLen = 0;
+    EVP_DigestFinal_ex((EVP_MD_CTX*)m_pCtx, m_arrMd5, &nLen );
+}
+
+String MD5Builder::toString()
+{
+    char sz[ 2 * sizeof( m_arrMd5 ) + 1 ];
+    for( size_t nIdx = 0; nIdx < sizeof( m_arrMd5 ); nIdx++ )
+        snprintf( sz + 2 * nIdx, 3, "%02x", m_arrMd5[ nIdx ]);
+    return String( sz );
+}
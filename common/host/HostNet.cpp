@@ -0,0 +1,208 @@
+/**
+ * Host-native Arduino shim - WiFiClient on POSIX sockets
+ * 2022 Łukasz Łasek
+ */
+#include <WiFiClient.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+CHostNet* CHostNet::Sm_pNet = nullptr;
+
+int WiFiClient::connect( IPAddress ip, uint16_t port )
+{
+    return connect( ip.toString().c_str(), port );
+}
+
+int WiFiClient::connect( const char* host, uint16_t port )
+{
+    stop();
+    m_pNet = CHostNet::Sm_pNet;
+    if( m_pNet )
+    {
+        m_nFd = m_pNet->Connect( host, port );
+        return m_nFd >= 0;
+    }
+
+    char szPort[ 8 ];
+    snprintf( szPort, sizeof( szPort ), "%u", port );
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* pai = nullptr;
+    if( getaddrinfo( host, szPort, &hints, &pai ) || !pai )
+        return 0;
+
+    int nFd = socket( pai->ai_family, pai->ai_socktype, pai->ai_protocol );
+    if( nFd < 0 )
+    {
+        freeaddrinfo( pai );
+        return 0;
+    }
+
+    // Non-blocking connect bounded by the stream timeout:
+    fcntl( nFd, F_SETFL, fcntl( nFd, F_GETFL ) | O_NONBLOCK );
+    int nRet = ::connect( nFd, pai->ai_addr, pai->ai_addrlen );
+    freeaddrinfo( pai );
+    if(( nRet < 0 ) && ( errno == EINPROGRESS ))
+    {
+        pollfd pfd = { nFd, POLLOUT, 0 };
+        int nErr = 0;
+        socklen_t nErrLen = sizeof( nErr );
+        if(( poll( &pfd, 1, m_nTimeout ) == 1 ) && !getsockopt( nFd, SOL_SOCKET, SO_ERROR, &nErr, &nErrLen ) && !nErr )
+            nRet = 0;
+    }
+    if( nRet < 0 )
+    {
+        close( nFd );
+        return 0;
+    }
+
+    int nOne = 1;
+    setsockopt( nFd, IPPROTO_TCP, TCP_NODELAY, &nOne, sizeof( nOne ));
+    m_nFd = nFd;
+    return 1;
+}
+
+size_t WiFiClient::write( const uint8_t* buf, size_t size )
+{
+    if( m_nFd < 0 )
+        return 0;
+    if( m_pNet )
+    {
+        int nRet = m_pNet->Send( m_nFd, buf, size );
+        return ( nRet > 0 ) ? nRet : 0;
+    }
+
+    size_t nSent = 0;
+    while( nSent < size )
+    {
+        ssize_t nRet = send( m_nFd, buf + nSent, size - nSent, MSG_NOSIGNAL );
+        if( nRet > 0 )
+        {
+            nSent += nRet;
+        }
+        else if(( nRet < 0 ) && ( errno == EAGAIN ))
+        {
+            pollfd pfd = { m_nFd, POLLOUT, 0 };
+            poll( &pfd, 1, 10 );
+        }
+        else
+        {
+            stop();
+            break;
+        }
+    }
+    return nSent;
+}
+
+int WiFiClient::available()
+{
+    if( m_nFd < 0 )
+        return 0;
+    int nPeek = ( m_nPeek >= 0 ) ? 1 : 0;
+    if( m_pNet )
+    {
+        int nAvail = m_pNet->Available( m_nFd );
+        if( nAvail < 0 )
+        {
+            stop();
+            return nPeek;
+        }
+        return nAvail + nPeek;
+    }
+
+    int nAvail = 0;
+    if( ioctl( m_nFd, FIONREAD, &nAvail ) < 0 )
+        return nPeek;
+    if( !nAvail && !nPeek )
+    {
+        // Detect the closed connection:
+        uint8_t b;
+        ssize_t nRet = recv( m_nFd, &b, 1, MSG_PEEK | MSG_DONTWAIT );
+        if(( nRet == 0 ) || (( nRet < 0 ) && ( errno != EAGAIN )))
+            stop();
+    }
+    return nAvail + nPeek;
+}
+
+int WiFiClient::read()
+{
+    uint8_t b;
+    return ( read( &b, 1 ) == 1 ) ? b : -1;
+}
+
+int WiFiClient::read( uint8_t* buf, size_t size )
+{
+    if(( m_nFd < 0 ) || ( !size ))
+        return -1;
+
+    size_t nRead = 0;
+    if( m_nPeek >= 0 )
+    {
+        *buf++ = m_nPeek;
+        m_nPeek = -1;
+        size--;
+        nRead++;
+        if( !size )
+            return nRead;
+    }
+
+    int nRet;
+    if( m_pNet )
+    {
+        nRet = m_pNet->Recv( m_nFd, buf, size );
+    }
+    else
+    {
+        nRet = recv( m_nFd, buf, size, MSG_DONTWAIT );
+        if(( nRet < 0 ) && ( errno == EAGAIN ))
+            nRet = 0;
+        else if( nRet == 0 )
+            nRet = -1;
+    }
+    if( nRet < 0 )
+    {
+        stop();
+        return nRead ? nRead : -1;
+    }
+    return nRead + nRet;
+}
+
+int WiFiClient::peek()
+{
+    if( m_nPeek < 0 )
+    {
+        uint8_t b;
+        if( read( &b, 1 ) == 1 )
+            m_nPeek = b;
+    }
+    return m_nPeek;
+}
+
+void WiFiClient::stop()
+{
+    if( m_nFd >= 0 )
+    {
+        if( m_pNet )
+            m_pNet->Close( m_nFd );
+        else
+            close( m_nFd );
+    }
+    m_nFd = -1;
+    m_nPeek = -1;
+}
+
+uint8_t WiFiClient::connected()
+{
+    if( m_nFd < 0 )
+        return 0;
+    available();
+    return m_nFd >= 0;
+}
@@ -0,0 +1,53 @@
+/**
+ * Host-native Arduino shim - WiFiServer on POSIX sockets
+ * 2022 Łukasz Łasek
+ */
+#include <WiFiServer.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+void WiFiServer::begin()
+{
+    stop();
+    int nFd = socket( AF_INET, SOCK_STREAM, 0 );
+    if( nFd < 0 )
+        return;
+    int nOne = 1;
+    setsockopt( nFd, SOL_SOCKET, SO_REUSEADDR, &nOne, sizeof( nOne ));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( m_nPort );
+    addr.sin_addr.s_addr = htonl( INADDR_ANY );
+    if(( bind( nFd, (sockaddr*)&addr, sizeof( addr )) < 0 ) || ( listen( nFd, 4 ) < 0 ))
+    {
+        ::close( nFd );
+        return;
+    }
+    fcntl( nFd, F_SETFL, fcntl( nFd, F_GETFL ) | O_NONBLOCK );
+    m_nFd = nFd;
+}
+
+WiFiClient WiFiServer::accept()
+{
+    WiFiClient client;
+    if( m_nFd < 0 )
+        return client;
+    int nFd = ::accept( m_nFd, nullptr, nullptr );
+    if( nFd < 0 )
+        return client;
+    fcntl( nFd, F_SETFL, fcntl( nFd, F_GETFL ) | O_NONBLOCK );
+    int nOne = 1;
+    setsockopt( nFd, IPPROTO_TCP, TCP_NODELAY, &nOne, sizeof( nOne ));
+    client.m_nFd = nFd;
+    return client;
+}
+
+void WiFiServer::stop()
+{
+    if( m_nFd >= 0 )
+        ::close( m_nFd );
+    m_nFd = -1;
+}
@@ -0,0 +1,102 @@
+/**
+ * Host-native Arduino shim - simulation hooks
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+
+/// Number of the simulated GPIO pins
+#define HOST_GPIO_PINS  17
+
+/**
+ * Host clock.
+ * 
+ * The real (steady) clock is used by default. The virtual clock starts at 0 and only moves
+ * when advanced by the simulator - or by delay(), so the simulation is deterministic and
+ * runs as fast as the host allows.
+ */
+class CHostClock
+{
+public:
+    /**
+     * Switch to the virtual clock.
+     * 
+     * @param[in]   a_nStartUs  Virtual time to start at in us.
+     */
+    static void SetVirtual( uint64_t a_nStartUs = 0 );
+
+    /**
+     * Check if the virtual clock is used.
+     * 
+     * @return  true if virtual.
+     */
+    static bool IsVirtual();
+
+    /**
+     * Advance the virtual clock.
+     * 
+     * @param[in]   a_nUs   Time to advance by in us.
+     */
+    static void Advance( uint64_t a_nUs );
+
+    /**
+     * Return the current time.
+     * 
+     * @return  Time in us.
+     */
+    static uint64_t Micros();
+};
+
+/**
+ * Host GPIO.
+ * 
+ * Lets a simulator drive the input pins - the attached ISRs are invoked on the edges,
+ * and capture the output pins - every level change is reported via the output callback.
+ * 
+ * A simulator running several devices in one process gives every device its own bank of pins:
+ * the bank is selected before the device code runs, all the GPIO functions act on the current bank.
+ */
+class CHostGpio
+{
+public:
+    /**
+     * Output pin level change callback.
+     * 
+     * @param[in]   a_nPin  Pin.
+     * @param[in]   a_nVal  New level: LOW, HIGH.
+     */
+    typedef std::function< void( uint8_t a_nPin, uint8_t a_nVal )> OutputCb;
+
+    /**
+     * Select the current GPIO bank, the banks are created on demand.
+     * 
+     * @param[in]   a_nBank Bank: 0 - default.
+     */
+    static void SetBank( uint16_t a_nBank );
+
+    /**
+     * Return the current GPIO bank.
+     * 
+     * @return  Bank.
+     */
+    static uint16_t GetBank();
+
+    /**
+     * Drive an input pin. The attached ISR is invoked if the level changes.
+     * 
+     * @param[in]   a_nPin  Pin.
+     * @param[in]   a_nVal  Level: LOW, HIGH.
+     */
+    static void SetInput( uint8_t a_nPin, uint8_t a_nVal );
+
+    /**
+     * Return the pin level.
+     * 
+     * @param[in]   a_nPin  Pin.
+     * 
+     * @return  Level: LOW, HIGH.
+     */
+    static uint8_t Get( uint8_t a_nPin );
+
+    static OutputCb Sm_fnOnOutput;  ///< Output pin level change callback
+};
@@ -0,0 +1,288 @@
+/**
+ * Host-native Arduino shim - BearSSL WiFiClientSecure on OpenSSL
+ * 2022 Łukasz Łasek
+ */
+#include <WiFiClientSecure.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+
+namespace BearSSL
+{
+
+static SSL_CTX* GetCtx()
+{
+    static SSL_CTX* Sl_pCtx = nullptr;
+    if( !Sl_pCtx )
+    {
+        signal( SIGPIPE, SIG_IGN );     // OpenSSL writes to the socket directly
+        Sl_pCtx = SSL_CTX_new( TLS_client_method());
+        SSL_CTX_set_min_proto_version( Sl_pCtx, TLS1_2_VERSION );
+        SSL_CTX_set_max_proto_version( Sl_pCtx, TLS1_2_VERSION );
+        long nOpts = SSL_OP_NO_TICKET;
+#ifdef SSL_OP_NO_EXTENDED_MASTER_SECRET
+        nOpts |= SSL_OP_NO_EXTENDED_MASTER_SECRET;
+#endif
+        SSL_CTX_set_options( Sl_pCtx, nOpts );
+        SSL_CTX_set_verify( Sl_pCtx, SSL_VERIFY_NONE, nullptr );    // pinned keys verified after the handshake
+    }
+    return Sl_pCtx;
+}
+
+PublicKey::~PublicKey()
+{
+    EVP_PKEY_free( m_pKey );
+}
+
+bool PublicKey::parse( const char* a_pszPem )
+{
+    EVP_PKEY_free( m_pKey );
+    BIO* pBio = BIO_new_mem_buf( a_pszPem, -1 );
+    m_pKey = PEM_read_bio_PUBKEY( pBio, nullptr, nullptr, nullptr );
+    BIO_free( pBio );
+    return m_pKey != nullptr;
+}
+
+WiFiClientSecure::WiFiClientSecure()
+    : m_pSsl( nullptr ), m_pSession( nullptr ), m_pKnownKey( nullptr ), m_bFp( false ), m_bInsecure( false ),
+      m_nRxBufSize( 16384 ), m_nTxBufSize( 512 ), m_nLastErr( 0 ), m_nRxOffs( 0 ), m_nRxLen( 0 )
+{
+}
+
+bool WiFiClientSecure::setFingerprint( const uint8_t a_arrFp[ 20 ])
+{
+    memcpy( m_arrFp, a_arrFp, sizeof( m_arrFp ));
+    m_bFp = true;
+    return true;
+}
+
+bool WiFiClientSecure::setFingerprint( const char* a_pszFp )
+{
+    uint8_t arrFp[ 20 ];
+    for( int nIdx = 0; nIdx < 20; nIdx++ )
+    {
+        while( *a_pszFp == ':' || *a_pszFp == ' ' )
+            a_pszFp++;
+        unsigned int nByte;
+        if( sscanf( a_pszFp, "%2x", &nByte ) != 1 )
+            return false;
+        arrFp[ nIdx ] = nByte;
+        a_pszFp += 2;
+    }
+    return setFingerprint( arrFp );
+}
+
+int WiFiClientSecure::connect( const char* host, uint16_t port )
+{
+    stop();
+    m_nLastErr = 0;
+    if(( CHostNet::Sm_pNet ) || ( !WiFiClient::connect( host, port )))
+        return 0;
+
+    m_pSsl = SSL_new( GetCtx());
+    SSL_set_fd( m_pSsl, m_nFd );
+    SSL_set_tlsext_host_name( m_pSsl, host );
+    uint8_t nMfl = ( m_nRxBufSize <= 512 ) ? TLSEXT_max_fragment_length_512
+        : ( m_nRxBufSize <= 1024 ) ? TLSEXT_max_fragment_length_1024
+        : ( m_nRxBufSize <= 2048 ) ? TLSEXT_max_fragment_length_2048
+        : ( m_nRxBufSize <= 4096 ) ? TLSEXT_max_fragment_length_4096 : 0;
+    if( nMfl )
+        SSL_set_tlsext_max_fragment_length( m_pSsl, nMfl );
+
+    // Rebuild the OpenSSL session out of the BearSSL session parameters:
+    br_ssl_session_parameters* pParams = ( m_pSession ) ? m_pSession->getSession() : nullptr;
+    if(( pParams ) && ( pParams->session_id_len ))
+    {
+        uint8_t arrCs[ 2 ] = { (uint8_t)( pParams->cipher_suite >> 8 ), (uint8_t)pParams->cipher_suite };
+        const SSL_CIPHER* pCipher = SSL_CIPHER_find( m_pSsl, arrCs );
+        SSL_SESSION* pSess = SSL_SESSION_new();
+        if(( pCipher )
+            && ( SSL_SESSION_set1_id( pSess, pParams->session_id, pParams->session_id_len ))
+            && ( SSL_SESSION_set1_master_key( pSess, pParams->master_secret, sizeof( pParams->master_secret )))
+            && ( SSL_SESSION_set_protocol_version( pSess, pParams->version ))
+            && ( SSL_SESSION_set_cipher( pSess, pCipher )))
+        {
+            SSL_set_session( m_pSsl, pSess );
+        }
+        SSL_SESSION_free( pSess );
+    }
+
+    // Blocking handshake bounded by the stream timeout:
+    unsigned long nStart = millis();
+    int nRet;
+    while(( nRet = SSL_connect( m_pSsl )) != 1 )
+    {
+        int nErr = SSL_get_error( m_pSsl, nRet );
+        long nLeft = (long)m_nTimeout - (long)( millis() - nStart );
+        if((( nErr != SSL_ERROR_WANT_READ ) && ( nErr != SSL_ERROR_WANT_WRITE )) || ( nLeft <= 0 ))
+        {
+            m_nLastErr = ( nErr ) ? nErr : -1;
+            stop();
+            return 0;
+        }
+        pollfd pfd = { m_nFd, (short)(( nErr == SSL_ERROR_WANT_READ ) ? POLLIN : POLLOUT ), 0 };
+        poll( &pfd, 1, nLeft );
+    }
+
+    if(( !SSL_session_reused( m_pSsl )) && ( !VerifyPeer()))
+    {
+        m_nLastErr = -2;
+        stop();
+        return 0;
+    }
+
+    if( pParams )
+    {
+        SSL_SESSION* pSess = SSL_get_session( m_pSsl );
+        unsigned int nIdLen;
+        const unsigned char* pId = SSL_SESSION_get_id( pSess, &nIdLen );
+        memset( pParams, 0, sizeof( *pParams ));
+        if( nIdLen <= sizeof( pParams->session_id ))
+        {
+            memcpy( pParams->session_id, pId, nIdLen );
+            pParams->session_id_len = nIdLen;
+            pParams->version = SSL_SESSION_get_protocol_version( pSess );
+            pParams->cipher_suite = SSL_CIPHER_get_protocol_id( SSL_SESSION_get0_cipher( pSess ));
+            SSL_SESSION_get_master_key( pSess, pParams->master_secret, sizeof( pParams->master_secret ));
+        }
+    }
+    return 1;
+}
+
+bool WiFiClientSecure::VerifyPeer()
+{
+    if( m_bInsecure )
+        return true;
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    X509* pCert = SSL_get1_peer_certificate( m_pSsl );
+#else
+    X509* pCert = SSL_get_peer_certificate( m_pSsl );
+#endif
+    if( !pCert )
+        return false;
+
+    bool bRet = false;
+    if( m_bFp )
+    {
+        uint8_t arrFp[ EVP_MAX_MD_SIZE ];
+        unsigned int nLen = 0;
+        bRet = ( X509_digest( pCert, EVP_sha1(), arrFp, &nLen )) && ( nLen == 20 ) && ( !memcmp( arrFp, m_arrFp, 20 ));
+    }
+    else if(( m_pKnownKey ) && ( m_pKnownKey->m_pKey ))
+    {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        bRet = EVP_PKEY_eq( X509_get0_pubkey( pCert ), m_pKnownKey->m_pKey ) == 1;
+#else
+        bRet = EVP_PKEY_cmp( X509_get0_pubkey( pCert ), m_pKnownKey->m_pKey ) == 1;
+#endif
+    }
+    X509_free( pCert );
+    return bRet;
+}
+
+bool WiFiClientSecure::Fill()
+{
+    if( !m_pSsl )
+        return false;
+    if( m_nRxOffs < m_nRxLen )
+        return true;
+
+    m_nRxOffs = m_nRxLen = 0;
+    int nRet = SSL_read( m_pSsl, m_arrRx, sizeof( m_arrRx ));
+    if( nRet > 0 )
+    {
+        m_nRxLen = nRet;
+        return true;
+    }
+    int nErr = SSL_get_error( m_pSsl, nRet );
+    if(( nErr != SSL_ERROR_WANT_READ ) && ( nErr != SSL_ERROR_WANT_WRITE ))
+        stop();
+    return false;
+}
+
+size_t WiFiClientSecure::write( const uint8_t* buf, size_t size )
+{
+    if(( !m_pSsl ) || ( !size ))
+        return 0;
+
+    size_t nSent = 0;
+    while( nSent < size )
+    {
+        int nRet = SSL_write( m_pSsl, buf + nSent, size - nSent );
+        if( nRet > 0 )
+        {
+            nSent += nRet;
+            continue;
+        }
+        int nErr = SSL_get_error( m_pSsl, nRet );
+        if(( nErr != SSL_ERROR_WANT_READ ) && ( nErr != SSL_ERROR_WANT_WRITE ))
+        {
+            stop();
+            break;
+        }
+        pollfd pfd = { m_nFd, (short)(( nErr == SSL_ERROR_WANT_READ ) ? POLLIN : POLLOUT ), 0 };
+        poll( &pfd, 1, 10 );
+    }
+    return nSent;
+}
+
+int WiFiClientSecure::available()
+{
+    return Fill() ? m_nRxLen - m_nRxOffs : 0;
+}
+
+int WiFiClientSecure::read()
+{
+    uint8_t b;
+    return ( read( &b, 1 ) == 1 ) ? b : -1;
+}
+
+int WiFiClientSecure::read( uint8_t* buf, size_t size )
+{
+    if( !Fill())
+        return ( m_pSsl ) ? 0 : -1;
+
+    size_t nLen = min( size, (size_t)( m_nRxLen - m_nRxOffs ));
+    memcpy( buf, m_arrRx + m_nRxOffs, nLen );
+    m_nRxOffs += nLen;
+    return nLen;
+}
+
+int WiFiClientSecure::peek()
+{
+    return Fill() ? m_arrRx[ m_nRxOffs ] : -1;
+}
+
+void WiFiClientSecure::stop()
+{
+    if( m_pSsl )
+    {
+        SSL_shutdown( m_pSsl );
+        SSL_free( m_pSsl );
+        m_pSsl = nullptr;
+    }
+    m_nRxOffs = m_nRxLen = 0;
+    WiFiClient::stop();
+}
+
+uint8_t WiFiClientSecure::connected()
+{
+    if( !m_pSsl )
+        return 0;
+    Fill();
+    return m_pSsl != nullptr;
+}
+
+int WiFiClientSecure::getLastSSLError( char* a_pszDest, size_t a_nLen )
+{
+    if(( a_pszDest ) && ( a_nLen ))
+        snprintf( a_pszDest, a_nLen, "ssl err %d", m_nLastErr );
+    return m_nLastErr;
+}
+
+}
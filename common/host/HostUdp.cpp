@@ -0,0 +1,98 @@
+/**
+ * Host-native Arduino shim - WiFiUdp on POSIX sockets
+ * 2022 Łukasz Łasek
+ */
+#include <WiFiUdp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+uint8_t WiFiUDP::begin( uint16_t port )
+{
+    stop();
+    int nFd = socket( AF_INET, SOCK_DGRAM, 0 );
+    if( nFd < 0 )
+        return 0;
+    int nOne = 1;
+    setsockopt( nFd, SOL_SOCKET, SO_REUSEADDR, &nOne, sizeof( nOne ));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( port );
+    addr.sin_addr.s_addr = htonl( INADDR_ANY );
+    if( bind( nFd, (sockaddr*)&addr, sizeof( addr )) < 0 )
+    {
+        close( nFd );
+        return 0;
+    }
+    fcntl( nFd, F_SETFL, fcntl( nFd, F_GETFL ) | O_NONBLOCK );
+    m_nFd = nFd;
+    return 1;
+}
+
+void WiFiUDP::stop()
+{
+    if( m_nFd >= 0 )
+        close( m_nFd );
+    m_nFd = -1;
+    m_nRxLen = m_nRxPos = m_nTxLen = 0;
+}
+
+int WiFiUDP::parsePacket()
+{
+    m_nRxLen = m_nRxPos = 0;
+    if( m_nFd < 0 )
+        return 0;
+    sockaddr_in addr = {};
+    socklen_t nAddrLen = sizeof( addr );
+    ssize_t nRet = recvfrom( m_nFd, m_arrRx, sizeof( m_arrRx ), MSG_DONTWAIT, (sockaddr*)&addr, &nAddrLen );
+    if( nRet <= 0 )
+        return 0;
+    m_nRxLen = nRet;
+    m_remoteIp = IPAddress( addr.sin_addr.s_addr );
+    m_nRemotePort = ntohs( addr.sin_port );
+    return m_nRxLen;
+}
+
+int WiFiUDP::read()
+{
+    return ( m_nRxPos < m_nRxLen ) ? m_arrRx[ m_nRxPos++ ] : -1;
+}
+
+int WiFiUDP::read( uint8_t* buf, size_t size )
+{
+    size_t nLen = min( size, (size_t)( m_nRxLen - m_nRxPos ));
+    memcpy( buf, m_arrRx + m_nRxPos, nLen );
+    m_nRxPos += nLen;
+    return nLen;
+}
+
+int WiFiUDP::beginPacket( IPAddress ip, uint16_t port )
+{
+    m_txIp = ip;
+    m_nTxPort = port;
+    m_nTxLen = 0;
+    return m_nFd >= 0;
+}
+
+size_t WiFiUDP::write( const uint8_t* buf, size_t size )
+{
+    size_t nLen = min( size, sizeof( m_arrTx ) - m_nTxLen );
+    memcpy( m_arrTx + m_nTxLen, buf, nLen );
+    m_nTxLen += nLen;
+    return nLen;
+}
+
+int WiFiUDP::endPacket()
+{
+    if( m_nFd < 0 )
+        return 0;
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( m_nTxPort );
+    addr.sin_addr.s_addr = (uint32_t)m_txIp;
+    ssize_t nRet = sendto( m_nFd, m_arrTx, m_nTxLen, MSG_DONTWAIT, (sockaddr*)&addr, sizeof( addr ));
+    m_nTxLen = 0;
+    return nRet >= 0;
+}
@@ -0,0 +1,129 @@
+/**
+ * Host-native Arduino shim - Updater on a host file
+ * 2022 Łukasz Łasek
+ */
+#include <Updater.h>
+#include <openssl/evp.h>
+#include <strings.h>
+
+UpdaterClass Update;
+const char* UpdaterClass::Sm_pszImage = "/tmp/swota";
+
+bool UpdaterClass::begin( size_t a_nSize, int a_nCmd )
+{
+    Reset();
+    m_nError = UPDATE_ERROR_OK;
+    if(( !a_nSize ) || (( a_nCmd != U_FLASH ) && ( a_nCmd != U_FS )))
+    {
+        m_nError = UPDATE_ERROR_SIZE;
+        return false;
+    }
+    if( a_nSize > HOST_UPDATE_MAX_SIZE )
+    {
+        m_nError = UPDATE_ERROR_SPACE;
+        return false;
+    }
+    m_strPath = Sm_pszImage;
+    m_strPath += ( a_nCmd == U_FLASH ) ? ".flash" : ".fs";
+    m_strTmpPath = m_strPath;
+    m_strTmpPath += ".tmp";
+    m_pFile = fopen( m_strTmpPath.c_str(), "wb" );
+    if( !m_pFile )
+    {
+        m_nError = UPDATE_ERROR_WRITE;
+        return false;
+    }
+    m_pMd5 = EVP_MD_CTX_new();
+    EVP_DigestInit_ex((EVP_MD_CTX*)m_pMd5, EVP_md5(), nullptr );
+    m_nSize = a_nSize;
+    return true;
+}
+
+bool UpdaterClass::setMD5( const char* a_pszMd5 )
+{
+    if( strlen( a_pszMd5 ) != 32 )
+        return false;
+    m_strMd5 = a_pszMd5;
+    return true;
+}
+
+size_t UpdaterClass::write( uint8_t* a_pData, size_t a_nLen )
+{
+    if(( !m_nSize ) || ( hasError()))
+        return 0;
+    if( a_nLen > remaining())
+    {
+        m_nError = UPDATE_ERROR_SPACE;
+        return 0;
+    }
+    EVP_DigestUpdate((EVP_MD_CTX*)m_pMd5, a_pData, a_nLen );
+    size_t nLeft = a_nLen;
+    while( nLeft )
+    {
+        size_t nLen = min( nLeft, FLASH_SECTOR_SIZE - m_nBufLen );
+        memcpy( m_arrBuf + m_nBufLen, a_pData, nLen );
+        m_nBufLen += nLen;
+        a_pData += nLen;
+        nLeft -= nLen;
+        if(( m_nBufLen == FLASH_SECTOR_SIZE ) && ( !FlushSector()))
+            return 0;
+    }
+    m_nProgress += a_nLen;
+    return a_nLen;
+}
+
+bool UpdaterClass::end( bool a_bEvenIfRemaining )
+{
+    if(( !m_nSize ) || ( hasError()) || (( !isFinished()) && ( !a_bEvenIfRemaining )))
+    {
+        Reset();
+        return false;
+    }
+    if(( m_nBufLen ) && ( !FlushSector()))
+    {
+        Reset();
+        return false;
+    }
+    uint8_t arrMd5[ EVP_MAX_MD_SIZE ];
+    unsigned int nMd5Len = 0;
+    EVP_DigestFinal_ex((EVP_MD_CTX*)m_pMd5, arrMd5, &nMd5Len );
+    char szMd5[ 2 * EVP_MAX_MD_SIZE + 1 ] = {};
+    for( unsigned int nIdx = 0; nIdx < nMd5Len; nIdx++ )
+        snprintf( szMd5 + 2 * nIdx, 3, "%02x", arrMd5[ nIdx ]);
+    if(( m_strMd5.length()) && ( strcasecmp( m_strMd5.c_str(), szMd5 )))
+    {
+        m_nError = UPDATE_ERROR_MD5;
+        Reset();
+        return false;
+    }
+    fclose( m_pFile );
+    m_pFile = nullptr;
+    rename( m_strTmpPath.c_str(), m_strPath.c_str());
+    Reset();
+    return true;
+}
+
+bool UpdaterClass::FlushSector()
+{
+    if( fwrite( m_arrBuf, 1, m_nBufLen, m_pFile ) != m_nBufLen )
+    {
+        m_nError = UPDATE_ERROR_WRITE;
+        return false;
+    }
+    m_nBufLen = 0;
+    return true;
+}
+
+void UpdaterClass::Reset()
+{
+    if( m_pFile )
+    {
+        fclose( m_pFile );
+        m_pFile = nullptr;
+        remove( m_strTmpPath.c_str());
+    }
+    EVP_MD_CTX_free((EVP_MD_CTX*)m_pMd5);
+    m_pMd5 = nullptr;
+    m_strMd5 = "";
+    m_nSize = m_nProgress = m_nBufLen = 0;
+}
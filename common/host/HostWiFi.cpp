@@ -0,0 +1,55 @@
+/**
+ * Host-native Arduino shim - ESP8266WiFi and ESP8266mDNS
+ * 2022 Łukasz Łasek
+ */
+#include <ESP8266WiFi.h>
+#include <ESP8266mDNS.h>
+
+ESP8266WiFiClass WiFi;
+MDNSResponder MDNS;
+
+WiFiEventHandler ESP8266WiFiClass::onStationModeConnected( std::function< void( const WiFiEventStationModeConnected& )> a_fn )
+{
+    m_fnConn = a_fn;
+    return WiFiEventHandler( this, []( void* ) {} );
+}
+
+WiFiEventHandler ESP8266WiFiClass::onStationModeDisconnected( std::function< void( const WiFiEventStationModeDisconnected& )> a_fn )
+{
+    m_fnDisconn = a_fn;
+    return WiFiEventHandler( this, []( void* ) {} );
+}
+
+WiFiEventHandler ESP8266WiFiClass::onStationModeGotIP( std::function< void( const WiFiEventStationModeGotIP& )> a_fn )
+{
+    m_fnGotIp = a_fn;
+    return WiFiEventHandler( this, []( void* ) {} );
+}
+
+WiFiEventHandler ESP8266WiFiClass::onStationModeDHCPTimeout( std::function< void()> a_fn )
+{
+    m_fnDhcpTimeout = a_fn;
+    return WiFiEventHandler( this, []( void* ) {} );
+}
+
+bool ESP8266WiFiClass::disconnect( bool a_bWifiOff )
+{
+    if( !m_bConnected )
+        return true;
+    m_bConnected = false;
+    if( m_fnOnDisconnect )
+        m_fnOnDisconnect();
+    if( m_fnDisconn )
+        m_fnDisconn( WiFiEventStationModeDisconnected());
+    return true;
+}
+
+int ESP8266WiFiClass::begin( const char* a_pszSsid, const char* a_pszPwd )
+{
+    m_bConnected = true;
+    if( m_fnConn )
+        m_fnConn( WiFiEventStationModeConnected());
+    if( m_fnGotIp )
+        m_fnGotIp( WiFiEventStationModeGotIP());
+    return 1;
+}
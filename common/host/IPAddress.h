@@ -0,0 +1,36 @@
+/**
+ * Host-native Arduino shim - IPAddress
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+
+/**
+ * IPv4 address.
+ */
+class IPAddress
+{
+public:
+    IPAddress( uint32_t a_nAddr = 0 ) : m_nAddr( a_nAddr ) {}
+    IPAddress( uint8_t a, uint8_t b, uint8_t c, uint8_t d ) : m_nAddr( a | ( b << 8 ) | ( c << 16 ) | ((uint32_t)d << 24 )) {}
+    operator uint32_t() const { return m_nAddr; }
+    uint8_t operator[]( int a_nIdx ) const { return ( m_nAddr >> ( a_nIdx * 8 )) & 0xff; }
+    String toString() const
+    {
+        char sz[ 16 ];
+        snprintf( sz, sizeof( sz ), "%u.%u.%u.%u", (*this)[ 0 ], (*this)[ 1 ], (*this)[ 2 ], (*this)[ 3 ]);
+        return String( sz );
+    }
+    bool fromString( const String& a_rstr )
+    {
+        uint nA, nB, nC, nD;
+        char c;
+        if(( sscanf( a_rstr.c_str(), "%u.%u.%u.%u%c", &nA, &nB, &nC, &nD, &c ) != 4 ) || ( nA > 255 ) || ( nB > 255 ) || ( nC > 255 ) || ( nD > 255 ))
+            return false;
+        *this = IPAddress( nA, nB, nC, nD );
+        return true;
+    }
+
+private:
+    uint32_t m_nAddr;
+};
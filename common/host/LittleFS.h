@@ -0,0 +1,61 @@
+/**
+ * Host-native Arduino shim - LittleFS
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+
+/**
+ * File on the host file system.
+ */
+class File : public Stream
+{
+public:
+    File( FILE* a_pFile = nullptr ) : m_pFile( a_pFile ) {}
+    File( const File& ) = delete;
+    File( File&& a_rOther ) : m_pFile( a_rOther.m_pFile ) { a_rOther.m_pFile = nullptr; }
+    File& operator=( File&& a_rOther ) { close(); m_pFile = a_rOther.m_pFile; a_rOther.m_pFile = nullptr; return *this; }
+    virtual ~File() { close(); }
+
+    operator bool() const { return m_pFile != nullptr; }
+    void close() { if( m_pFile ) fclose( m_pFile ); m_pFile = nullptr; }
+    bool seek( uint32_t a_nPos ) { return m_pFile && !fseek( m_pFile, a_nPos, SEEK_SET ); }
+    size_t position() { return m_pFile ? ftell( m_pFile ) : 0; }
+    size_t size();
+    virtual int available();
+    virtual int read() { return m_pFile ? fgetc( m_pFile ) : -1; }
+    int read( uint8_t* a_pBuf, size_t a_nSize ) { return m_pFile ? fread( a_pBuf, 1, a_nSize, m_pFile ) : -1; }
+    virtual int peek();
+    virtual size_t write( uint8_t a_b ) { return m_pFile ? fwrite( &a_b, 1, 1, m_pFile ) : 0; }
+    virtual size_t write( const uint8_t* a_pBuf, size_t a_nSize ) { return m_pFile ? fwrite( a_pBuf, 1, a_nSize, m_pFile ) : 0; }
+    using Print::write;
+    virtual void flush() { if( m_pFile ) fflush( m_pFile ); }
+    String readStringUntil( char a_cTerm );
+    String readString() { String str; int c; while(( c = read()) >= 0 ) str += (char)c; return str; }
+
+private:
+    FILE* m_pFile;
+};
+
+/**
+ * LittleFS on a host directory.
+ * 
+ * The root directory is taken from the SW_FS_ROOT environment variable unless set with SetRoot(), default: "data".
+ */
+class CHostFS
+{
+public:
+    bool begin() { return true; }
+    void end() {}
+    File open( const char* a_pszPath, const char* a_pszMode );
+    File open( const String& a_rstrPath, const char* a_pszMode ) { return open( a_rstrPath.c_str(), a_pszMode ); }
+    bool exists( const char* a_pszPath );
+    bool remove( const char* a_pszPath );
+    bool rename( const char* a_pszFrom, const char* a_pszTo );
+    void SetRoot( const char* a_pszRoot ) { m_strRoot = a_pszRoot; }
+    String GetPath( const char* a_pszPath );
+
+private:
+    String m_strRoot;
+};
+extern CHostFS LittleFS;
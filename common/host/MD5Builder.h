@@ -0,0 +1,28 @@
+/**
+ * Host-native Arduino shim - MD5Builder
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+
+/**
+ * ESP8266 MD5Builder subset on OpenSSL.
+ */
+class MD5Builder
+{
+public:
+    MD5Builder() : m_pCtx( nullptr ), m_arrMd5() {}
+    ~MD5Builder();
+    MD5Builder( const MD5Builder& ) = delete;
+    MD5Builder& operator=( const MD5Builder& ) = delete;
+
+    void begin();
+    void add( const uint8_t* a_pData, uint16_t a_nLen );
+    void calculate();
+    void getBytes( uint8_t* a_pOutput ) { memcpy( a_pOutput, m_arrMd5, sizeof( m_arrMd5 )); }
+    String toString();
+
+protected:
+    void* m_pCtx;           ///< MD5 context
+    uint8_t m_arrMd5[ 16 ]; ///< Calculated MD5
+};
@@ -0,0 +1,81 @@
+/**
+ * Host-native Arduino shim - Print/Stream/Client
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+/**
+ * Arduino Print subset.
+ */
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write( uint8_t a_b ) = 0;
+    virtual size_t write( const uint8_t* a_pBuf, size_t a_nSize )
+    {
+        size_t n = 0;
+        while( a_nSize-- && write( *a_pBuf++ ))
+            n++;
+        return n;
+    }
+    virtual int availableForWrite() { return 0; }
+    virtual void flush() {}
+
+    size_t write( const char* a_psz ) { return write((const uint8_t*)a_psz, strlen( a_psz )); }
+    size_t print( const char* a_psz ) { return write( a_psz ); }
+    size_t print( const String& a_rstr ) { return write( a_rstr.c_str()); }
+    size_t print( char a_c ) { return write((uint8_t)a_c ); }
+    size_t print( int a_n ) { return printf( "%d", a_n ); }
+    size_t print( unsigned int a_n ) { return printf( "%u", a_n ); }
+    size_t print( long a_n ) { return printf( "%ld", a_n ); }
+    size_t print( unsigned long a_n ) { return printf( "%lu", a_n ); }
+    template< typename T >
+    size_t println( const T& a_rVal ) { size_t n = print( a_rVal ); return n + println(); }
+    size_t println() { return write( "\n" ); }
+    size_t printf( const char* a_pszFmt, ... ) __attribute__(( format( printf, 2, 3 )))
+    {
+        char sz[ 256 ];
+        va_list args;
+        va_start( args, a_pszFmt );
+        int n = vsnprintf( sz, sizeof( sz ), a_pszFmt, args );
+        va_end( args );
+        if( n < 0 )
+            return 0;
+        return write((const uint8_t*)sz, ((size_t)n < sizeof( sz )) ? n : sizeof( sz ) - 1 );
+    }
+};
+
+/**
+ * Arduino Stream subset.
+ */
+class Stream : public Print
+{
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    void setTimeout( unsigned long a_nTimeout ) { m_nTimeout = a_nTimeout; }
+
+protected:
+    unsigned long m_nTimeout = 1000;
+};
+
+/**
+ * Arduino Serial on stdout.
+ */
+class HardwareSerial : public Stream
+{
+public:
+    void begin( unsigned long ) {}
+    virtual size_t write( uint8_t a_b ) { return fwrite( &a_b, 1, 1, stdout ); }
+    virtual size_t write( const uint8_t* a_pBuf, size_t a_nSize ) { return fwrite( a_pBuf, 1, a_nSize, stdout ); }
+    using Print::write;
+    virtual int available() { return 0; }
+    virtual int read() { return -1; }
+    virtual int peek() { return -1; }
+};
+extern HardwareSerial Serial;
@@ -0,0 +1,69 @@
+/**
+ * Host-native Arduino shim - Updater
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+
+#define U_FLASH     0
+#define U_FS        100
+#define U_AUTH      200
+
+#define UPDATE_ERROR_OK         0
+#define UPDATE_ERROR_WRITE      1
+#define UPDATE_ERROR_SPACE      4
+#define UPDATE_ERROR_SIZE       5
+#define UPDATE_ERROR_STREAM     6
+#define UPDATE_ERROR_MD5        7
+
+/// Max image size accepted by the host updater
+#define HOST_UPDATE_MAX_SIZE    ( 2 * 1024 * 1024 )
+
+/**
+ * ESP8266 Updater subset.
+ * 
+ * Buffers the image in flash sectors like the device and writes the sectors to a host file:
+ * Sm_pszImage + ".flash" or ".fs" depending on the command. The MD5 set is verified by end().
+ */
+class UpdaterClass
+{
+public:
+    UpdaterClass() : m_pFile( nullptr ), m_pMd5( nullptr ), m_nSize( 0 ), m_nProgress( 0 ), m_nBufLen( 0 ), m_nError( UPDATE_ERROR_OK ) {}
+
+    bool begin( size_t a_nSize, int a_nCmd = U_FLASH );
+    bool setMD5( const char* a_pszMd5 );
+    size_t write( uint8_t* a_pData, size_t a_nLen );
+    bool end( bool a_bEvenIfRemaining = false );
+    bool isRunning() { return m_nSize > 0; }
+    bool isFinished() { return ( m_nSize > 0 ) && ( m_nProgress == m_nSize ); }
+    bool hasError() { return m_nError != UPDATE_ERROR_OK; }
+    uint8_t getError() { return m_nError; }
+    size_t size() { return m_nSize; }
+    size_t progress() { return m_nProgress; }
+    size_t remaining() { return m_nSize - m_nProgress; }
+
+    static const char* Sm_pszImage; ///< Host image file path without the extension
+
+protected:
+    /**
+     * Write the buffered sector to the file.
+     */
+    bool FlushSector();
+
+    /**
+     * Abandon the update, remove the partial image.
+     */
+    void Reset();
+
+    FILE* m_pFile;                          ///< Image file
+    void* m_pMd5;                           ///< MD5 context
+    String m_strPath;                       ///< Image file path
+    String m_strTmpPath;                    ///< Image file path while written
+    String m_strMd5;                        ///< Expected MD5, empty: not verified
+    size_t m_nSize;                         ///< Image size, 0: no update
+    size_t m_nProgress;                     ///< Bytes written so far
+    uint8_t m_arrBuf[ FLASH_SECTOR_SIZE ];  ///< Sector buffer
+    size_t m_nBufLen;                       ///< Bytes in the sector buffer
+    uint8_t m_nError;                       ///< Last error: UPDATE_ERROR_...
+};
+extern UpdaterClass Update;
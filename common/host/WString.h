@@ -0,0 +1,80 @@
+/**
+ * Host-native Arduino shim - String
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <stdlib.h>
+#include <string>
+
+/**
+ * Arduino String subset on top of std::string.
+ */
+class String
+{
+public:
+    String() {}
+    String( const char* a_psz ) : m_str( a_psz ? a_psz : "" ) {}
+    String( const std::string& a_rstr ) : m_str( a_rstr ) {}
+    explicit String( char a_c ) : m_str( 1, a_c ) {}
+    explicit String( int a_n ) : m_str( std::to_string( a_n )) {}
+    explicit String( unsigned int a_n ) : m_str( std::to_string( a_n )) {}
+    explicit String( long a_n ) : m_str( std::to_string( a_n )) {}
+    explicit String( unsigned long a_n ) : m_str( std::to_string( a_n )) {}
+
+    const char* c_str() const { return m_str.c_str(); }
+    unsigned int length() const { return m_str.length(); }
+    bool isEmpty() const { return m_str.empty(); }
+    void clear() { m_str.clear(); }
+    bool reserve( unsigned int a_nSize ) { m_str.reserve( a_nSize ); return true; }
+    long toInt() const { return atol( m_str.c_str()); }
+    char charAt( unsigned int a_nIdx ) const { return ( a_nIdx < m_str.length()) ? m_str[ a_nIdx ] : 0; }
+    char& operator[]( unsigned int a_nIdx ) { return m_str[ a_nIdx ]; }
+    char operator[]( unsigned int a_nIdx ) const { return charAt( a_nIdx ); }
+    int indexOf( char a_c, unsigned int a_nFrom = 0 ) const { size_t n = m_str.find( a_c, a_nFrom ); return ( n == std::string::npos ) ? -1 : (int)n; }
+    String substring( unsigned int a_nFrom ) const { return ( a_nFrom < m_str.length()) ? String( m_str.substr( a_nFrom )) : String(); }
+    String substring( unsigned int a_nFrom, unsigned int a_nTo ) const { return ( a_nFrom < a_nTo ) ? String( m_str.substr( a_nFrom, a_nTo - a_nFrom )) : String(); }
+    bool startsWith( const String& a_rstr ) const { return m_str.compare( 0, a_rstr.m_str.length(), a_rstr.m_str ) == 0; }
+    void trim()
+    {
+        size_t nBeg = m_str.find_first_not_of( " \t\r\n" );
+        size_t nEnd = m_str.find_last_not_of( " \t\r\n" );
+        m_str = ( nBeg == std::string::npos ) ? std::string() : m_str.substr( nBeg, nEnd - nBeg + 1 );
+    }
+
+    bool concat( const String& a_rstr ) { m_str += a_rstr.m_str; return true; }
+    bool concat( const char* a_psz ) { m_str += a_psz; return true; }
+    bool concat( const char* a_psz, unsigned int a_nLen ) { m_str.append( a_psz, a_nLen ); return true; }
+    bool concat( char a_c ) { m_str += a_c; return true; }
+
+    String& operator+=( const String& a_rstr ) { m_str += a_rstr.m_str; return *this; }
+    String& operator+=( const char* a_psz ) { m_str += a_psz; return *this; }
+    String& operator+=( char a_c ) { m_str += a_c; return *this; }
+    String& operator+=( int a_n ) { m_str += std::to_string( a_n ); return *this; }
+    String& operator+=( unsigned int a_n ) { m_str += std::to_string( a_n ); return *this; }
+    String& operator+=( long a_n ) { m_str += std::to_string( a_n ); return *this; }
+    String& operator+=( unsigned long a_n ) { m_str += std::to_string( a_n ); return *this; }
+
+    bool operator==( const String& a_rstr ) const { return m_str == a_rstr.m_str; }
+    bool operator==( const char* a_psz ) const { return m_str == a_psz; }
+    bool operator!=( const String& a_rstr ) const { return m_str != a_rstr.m_str; }
+    bool operator!=( const char* a_psz ) const { return m_str != a_psz; }
+    bool equals( const String& a_rstr ) const { return m_str == a_rstr.m_str; }
+
+    template< typename T >
+    friend String operator+( const String& a_rstr, const T& a_rVal )
+    {
+        String str( a_rstr );
+        str += a_rVal;
+        return str;
+    }
+
+private:
+    std::string m_str;
+};
+
+inline String operator+( const char* a_psz, const String& a_rstr )
+{
+    String str( a_psz );
+    str += a_rstr;
+    return str;
+}
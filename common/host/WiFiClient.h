@@ -0,0 +1,77 @@
+/**
+ * Host-native Arduino shim - WiFiClient
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Client.h>
+
+/**
+ * Host network hook.
+ * 
+ * Lets a simulator replace the TCP stack, e.g. with an in-process broker.
+ * A connection opened through the hook is identified by a non-negative handle.
+ */
+class CHostNet
+{
+public:
+    virtual ~CHostNet() {}
+    virtual int Connect( const char* a_pszHost, uint16_t a_nPort ) = 0;
+    virtual int Send( int a_nConn, const uint8_t* a_pBuf, size_t a_nSize ) = 0;
+    virtual int Recv( int a_nConn, uint8_t* a_pBuf, size_t a_nSize ) = 0;    ///< -1:closed, 0:no data
+    virtual int Available( int a_nConn ) = 0;                                 ///< -1:closed
+    virtual void Close( int a_nConn ) = 0;
+
+    static CHostNet* Sm_pNet;   ///< Installed hook, nullptr:POSIX sockets
+};
+
+/**
+ * WIFI client on top of POSIX TCP sockets or the installed host network hook.
+ * 
+ * The reads are non-blocking, the connect is blocking with the configured timeout.
+ * The hook is captured on connect: the connections accepted by WiFiServer are always POSIX sockets.
+ * A client is movable, not copyable.
+ */
+class WiFiClient : public Client
+{
+public:
+    WiFiClient() : m_nFd( -1 ), m_nPeek( -1 ), m_pNet( nullptr ) {}
+    virtual ~WiFiClient() { stop(); }
+    WiFiClient( const WiFiClient& ) = delete;
+    WiFiClient& operator=( const WiFiClient& ) = delete;
+    WiFiClient( WiFiClient&& a_rOther ) : WiFiClient() { *this = std::move( a_rOther ); }
+    WiFiClient& operator=( WiFiClient&& a_rOther )
+    {
+        if( this != &a_rOther )
+        {
+            stop();
+            m_nFd = a_rOther.m_nFd;
+            m_nPeek = a_rOther.m_nPeek;
+            m_pNet = a_rOther.m_pNet;
+            a_rOther.m_nFd = -1;
+            a_rOther.m_nPeek = -1;
+        }
+        return *this;
+    }
+
+    virtual int connect( IPAddress ip, uint16_t port );
+    virtual int connect( const char* host, uint16_t port );
+    virtual size_t write( uint8_t b ) { return write( &b, 1 ); }
+    virtual size_t write( const uint8_t* buf, size_t size );
+    virtual int availableForWrite() { return ( m_nFd >= 0 ) ? 4096 : 0; }
+    virtual int available();
+    virtual int read();
+    virtual int read( uint8_t* buf, size_t size );
+    virtual int peek();
+    virtual void flush() {}
+    virtual void stop();
+    virtual uint8_t connected();
+    virtual operator bool() { return connected(); }
+    void setNoDelay( bool ) {}
+
+protected:
+    friend class WiFiServer;
+
+    int m_nFd;          ///< Socket or the host network hook connection handle
+    int m_nPeek;        ///< Peeked byte, -1:none
+    CHostNet* m_pNet;   ///< Host network hook of the connection, nullptr:POSIX socket
+};
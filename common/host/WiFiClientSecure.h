@@ -0,0 +1,118 @@
+/**
+ * Host-native Arduino shim - BearSSL WiFiClientSecure
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <WiFiClient.h>
+
+typedef struct ssl_st SSL;
+typedef struct evp_pkey_st EVP_PKEY;
+
+/// BearSSL key usages
+#define BR_KEYTYPE_KEYX     0x10
+#define BR_KEYTYPE_SIGN     0x20
+
+/**
+ * BearSSL session parameters - same layout as in BearSSL.
+ */
+typedef struct
+{
+    unsigned char session_id[ 32 ];
+    unsigned char session_id_len;
+    uint16_t version;
+    uint16_t cipher_suite;
+    unsigned char master_secret[ 48 ];
+} br_ssl_session_parameters;
+
+namespace BearSSL
+{
+
+/**
+ * TLS session - same layout as in the ESP8266 core, the parameters are private.
+ */
+class Session
+{
+    friend class WiFiClientSecure;
+
+public:
+    Session() { memset( &_session, 0, sizeof( _session )); }
+
+private:
+    br_ssl_session_parameters* getSession() { return &_session; }
+
+    br_ssl_session_parameters _session;
+};
+
+/**
+ * Server public key (RSA or EC) parsed from a PEM.
+ */
+class PublicKey
+{
+    friend class WiFiClientSecure;
+
+public:
+    PublicKey() : m_pKey( nullptr ) {}
+    PublicKey( const char* a_pszPem ) : m_pKey( nullptr ) { parse( a_pszPem ); }
+    ~PublicKey();
+    PublicKey( const PublicKey& ) = delete;
+    PublicKey& operator=( const PublicKey& ) = delete;
+
+    bool parse( const char* a_pszPem );
+
+private:
+    EVP_PKEY* m_pKey;
+};
+
+/**
+ * TLS 1.2 client on top of OpenSSL with the BearSSL::WiFiClientSecure API subset.
+ * 
+ * Same as BearSSL: only the session ID resumption is offered (no session tickets, no extended master secret),
+ * the max fragment length is requested according to the receive buffer size, and the server is
+ * authenticated by a pinned SHA1 certificate fingerprint or a pinned public key - no CA chain.
+ * The handshake is blocking, bounded by the stream timeout. The host network hook is not supported.
+ */
+class WiFiClientSecure : public WiFiClient
+{
+public:
+    WiFiClientSecure();
+    virtual ~WiFiClientSecure() { stop(); }
+
+    virtual int connect( IPAddress ip, uint16_t port ) { return connect( ip.toString().c_str(), port ); }
+    virtual int connect( const char* host, uint16_t port );
+    virtual size_t write( uint8_t b ) { return write( &b, 1 ); }
+    virtual size_t write( const uint8_t* buf, size_t size );
+    virtual int availableForWrite() { return ( m_pSsl ) ? m_nTxBufSize : 0; }
+    virtual int available();
+    virtual int read();
+    virtual int read( uint8_t* buf, size_t size );
+    virtual int peek();
+    virtual void stop();
+    virtual uint8_t connected();
+
+    void setInsecure() { m_bInsecure = true; }
+    bool setFingerprint( const uint8_t a_arrFp[ 20 ]);
+    bool setFingerprint( const char* a_pszFp );
+    void setKnownKey( const PublicKey* a_pKey, unsigned a_nUsages = BR_KEYTYPE_KEYX | BR_KEYTYPE_SIGN ) { m_pKnownKey = a_pKey; }
+    void setBufferSizes( int a_nRecv, int a_nXmit ) { m_nRxBufSize = a_nRecv; m_nTxBufSize = a_nXmit; }
+    void setSession( Session* a_pSession ) { m_pSession = a_pSession; }
+    int getLastSSLError( char* a_pszDest = nullptr, size_t a_nLen = 0 );
+
+protected:
+    bool Fill();
+    bool VerifyPeer();
+
+    SSL* m_pSsl;                    ///< OpenSSL connection, nullptr:disconnected
+    Session* m_pSession;            ///< Session to resume and update
+    const PublicKey* m_pKnownKey;   ///< Pinned public key
+    uint8_t m_arrFp[ 20 ];          ///< Pinned certificate SHA1 fingerprint
+    bool m_bFp;                     ///< Fingerprint pinned
+    bool m_bInsecure;               ///< No server authentication
+    int m_nRxBufSize;               ///< Receive buffer size - max fragment length
+    int m_nTxBufSize;               ///< Transmit buffer size
+    int m_nLastErr;                 ///< Last error
+    uint8_t m_arrRx[ 16384 ];       ///< Decrypted data not read yet
+    uint16_t m_nRxOffs;             ///< Read offset in m_arrRx
+    uint16_t m_nRxLen;              ///< Data length in m_arrRx
+};
+
+}
@@ -0,0 +1,33 @@
+/**
+ * Host-native Arduino shim - WiFiServer
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+#include "WiFiClient.h"
+
+/**
+ * WIFI TCP server on top of a POSIX listening socket.
+ * 
+ * Always POSIX - the host network hook is not involved, so a simulator can be reached by the host tools (e.g. curl).
+ * accept() is non-blocking, the accepted clients are non-blocking as well.
+ */
+class WiFiServer
+{
+public:
+    WiFiServer( uint16_t port ) : m_nPort( port ), m_nFd( -1 ) {}
+    ~WiFiServer() { stop(); }
+    WiFiServer( const WiFiServer& ) = delete;
+    WiFiServer& operator=( const WiFiServer& ) = delete;
+
+    void begin();
+    void begin( uint16_t port ) { m_nPort = port; begin(); }
+    WiFiClient accept();
+    void stop();
+    void close() { stop(); }
+    uint8_t status() { return m_nFd >= 0; }
+
+protected:
+    uint16_t m_nPort;   ///< Listening port
+    int m_nFd;          ///< Listening socket
+};
@@ -0,0 +1,52 @@
+/**
+ * Host-native Arduino shim - WiFiUdp
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+#include "IPAddress.h"
+
+/// Max UDP datagram size kept by the shim
+#define HOST_UDP_BUF_LEN    1472
+
+/**
+ * WIFI UDP socket on top of POSIX UDP sockets.
+ * 
+ * A received datagram is buffered by parsePacket(), a sent one is buffered between beginPacket() and endPacket().
+ * All the calls are non-blocking.
+ */
+class WiFiUDP : public Print
+{
+public:
+    WiFiUDP() : m_nFd( -1 ), m_nRxLen( 0 ), m_nRxPos( 0 ), m_nTxLen( 0 ), m_nRemotePort( 0 ), m_nTxPort( 0 ) {}
+    virtual ~WiFiUDP() { stop(); }
+    WiFiUDP( const WiFiUDP& ) = delete;
+    WiFiUDP& operator=( const WiFiUDP& ) = delete;
+
+    uint8_t begin( uint16_t port );
+    void stop();
+    int parsePacket();
+    int available() { return m_nRxLen - m_nRxPos; }
+    int read();
+    int read( uint8_t* buf, size_t size );
+    int read( char* buf, size_t size ) { return read((uint8_t*)buf, size ); }
+    IPAddress remoteIP() { return m_remoteIp; }
+    uint16_t remotePort() { return m_nRemotePort; }
+    int beginPacket( IPAddress ip, uint16_t port );
+    using Print::write;
+    virtual size_t write( uint8_t b ) { return write( &b, 1 ); }
+    virtual size_t write( const uint8_t* buf, size_t size );
+    int endPacket();
+
+protected:
+    int m_nFd;                              ///< Socket
+    uint8_t m_arrRx[ HOST_UDP_BUF_LEN ];    ///< Received datagram
+    uint8_t m_arrTx[ HOST_UDP_BUF_LEN ];    ///< Datagram to send
+    uint16_t m_nRxLen;                      ///< Received datagram length
+    uint16_t m_nRxPos;                      ///< Read position in the received datagram
+    uint16_t m_nTxLen;                      ///< Length of the datagram to send
+    IPAddress m_remoteIp;                   ///< Sender of the received datagram
+    uint16_t m_nRemotePort;                 ///< Sender port of the received datagram
+    IPAddress m_txIp;                       ///< Destination of the datagram to send
+    uint16_t m_nTxPort;                     ///< Destination port of the datagram to send
+};
@@ -0,0 +1,10 @@
+/**
+ * Host-native Arduino shim - flash layout
+ * 2022 Łukasz Łasek
+ */
+#pragma once
+#include <Arduino.h>
+
+/// FS partition in the host flash - same as eagle.flash.4m2m.ld
+#define FS_PHYS_ADDR    0x200000
+#define FS_PHYS_SIZE    0x1fa000